@@ -61,6 +61,30 @@
 #define MAX_THREADS 10 
 //@}
 
+/** @name DISCOVERY_THREADS
+ *  The {\tt DISCOVERY_THREADS} constant limits how many of the threads
+ *  in the thread pool may handle SSDP searches and advertisements at the
+ *  same time, so that a burst of discovery traffic leaves threads free
+ *  for SOAP control requests, which are always served first.  A value of
+ *  0 means no limit.
+ */
+//@{
+
+#define DISCOVERY_THREADS 4
+
+//@}
+
+/** @name EVENTING_THREADS
+ *  The {\tt EVENTING_THREADS} constant limits how many threads may deliver
+ *  GENA notifications and handle subscriptions at the same time.  A
+ *  value of 0 means no limit.
+ */
+//@{
+
+#define EVENTING_THREADS 4
+
+//@}
+
 
 /** @name HTTP_READ_BYTES
  * HTTP Responses will read at most HTTP_READ_BYTES.  This prevents devices
@@ -107,6 +131,116 @@
 
 //@}
 
+/** @name MINISERVER_REACTOR
+ *  When {\tt MINISERVER_REACTOR} is 1, the internal HTTP server watches all
+ *  of its connections from a single thread with {\tt epoll}, reads requests
+ *  as the bytes arrive and only hands complete requests to the thread pool.
+ *  SOAP and GENA requests made with HTTP/1.1 keep their connection open for
+ *  further requests.  Setting it to 0 restores the thread-per-connection
+ *  server that closes every connection after one request.
+ */
+//@{
+
+#define MINISERVER_REACTOR 1
+
+//@}
+
+/** @name MINISERVER_KEEPALIVE_TIMEOUT
+ *  The {\tt MINISERVER_KEEPALIVE_TIMEOUT} is the time, in seconds, that an
+ *  idle persistent connection is kept open waiting for the next request
+ *  when {\tt MINISERVER_REACTOR} is 1.  The default is 30 seconds.
+ */
+//@{
+
+#define MINISERVER_KEEPALIVE_TIMEOUT 30
+
+//@}
+
+/** @name MINISERVER_MAX_REQUEST_BYTES
+ *  The {\tt MINISERVER_MAX_REQUEST_BYTES} is the largest request, headers
+ *  and body, in bytes, that the internal HTTP server accepts.  A larger
+ *  request, or one whose {\tt CONTENT-LENGTH} says it would be larger, is
+ *  answered with 413 and its connection is closed.  It also bounds the
+ *  memory each connection can take.  The default is 1 MB.
+ */
+//@{
+
+#define MINISERVER_MAX_REQUEST_BYTES 1048576
+
+//@}
+
+/** @name WEB_SERVER_CACHE_BYTES
+ *  The {\tt WEB_SERVER_CACHE_BYTES} is the most memory, in bytes, the
+ *  internal web server uses to keep complete responses, ready to send,
+ *  for its aliases (such as the description documents registered with
+ *  {\bf UpnpRegisterRootDevice}) and for small files under the web server
+ *  root directory.  A cached file is checked for changes at most once a
+ *  second.  Setting it to 0 builds every response from its alias or file.
+ *  The default is 1 MB.
+ */
+//@{
+
+#define WEB_SERVER_CACHE_BYTES 1048576
+
+//@}
+
+/** @name HTTP_CLIENT_MAX_IDLE_PER_HOST
+ *  The {\tt HTTP_CLIENT_MAX_IDLE_PER_HOST} is the number of idle HTTP/1.1
+ *  connections the SDK keeps open to each remote host and port after a
+ *  SOAP, GENA or download request completes, so the next request to the
+ *  same host does not pay for a new TCP connection.  It only limits the
+ *  connections kept idle: requests made at the same time to one host each
+ *  use their own connection, however many there are, and the ones beyond
+ *  this number are closed when they complete.  Setting it to 0 closes
+ *  every connection after one request.  The default is 2.
+ */
+//@{
+
+#define HTTP_CLIENT_MAX_IDLE_PER_HOST 2
+
+//@}
+
+/** @name HTTP_CLIENT_IDLE_TIMEOUT
+ *  The {\tt HTTP_CLIENT_IDLE_TIMEOUT} is the time, in seconds, that an
+ *  idle client connection is kept before it is closed.  It should be
+ *  shorter than the time the remote servers keep idle connections open.
+ *  The default is 10 seconds.
+ */
+//@{
+
+#define HTTP_CLIENT_IDLE_TIMEOUT 10
+
+//@}
+
+/** @name DESC_CACHE_BYTES
+ *  The {\tt DESC_CACHE_BYTES} is the most memory, in bytes, used to keep
+ *  documents downloaded with {\bf UpnpDownloadUrlItem} and
+ *  {\bf UpnpDownloadXmlDoc}.  A description document at the LOCATION of an
+ *  SSDP advertisement is then answered from memory until the advertisement
+ *  expires or the device says ssdp:byebye, and other documents are
+ *  downloaded again only if the server says they changed.  Setting it to 0
+ *  downloads every document each time.  The default is 1 MB.
+ */
+//@{
+
+#define DESC_CACHE_BYTES 1048576
+
+//@}
+
+/** @name DOM_TAG_INDEX
+ *  When {\tt DOM_TAG_INDEX} is 1, the first {\bf getElementsByTagName}
+ *  call on a document builds a table from tag names to the elements of
+ *  the document, and later calls look the name up in it instead of
+ *  walking the tree.  The table is dropped whenever a node is added to
+ *  or removed from the document.  Setting it to 0 makes every call walk
+ *  the tree.
+ */
+//@{
+
+#define DOM_TAG_INDEX 1
+
+//@}
+
 //@}
 
 
@@ -1224,6 +1224,38 @@ int UpnpNotifyExt(
 
     );
 
+/** {\bf UpnpSetEventModeration} limits how often a service sends events.
+ *  Once an event has been sent, changes passed to {\bf UpnpNotify} or
+ *  {\bf UpnpNotifyExt} during the next {\bf MinInterval} milliseconds
+ *  are merged, keeping the latest value of each variable, and sent to 
+ *  all subscribers as a single property set when the interval ends.
+ *  Services send every change right away until this is called, and 
+ *  again after it is called with a {\bf MinInterval} of 0.
+ *
+ *  @return An integer representing one of the following:
+ *    \begin{itemize}
+ *      \item {\tt UPNP_E_SUCCESS}: The operation completed successfully.
+ *      \item {\tt UPNP_E_INVALID_HANDLE}: The handle is not a valid device 
+ *              handle.
+ *      \item {\tt UPNP_E_INVALID_SERVICE}: The {\bf DevId} {\bf ServId} 
+ *              pair refers to an invalid service.
+ *      \item {\tt UPNP_E_INVALID_PARAM}: {\bf MinInterval} is less than 
+ *              zero.
+ *      \item {\tt UPNP_E_FINISH}: The UPnP library is already terminated or 
+ *              is not initialized.
+ *    \end{itemize}
+ */
+
+int UpnpSetEventModeration(
+    IN UpnpDevice_Handle,       /** The handle to the device sending the 
+                                    events. */
+    IN const char *DevID,       /** The device ID of the subdevice of the 
+                                    service. */
+    IN const char *ServID,      /** The unique identifier of the service. */
+    IN int MinInterval          /** The minimum time, in milliseconds, 
+                                    between two events of the service. */
+    );
+
 /** {\bf UpnpRenewSubscription} renews a subscription that is about to 
  *  expire.  This function is synchronous.
  *
@@ -1585,6 +1617,13 @@ int UpnpUnSubscribeAsync(
  *  The UPnP library allocates the memory for {\bf outBuf} and the 
  *  application is responsible for freeing this memory.
  *
+ *  Downloaded documents are kept in memory, up to {\bf DESC_CACHE_BYTES}.
+ *  A document at the location of an SSDP advertisement is returned 
+ *  without contacting the device until the advertisement expires or the 
+ *  device sends ssdp:byebye. Other documents are fetched again with 
+ *  If-None-Match/If-Modified-Since and a 304 reply is answered from 
+ *  memory. {\bf outBuf} is always a fresh copy.
+ *
  *  @return An integer representing one of the following:
  *    \begin{itemize}
  *      \item {\tt UPNP_E_SUCCESS}: The operation completed successfully.
@@ -1620,6 +1659,13 @@ int UpnpDownloadUrlItem(
  *  The UPnP library parses the document and returns it in the from of a 
  *  DOM document. The application is responsible for freeing the DOM document.
  *
+ *  The document is fetched with {\bf UpnpDownloadUrlItem}, so only the 
+ *  download is cached: every call parses the text again. The application 
+ *  owns and may change the DOM document it gets, so a cached tree would 
+ *  have to be cloned for each caller, and {\bf UpnpDocument_cloneNode} 
+ *  does not copy attributes and leaves the copy tied to the original 
+ *  document.
+ *
  *  @return An integer representing one of the following:
  *    \begin{itemize}
  *      \item {\tt UPNP_E_SUCCESS}: The operation completed successfully.
@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+/*****************************************************************/
+//	File  : DOMCharScan.cpp
+//	Description:  Scans used by the Parser to find the end of text,
+//	white space and attribute values.  They work on null terminated
+//	strings and use SSE2 or AVX2 when the processor has them,
+//	chosen once when the library is loaded.
+/*****************************************************************/
+
+#ifndef _DOMCHARSCAN_H_
+#define _DOMCHARSCAN_H_
+
+//returns the first c or null character at or after s
+const char *scan_to_char(const char *s, char c);
+
+//returns the first character at or after s that is not white space
+const char *scan_past_space(const char *s);
+
+//returns the first character in [s, end) that copy_token can not copy
+//as it is: '&', '<', a control character other than tab, newline and
+//carriage return (including the terminating null), or a byte of a
+//multibyte UTF-8 character; end if there is none
+const char *scan_plain_chars(const char *s, const char *end);
+
+#endif
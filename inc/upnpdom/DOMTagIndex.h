@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+/*****************************************************************/
+//	Class : DOMTagIndex
+//	File  : DOMTagIndex.cpp
+//	Description:  Table from element tag names to the elements of
+//	one document, in document order.  A document builds it the first
+//	time getElementsByTagName is called on it and drops it whenever
+//	its tree changes.  Like the rest of the DOM it must not be used
+//	from two threads at once.
+/*****************************************************************/
+
+#ifndef _DOMTAGINDEX_H_
+#define _DOMTAGINDEX_H_
+
+class NodeAct;
+class NodeList;
+
+class DOMTagIndex
+{
+public:
+	//returns NULL if there is not enough memory
+	static DOMTagIndex* build(NodeAct *root);
+	~DOMTagIndex();
+
+	//adds the elements below scope that getElementsByTagName would
+	//return to list; scope must be root or a node of its tree
+	void find(NodeAct *scope, char *tagName, NodeList *list);
+
+private:
+	DOMTagIndex();
+
+	struct Entry
+	{
+		const char *localName;	//the name without its prefix
+		unsigned int hash;
+		NodeAct **items;
+		unsigned long count;
+		unsigned long capacity;
+		Entry *next;
+	};
+
+	bool add(NodeAct *element);
+	bool addToEntry(Entry *e, NodeAct *element);
+	Entry* lookup(const char *localName, unsigned int hash);
+	bool grow();
+
+	Entry **buckets;
+	unsigned int bucketCount;	//a power of two
+	unsigned int entryCount;
+	Entry allElements;	//answers "*"
+	unsigned long nodeCount;
+};
+
+#endif
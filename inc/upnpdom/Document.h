@@ -66,7 +66,7 @@ public:
 
 	//Additional Interfaces
     	Document& operator = (const Document &other);
-	Document& ReadDocumentFileOrBuffer(char * xmlFile, bool file);
+	Document& ReadDocumentFileOrBuffer(char * xmlFile, bool file, int bufferLen = -1);
 	Attr& createAttribute(char *name, char *value);
 	void  createDocument(Document **returnDoc); 
 	void deleteDocument();
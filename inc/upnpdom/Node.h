@@ -101,6 +101,7 @@ private:
 
 protected:
     void SearchList(Node& n, char *tagname, NodeList **lst, bool ignorePrefix);
+    bool IndexedSearch(char *tagname, NodeList *lst);
 };
 
 #endif  // Node.h
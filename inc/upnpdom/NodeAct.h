@@ -38,6 +38,8 @@
 #include "Node.h"
 #include "all.h"
 #include "DOMException.h"
+#include "DOMArena.h"
+#include "DOMTagIndex.h"
 
 class Node;
 
@@ -47,8 +49,19 @@ public:
 	int RefCount;
 
 	NodeAct(NODE_TYPE nt,char *NodeName, char *NodeValue, Node * myCreator);
+	//the name and value are copied into arena; the node itself must be
+	//created with new(arena)
+	NodeAct(NODE_TYPE nt,char *NodeName, char *NodeValue, DOMArena *arena);
 	NodeAct(const NodeAct &other, bool deep);
 	~NodeAct();
+
+	//nodes made with new(arena) are taken from a DOMArena; delete works
+	//for both kinds and only gives the memory back to the arena
+	void* operator new(size_t size);
+	void* operator new(size_t size, DOMArena *arena);
+	void operator delete(void *p);
+	void operator delete(void *p, DOMArena *arena);
+
 	NodeAct* cloneNode(bool deep);
 	void appendChild(NodeAct *newChild);
 	void insertBefore(NodeAct *newChild, NodeAct *refChild);
@@ -59,6 +72,7 @@ public:
 	void deleteNodeAct();
 	void setName(char *n);
 	void setValue(char *v);
+	void replaceValue(char *v);	//frees the old value unless it is in the arena
 	char *NA_NodeName;
 	char *NA_NodeValue;
 	NODE_TYPE NA_NodeType;
@@ -71,8 +85,13 @@ public:
 	NodeAct *PrevSibling;
 	NodeAct *FirstAttr;
 	NodeAct *LastAttr;
+	bool NameInArena;	//set if the string is part of an arena
+	bool ValueInArena;
+	DOMTagIndex *TagIndex;	//only a document node has one
+	unsigned long IndexOrder;	//position in document order, set by DOMTagIndex
 
 private:
+	void treeChanged();
 	void deleteNodeTree(NodeAct *na);
 	bool findNodeFromRef(NodeAct *from, NodeAct *find);
 	void changeOwnerNode(NodeAct *n, NodeAct *newOwner);
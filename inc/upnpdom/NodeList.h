@@ -42,25 +42,24 @@ class Node;
 class NodeList;
 class NodeAct;
 
-struct InternalList
-{
-	NodeAct *ofWho;
-	InternalList *next;
-};
-
 class NodeList
 {
 public:
 	NodeList()
 	{
-		head=NULL;
+		items=NULL;
+		length=0;
+		capacity=0;
 	}
 	~NodeList();
 	Node& item(unsigned long index);
 	unsigned long getLength();
 	void deleteNodeList();
 	NodeList *ownerNodeList;
-	InternalList *head;
+	//the nodes in list order; indexing and length are O(1)
+	NodeAct **items;
+	unsigned long length;
+	unsigned long capacity;
 	void addToInternalList(NodeAct *add);
 protected:
 //	Node *ofWho;//keeps track of the 
@@ -54,15 +54,19 @@
 #define START_TREE  1024
 #define END_TREE  1024
 
-
+struct Upnp_SAXHandler;
 
 class Parser  
 {
 public:
 	//getNextNode returns NodeName, NodeValue and NodeType of the next node parsed
 	int getNextNode(NODE_TYPE &NodeType, char **NodeName, char **NodeValue, bool &IsEnd, bool IgnoreWhiteSpace);
-	Parser(char *parseStr);
+	// parseLen < 0: parseStr is null terminated
+	Parser(char *parseStr, int parseLen = -1);
 	~Parser();
+	// Reports the elements and text of parseStr to handler as they are scanned,
+	// without building any nodes; see UpnpParse_SAX for the return values.
+	static int parseEvents(const char *parseStr, int parseLen, const Upnp_SAXHandler *handler, void *cookie);
 
 private:
 	char *ParseBuff; //Holds the buffer to parse
@@ -695,6 +695,26 @@ int UpnpNodeList_getLength(
 	Upnp_NodeList OperationNodeList
 	);
 
+/** {\bf UpnpNodeList_next} returns the node at *{\bf position} and
+ *  moves *{\bf position} to the node after it.  Starting from a position
+ *  of 0, it walks the whole list:
+ *  \begin{verbatim}
+    unsigned long pos = 0;
+    while ((node = UpnpNodeList_next(list, &pos)) != NULL)
+    {
+        ...
+        UpnpNode_free(node);
+    }
+    \end{verbatim}
+ *
+ * @return The node, which must be freed with {\bf UpnpNode_free}, or 
+ *         {\tt NULL} after the last node.
+ */
+Upnp_Node UpnpNodeList_next(
+	Upnp_NodeList OperationNodeList, /** The list to walk. */
+	unsigned long *position          /** Position of the next node. */
+	);
+
 /** Frees a NodeList object.
  *
  * @return This method does not return a value.
@@ -776,6 +796,20 @@ Upnp_DOMString UpnpPrintDocumentDeEscaped(
 	Upnp_Node OperationNode /** The DOM object to render to XML. */
 	);
 
+/**{\bf UpnpPrintDocumentToBuffer} renders a DOM object into a buffer
+ * supplied by the caller, the same way as {\bf UpnpNewPrintDocument}.
+ * At most {\bf BuffLen} - 1 characters and a terminating null are
+ * written.  If the return value is {\bf BuffLen} or more, the output was
+ * cut short and a buffer of the returned length plus one is needed.
+ *
+ * @return The length of the rendered XML, or -1 if the node is not valid.
+ */
+int UpnpPrintDocumentToBuffer(
+	Upnp_Node OperationNode, /** The DOM object to render to XML. */
+	char * Upnp_Buff,        /** Buffer to store the XML. */
+	int BuffLen              /** Size of {\bf Upnp_Buff}. */
+	);
+
 /** {\bf UpnpPrintDocument} is obsolete and may be removed in future versions.
  * Use {\bf UpnpNewPrintDocument} instead.
  */	
@@ -792,6 +826,65 @@ Upnp_Document UpnpParse_Buffer(
 	char *Buff  	/** The buffer containing the XML to parse. */
 	);
 
+/** {\bf UpnpParse_BufferLen} parses the first {\bf Len} bytes of a
+ *  buffer, returning a DOM Document.  The buffer does not have to be
+ *  null terminated.
+ *
+ * @return A DOM document representation of the XML buffer.
+ */		
+Upnp_Document UpnpParse_BufferLen(
+	char *Buff,  	/** The buffer containing the XML to parse. */
+	int Len 	/** The number of bytes to parse. */
+	);
+
+/** {\bf Upnp_SAXHandler} holds the functions that {\bf UpnpParse_SAX}
+ *  calls as it reads a document.  The names, values and text passed to
+ *  them are not null terminated; they point into the buffer being parsed,
+ *  or, for text and attribute values containing references such as
+ *  {\tt \&amp;}, into a decoded copy that is only valid during the call.
+ *  Any of the functions may be {\tt NULL}.  A function returns 0 to
+ *  continue parsing, or any other value to stop it.
+ */
+typedef struct Upnp_SAXHandler
+{
+  /** Called for each start tag, and for each empty element tag before its
+   *  attributes. */
+  int (*StartElement)(void *Cookie, const char *Name, int NameLen);
+
+  /** Called for each attribute, after the {\bf StartElement} of its
+   *  element. */
+  int (*Attribute)(void *Cookie, const char *Name, int NameLen,
+                   const char *Value, int ValueLen);
+
+  /** Called for each run of text or CDATA inside the root element,
+   *  including white space between tags. */
+  int (*Characters)(void *Cookie, const char *Text, int TextLen);
+
+  /** Called for each end tag, and right after the attributes of an empty
+   *  element tag. */
+  int (*EndElement)(void *Cookie, const char *Name, int NameLen);
+} Upnp_SAXHandler;
+
+/** {\bf UpnpParse_SAX} reads the first {\bf Len} bytes of an XML buffer
+ *  and reports its elements and text to the functions in {\bf Handler}
+ *  without building a DOM Document.  The buffer is not changed and does
+ *  not have to be null terminated.  Comments, processing instructions
+ *  and the document type declaration are skipped.
+ *
+ * @return 0 if the whole document was read, -1 if it is not well formed,
+ *         or the value returned by the function in {\bf Handler} that
+ *         stopped the parse.  Parts of a document that is not well formed
+ *         may already have been reported before -1 is returned.
+ */
+int UpnpParse_SAX(
+	const char *Buff,                /** The buffer containing the XML to parse. */
+	int Len,                         /** The number of bytes to parse, or -1
+	                                     if {\bf Buff} is null terminated. */
+	const Upnp_SAXHandler *Handler,  /** The functions to call. */
+	void *Cookie                     /** Passed to each function in
+	                                     {\bf Handler}. */
+	);
+
 /** {\bf UpnpDOMString_free} frees Upnp_DOMString buffers. Should only
  *  be used to deallocate UpnpDOMStrings passed out of the library, or
  *  created through {\bf UpnpCloneDOMString}.
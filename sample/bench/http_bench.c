@@ -0,0 +1,340 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// File : http_bench.c
+//
+// Load driver for the miniserver of a running device, for instance the
+// tvdevice sample.  Each client thread sends one request after the
+// other for a fixed time and the requests answered with 200 OK per
+// second are printed.  A client keeps its connection while the server
+// does; with -1 every request uses a connection of its own.
+//
+// The request is a GET of path, or with -q a SOAP QueryStateVariable of
+// var posted to the control URL.  To compare two builds of the library,
+// run the device with LD_LIBRARY_PATH pointing at each of them.
+//
+// -c takes a comma separated list of client counts, e.g. 1,2,4,8; each
+// count is run in turn, which shows how control requests scale with the
+// number of threads the device serves at once.
+//
+// usage: http_bench [-c clients[,clients...]] [-t seconds] [-1]
+//                   [-q controlURL var] host port [path]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_CLIENTS 4
+#define DEFAULT_SECONDS 5
+#define DEFAULT_PATH "/tvdevicedesc.xml"
+#define MAX_REQUEST 2048
+#define MAX_ROUNDS 16
+
+static struct sockaddr_in ServerAddr;
+static char Request[MAX_REQUEST];
+static int RequestLen;
+static int OnePerConnection = 0;
+static double EndTime;
+
+typedef struct {
+  pthread_t thread;
+  int answered;         // 200 OK responses
+  int failed;           // other responses and broken connections
+  int connections;
+} Client;
+
+static double Now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int Connect(void)
+{
+  int fd;
+  int on = 1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, (struct sockaddr *) &ServerAddr, sizeof(ServerAddr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// value of the header name in the header block hdr; NULL if missing
+static const char *FindHeader(const char *hdr, const char *name)
+{
+  int len = strlen(name);
+  const char *line = strstr(hdr, "\r\n");
+
+  while (line != NULL && line[2] != '\r') {
+    line += 2;
+    if (strncasecmp(line, name, len) == 0 && line[len] == ':')
+      return line + len + 1;
+    line = strstr(line, "\r\n");
+  }
+  return NULL;
+}
+
+// reads one response; returns its status code, or -1 if the connection
+//  broke; *keep is set if the server keeps the connection
+static int ReadResponse(int fd, int *keep)
+{
+  static __thread char buf[256 * 1024];
+  const char *end = NULL;
+  const char *value;
+  int len = 0;
+  int want = -1;
+  int status;
+  int n;
+
+  while (end == NULL || (want >= 0 && len < want)) {
+    if (len == (int) sizeof(buf) - 1)
+      return -1;
+    n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+    if (n <= 0)
+      break;
+    len += n;
+    buf[len] = 0;
+    if (end == NULL && (end = strstr(buf, "\r\n\r\n")) != NULL) {
+      value = FindHeader(buf, "CONTENT-LENGTH");
+      if (value != NULL)
+	want = end + 4 - buf + atoi(value);
+    }
+  }
+  if (end == NULL || (want >= 0 && len < want))
+    return -1;
+
+  if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1)
+    return -1;
+  value = FindHeader(buf, "CONNECTION");
+  *keep = want >= 0 && strncmp(buf, "HTTP/1.1", 8) == 0 &&
+    (value == NULL || strncasecmp(value + strspn(value, " \t"), "close",
+				  5) != 0);
+  return status;
+}
+
+static void *RunClient(void *arg)
+{
+  Client *c = (Client *) arg;
+  int fd = -1;
+  int keep = 0;
+  int status;
+
+  while (Now() < EndTime) {
+    if (fd == -1) {
+      fd = Connect();
+      if (fd == -1) {
+	c->failed++;
+	continue;
+      }
+      c->connections++;
+    }
+
+    status = -1;
+    if (send(fd, Request, RequestLen, MSG_NOSIGNAL) == RequestLen)
+      status = ReadResponse(fd, &keep);
+    if (status == 200)
+      c->answered++;
+    else
+      c->failed++;
+
+    if (status == -1 || !keep || OnePerConnection) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd != -1)
+    close(fd);
+  return NULL;
+}
+
+static void MakeGet(const char *host, const char *path)
+{
+  RequestLen = snprintf(Request, sizeof(Request),
+			"GET %s HTTP/1.1\r\nHOST: %s\r\n%s\r\n", path, host,
+			OnePerConnection ? "CONNECTION: close\r\n" : "");
+}
+
+static void MakeQuery(const char *host, const char *url, const char *var)
+{
+  char body[1024];
+  int len;
+
+  len = snprintf(body, sizeof(body),
+		 "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\""
+		 " s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+		 "<s:Body><u:QueryStateVariable"
+		 " xmlns:u=\"urn:schemas-upnp-org:control-1-0\">"
+		 "<u:varName>%s</u:varName></u:QueryStateVariable>"
+		 "</s:Body></s:Envelope>", var);
+  RequestLen = snprintf(Request, sizeof(Request),
+			"POST %s HTTP/1.1\r\nHOST: %s\r\n"
+			"CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+			"SOAPACTION: \"urn:schemas-upnp-org:control-1-0"
+			"#QueryStateVariable\"\r\n"
+			"CONTENT-LENGTH: %d\r\n%s\r\n%s", url, host, len,
+			OnePerConnection ? "CONNECTION: close\r\n" : "",
+			body);
+}
+
+static void Usage(void)
+{
+  fprintf(stderr, "usage: http_bench [-c clients[,clients...]] [-t seconds]"
+	  " [-1]\n                  [-q controlURL var] host port [path]\n");
+  exit(1);
+}
+
+// parses the client counts of -c into rounds; returns how many there are
+static int ParseCounts(const char *arg, int *rounds)
+{
+  int n = 0;
+
+  while (n < MAX_ROUNDS) {
+    rounds[n] = atoi(arg);
+    if (rounds[n] <= 0)
+      return 0;
+    n++;
+    arg = strchr(arg, ',');
+    if (arg == NULL)
+      return n;
+    arg++;
+  }
+  return 0;
+}
+
+// runs numClients clients for seconds; returns the number of failures
+static int RunRound(int numClients, int seconds, const char *what)
+{
+  Client *clients;
+  int answered = 0;
+  int failed = 0;
+  int connections = 0;
+  double start;
+  double elapsed;
+  int i;
+
+  clients = (Client *) calloc(numClients, sizeof(Client));
+  if (clients == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+
+  start = Now();
+  EndTime = start + seconds;
+  for (i = 0; i < numClients; i++) {
+    if (pthread_create(&clients[i].thread, NULL, RunClient,
+		       &clients[i]) != 0) {
+      fprintf(stderr, "can not start client %d\n", i);
+      exit(1);
+    }
+  }
+  for (i = 0; i < numClients; i++) {
+    pthread_join(clients[i].thread, NULL);
+    answered += clients[i].answered;
+    failed += clients[i].failed;
+    connections += clients[i].connections;
+  }
+  elapsed = Now() - start;
+
+  printf("%s, %3d clients: %10.1f req/s  (%d answered, %d failed,"
+	 " %d connections)\n", what, numClients, answered / elapsed,
+	 answered, failed, connections);
+  fflush(stdout);
+  free(clients);
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  int rounds[MAX_ROUNDS] = {DEFAULT_CLIENTS};
+  int numRounds = 1;
+  int seconds = DEFAULT_SECONDS;
+  const char *queryUrl = NULL;
+  const char *queryVar = NULL;
+  const char *path = DEFAULT_PATH;
+  char host[64];
+  char what[MAX_REQUEST];
+  int failed = 0;
+  int i = 1;
+
+  while (i < argc && argv[i][0] == '-') {
+    if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      numRounds = ParseCounts(argv[i += 1], rounds);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      seconds = atoi(argv[i += 1]);
+    else if (strcmp(argv[i], "-1") == 0)
+      OnePerConnection = 1;
+    else if (strcmp(argv[i], "-q") == 0 && i + 2 < argc) {
+      queryUrl = argv[i + 1];
+      queryVar = argv[i + 2];
+      i += 2;
+    } else
+      Usage();
+    i++;
+  }
+  if (argc - i < 2 || argc - i > 3 || numRounds == 0 || seconds <= 0)
+    Usage();
+  if (argc - i == 3)
+    path = argv[i + 2];
+
+  memset(&ServerAddr, 0, sizeof(ServerAddr));
+  ServerAddr.sin_family = AF_INET;
+  ServerAddr.sin_port = htons(atoi(argv[i + 1]));
+  if (inet_aton(argv[i], &ServerAddr.sin_addr) == 0)
+    Usage();
+  snprintf(host, sizeof(host), "%s:%s", argv[i], argv[i + 1]);
+
+  if (queryUrl != NULL)
+    MakeQuery(host, queryUrl, queryVar);
+  else
+    MakeGet(host, path);
+  snprintf(what, sizeof(what), "%s %s", queryUrl != NULL ? "POST" : "GET",
+	   queryUrl != NULL ? queryUrl : path);
+
+  for (i = 0; i < numRounds; i++)
+    failed += RunRound(rounds[i], seconds, what);
+  return failed != 0;
+}
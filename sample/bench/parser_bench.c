@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// File : parser_bench.c
+//
+// Times the DOM parser (UpnpParse_Buffer) on UPnP payloads:
+//
+// - the description and SCPD documents of the tvdevice sample, or the
+//   files named on the command line
+// - a ContentDirectory Browse response, whose Result is an escaped
+//   DIDL-Lite document, so the text is mostly character references
+// - the DIDL-Lite document itself, as a control point parses it after
+//   taking it out of the Result
+//
+// Each payload is parsed repeatedly for about a second and the time of
+// one parse is printed.  To compare two builds of the library, run the
+// same binary with LD_LIBRARY_PATH pointing at each of them.
+//
+// usage: parser_bench [-n items] [file ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "upnp.h"
+
+#define DEFAULT_ITEMS 1000
+
+static const char *DefaultFiles[] = {
+  "../tvdevice/web/tvdevicedesc.xml",
+  "../tvdevice/web/tvcontrolSCPD.xml",
+  "../tvdevice/web/tvpictureSCPD.xml",
+  NULL
+};
+
+typedef struct {
+  char *buf;
+  int len;
+  int size;
+} Text;
+
+static double Now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void Append(Text *t, const char *s)
+{
+  int n = strlen(s);
+
+  if (t->len + n + 1 > t->size) {
+    t->size = (t->len + n + 1) * 2;
+    t->buf = (char *) realloc(t->buf, t->size);
+    if (t->buf == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  memcpy(t->buf + t->len, s, n + 1);
+  t->len += n;
+}
+
+// appends s with the characters XML needs escaped as references
+static void AppendEscaped(Text *t, const char *s)
+{
+  char c[2] = {0, 0};
+
+  for (; *s; s++) {
+    switch (*s) {
+    case '<': Append(t, "&lt;"); break;
+    case '>': Append(t, "&gt;"); break;
+    case '&': Append(t, "&amp;"); break;
+    case '"': Append(t, "&quot;"); break;
+    default: c[0] = *s; Append(t, c); break;
+    }
+  }
+}
+
+// a DIDL-Lite result with one music track per item
+static void MakeDidl(Text *t, int items)
+{
+  char item[1024];
+  int i;
+
+  Append(t, "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\""
+	 " xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+	 " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">");
+  for (i = 0; i < items; i++) {
+    sprintf(item,
+	    "<item id=\"64$%d\" parentID=\"64\" restricted=\"1\">"
+	    "<dc:title>Track %d &amp; Friends</dc:title>"
+	    "<dc:creator>Some Artist</dc:creator>"
+	    "<upnp:album>An Album Title</upnp:album>"
+	    "<upnp:genre>Rock</upnp:genre>"
+	    "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+	    "<res protocolInfo=\"http-get:*:audio/mpeg:*\" size=\"4718592\""
+	    " duration=\"0:03:54\">http://192.168.0.4:5431/media/%d.mp3</res>"
+	    "</item>", i, i, i);
+    Append(t, item);
+  }
+  Append(t, "</DIDL-Lite>");
+}
+
+// a Browse response carrying the DIDL-Lite result of MakeDidl
+static void MakeBrowseResponse(Text *t, int items)
+{
+  Text didl = {NULL, 0, 0};
+  char counts[256];
+
+  MakeDidl(&didl, items);
+  Append(t, "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\""
+	 " s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+	 "<s:Body><u:BrowseResponse"
+	 " xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+	 "<Result>");
+  AppendEscaped(t, didl.buf);
+  sprintf(counts, "</Result><NumberReturned>%d</NumberReturned>"
+	  "<TotalMatches>%d</TotalMatches><UpdateID>1</UpdateID>"
+	  "</u:BrowseResponse></s:Body></s:Envelope>", items, items);
+  Append(t, counts);
+  free(didl.buf);
+}
+
+static char *ReadFile(const char *name)
+{
+  FILE *f = fopen(name, "rb");
+  char *buf;
+  long len;
+
+  if (f == NULL)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = (char *) malloc(len + 1);
+  if (buf == NULL || fread(buf, 1, len, f) != (size_t) len) {
+    free(buf);
+    fclose(f);
+    return NULL;
+  }
+  buf[len] = 0;
+  fclose(f);
+  return buf;
+}
+
+// parses doc until about a second has passed and prints one parse's time
+static int Bench(const char *name, char *doc)
+{
+  Upnp_Document parsed;
+  double start;
+  double elapsed;
+  int runs = 0;
+
+  start = Now();
+  do {
+    parsed = UpnpParse_Buffer(doc);
+    if (parsed == NULL) {
+      printf("%-28s does not parse\n", name);
+      return -1;
+    }
+    UpnpDocument_free(parsed);
+    runs++;
+    elapsed = Now() - start;
+  } while (elapsed < 1.0);
+
+  printf("%-28s %9d bytes %10.1f us/parse %8.1f MB/s\n", name,
+	 (int) strlen(doc), elapsed * 1e6 / runs,
+	 strlen(doc) * runs / elapsed / 1e6);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char **files = DefaultFiles;
+  Text t = {NULL, 0, 0};
+  char name[64];
+  int items = DEFAULT_ITEMS;
+  int ret = 0;
+  int i = 1;
+  char *doc;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    items = atoi(argv[2]);
+    i = 3;
+  }
+  if (i < argc)
+    files = (const char **) &argv[i];
+
+  for (; *files != NULL; files++) {
+    doc = ReadFile(*files);
+    if (doc == NULL) {
+      printf("%-28s can not be read\n", *files);
+      ret = 1;
+      continue;
+    }
+    if (Bench(strrchr(*files, '/') ? strrchr(*files, '/') + 1 : *files,
+	      doc) != 0)
+      ret = 1;
+    free(doc);
+  }
+
+  MakeBrowseResponse(&t, items);
+  sprintf(name, "BrowseResponse (%d items)", items);
+  if (Bench(name, t.buf) != 0)
+    ret = 1;
+
+  t.len = 0;
+  MakeDidl(&t, items);
+  sprintf(name, "DIDL-Lite (%d items)", items);
+  if (Bench(name, t.buf) != 0)
+    ret = 1;
+  free(t.buf);
+
+  return ret;
+}
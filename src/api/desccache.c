@@ -0,0 +1,419 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// File : desccache.c
+//
+// Keeps the documents downloaded by UpnpDownloadUrlItem so that a control
+// point that downloads the description of every device it hears
+// advertise does not fetch the same bytes again each time:
+//
+// - a document at the LOCATION of an SSDP advertisement is served from
+//   memory until the advertisement's CACHE-CONTROL max-age runs out, or
+//   until the device says ssdp:byebye
+// - otherwise it is fetched with If-None-Match/If-Modified-Since, and a
+//   304 reply is answered from memory
+//
+// The cache holds at most DESC_CACHE_BYTES, least recently used
+// documents are dropped first. Only the text is kept, UpnpDownloadXmlDoc
+// still parses it on every call.
+
+#include "../../inc/tools/config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "desccache.h"
+
+//number of buckets in the url index
+#define DESC_CACHE_HASH_SIZE 64
+
+typedef struct DESC_CACHE_ENTRY {
+  char *url;
+  char *body;                     //null terminated
+  int size;                       //bytes counted against DESC_CACHE_BYTES
+  char contentType[LINE_SIZE];
+  char etag[LINE_SIZE];           //"" if the server sent none
+  char lastModified[LINE_SIZE];   //"" if the server sent none
+  char udn[LINE_SIZE];            //device that advertised url, if any
+  time_t freshUntil;              //served without asking the server until then
+  struct DESC_CACHE_ENTRY *prev;  //more recently used
+  struct DESC_CACHE_ENTRY *next;  //less recently used
+  struct DESC_CACHE_ENTRY *hashNext; //next in the same url index bucket
+} desc_cache_entry;
+
+static desc_cache_entry *DescCacheIndex[DESC_CACHE_HASH_SIZE];
+static desc_cache_entry *DescCacheHead=NULL;
+static desc_cache_entry *DescCacheTail=NULL;
+static int DescCacheSize=0;
+static pthread_mutex_t DescCacheMutex=PTHREAD_MUTEX_INITIALIZER;
+
+
+//unlinks entry from the list
+static void unlinkEntry(desc_cache_entry *entry)
+{
+  if (entry->prev)
+    entry->prev->next=entry->next;
+  else
+    DescCacheHead=entry->next;
+  if (entry->next)
+    entry->next->prev=entry->prev;
+  else
+    DescCacheTail=entry->prev;
+  entry->prev=entry->next=NULL;
+}
+
+//puts entry at the most recently used end of the list
+static void linkEntry(desc_cache_entry *entry)
+{
+  entry->prev=NULL;
+  entry->next=DescCacheHead;
+  if (DescCacheHead)
+    DescCacheHead->prev=entry;
+  else
+    DescCacheTail=entry;
+  DescCacheHead=entry;
+}
+
+//url index bucket of url
+static desc_cache_entry ** urlBucket(const char *url)
+{
+  unsigned int h=5381;
+
+  while (*url)
+    h=(h*33)^(unsigned char) (*url++);
+  return &DescCacheIndex[h%DESC_CACHE_HASH_SIZE];
+}
+
+static void freeEntry(desc_cache_entry *entry)
+{
+  desc_cache_entry **link=urlBucket(entry->url);
+
+  while ( (*link) && ((*link)!=entry) )
+    link=&(*link)->hashNext;
+  if (*link)
+    (*link)=entry->hashNext;
+
+  unlinkEntry(entry);
+  DescCacheSize-=entry->size;
+  free(entry->url);
+  free(entry->body);
+  free(entry);
+}
+
+static desc_cache_entry * findEntry(const char *url)
+{
+  desc_cache_entry *entry;
+
+  for (entry=*urlBucket(url); entry!=NULL; entry=entry->hashNext)
+    if (!strcmp(entry->url,url))
+      return entry;
+  return NULL;
+}
+
+//copies a header value into a LINE_SIZE buffer; values that do not fit
+//are dropped, since a cut validator would never match
+static void copyValue(char *out, const token *in)
+{
+  if ( (in==NULL) || (in->size<=0) || (in->size>=LINE_SIZE))
+    out[0]='\0';
+  else
+    {
+      memcpy(out,in->buff,in->size);
+      out[in->size]='\0';
+    }
+}
+
+//returns a malloced copy of the body of entry, or NULL
+static char * copyBody(desc_cache_entry *entry, char *contentType)
+{
+  char *body=(char *)malloc(strlen(entry->body)+1);
+
+  if (body==NULL)
+    {
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"Insuffecient memory\n");)
+      return NULL;
+    }
+  strcpy(body,entry->body);
+  strcpy(contentType,entry->contentType);
+  return body;
+}
+
+
+//*************************************************************************
+//* Name: DescCacheLookup
+//*
+//* Description:  looks url up in the cache. If it is there and still
+//*               fresh, a copy of the document is returned. Otherwise
+//*               the headers that end the GET request for url are
+//*               written to conditional: If-None-Match and
+//*               If-Modified-Since when a copy can be revalidated,
+//*               or just the empty line.
+//*              
+//* In:           const char *url
+//*               char **body (space to place the document)
+//*               char *contentType (LINE_SIZE space for its type)
+//*               char *conditional (DESC_CACHE_COND_SIZE space)
+//*
+//* Out:          (*body) malloced copy of the document, if fresh
+//*           
+//* Return Codes: DESC_CACHE_FRESH (body and contentType are set)
+//*               DESC_CACHE_STALE (send the conditional request and
+//*               call DescCacheRevalidated on 304 Not Modified)
+//*               DESC_CACHE_MISS
+//*************************************************************************
+int DescCacheLookup(const char *url, char **body, char *contentType,
+		    char *conditional)
+{
+  desc_cache_entry *entry;
+  int result=DESC_CACHE_MISS;
+
+  strcpy(conditional,"\r\n");
+  if (DESC_CACHE_BYTES<=0)
+    return DESC_CACHE_MISS;
+
+  pthread_mutex_lock(&DescCacheMutex);
+  if ( (entry=findEntry(url))!=NULL)
+    {
+      unlinkEntry(entry);
+      linkEntry(entry);
+      if ( (entry->freshUntil>time(NULL))
+	   && ( ((*body)=copyBody(entry,contentType))!=NULL))
+	result=DESC_CACHE_FRESH;
+      else if ( (entry->etag[0]) || (entry->lastModified[0]))
+	{
+	  conditional[0]='\0';
+	  if (entry->etag[0])
+	    sprintf(conditional,"IF-NONE-MATCH: %s\r\n",entry->etag);
+	  if (entry->lastModified[0])
+	    sprintf(conditional+strlen(conditional),
+		    "IF-MODIFIED-SINCE: %s\r\n",entry->lastModified);
+	  strcat(conditional,"\r\n");
+	  result=DESC_CACHE_STALE;
+	}
+    }
+  pthread_mutex_unlock(&DescCacheMutex);
+
+  DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"DescCacheLookup: %s %s\n",url,result==DESC_CACHE_FRESH?"fresh":(result==DESC_CACHE_STALE?"stale":"miss"));)
+  return result;
+}
+
+
+//*************************************************************************
+//* Name: DescCacheRevalidated
+//*
+//* Description:  returns the cached copy of url after the server
+//*               answered a conditional request with 304 Not Modified
+//*              
+//* In:           const char *url
+//*               char **body (space to place the document)
+//*               char *contentType (LINE_SIZE space for its type)
+//*
+//* Out:          (*body) malloced copy of the document
+//*           
+//* Return Codes: UPNP_E_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//*               UPNP_E_INVALID_URL (the copy was dropped meanwhile)
+//*************************************************************************
+int DescCacheRevalidated(const char *url, char **body, char *contentType)
+{
+  desc_cache_entry *entry;
+  int result=UPNP_E_INVALID_URL;
+
+  pthread_mutex_lock(&DescCacheMutex);
+  if ( (entry=findEntry(url))!=NULL)
+    result= ((*body)=copyBody(entry,contentType))!=NULL ?
+      UPNP_E_SUCCESS : UPNP_E_OUTOF_MEMORY;
+  pthread_mutex_unlock(&DescCacheMutex);
+  return result;
+}
+
+
+//*************************************************************************
+//* Name: DescCacheStore
+//*
+//* Description:  keeps a copy of a document received with 200 OK,
+//*               replacing an older copy of url. Documents larger
+//*               than a quarter of DESC_CACHE_BYTES are not kept.
+//*               Least recently used documents are dropped to make
+//*               room.
+//*              
+//* In:           const char *url
+//*               const char *body (null terminated document)
+//*               const char *contentType
+//*               const token *etag (ETag header value, or NULL)
+//*               const token *lastModified (Last-Modified header
+//*                                          value, or NULL)
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+void DescCacheStore(const char *url, const char *body, const char *contentType,
+		    const token *etag, const token *lastModified)
+{
+  desc_cache_entry *entry;
+  char *copy;
+  int size=sizeof(desc_cache_entry)+strlen(url)+1+strlen(body)+1;
+
+  if ( (DESC_CACHE_BYTES<=0) || (size>DESC_CACHE_BYTES/4))
+    return;
+
+  if ( (copy=(char *)malloc(strlen(body)+1))==NULL)
+    {
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"Insuffecient memory\n");)
+      return;
+    }
+  strcpy(copy,body);
+
+  pthread_mutex_lock(&DescCacheMutex);
+  if ( (entry=findEntry(url))!=NULL)
+    {
+      //the device keeps its advertisement, only the document changed
+      unlinkEntry(entry);
+      DescCacheSize-=entry->size;
+      free(entry->body);
+    }
+  else if ( (entry=(desc_cache_entry *)malloc(sizeof(desc_cache_entry)))==NULL
+	    || (entry->url=(char *)malloc(strlen(url)+1))==NULL)
+    {
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"Insuffecient memory\n");)
+      free(entry);
+      free(copy);
+      pthread_mutex_unlock(&DescCacheMutex);
+      return;
+    }
+  else
+    {
+      strcpy(entry->url,url);
+      entry->udn[0]='\0';
+      entry->freshUntil=0;
+      entry->hashNext=*urlBucket(url);
+      *urlBucket(url)=entry;
+    }
+  entry->body=copy;
+  entry->size=size;
+  strncpy(entry->contentType,contentType,LINE_SIZE-1);
+  entry->contentType[LINE_SIZE-1]='\0';
+  copyValue(entry->etag,etag);
+  copyValue(entry->lastModified,lastModified);
+  linkEntry(entry);
+  DescCacheSize+=size;
+
+  while (DescCacheSize>DESC_CACHE_BYTES)
+    freeEntry(DescCacheTail);
+  pthread_mutex_unlock(&DescCacheMutex);
+}
+
+
+//*************************************************************************
+//* Name: DescCacheAdvertised
+//*
+//* Description:  called for each SSDP advertisement or search reply.
+//*               The cached document at its LOCATION stays fresh for
+//*               the max-age of the advertisement.
+//*              
+//* In:           const char *url (LOCATION header)
+//*               const char *udn (device that sent it)
+//*               int maxAge (CACHE-CONTROL max-age in seconds)
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+void DescCacheAdvertised(const char *url, const char *udn, int maxAge)
+{
+  desc_cache_entry *entry;
+
+  if ( (DESC_CACHE_BYTES<=0) || (url==NULL) || (url[0]=='\0'))
+    return;
+
+  pthread_mutex_lock(&DescCacheMutex);
+  if ( (entry=findEntry(url))!=NULL)
+    {
+      entry->freshUntil= maxAge>0 ? time(NULL)+maxAge : 0;
+      strncpy(entry->udn,udn,LINE_SIZE-1);
+      entry->udn[LINE_SIZE-1]='\0';
+    }
+  pthread_mutex_unlock(&DescCacheMutex);
+}
+
+
+//*************************************************************************
+//* Name: DescCacheExpireDevice
+//*
+//* Description:  called for ssdp:byebye. The documents advertised by
+//*               the device are revalidated the next time they are
+//*               downloaded.
+//*              
+//* In:           const char *udn (device that left)
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+void DescCacheExpireDevice(const char *udn)
+{
+  desc_cache_entry *entry;
+
+  if ( (udn==NULL) || (udn[0]=='\0'))
+    return;
+
+  pthread_mutex_lock(&DescCacheMutex);
+  for (entry=DescCacheHead; entry!=NULL; entry=entry->next)
+    if (!strcmp(entry->udn,udn))
+      entry->freshUntil=0;
+  pthread_mutex_unlock(&DescCacheMutex);
+}
+
+
+//*************************************************************************
+//* Name: DescCacheClear
+//*
+//* Description:  drops every cached document (used by UpnpFinish)
+//*              
+//* In:           None
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+void DescCacheClear(void)
+{
+  pthread_mutex_lock(&DescCacheMutex);
+  while (DescCacheHead!=NULL)
+    freeEntry(DescCacheHead);
+  pthread_mutex_unlock(&DescCacheMutex);
+}
@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation 
+// All rights reserved. 
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions are met: 
+//
+// * Redistributions of source code must retain the above copyright notice, 
+// this list of conditions and the following disclaimer. 
+// * Redistributions in binary form must reproduce the above copyright notice, 
+// this list of conditions and the following disclaimer in the documentation 
+// and/or other materials provided with the distribution. 
+// * Neither name of Intel Corporation nor the names of its contributors 
+// may be used to endorse or promote products derived from this software 
+// without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR 
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR 
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY 
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// File : desccache.h
+// Cache of documents downloaded by UpnpDownloadUrlItem, see desccache.c
+
+#ifndef DESCCACHE_H
+#define DESCCACHE_H
+
+#include "../../inc/upnp.h"
+#include "../inc/genlib/http_client/http_client.h"
+
+//results of DescCacheLookup
+#define DESC_CACHE_MISS  0
+#define DESC_CACHE_STALE 1
+#define DESC_CACHE_FRESH 2
+
+//space needed for the headers written by DescCacheLookup
+#define DESC_CACHE_COND_SIZE (2*LINE_SIZE+64)
+
+int DescCacheLookup(const char *url, char **body, char *contentType,
+		    char *conditional);
+int DescCacheRevalidated(const char *url, char **body, char *contentType);
+void DescCacheStore(const char *url, const char *body, const char *contentType,
+		    const token *etag, const token *lastModified);
+void DescCacheAdvertised(const char *url, const char *udn, int maxAge);
+void DescCacheExpireDevice(const char *udn);
+void DescCacheClear(void);
+
+#endif
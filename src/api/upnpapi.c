@@ -56,6 +56,7 @@
 #include "../inc/genlib/service_table/service_table.h"
 #include "../inc/genlib/miniserver/miniserver.h"
 //*******************************************
+#include "desccache.h"
 
 /* ********************* */
 #ifdef INTERNAL_WEB_SERVER
@@ -64,7 +65,14 @@
 #endif /* INTERNAL_WEB_SERVER */
 /* ****************** */
 
-pthread_mutex_t GlobalHndMutex = PTHREAD_MUTEX_INITIALIZER;
+// Writers are preferred where the library supports it, so that a steady
+// stream of control requests can not hold off (un)registration and
+// subscription changes.
+#ifdef PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+pthread_rwlock_t GlobalHndRWLock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+#else
+pthread_rwlock_t GlobalHndRWLock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
 #include "../inc/genlib/timer_thread/timer_thread.h"
 
 int UpnpSdkInit = 0; // Global variable to denote the state of Upnp SDK
@@ -104,6 +112,8 @@ int UpnpInit(IN const char *HostIP, IN unsigned short DestPort)
      
     tpool_SetMaxThreads(MAX_THREADS + 3); // 3 threads are required for running
                                     // miniserver, ssdp.
+    tpool_SetPriorityQuota(TPOOL_DISCOVERY, DISCOVERY_THREADS);
+    tpool_SetPriorityQuota(TPOOL_EVENTING, EVENTING_THREADS);
     if (tintr_Init(SIGUSR1) != 0)
 	   return UPNP_E_INIT_FAILED;
     UpnpSdkInit = 1; 
@@ -198,6 +208,8 @@ int UpnpFinish()
     sleep(3);
 
     StopMiniServer(); 
+    closeIdleConnections();
+    DescCacheClear();
     tintr_Done();
 
     DBGONLY(
@@ -231,7 +243,6 @@ int UpnpRegisterRootDevice (
 
     if(UpnpSdkInit != 1)
     {
-        HandleUnlock();
         return UPNP_E_FINISH;
     }
     if (Hnd == NULL || Fun == NULL || DescUrl == NULL || strlen(DescUrl) == 0) 
@@ -263,6 +274,7 @@ int UpnpRegisterRootDevice (
     HInfo->DeviceList = NULL;
     HInfo->ServiceList = NULL;
     HInfo->DescDocument = NULL;
+    HInfo->AdvTable = NULL;
     CLIENTONLY(HInfo->ClientSubList=NULL;)
     HInfo->MaxSubscriptions=UPNP_INFINITE;
     HInfo->MaxSubscriptionTimeOut=UPNP_INFINITE;
@@ -301,6 +313,15 @@ int UpnpRegisterRootDevice (
         return UPNP_E_INVALID_DESC;
     }
 
+    #if EXCLUDE_SSDP == 0
+    if ((retVal = BuildAdvTable(HInfo)) != UPNP_E_SUCCESS)
+    {
+        FreeHandle(*Hnd);
+        HandleUnlock();
+        return retVal;
+    }
+    #endif
+
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"UpnpRegisterRootDevice: Gena Check\n");)
 
     //*******************************
@@ -336,6 +357,9 @@ int UpnpUnRegisterRootDevice(IN UpnpDevice_Handle Hnd)
     int retVal = 0;
     struct Handle_Info *HInfo;
     struct Handle_Info *info;
+    #if EXCLUDE_SSDP == 0
+    SsdpAdvTable *AdvTable;
+    #endif
 
     DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Inside UpnpUnRegisterRootDevice \n");)
 
@@ -359,6 +383,15 @@ int UpnpUnRegisterRootDevice(IN UpnpDevice_Handle Hnd)
     #endif
 
     info = (struct Handle_Info *) HandleTable[Hnd];
+
+    #if EXCLUDE_SSDP == 0
+    HandleLock();
+    AdvTable = info->AdvTable;
+    info->AdvTable = NULL;
+    HandleUnlock();
+    ReleaseAdvTable(AdvTable);
+    #endif
+
     UpnpNodeList_free( info->DeviceList );
     UpnpNodeList_free( info->ServiceList );
     UpnpDocument_free( info->DescDocument );
@@ -706,6 +739,7 @@ int UpnpRegisterRootDevice2( IN Upnp_DescType descriptionType,
     HInfo->MaxAge = DEFAULT_MAXAGE;
     HInfo->DeviceList = NULL;
     HInfo->ServiceList = NULL;
+    HInfo->AdvTable = NULL;
     CLIENTONLY(HInfo->ClientSubList=NULL;)
     HInfo->MaxSubscriptions=UPNP_INFINITE;
     HInfo->MaxSubscriptionTimeOut=UPNP_INFINITE;
@@ -739,6 +773,15 @@ int UpnpRegisterRootDevice2( IN Upnp_DescType descriptionType,
         return UPNP_E_INVALID_DESC;
     }
 
+    #if EXCLUDE_SSDP == 0
+    if ((retVal = BuildAdvTable(HInfo)) != UPNP_E_SUCCESS)
+    {
+        FreeHandle(*Hnd);
+        HandleUnlock();
+        return retVal;
+    }
+    #endif
+
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"UpnpRegisterRootDevice2: Gena Check\n");)
 
     //*******************************
@@ -777,7 +820,6 @@ int UpnpRegisterClient(IN Upnp_FunPtr Fun,
 
     if(UpnpSdkInit != 1)
     {
-        HandleUnlock();
         return UPNP_E_FINISH;
     }
     if (Fun == NULL || Hnd == NULL) 
@@ -916,7 +958,7 @@ int UpnpSearchAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSearchAsync \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1021,7 +1063,7 @@ int UpnpSubscribeAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSubscribeAsync \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1058,7 +1100,7 @@ int UpnpSubscribeAsync(IN UpnpClient_Handle Hnd,
     Param->Fun = Fun;
     Param->Cookie = (void*) Cookie_const;
 
-    tpool_Schedule( (void *)UpnpThreadDistribution , Param);
+    tpool_ScheduleWithPriority(TPOOL_EVENTING, (void *)UpnpThreadDistribution , Param);
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpSubscribeAsync \n");)
 
@@ -1079,7 +1121,7 @@ int  UpnpSubscribe (IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSubscribe \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1118,7 +1160,7 @@ int  UpnpUnSubscribe (IN UpnpClient_Handle Hnd, IN Upnp_SID SubsId)
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpUnSubscribe \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1152,7 +1194,7 @@ int UpnpUnSubscribeAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpUnSubscribeAsync \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1180,7 +1222,7 @@ int UpnpUnSubscribeAsync(IN UpnpClient_Handle Hnd,
     Param->Fun = Fun;
     Param->Cookie = (void*) Cookie_const;
 
-    tpool_Schedule((void *) UpnpThreadDistribution, Param);
+    tpool_ScheduleWithPriority(TPOOL_EVENTING, (void *) UpnpThreadDistribution, Param);
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpUnSubscribeAsync \n");)
 
@@ -1197,7 +1239,7 @@ int  UpnpRenewSubscription (IN UpnpClient_Handle Hnd, INOUT int *TimeOut,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpRenewSubscription \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1236,6 +1278,7 @@ int UpnpRenewSubscriptionAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpRenewSubscriptionAsync \n");)
 
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1269,7 +1312,7 @@ int UpnpRenewSubscriptionAsync(IN UpnpClient_Handle Hnd,
     Param->Cookie = (void*) Cookie_const;
     Param->TimeOut = TimeOut;
 
-    tpool_Schedule((void *) UpnpThreadDistribution, Param);
+    tpool_ScheduleWithPriority(TPOOL_EVENTING, (void *) UpnpThreadDistribution, Param);
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpRenewSubscriptionAsync \n");)
 
@@ -1295,7 +1338,7 @@ int UpnpNotify(IN UpnpDevice_Handle Hnd ,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpNotify \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE) 
     {
         HandleUnlock();
@@ -1340,7 +1383,7 @@ int UpnpNotifyExt(IN UpnpDevice_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpNotify \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE) 
     {
         HandleUnlock();
@@ -1368,6 +1411,34 @@ int UpnpNotifyExt(IN UpnpDevice_Handle Hnd,
 
 #endif // INCLUDE_DEVICE_APIS
 
+#ifdef INCLUDE_DEVICE_APIS
+int UpnpSetEventModeration(IN UpnpDevice_Handle Hnd,
+    IN const char *DevID_const,
+    IN const char *ServName_const,
+    IN int MinInterval)
+{
+    char *DevID = (char *)DevID_const;
+    char *ServName = (char *)ServName_const;
+    int retVal;
+
+    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSetEventModeration \n");)
+
+    if (UpnpSdkInit != 1)
+        return UPNP_E_FINISH;
+    if (DevID == NULL || ServName == NULL)
+        return UPNP_E_INVALID_SERVICE;
+    if (MinInterval < 0)
+        return UPNP_E_INVALID_PARAM;
+
+    retVal = genaSetEventModeration(Hnd,DevID,ServName,MinInterval);
+
+    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpSetEventModeration \n");)
+
+    return retVal;
+
+}  /****************** End of UpnpSetEventModeration *********************/
+#endif // INCLUDE_DEVICE_APIS
+
 #ifdef INCLUDE_DEVICE_APIS
 int UpnpAcceptSubscription(IN UpnpDevice_Handle Hnd ,
     IN const char *DevID_const,
@@ -1386,7 +1457,7 @@ int UpnpAcceptSubscription(IN UpnpDevice_Handle Hnd ,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpAcceptSubscription \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE) 
     {
         HandleUnlock();
@@ -1437,7 +1508,7 @@ int UpnpAcceptSubscriptionExt(IN UpnpDevice_Handle Hnd ,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpAcceptSubscription \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE) 
     {
         HandleUnlock();
@@ -1501,7 +1572,7 @@ int UpnpSendAction( IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSendAction \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1544,7 +1615,7 @@ int UpnpSendActionAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpSendActionAsync \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1580,7 +1651,7 @@ int UpnpSendActionAsync(IN UpnpClient_Handle Hnd,
     Param->Cookie = (void*) Cookie_const;
     Param->Fun = Fun;
 
-    tpool_Schedule((void *) UpnpThreadDistribution, Param);
+    tpool_ScheduleWithPriority(TPOOL_CONTROL, (void *) UpnpThreadDistribution, Param);
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpSendActionAsync \n");)
 
@@ -1602,7 +1673,7 @@ int UpnpGetServiceVarStatusAsync(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpGetServiceVarStatusAsync \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT)
     {
         HandleUnlock();
@@ -1628,7 +1699,7 @@ int UpnpGetServiceVarStatusAsync(IN UpnpClient_Handle Hnd,
     Param->Fun = Fun;
     Param->Cookie = (void*) Cookie_const;
 
-    tpool_Schedule((void *) UpnpThreadDistribution, Param);
+    tpool_ScheduleWithPriority(TPOOL_CONTROL, (void *) UpnpThreadDistribution, Param);
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting UpnpGetServiceVarStatusAsync \n");)
 
@@ -1648,7 +1719,7 @@ int UpnpGetServiceVarStatus(IN UpnpClient_Handle Hnd,
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpGetServiceVarStatus \n");)
 
-    HandleLock();
+    HandleReadLock();
     if(GetHandleInfo(Hnd, &SInfo) != HND_CLIENT) 
     {
         HandleUnlock();
@@ -1679,14 +1750,40 @@ int UpnpGetServiceVarStatus(IN UpnpClient_Handle Hnd,
 //
 //-----------------------------------------------------------------------------
 
+// fetches url, ending the GET request with conditional, and parses the
+// response; on success *tmpBuf holds the response and must be freed
+static int FetchUrlItem(char *url, char *conditional, char **tmpBuf,
+    http_message *msgBuf)
+{
+    int retVal;
+
+    if ((retVal = transferHTTP("GET", conditional, strlen(conditional), tmpBuf, url)) != HTTP_SUCCESS)
+    {
+        return retVal;
+    }
+
+    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"UpnpDownloadUrlItem: tmpBuf is = %s\n",*tmpBuf);
+            UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"************************END OF OUTBUF**************************\n");)
+
+    if ((retVal = parse_http_response(*tmpBuf, msgBuf, strlen(*tmpBuf))) != HTTP_SUCCESS)
+    {
+        free(*tmpBuf);
+        return retVal;
+    }
+
+    return HTTP_SUCCESS;
+}
+
 int UpnpDownloadUrlItem( const char *url_const,
     char **outBuf, char *contentType)
 {
     char *tmpBuf;
-    int retVal = 0, bufLen = 0;
+    int retVal = 0;
     http_message msgBuf;
-    token ctBuf;
+    token ctBuf, etagBuf, lastModBuf;
     char *url = (char *)url_const;
+    char conditional[DESC_CACHE_COND_SIZE];
+    int cached;
 
     DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside UpnpDownloadUrlItem \n");)
 
@@ -1695,20 +1792,32 @@ int UpnpDownloadUrlItem( const char *url_const,
 
     if (contentType !=  NULL)
         strcpy(contentType,"");
+
+    if ((cached = DescCacheLookup(url, outBuf, contentType, conditional)) == DESC_CACHE_FRESH)
+        return UPNP_E_SUCCESS;
     
-    if ((retVal = transferHTTP("GET", "\r\n", 2,&tmpBuf, url)) != HTTP_SUCCESS)
+    if ((retVal = FetchUrlItem(url, conditional, &tmpBuf, &msgBuf)) != HTTP_SUCCESS)
     {
         return retVal;
     }
 
-    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"UpnpDownloadUrlItem: tmpBuf is = %s\n",tmpBuf);
-            UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"************************END OF OUTBUF**************************\n");)
-    bufLen = strlen(tmpBuf);
-
-    if ((retVal = parse_http_response(tmpBuf, &msgBuf, bufLen)) != HTTP_SUCCESS)
+    if (cached == DESC_CACHE_STALE && 
+        !strncasecmp(msgBuf.status.status_code.buff, "304", strlen("304")))
     {
+        free_http_message(&msgBuf);
         free(tmpBuf);
-        return retVal;
+        DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"UpnpDownloadUrlItem: not modified\n");)
+        retVal = DescCacheRevalidated(url, outBuf, contentType);
+        if (retVal != UPNP_E_INVALID_URL)
+            return retVal;
+
+        // the copy was dropped while the request was out; fetch it once
+        // more without validators, so the answer can not be another 304
+        strcpy(conditional, "\r\n");
+        if ((retVal = FetchUrlItem(url, conditional, &tmpBuf, &msgBuf)) != HTTP_SUCCESS)
+        {
+            return retVal;
+        }
     }
 
     if (msgBuf.content.size == 0)
@@ -1737,6 +1846,8 @@ int UpnpDownloadUrlItem( const char *url_const,
     (*outBuf) = (char *) malloc (msgBuf.content.size + 1);
     if (*outBuf == NULL)
     {
+        free_http_message(&msgBuf);
+        free(tmpBuf);
         return UPNP_E_OUTOF_MEMORY;
     }
     strcpy(*outBuf, msgBuf.content.buff);
@@ -1745,6 +1856,10 @@ int UpnpDownloadUrlItem( const char *url_const,
         strncpy(contentType, ctBuf.buff, LINE_SIZE - 1 > ctBuf.size ? 
                 ctBuf.size : LINE_SIZE - 1);
 
+    DescCacheStore(url, *outBuf, contentType,
+        search_for_header(&msgBuf,"ETag",&etagBuf) ? &etagBuf : NULL,
+        search_for_header(&msgBuf,"Last-Modified",&lastModBuf) ? &lastModBuf : NULL);
+
     DBGONLY(
     UpnpPrintf(UPNP_PACKET,API,__FILE__,__LINE__,"UpnpDownloadUrlItem: OutBuf is = %s\n",*outBuf);
     UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"************************END OF OUTBUF**************************\n");)
@@ -1820,236 +1935,99 @@ int UpnpDownloadXmlDoc(const char *url_const,
 //-----------------------------------------------------------------------------
 
 //********************************************************
-//* Name: AdvertiseAndReply
-//* Description:  Function to send SSDP advertisements, replies and
-//*               shutdown messages.
-//* Called by:    UpnpSendAdvertisement, SsdpCallbackHandler, 
-//*               UpnpUnRegisterRootDevice.
-//* In:           int AdFlag :
-//*                           AdFlag = -1 : Send Shutdown 
-//*                           AdFlag = 0 : Send Reply
-//*                           AdFlag = 1 : Send Advertisement
-//*               UpnpDevice_Handle Hnd : Device handle
-//*               enum SsdpSearchType SearchType : Search type for sending
-//*                                                replies.
-//*               struct sockaddr_in *DestAddr : Destination address
-//*               char *DeviceType : Device type
-//*               char *DeviceUDN : Device UDN
-//*               char *ServiceType : Service type
-//*               int Exp : Advertisement age
-//* Out:          none
-//* Return Codes: UPNP_E_SUCCESS
-//* Error Codes:  UPNP_E_INVALID_HANDLE
-//*
+//* Name: GetElementText
+//* Description:  Function to copy the text of the first element with
+//*               the given tag name below a node.
+//* Called by:    BuildAdvTable
+//* In:           Upnp_Node Node : Node to search below
+//*               char *TagName : Tag of the element
+//*               char *Out : Output buffer of LINE_SIZE bytes
+//* Out:          Text of the element in Out
+//* Return Codes: 1 if found, 0 otherwise
 //********************************************************
 #ifdef INCLUDE_DEVICE_APIS
 #if EXCLUDE_SSDP == 0
 
-int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd, 
-                  enum SsdpSearchType SearchType, struct sockaddr_in *DestAddr,
-                      char *DeviceType, char *DeviceUDN, 
-                      char *ServiceType, int Exp)
+static int GetElementText(Upnp_Node Node, char *TagName, char *Out)
 {
-    int i, j;
-    int defaultExp = DEFAULT_MAXAGE;
-    struct Handle_Info *  SInfo=NULL; 
-    char  UDNstr[100], devType[100], servType[100];
-    Upnp_NodeList NodeList = NULL; 
-    Upnp_NodeList tmpNodeList = NULL; 
-    Upnp_Node tmpNode = NULL;
-    Upnp_Node tmpNode2 = NULL;
-    Upnp_Node textNode = NULL;
-    Upnp_DOMException err; 
+    Upnp_NodeList NodeList;
+    Upnp_Node tmpNode;
+    Upnp_Node textNode;
+    Upnp_DOMException err;
     Upnp_DOMString tmpStr;
 
-    DBGONLY(
-    Upnp_DOMString dbgStr;
-    UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside AdvertiseAndReply with AdFlag = %d\n", AdFlag);)
-
-    HandleLock();
-    if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE) 
-    {
-        HandleUnlock();
-        return UPNP_E_INVALID_HANDLE;
-    }
-    defaultExp = SInfo->MaxAge;
+    NodeList = UpnpElement_getElementsByTagName(Node, TagName);
+    if (NodeList == NULL)
+        return 0;
+    tmpNode = UpnpNodeList_item(NodeList, 0);
+    UpnpNodeList_free(NodeList);
+    if (tmpNode == NULL)
+        return 0;
+    textNode = UpnpNode_getFirstChild(tmpNode);
+    UpnpNode_free(tmpNode);
+    if (textNode == NULL)
+        return 0;
+    tmpStr = UpnpNode_getNodeValue(textNode, &err);
+    UpnpNode_free(textNode);
+    if (tmpStr == NULL)
+        return 0;
+    strncpy(Out, tmpStr, LINE_SIZE - 1);
+    Out[LINE_SIZE - 1] = '\0';
+    free(tmpStr);
+    return 1;
+}  /****************** End of GetElementText *********************/
 
-    // Modified to prevent more than one thread accessing the same UpnpDocument
-    //   HandleUnlock();
+//********************************************************
+//* Name: BuildAdvTable
+//* Description:  Function to walk the description document once and
+//*               record every device and service the root device 
+//*               advertises, so that AdvertiseAndReply does not have
+//*               to touch the DOM.
+//* Called by:    UpnpRegisterRootDevice, UpnpRegisterRootDevice2
+//* In:           struct Handle_Info *HInfo : Handle with DescURL,
+//*                                           DeviceList and ServiceList set
+//* Out:          HInfo->AdvTable
+//* Return Codes: UPNP_E_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//********************************************************
 
-    // parse the device list and send advertisements/replies 
-    for (i = 0; ; i++)
-    {
+int BuildAdvTable(struct Handle_Info *HInfo)
+{
+    int i;
+    unsigned long pos;
+    int retVal = UPNP_E_SUCCESS;
+    char UDNstr[LINE_SIZE], devType[LINE_SIZE], servType[LINE_SIZE];
+    Upnp_NodeList NodeList = NULL; 
+    Upnp_Node tmpNode = NULL;
+    SsdpAdvTable *Table;
 
-        DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Entering new device list with i = %d\n\n", i);)
+    HInfo->AdvTable = NULL;
+    if ((Table = CreateAdvTable(HInfo->DescURL)) == NULL)
+        return UPNP_E_OUTOF_MEMORY;
 
+    for (i = 0; retVal == UPNP_E_SUCCESS; i++)
+    {
         UpnpNode_free(tmpNode);
-        tmpNode = UpnpNodeList_item(SInfo->DeviceList, i);
+        tmpNode = UpnpNodeList_item(HInfo->DeviceList, i);
         if (tmpNode == NULL)
-        {
-            DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting new device list with i = %d\n\n", i);)
             break;
-        }
-
-        DBGONLY(
-        dbgStr = UpnpNode_getNodeName(tmpNode);
-        UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Extracting device type once for %s\n", dbgStr);
-        free(dbgStr);)
-        // extract device type 
-
-        NodeList = UpnpElement_getElementsByTagName(tmpNode, "deviceType"); 
-        if (NodeList == NULL)
-        {
-            continue;
-        }
-
-        DBGONLY(
-        dbgStr = UpnpNode_getNodeName(tmpNode);
-        UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Extracting UDN for %s\n", dbgStr);
-        free(dbgStr);)
 
-        DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Extracting device type\n");)
-
-        tmpNode2 = UpnpNodeList_item(NodeList, 0);
-        UpnpNodeList_free(NodeList);
-        if (tmpNode2 == NULL)
-        {
+        if (!GetElementText(tmpNode, "deviceType", devType))
             continue;
-        }
-        textNode = UpnpNode_getFirstChild(tmpNode2);
-        UpnpNode_free(tmpNode2);
-        if (textNode == NULL)
+        if (!GetElementText(tmpNode, "UDN", UDNstr))
         {
-            continue;
-        }
-
-        DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Extracting device type \n");)
-
-        tmpStr = UpnpNode_getNodeValue(textNode, &err);
-        UpnpNode_free(textNode);
-        if (tmpStr == NULL) 
-        {
-            continue;
-        }
-        strcpy(devType , tmpStr);
-        free(tmpStr);
-        if (devType == NULL)
-        {
-            continue;
-        }
-
-        DBGONLY(
-        UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Extracting device type = %s\n", devType);
-        if (tmpNode == NULL)
-        UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"TempNode is NULL\n");
-        dbgStr =  UpnpNode_getNodeName(tmpNode);
-        UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Extracting UDN for %s\n",dbgStr);
-        free(dbgStr);)
-
-        // extract UDN 
-
-        NodeList = UpnpElement_getElementsByTagName(tmpNode, "UDN"); 
-        if (NodeList == NULL)
-        {
-
-            DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"UDN not found!!!\n");)
-            continue;
-        }
-        tmpNode2 = UpnpNodeList_item(NodeList, 0);
-        UpnpNodeList_free(NodeList);
-        if (tmpNode2 == NULL)
-        {
-
             DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"UDN not found!!!\n");)
             continue;
         }
-        textNode = UpnpNode_getFirstChild(tmpNode2);
-        UpnpNode_free(tmpNode2);
-        if (textNode == NULL)
-        {
-
-            DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"UDN not found!!!\n");)
-            continue;
-        }
-        tmpStr = UpnpNode_getNodeValue(textNode, &err);
-        UpnpNode_free(textNode);
-        if (tmpStr == NULL)
-        {
-            DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"UDN not found!!!!\n");)
-            continue;
-        }
-        strcpy(UDNstr, tmpStr);
-        free(tmpStr);
-        if (UDNstr == NULL)
-        {
-            continue;
-        }
 
-        DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Sending UDNStr = %s \n", UDNstr);)
-
-        if (AdFlag)
-        {
-            // send the device advertisement 
-            if (AdFlag == 1)
-            {
-                DeviceAdvertisement(devType, i==0 , UDNstr, SERVER,SInfo->DescURL, Exp); 
-            }
-            else // AdFlag == -1
-            {
-                DeviceShutdown(devType, i==0 , UDNstr, SERVER, SInfo->DescURL, Exp); 
-            }
-        }
-        else
-        {
-            switch (SearchType)
-            {
-                case SSDP_ALL :
-                    DeviceReply(DestAddr, devType, i==0, UDNstr, SERVER,SInfo->DescURL, defaultExp);
-                    break;
-
-                case SSDP_ROOTDEVICE :
-
-                    if (i==0)
-                    {
-                        SendReply(DestAddr, devType, 1, UDNstr, SERVER,SInfo->DescURL, defaultExp, 0);
-                    }
-                    break;
-                case SSDP_DEVICE :
-                    if (DeviceUDN != NULL && strlen(DeviceUDN) != 0) 
-                    {
-                        if (strcasecmp(DeviceUDN, UDNstr))
-                        {
-                            DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"DeviceUDN=%s and search UDN=%s did not match\n",UDNstr, DeviceUDN);)
-                            break;
-                        }
-                        else
-                        {
-
-                            DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"DeviceUDN=%s and search UDN=%s MATCH\n",UDNstr, DeviceUDN);)
-                            SendReply(DestAddr, devType, 0, UDNstr,SERVER, SInfo->DescURL, defaultExp, 0);
-                            break;
-                        }
-  
-                    }
-                    if (!strcasecmp(DeviceType, devType))
-                    {
+        DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Adding device %s of type %s\n", UDNstr, devType);)
 
-                        DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"DeviceType=%s and search devType=%s MATCH\n",devType,DeviceType);)
-                        SendReply(DestAddr, devType, 0, UDNstr,SERVER, SInfo->DescURL, defaultExp, 1);
-                    }
-
-                    DBGONLY(else UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"DeviceType=%s and search devType=%s DID NOT MATCH\n",devType,DeviceType);)
-
-                    break;
-                default : break;
-            }
-        }
-
-        // send service advertisements for services corresponding to the same device 
-        DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Sending service Advertisement\n");)
+        if ((retVal = AdvTableAddDevice(Table, devType, i==0, UDNstr)) != UPNP_E_SUCCESS)
+            break;
 
+        // services are looked up by the same index as their device 
         UpnpNode_free(tmpNode);
-        tmpNode = UpnpNodeList_item(SInfo->ServiceList, i);
+        tmpNode = UpnpNodeList_item(HInfo->ServiceList, i);
         if (tmpNode == NULL)
             continue;
 
@@ -2059,93 +2037,102 @@ int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd,
             DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Service not found 3\n");)
             continue;
         }
-        for (j = 0; ; j++)
+        for (pos = 0; ; )
         {
             UpnpNode_free(tmpNode);
-            tmpNode = UpnpNodeList_item(NodeList, j);
+            tmpNode = UpnpNodeList_next(NodeList, &pos);
             if (tmpNode == NULL)
                 break;
 
-            tmpNodeList = UpnpElement_getElementsByTagName(tmpNode,"serviceType");
-
-            if (tmpNodeList == NULL)
+            // servType is of format Servicetype:ServiceVersion
+            if (!GetElementText(tmpNode, "serviceType", servType))
             {
                 DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"ServiceType not found \n");)
                 continue;
             }
-            tmpNode2 = UpnpNodeList_item(tmpNodeList, 0);
-            UpnpNodeList_free(tmpNodeList);
-            if (tmpNode2 == NULL)
-            {
-                continue;
-            }
-            textNode = UpnpNode_getFirstChild(tmpNode2);
-            UpnpNode_free(tmpNode2);
-            if (textNode == NULL)
-            {
-                continue;
-            }
 
-            // servType is of format Servicetype:ServiceVersion
+            DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"ServiceType = %s\n", servType);)
 
-            tmpStr = UpnpNode_getNodeValue(textNode, &err);
-            UpnpNode_free(textNode);
-            if (tmpStr == NULL)
-            {
-                continue;
-            }
-            strcpy(servType, tmpStr); 
-            free(tmpStr);
-            if (servType == NULL)
-            {
-                continue;
-            }
+            if ((retVal = AdvTableAddService(Table, UDNstr, servType)) != UPNP_E_SUCCESS)
+                break;
+        }
+        UpnpNodeList_free(NodeList);
+    }
+    UpnpNode_free(tmpNode);
 
-            DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"ServiceType = %s\n", servType);)
+    if (retVal != UPNP_E_SUCCESS)
+    {
+        FreeAdvTable(Table);
+        return retVal;
+    }
 
-            if (AdFlag)
-            {
-                if (AdFlag == 1)
-                {
-                    ServiceAdvertisement(UDNstr, servType,SERVER, SInfo->DescURL, Exp);
-                }
-                else // AdFlag == -1
-                {
-                    ServiceShutdown(UDNstr, servType, SERVER,SInfo->DescURL, Exp);
-                }
-                
-            }
-            else
-            {
-                switch(SearchType)
-                {
-                    case SSDP_ALL :
+    HInfo->AdvTable = Table;
+    return UPNP_E_SUCCESS;
+}  /****************** End of BuildAdvTable *********************/
 
-                        ServiceReply(DestAddr, servType, UDNstr,SERVER,  SInfo->DescURL, defaultExp);
-                        break;
+#endif
+#endif
+
+//********************************************************
+//* Name: AdvertiseAndReply
+//* Description:  Function to send SSDP advertisements, replies and
+//*               shutdown messages.
+//* Called by:    UpnpSendAdvertisement, SsdpCallbackHandler, 
+//*               UpnpUnRegisterRootDevice.
+//* In:           int AdFlag :
+//*                           AdFlag = -1 : Send Shutdown 
+//*                           AdFlag = 0 : Send Reply
+//*                           AdFlag = 1 : Send Advertisement
+//*               UpnpDevice_Handle Hnd : Device handle
+//*               enum SsdpSearchType SearchType : Search type for sending
+//*                                                replies.
+//*               struct sockaddr_in *DestAddr : Destination address
+//*               char *DeviceType : Device type
+//*               char *DeviceUDN : Device UDN
+//*               char *ServiceType : Service type
+//*               int Exp : Advertisement age
+//* Out:          none
+//* Return Codes: UPNP_E_SUCCESS
+//* Error Codes:  UPNP_E_INVALID_HANDLE
+//*
+//********************************************************
+#ifdef INCLUDE_DEVICE_APIS
+#if EXCLUDE_SSDP == 0
 
-                    case SSDP_SERVICE :
+int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd, 
+                  enum SsdpSearchType SearchType, struct sockaddr_in *DestAddr,
+                      char *DeviceType, char *DeviceUDN, 
+                      char *ServiceType, int Exp)
+{
+    int retVal;
+    int defaultExp = DEFAULT_MAXAGE;
+    struct Handle_Info *  SInfo=NULL; 
+    SsdpAdvTable *AdvTable;
 
-                        if (ServiceType != NULL)
-                        {
-                            if (!strcasecmp(ServiceType, servType))
-                            {
-                                ServiceReply(DestAddr, servType,UDNstr, SERVER, SInfo->DescURL, defaultExp);
-                            }
-                        }
-                        break;
-                    default : break;
-                } // switch(SearchType)               
+    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Inside AdvertiseAndReply with AdFlag = %d\n", AdFlag);)
 
-            }
-        }
+    HandleReadLock();
+    if(GetHandleInfo(Hnd, &SInfo) != HND_DEVICE || SInfo->AdvTable == NULL) 
+    {
+        HandleUnlock();
+        return UPNP_E_INVALID_HANDLE;
     }
-    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting AdvertiseAndReply : \n");)
+    defaultExp = SInfo->MaxAge;
+
+    // The table is immutable, so it is only pinned while the packets
+    // are sent and the handle lock is not held across the network I/O.
+    AdvTable = SInfo->AdvTable;
+    HoldAdvTable(AdvTable);
+    HandleUnlock();
+
+    retVal = AdvTableSend(AdvTable, AdFlag, SearchType, DestAddr, DeviceType,
+                          DeviceUDN, ServiceType, AdFlag ? Exp : defaultExp);
 
-      HandleUnlock();// Modified to prevent more than one 
-                     //thread accessing the same UpnpDocument
+    ReleaseAdvTable(AdvTable);
 
-    return  UPNP_E_SUCCESS; 
+    DBGONLY(UpnpPrintf(UPNP_ALL,API,__FILE__,__LINE__,"Exiting AdvertiseAndReply : \n");)
+
+    return  retVal; 
  
 }  /****************** End of AdvertiseAndReply *********************/
 
@@ -2514,6 +2501,14 @@ void SsdpCallbackEventHandler(SsdpEvent * Evt)
                                 Evt->Cookie);
                     break;
                 }
+                /* the description at the location stays valid as long
+                   as the advertisement */
+                for (cptr = Evt->Location; *cptr == ' '; cptr++);
+                if (Evt->Cmd == BYEBYE)
+                    DescCacheExpireDevice(Evt->UDN);
+                else
+                    DescCacheAdvertised(cptr, Evt->UDN, Evt->MaxAge);
+
                 /* callback on client with Upnp_Discovery */
 
                 param = (struct Upnp_Discovery *) malloc (sizeof(struct Upnp_Discovery)); 
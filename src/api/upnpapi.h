@@ -94,6 +94,7 @@ void UpnpThreadDistribution(struct UpnpNonblockParam * Param);
 int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd, enum SsdpSearchType 
 SearchType, struct sockaddr_in *DestAddr, char *DeviceType, char *DeviceUDN, 
 char *ServiceType, IN int Exp);
+int BuildAdvTable(struct Handle_Info *HInfo);
 void SsdpCallbackEventHandler(SsdpEvent * Evt);
 void AutoAdvertise(void *input);
 void printNodes(Upnp_Node tmpRoot, int depth); 
@@ -70,8 +70,9 @@ int respond(int sockfd, char * message)
 //********************************************************
 //* Name: genaCallback
 //* Description:  genaCallback called from miniserver when a gena request has been received.
-//*               the request is parsed and the appropiate gena function is called.
-//* In:           char * document (request passed in from miniserver, 
+//*               the request, already parsed by the miniserver, is
+//*               loaded and the appropiate gena function is called.
+//* In:           MiniServerRequest * msg (request passed in from miniserver, 
 //*                                caller is responsible for memory)
 //*               int sockfd (socket passed in from miniserver)
 //*               
@@ -81,12 +82,13 @@ int respond(int sockfd, char * message)
 //*               
 //********************************************************
 
-void genaCallback (const char *document, int sockfd)
+void genaCallback (const MiniServerRequest *msg, int sockfd)
 {
   int success=0;
 
   http_message request;
-  if ( (parse_http_request( (char *) document,&request,strlen(document)))==HTTP_SUCCESS)
+  if ( (load_http_message( (char *) msg->document,msg->documentLen,
+			   msg->parser,&request))==HTTP_SUCCESS)
     { 
       if ( !(strncasecmp(request.request.method.buff,"SUBSCRIBE",
 			 request.request.method.size)))
@@ -114,7 +116,6 @@ void genaCallback (const char *document, int sockfd)
   else
     {
       respond(sockfd,BAD_REQUEST);
-      close(sockfd);
     }
 
 }
@@ -76,7 +76,7 @@ void GenaAutoRenewSubscription(void *input)
     }
   if (send_callback)
     {
-      HandleLock();
+      HandleReadLock();
       if ( GetHandleInfo(event->handle,&handle_info)!=HND_CLIENT)
 	{
 	  HandleUnlock();
@@ -213,10 +213,10 @@ int genaUnregisterClient(UpnpClient_Handle client_handle)
 //* Name: genaNotifyReceived
 //* Description:  Function called from genaCallback to handle reception of events (client).
 //*               Function validates that the headers of the request confrom to the Upnp v 1.0 spec.
-//*               Function parses the content of the request as XML. (only checks if it is valid XML)
 //*               Function then tries to find and lock the client handle which corrsponds to the incoming SID
-//*               If the SID is valid, respond OK, increment callback reference count, unlock client handle
-//*               make client callback with Upnp_Event struct.
+//*               If the SID is valid, unlock client handle, parse the content into the DOM document
+//*               passed to the client (BAD_REQUEST if it is not XML), respond OK and make client 
+//*               callback with Upnp_Event struct.  The content is parsed once.
 //*               Note: The values passed in the Upnp_event struct are only valid during the callback.
 //* In:           http_message request (parsed http_message)
 //*               int sockfd  (socket)
@@ -241,7 +241,7 @@ void genaNotifyReceived(http_message request, int sockfd)
   void * cookie;
   Upnp_FunPtr callback;
   UpnpClient_Handle client_handle;
-    
+
    //get SID
   if ( !search_for_header(&request,"SID",&sid))
     {
@@ -275,22 +275,21 @@ void genaNotifyReceived(http_message request, int sockfd)
       return;
     }
   
-  //parse the content (should be XML)
-  if ( (request.content.size==0)
-       || ( (ChangedVars=UpnpParse_Buffer(request.content.buff))==NULL))
+  //the document for the callback is only built once the SID is
+  //known to be one of ours
+  if (request.content.size==0)
     {
       respond(sockfd,BAD_REQUEST);
       return;
     }
 
   //Lock handle
-  HandleLock();
+  HandleReadLock();
 
   if ( (GetClientHandleInfo(&client_handle, &handle_info)!=HND_CLIENT))
     {
       respond(sockfd,INVALID_SID);
       HandleUnlock();
-      UpnpDocument_free(ChangedVars);
       return;
     }
   
@@ -304,14 +303,13 @@ void genaNotifyReceived(http_message request, int sockfd)
 	  //try and get Subscription Lock (in case we are in the process of subscribing)
 	  SubscribeLock();
 	  //get HandleLock again;
-	  HandleLock();
+	  HandleReadLock();
 	  
 	  if ( (GetClientHandleInfo(&client_handle, &handle_info)!=HND_CLIENT))
 	    {
 	      respond(sockfd,INVALID_SID);
 	      SubscribeUnlock();
 	      HandleUnlock();
-	      UpnpDocument_free(ChangedVars);
 	      return;
 	    }
 	  
@@ -320,7 +318,6 @@ void genaNotifyReceived(http_message request, int sockfd)
 	      respond(sockfd,INVALID_SID);
 	      SubscribeUnlock();
 	      HandleUnlock();
-	      UpnpDocument_free(ChangedVars);
 	      return;
 	    }
 	  SubscribeUnlock();
@@ -329,18 +326,14 @@ void genaNotifyReceived(http_message request, int sockfd)
 	{
 	  respond(sockfd,INVALID_SID);
 	  HandleUnlock();
-	  UpnpDocument_free(ChangedVars);
 	  return;
 	}
       
     }
   
-  respond(sockfd,HTTP_OK_CRLF);
-  
   // fill event struct
   strcpy((char *)event_struct.Sid,subscription->sid);
   event_struct.EventKey=eventKey;
-  event_struct.ChangedVariables=ChangedVars;
   
   //copy callback
   callback=handle_info->Callback;
@@ -348,6 +341,16 @@ void genaNotifyReceived(http_message request, int sockfd)
   
   HandleUnlock();
 
+  if ( (ChangedVars=UpnpParse_BufferLen(request.content.buff,
+					request.content.size))==NULL)
+    {
+      respond(sockfd,BAD_REQUEST);
+      return;
+    }
+  event_struct.ChangedVariables=ChangedVars;
+
+  respond(sockfd,HTTP_OK_CRLF);
+
   //make call back with event struct
   //in the future should find a way of mainting
   //that the handle is not unregistered in the middle of a 
@@ -496,7 +499,7 @@ int genaSubscribe(UpnpClient_Handle client_handle, char * PublisherURL,
  
 
   DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENA SUBSCRIBE BEGIN"));
-  HandleLock();
+  HandleReadLock();
   //validate handle
 
   if ( (GetHandleInfo(client_handle,&handle_info)!=HND_CLIENT))
@@ -523,7 +526,6 @@ int genaSubscribe(UpnpClient_Handle client_handle, char * PublisherURL,
   
   if (headers==NULL)
     {
-      HandleUnlock();
       return UPNP_E_OUTOF_MEMORY;
     }
   sprintf(headers, "CALLBACK: <http://%s:%d/>\r\nNT: upnp:event\r\nTIMEOUT: Second-%s\r\n\r\n",
@@ -36,6 +36,7 @@
 #if EXCLUDE_GENA == 0
 
 #include "gena/gena.h"
+#include "genlib/util/membuffer.h"
 #include <sys/utsname.h>
 
 DEVICEONLY(
@@ -161,7 +162,8 @@ int respondOK(int sockfd,int time_out,subscription *sub)
   size+= sprintf( server, "SERVER: %s/%s UPnP/1.0 Intel UPnP SDK/1.0\r\n",
                   sys_info.sysname, sys_info.release );  //strlen(SERVER_GENA);
   size+= strlen("SID: \r\n") + sizeof(Upnp_SID);
-  size+= strlen("TIMEOUT: Second-\r\n\r\n") + MAX_SECONDS +1;
+  size+= strlen("TIMEOUT: Second-\r\n") + MAX_SECONDS;
+  size+= strlen("CONTENT-LENGTH: 0\r\n\r\n") +1;
   temp = (char *) malloc(size);
   if (temp==NULL)
     {
@@ -175,17 +177,144 @@ int respondOK(int sockfd,int time_out,subscription *sub)
   strcat(temp,sub->sid);
   strcat(temp,"\r\n");
   if (time_out>=0)
-    sprintf(&temp[strlen(temp)],"TIMEOUT: Second-%d\r\n\r\n",time_out);
+    sprintf(&temp[strlen(temp)],"TIMEOUT: Second-%d\r\n",time_out);
   else
-    strcat(temp,"TIMEOUT: Second-infinite\r\n\r\n");
+    strcat(temp,"TIMEOUT: Second-infinite\r\n");
+  //a length lets the subscriber keep the connection open
+  strcat(temp,"CONTENT-LENGTH: 0\r\n\r\n");
   return_code=respond(sockfd,temp);
   free(temp);
   return return_code;
 }
 
+//called by walkPropertySet for each variable of a property set
+typedef int (*PropertyVarFunc)(void * cookie, const char * name,
+			       const char * value);
+
+//********************************************************
+//* Name: walkPropertySet
+//* Description:  calls func for the name and value of each variable in
+//*               a property set document
+//* In:           Upnp_Document PropSet, PropertyVarFunc func, void * cookie
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  UPNP_E_INVALID_PARAM (the document has no variables)
+//*               the first error returned by func
+//********************************************************
+
+static int walkPropertySet(Upnp_Document PropSet, PropertyVarFunc func,
+			   void * cookie)
+{
+  Upnp_Node root=NULL;
+  Upnp_Node property=NULL;
+  Upnp_Node var=NULL;
+  Upnp_Node temp=NULL;
+  Upnp_DOMString name=NULL;
+  Upnp_DOMString value=NULL;
+  int found=0;
+  int return_code=GENA_SUCCESS;
+
+  root=UpnpDocument_getFirstChild(PropSet);
+  while ( (root!=NULL) && (UpnpNode_getNodeType(root)!=ELEMENT_NODE) )
+    {
+      temp=UpnpNode_getNextSibling(root);
+      UpnpNode_free(root);
+      root=temp;
+    }
+  if (root==NULL)
+    return UPNP_E_INVALID_PARAM;
+
+  property=UpnpNode_getFirstChild(root);
+  while ( (property!=NULL) && (return_code==GENA_SUCCESS) )
+    {
+      if (UpnpNode_getNodeType(property)==ELEMENT_NODE)
+	{
+	  var=UpnpNode_getFirstChild(property);
+	  while ( (var!=NULL) && (UpnpNode_getNodeType(var)!=ELEMENT_NODE) )
+	    {
+	      temp=UpnpNode_getNextSibling(var);
+	      UpnpNode_free(var);
+	      var=temp;
+	    }
+	  if (var!=NULL)
+	    {
+	      name=UpnpNode_getNodeName(var);
+	      value=getElementValue(var);
+	      return_code=func(cookie,name,value ? value : "");
+	      found=1;
+	      UpnpDOMString_free(name);
+	      if (value)
+		UpnpDOMString_free(value);
+	      UpnpNode_free(var);
+	    }
+	}
+      temp=UpnpNode_getNextSibling(property);
+      UpnpNode_free(property);
+      property=temp;
+    }
+  if (property)
+    UpnpNode_free(property);
+  UpnpNode_free(root);
+
+  if ( (return_code==GENA_SUCCESS) && (!found) )
+    return_code=UPNP_E_INVALID_PARAM;
+  return return_code;
+}
+
+//appends value to buf, escaping the characters that cannot appear in
+//XML character data; plain runs are copied in one piece
+static int writeEscaped(membuffer * buf, const char * value)
+{
+  const char * run=value;
+  const char * entity=NULL;
+  int return_code;
+
+  for (;;value++)
+    {
+      switch (*value)
+	{
+	case '&': entity="&amp;"; break;
+	case '<': entity="&lt;"; break;
+	case '>': entity="&gt;"; break;
+	case '\0': entity=NULL; break;
+	default: continue;
+	}
+      if ( (value>run)
+	   && ( (return_code=membuffer_append(buf,run,value-run))!=0) )
+	return return_code;
+      if (entity==NULL)
+	return XML_SUCCESS;
+      if ( (return_code=membuffer_append_str(buf,entity))!=0)
+	return return_code;
+      run=value+1;
+    }
+}
+
+//appends one <e:property> holding the variable to buf
+static int writeProperty(membuffer * buf, const char * name,
+			 const char * value)
+{
+  if ( (membuffer_append_str(buf,"<e:property>\n<")!=0)
+       || (membuffer_append_str(buf,name)!=0)
+       || (membuffer_append(buf,">",1)!=0)
+       || (writeEscaped(buf,value)!=0)
+       || (membuffer_append(buf,"</",2)!=0)
+       || (membuffer_append_str(buf,name)!=0)
+       || (membuffer_append_str(buf,">\n</e:property>\n")!=0) )
+    return UPNP_E_OUTOF_MEMORY;
+  return XML_SUCCESS;
+}
+
+static int writePropertyVar(void * cookie, const char * name,
+			    const char * value)
+{
+  return writeProperty((membuffer *) cookie,name,value);
+}
+
 //********************************************************
 //*Name: GeneratePropertySet
 //*Description: Function to generate XML propery Set for Notifications
+//*             The set is written in one pass, and values are escaped.
 //*             Note: XML_VERSION comment is NOT sent due to interop issues with Microsoft ME
 //*In:          char **names (each char* is null terminated), char ** values, int count 
 //*Out:         char ** out (dynamically allocated must be freed by caller)
@@ -194,52 +323,153 @@ int respondOK(int sockfd,int time_out,subscription *sub)
 int GeneratePropertySet(char **names, char ** values, int count,
 			char **out)
 {
-  char *buffer;
-  int counter=0;
-  int size=0;
- 
-  int temp_counter =0;
+  membuffer buf;
+  int return_code=XML_SUCCESS;
+  int counter;
+
+  membuffer_init(&buf);
+
+  //   XML_VERSION is not written: Microsoft Windows interoperability currently doesn't accept the XML_VERSION tag
+  if (membuffer_append_str(&buf,XML_PROPERTYSET_HEADER)!=0)
+    return_code=UPNP_E_OUTOF_MEMORY;
+  for (counter=0;(counter<count) && (return_code==XML_SUCCESS);counter++)
+    return_code=writeProperty(&buf,names[counter],values[counter]);
+  if ( (return_code==XML_SUCCESS)
+       && (membuffer_append_str(&buf,"</e:propertyset>\n\n")!=0) )
+    return_code=UPNP_E_OUTOF_MEMORY;
+
+  if (return_code!=XML_SUCCESS)
+    {
+      membuffer_destroy(&buf);
+      return return_code;
+    }
 
-  //  size+=strlen(XML_VERSION); Microsoft Windows Millenium interoperability currently will not work with the XML_VERSION 
+  (*out)=membuffer_detach(&buf);
+  return XML_SUCCESS;
+}
 
-  size+=strlen(XML_PROPERTYSET_HEADER);
-  size+=strlen("</e:propertyset>\n\n"); 
-   
-   for (temp_counter=0,counter=0;counter<count;counter++)
-    { 
-      size+=strlen("<e:property>\n</e:property>\n"); 
-      
-      size+= (2*strlen(names[counter])+strlen(values[counter])+(strlen("<></>\n")));
-      
-    }  
-   buffer=(char*)malloc(size+1);
+//********************************************************
+//*Name: GeneratePropertySetDoc
+//*Description: same as GeneratePropertySet, with the variables read
+//*             straight from a property set document
+//*In:          Upnp_Document PropSet
+//*Out:         char ** out (dynamically allocated must be freed by caller)
+//*Return Codes: XML_SUCCESS
+//*Error Codes: UPNP_E_INVALID_PARAM
+//*             UPNP_E_OUTOF_MEMORY
+//********************************************************
 
-   if (buffer==NULL)
-     { 
-      
-       return UPNP_E_OUTOF_MEMORY;
-     }
-   memset(buffer,0,size+1);
-  
-   //   strcpy(buffer,XML_VERSION); Microsoft Windows interoperability currently doesn't accept the XML_VERSION tag
-   strcpy(buffer,XML_PROPERTYSET_HEADER);
-   for (counter=0;counter<count;counter++)
-     {
-       strcat(buffer,"<e:property>\n");
-       sprintf(&buffer[strlen(buffer)],"<%s>%s</%s>\n</e:property>\n",names[counter],values[counter],names[counter]);
-     }
-   strcat(buffer,"</e:propertyset>\n\n");
-  
-   (*out)=buffer;
-   
-   return XML_SUCCESS;
- 
+int GeneratePropertySetDoc(Upnp_Document PropSet, char **out)
+{
+  membuffer buf;
+  int return_code=XML_SUCCESS;
+
+  membuffer_init(&buf);
+
+  if (membuffer_append_str(&buf,XML_PROPERTYSET_HEADER)!=0)
+    return_code=UPNP_E_OUTOF_MEMORY;
+  if (return_code==XML_SUCCESS)
+    return_code=walkPropertySet(PropSet,writePropertyVar,&buf);
+  if ( (return_code==XML_SUCCESS)
+       && (membuffer_append_str(&buf,"</e:propertyset>\n\n")!=0) )
+    return_code=UPNP_E_OUTOF_MEMORY;
+
+  if (return_code!=XML_SUCCESS)
+    {
+      membuffer_destroy(&buf);
+      return return_code;
+    }
+
+  (*out)=membuffer_detach(&buf);
+  return XML_SUCCESS;
+}
+
+//********************************************************
+//* Name: newNotifyPayload
+//* Description:  wraps a property set into the payload shared by the
+//*               notifications of one event, together with the headers
+//*               every subscriber gets.  The caller holds the only
+//*               reference.
+//* In:           char *UDN, char *servId
+//*               char *propertySet (taken over, freed on error)
+//* Out:          None
+//* Return Codes: the payload
+//* Error Codes:  NULL (out of memory)
+//********************************************************
+
+static notify_payload * newNotifyPayload(char * UDN, char * servId,
+					 char * propertySet)
+{
+  notify_payload * payload=NULL;
+  int headers_size;
+
+  headers_size=strlen("CONTENT-TYPE: text/xml\r\n") +
+    strlen("CONTENT-LENGTH: \r\n")+MAX_CONTENT_LENGTH +
+    strlen("NT: upnp:event\r\n") +
+    strlen("NTS: upnp:propchange\r\n")+1;
+
+  payload=(notify_payload *) malloc(sizeof(notify_payload));
+  if (payload==NULL)
+    {
+      free(propertySet);
+      return NULL;
+    }
+  payload->reference_count=1;
+  payload->UDN=(char *) malloc(strlen(UDN)+1);
+  payload->servId=(char *) malloc(strlen(servId)+1);
+  payload->headers=(char *) malloc(headers_size);
+  payload->propertySet=propertySet;
+  if ( (payload->UDN==NULL) || (payload->servId==NULL)
+       || (payload->headers==NULL) )
+    {
+      free(payload->UDN);
+      free(payload->servId);
+      free(payload->headers);
+      free(propertySet);
+      free(payload);
+      return NULL;
+    }
+  strcpy(payload->UDN,UDN);
+  strcpy(payload->servId,servId);
+
+  //changed to add null terminator at end of content
+  //content length = (length in bytes of property set) + null char
+  payload->propertySet_size=strlen(propertySet)+1;
+  sprintf(payload->headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",
+	  payload->propertySet_size);
+  payload->headers_size=strlen(payload->headers);
+
+  return payload;
+}
+
+//********************************************************
+//* Name: releaseNotifyPayload
+//* Description:  drops one reference to a payload; the last one
+//*               frees it.  Notifications of the same event are sent
+//*               and freed on different threads, so the count is
+//*               changed atomically.
+//* In:           notify_payload * payload
+//* Out:          None
+//* Return Codes: None
+//* Error Codes:  None
+//********************************************************
+
+static void releaseNotifyPayload(notify_payload * payload)
+{
+  if (__sync_sub_and_fetch(&payload->reference_count,1)==0)
+    {
+      free(payload->headers);
+      free(payload->propertySet);
+      free(payload->servId);
+      free(payload->UDN);
+      free(payload);
+    }
 }
 
 //********************************************************
 //* Name: free_notify_struct
 //* Description:  frees memory used in notify_threads
-//*               if the reference count is 0, actually frees the struct
+//*               and releases the payload it refers to
 //* In:           notify_thread_struct * input
 //* Out:          None
 //* Return Codes: None
@@ -248,15 +478,7 @@ int GeneratePropertySet(char **names, char ** values, int count,
 
 void free_notify_struct(notify_thread_struct * input)
 {
-  (*input->reference_count)--;
-  if ((*input->reference_count)==0)
-    {
-      free(input->headers);
-      free(input->propertySet);
-      free(input->servId);
-      free(input->UDN);
-      free(input->reference_count);
-    }
+  releaseNotifyPayload(input->payload);
   free(input);
 }
 
@@ -265,8 +487,10 @@ void free_notify_struct(notify_thread_struct * input)
 //*Description: Function to Notify a particular subscription of a particular event
 //*             In general the service should NOT be blocked around this call. (this may cause deadlock with a client)
 //*             NOTIFY http request is sent and the reply is processed.
-//*In:          char * headers (null terminated) (includes all headers (including \r\n) except SID and SEQ)
-//*             char * propertySet (null terminated) XML
+//*             Only the SID and SEQ headers are written for the
+//*             subscription; the shared headers and property set are
+//*             sent from the payload as they are.
+//*In:          notify_payload *payload (the event)
 //*             subscription *sub (subscription to be Notified, Assumes this is valid for life of function)
 //*Out:      
 //*Return Codes: GENA_SUCCESS  if the event was delivered   (all codes mapped to codes in upnp.h)
@@ -281,41 +505,31 @@ void free_notify_struct(notify_thread_struct * input)
 //*             GENA_E_NOTIFY_UNACCEPTED_REMOVE (this subscription must be removed)
 //********************************************************
 
-int genaNotify(char * headers, 
-	       char * propertySet, subscription *sub)
+int genaNotify(notify_payload * payload, subscription *sub)
 {
-  int full_size=0;
-  char *full_message;
+  char sid_seq[sizeof("SID: \r\nSEQ: \r\n\r\n")+SID_SIZE+MAX_EVENTS];
+  struct iovec parts[3];
   http_message parsed_response;
   int i;
   int return_code=GENA_E_NOTIFY_UNACCEPTED;
 
   char * response;
   
- 
-  
-  full_size=strlen(headers)+strlen("SID: \r\n") + SID_SIZE+
-    strlen("SEQ: \r\n\r\n") + MAX_EVENTS + strlen(propertySet)+1;
+  sprintf(sid_seq,"SID: %s\r\nSEQ: %d\r\n\r\n",sub->sid,sub->ToSendEventKey);
 
-  full_message = (char *) malloc(full_size);
-
-  if (full_message==NULL)
-    return UPNP_E_OUTOF_MEMORY;
-  
-  
-
-  sprintf(full_message,"%sSID: %s\r\nSEQ: %d\r\n\r\n%s",headers,sub->sid,sub->ToSendEventKey,propertySet);
-
-
- 
+  parts[0].iov_base=payload->headers;
+  parts[0].iov_len=payload->headers_size;
+  parts[1].iov_base=sid_seq;
+  parts[1].iov_len=strlen(sid_seq);
+  parts[2].iov_base=payload->propertySet;
+  parts[2].iov_len=payload->propertySet_size;
   
   for (i=0;i<sub->DeliveryURLs.size;i++)
     {
     
-      if (((return_code=transferHTTPparsedURL("NOTIFY", full_message,
-					      strlen(full_message)+1,
-					      &response,
-					      &sub->DeliveryURLs.parsedURLs[i])
+      if (((return_code=transferHTTPparsedURLv("NOTIFY", parts, 3,
+					       &response,
+					       &sub->DeliveryURLs.parsedURLs[i])
 	    )==HTTP_SUCCESS))
 	{
 	  break;
@@ -323,8 +537,6 @@ int genaNotify(char * headers,
       
     }
 
-  free(full_message);
-  
   if (return_code==HTTP_SUCCESS)
     {
        
@@ -361,6 +573,154 @@ int genaNotify(char * headers,
 
 
 
+//********************************************************
+//* Name: freeNotifyQueue
+//* Description:  frees the notifications still waiting in the
+//*               outbound queue of a subscription that is being removed
+//* In:           notify_thread_struct * head
+//* Out:          None
+//* Return Codes: None
+//* Error Codes:  None
+//********************************************************
+
+void freeNotifyQueue(notify_thread_struct * head)
+{
+  notify_thread_struct * next=NULL;
+
+  while (head)
+    {
+      next=head->next;
+      free_notify_struct(head);
+      head=next;
+    }
+}
+
+void genaNotifyThread(void * input);
+
+//********************************************************
+//* Name: queueNotify
+//* Description:  hands an event to a subscription.  Each
+//*               subscription has at most one notification in flight;
+//*               later ones wait in its outbound queue and are sent by
+//*               genaNotifyThread when the earlier one is done, so SEQ
+//*               numbers are delivered in order.
+//*               Must be called with the handle lock held.
+//* In:           UpnpDevice_Handle device_handle, subscription * sub
+//*               notify_payload * payload (gets one more reference)
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY (the event was not queued)
+//********************************************************
+
+static int queueNotify(UpnpDevice_Handle device_handle, subscription * sub,
+		       notify_payload * payload)
+{
+  notify_thread_struct * thread_struct=NULL;
+  int return_code=0;
+
+  thread_struct=(notify_thread_struct *) malloc(sizeof(notify_thread_struct));
+  if (thread_struct==NULL)
+    return UPNP_E_OUTOF_MEMORY;
+
+  __sync_add_and_fetch(&payload->reference_count,1);
+  thread_struct->payload=payload;
+  strcpy(thread_struct->sid,sub->sid);
+  thread_struct->eventKey=sub->eventKey;
+  thread_struct->device_handle=device_handle;
+  thread_struct->next=NULL;
+
+  if (sub->sending)
+    {
+      if (sub->outgoingTail)
+	sub->outgoingTail->next=thread_struct;
+      else
+	sub->outgoing=thread_struct;
+      sub->outgoingTail=thread_struct;
+    }
+  else
+    {
+      if ( (return_code=tpool_ScheduleWithPriority( TPOOL_EVENTING, genaNotifyThread, thread_struct ))!=0)
+	{
+	  free_notify_struct(thread_struct);
+	  if (return_code==-1)
+	    return_code=UPNP_E_OUTOF_MEMORY;
+	  return return_code;
+	}
+      sub->sending=1;
+    }
+
+  sub->eventKey++;
+  //if overflow, wrap to 1
+  if (sub->eventKey<0)
+    sub->eventKey=1;
+
+  return GENA_SUCCESS;
+}
+
+//********************************************************
+//* Name: nextNotify
+//* Description:  removes the next notification from the outbound queue
+//*               of a subscription.  When the queue is empty the
+//*               subscription no longer has a sender.
+//*               Must be called with the handle lock held.
+//* In:           subscription * sub
+//* Out:          None
+//* Return Codes: the next notification, or NULL
+//* Error Codes:  None
+//********************************************************
+
+static notify_thread_struct * nextNotify(subscription * sub)
+{
+  notify_thread_struct * next=sub->outgoing;
+
+  if (next==NULL)
+    {
+      sub->sending=0;
+      return NULL;
+    }
+  sub->outgoing=next->next;
+  if (sub->outgoing==NULL)
+    sub->outgoingTail=NULL;
+  next->next=NULL;
+  return next;
+}
+
+//********************************************************
+//* Name: skipNotify
+//* Description:  drops a notification that can not be sent and
+//*               returns the next one of its subscription, so the
+//*               subscription does not keep a sender it no longer has.
+//*               If the handle, service or subscription is gone, its
+//*               queue went with it.
+//*               Takes the handle lock.
+//* In:           notify_thread_struct * in (freed)
+//* Out:          None
+//* Return Codes: the next notification, or NULL
+//* Error Codes:  None
+//********************************************************
+
+static notify_thread_struct * skipNotify(notify_thread_struct * in)
+{
+  subscription *sub;
+  service_info *service;
+  struct Handle_Info * handle_info;
+  notify_thread_struct * next=NULL;
+
+  HandleLock();
+  if ( (GetHandleInfo(in->device_handle,&handle_info)==HND_DEVICE)
+       && ( (service = FindServiceId( &handle_info->ServiceTable, 
+				      in->payload->servId,
+				      in->payload->UDN)) !=NULL)
+       && ( (sub=GetSubscriptionSID(in->sid,service))!=NULL) )
+    next=nextNotify(sub);
+  HandleUnlock();
+
+  free_notify_struct(in);
+  return next;
+}
+
+//sends the notification in input and then the rest of the subscription's
+//outbound queue, one pool job per notification
 void genaNotifyThread(void * input)
 {
   
@@ -371,78 +731,79 @@ void genaNotifyThread(void * input)
   int return_code;
   struct Handle_Info * handle_info;
 
-  HandleLock();
-  //validate context
-
-  if ( GetHandleInfo(in->device_handle,&handle_info)!=HND_DEVICE)
+  while (in)
     {
-      free_notify_struct(in);
-      HandleUnlock();
-      return;
-    }
-  
-  if ( ( (service = FindServiceId( &handle_info->ServiceTable, 
-				   in->servId, in->UDN)) ==NULL)
-       || (!service->active) 
-       || ( (sub=GetSubscriptionSID(in->sid,service))==NULL)
-       || ( (copy_subscription(sub,&sub_copy)!=HTTP_SUCCESS)) )
-    { 
-      free_notify_struct(in);
+      //only reads here, so notifications to different subscribers
+      //are prepared in parallel
+      HandleReadLock();
+      //validate context
+
+      if ( (GetHandleInfo(in->device_handle,&handle_info)!=HND_DEVICE)
+	   || ( (service = FindServiceId( &handle_info->ServiceTable, 
+					  in->payload->servId,
+					  in->payload->UDN)) ==NULL)
+	   || (!service->active) 
+	   || ( (sub=FindSubscriptionSID(in->sid,service))==NULL)
+	   || ( (copy_subscription(sub,&sub_copy)!=HTTP_SUCCESS)) )
+	{ 
+	  HandleUnlock();
+	  in=skipNotify(in);
+	  continue;
+	}
+
       HandleUnlock();
-      return;
-    }
   
+      //transmit
  
-  if (in->eventKey!=sub->ToSendEventKey)
-    {
-      tpool_Schedule( genaNotifyThread, input); 
+      return_code = genaNotify(in->payload, &sub_copy);
+  
       freeSubscription(&sub_copy);
-      HandleUnlock();
-      return;
-    }
 
-  HandleUnlock();
+      HandleLock();
   
-  //transmit
- 
-  return_code = genaNotify(in->headers,
-	     in->propertySet, &sub_copy);
-  
-  freeSubscription(&sub_copy);
+      if ( GetHandleInfo(in->device_handle,&handle_info)!=HND_DEVICE)
+	{
+	  free_notify_struct(in);
+	  HandleUnlock();
+	  return;
+	}
 
-  HandleLock();
+      //validate context; a subscription that is gone took its queue
+      //with it
+      if ( ( (service = FindServiceId( &handle_info->ServiceTable, 
+				       in->payload->servId,
+				       in->payload->UDN)) ==NULL)
+	   || ( (sub=GetSubscriptionSID(in->sid,service))==NULL) )
+	{ 
+	  free_notify_struct(in);
+	  HandleUnlock();
+	  return;
+	}
   
-  if ( GetHandleInfo(in->device_handle,&handle_info)!=HND_DEVICE)
-    {
-      free_notify_struct(in);
-      HandleUnlock();
-      return;
-    }
+      sub->ToSendEventKey++;
 
-  //validate context
-  if ( ( (service = FindServiceId( &handle_info->ServiceTable, 
-				 in->servId, in->UDN)) ==NULL)
-       || (!service->active)
-       || ( (sub=GetSubscriptionSID(in->sid,service))==NULL) )
-    { 
-      free_notify_struct(in);
-      HandleUnlock();
-      return;
-    }
-  
-  sub->ToSendEventKey++;
+      if (sub->ToSendEventKey<0) //wrap to 1 for overflow
+	sub->ToSendEventKey=1;
 
-  if (sub->ToSendEventKey<0) //wrap to 1 for overflow
-    sub->ToSendEventKey=1;
+      if (return_code==GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB)
+	{
+	  //also frees the events still queued for it
+	  RemoveSubscriptionSID(in->sid,service);
+	  free_notify_struct(in);
+	  HandleUnlock();
+	  return;
+	}
 
-  if (return_code==GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB)
-    {
-      RemoveSubscriptionSID(in->sid,service);
-    }
-  
+      free_notify_struct(in);
 
-  free_notify_struct(in);
-  HandleUnlock();
+      //pass the queue on to a new job so other subscribers get a turn;
+      //keep sending from this one if the pool cannot take it
+      in=nextNotify(sub);
+      if ( (in!=NULL)
+	   && (tpool_ScheduleWithPriority( TPOOL_EVENTING, genaNotifyThread, in )==0) )
+	in=NULL;
+      HandleUnlock();
+    }
 }
 
 
@@ -454,54 +815,19 @@ int genaInitNotify(UpnpDevice_Handle device_handle,
 		   int var_count,
 		   Upnp_SID sid)
 {
-  char * UDN_copy=NULL;
-  char * servId_copy=NULL;
   char * propertySet=NULL;
-  char * headers=NULL;
+  notify_payload * payload=NULL;
   subscription * sub=NULL;
   service_info *service=NULL;
   int return_code=GENA_SUCCESS;
-  int headers_size;
-  int *reference_count=NULL;
   struct Handle_Info * handle_info;
 
-  notify_thread_struct *thread_struct=NULL;
-
   DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENA BEGIN INITIAL NOTIFY "));
 
-  reference_count= (int *) malloc(sizeof(int));
-   
-  if (reference_count==NULL)
-    return UPNP_E_OUTOF_MEMORY;
-  
-  (*reference_count)=0;
-
-  UDN_copy=(char *) malloc(strlen(UDN)+1);
-  
-  if (UDN_copy==NULL)
-    {
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-  servId_copy=(char *) malloc(strlen(servId)+1);
-  
-  if (servId_copy==NULL)
-    {
-      free(UDN_copy);
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-  
-  strcpy(UDN_copy,UDN);
-  strcpy(servId_copy,servId);
-  
   HandleLock();
 
   if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
     {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
       return GENA_E_BAD_HANDLE;
     }
@@ -509,21 +835,15 @@ int genaInitNotify(UpnpDevice_Handle device_handle,
   if ( (service = FindServiceId( &handle_info->ServiceTable, 
 			     servId, UDN)) ==NULL)
     { 
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
       return GENA_E_BAD_SERVICE;
     }
 
-  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SERVICE IN INIT NOTFY: UDN %s, ServID: %d ",UDN,servId));
+  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SERVICE IN INIT NOTFY: UDN %s, ServID: %s ",UDN,servId));
   
   if ( ( (sub=GetSubscriptionSID( sid,service))==NULL) ||
        (sub->active))
     {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
       return GENA_E_BAD_SID;
     }
@@ -535,80 +855,25 @@ int genaInitNotify(UpnpDevice_Handle device_handle,
   if ( (return_code=GeneratePropertySet(VarNames,VarValues,
 					var_count,&propertySet))!=XML_SUCCESS)
     {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
       return return_code;
     }
   
   DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENERATED PROPERY SET IN INIT NOTIFY: \n'%s'\n",propertySet));
 
-  headers_size=strlen("CONTENT-TYPE text/xml\r\n") +
-    strlen("CONTENT-LENGTH: \r\n")+MAX_CONTENT_LENGTH +
-    strlen("NT: upnp:event\r\n") +
-    strlen("NTS: upnp:propchange\r\n")+1;
-
-    
-  headers=(char *) malloc(headers_size);
-  
-  if (headers==NULL)
+  if ( (payload=newNotifyPayload(UDN,servId,propertySet))==NULL)
     {
-      free(propertySet);
-      free(UDN_copy);
-      free(servId_copy);
-      free(reference_count);
       HandleUnlock();
       return UPNP_E_OUTOF_MEMORY;
     }
-  
-  sprintf(headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",
-	  strlen(propertySet)+1);
-  
- 
 
   //schedule thread for initial notification
-
-  thread_struct=(notify_thread_struct *) malloc(sizeof(notify_thread_struct));
-  if (thread_struct==NULL)
-      return_code= UPNP_E_OUTOF_MEMORY;
-  else
-    {
-      (*reference_count)=1;
-      thread_struct->servId=servId_copy;
-      thread_struct->UDN=UDN_copy;
-      thread_struct->headers=headers;
-      thread_struct->propertySet=propertySet;
-      strcpy(thread_struct->sid,sid);
-      thread_struct->eventKey=sub->eventKey++;
-      thread_struct->reference_count=reference_count;
-      thread_struct->device_handle=device_handle;
-      if ( (return_code=tpool_Schedule( genaNotifyThread, thread_struct ))!=0)
-	{
-	  if (return_code==-1)
-	    return_code= UPNP_E_OUTOF_MEMORY;
-	}
-      else
-	return_code=GENA_SUCCESS;
-      
-    }
-  
-  if (return_code!=GENA_SUCCESS)
-    {
-     
-      free(reference_count);
-      free(UDN_copy);
-      free(servId_copy);
-      free(thread_struct);
-      free(propertySet);
-      free(headers);
-    }
+  return_code=queueNotify(device_handle,sub,payload);
+  releaseNotifyPayload(payload);
 
   HandleUnlock();
 
   return return_code;
-  
-  
 }
 
 
@@ -616,463 +881,546 @@ int genaInitNotify(UpnpDevice_Handle device_handle,
 
 int genaInitNotifyExt(UpnpDevice_Handle device_handle, char *UDN, char *servId,IN Upnp_Document PropSet, Upnp_SID sid)
 {
-  char * UDN_copy=NULL;
-  char * servId_copy=NULL;
-  char * headers=NULL;
+  char * propertySet=NULL;
+  notify_payload * payload=NULL;
   subscription * sub=NULL;
   service_info *service=NULL;
   int return_code=GENA_SUCCESS;
-  int headers_size;
-  int *reference_count=NULL;
   struct Handle_Info * handle_info;
-  Upnp_DOMString propertySet=NULL;
-  Upnp_DOMString TempPropSet=NULL;
-
-  notify_thread_struct *thread_struct=NULL;
 
   DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENA BEGIN INITIAL NOTIFY EXT"));
-  reference_count= (int *) malloc(sizeof(int));
-   
-  if (reference_count==NULL)
-    return UPNP_E_OUTOF_MEMORY;
-  
-  (*reference_count)=0;
 
-  UDN_copy=(char *) malloc(strlen(UDN)+1);
+  HandleLock();
+
+  if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
+    {
+      HandleUnlock();
+      return GENA_E_BAD_HANDLE;
+    }
+
+  if ( (service = FindServiceId( &handle_info->ServiceTable, 
+			     servId, UDN)) ==NULL)
+    { 
+      HandleUnlock();
+      return GENA_E_BAD_SERVICE;
+    }
+  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SERVICE IN INIT NOTFY EXT: UDN %s, ServID: %s\n",UDN,servId));
   
-  if (UDN_copy==NULL)
+  
+  if ( ( (sub=GetSubscriptionSID( sid,service))==NULL) ||
+       (sub->active))
     {
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
+      HandleUnlock();
+      return GENA_E_BAD_SID;
     }
-  servId_copy=(char *) malloc(strlen(servId)+1);
+  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SUBSCRIPTION IN INIT NOTIFY EXT: SID %s",sid));
+
+
+  sub->active=1;
   
-  if (servId_copy==NULL)
+  if ( (return_code=GeneratePropertySetDoc(PropSet,&propertySet))!=XML_SUCCESS)
+    {
+      HandleUnlock();
+      return return_code;
+    }
+
+  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENERATED PROPERY SET IN INIT EXT NOTIFY: %s",propertySet));
+
+  if ( (payload=newNotifyPayload(UDN,servId,propertySet))==NULL)
     {
-      free(UDN_copy);
-      free(reference_count);
+      HandleUnlock();
       return UPNP_E_OUTOF_MEMORY;
     }
+
+  //schedule thread for initial notification
+  return_code=queueNotify(device_handle,sub,payload);
+  releaseNotifyPayload(payload);
+
+  HandleUnlock();
+
+  return return_code;
+}
+
+//********************************************************
+//* Name: notifyAllPayload
+//* Description:  queues one event for every active subscriber of a
+//*               service; all of them share its payload
+//* In:           UpnpDevice_Handle device_handle, char *UDN, char *servId
+//*               char *propertySet (taken over)
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  GENA_E_BAD_HANDLE
+//*               GENA_E_BAD_SERVICE
+//*               UPNP_E_OUTOF_MEMORY
+//********************************************************
+
+static int notifyAllPayload(UpnpDevice_Handle device_handle, char * UDN,
+			    char * servId, char * propertySet)
+{
+  notify_payload * payload=NULL;
+  struct Handle_Info *handle_info;
+  subscription * finger=NULL;
+  service_info *service=NULL;
+  int return_code=GENA_SUCCESS;
+
+  if ( (payload=newNotifyPayload(UDN,servId,propertySet))==NULL)
+    return UPNP_E_OUTOF_MEMORY;
+
+  HandleLock();
+
+  if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
+    return_code=GENA_E_BAD_HANDLE;
+  else
+    {
+      if ( (service = FindServiceId( &handle_info->ServiceTable, 
+				     servId, UDN)) !=NULL)
+	{ 
+	  finger=GetFirstSubscription(service);
+	  
+	  while (finger)
+	    {
+	      if ( (return_code=queueNotify(device_handle,finger,payload))
+		   !=GENA_SUCCESS)
+		break;
+	      
+	      finger=GetNextSubscription(service,finger);
+	    }
+	}
+      else
+	return_code=GENA_E_BAD_SERVICE;  
+    }
   
-  strcpy(UDN_copy,UDN);
-  strcpy(servId_copy,servId);
+  HandleUnlock();
+
+  releaseNotifyPayload(payload);
   
+  return return_code;
+}
+
+static int sendNotifyAll(UpnpDevice_Handle device_handle,
+			 char *UDN,
+			 char *servId,
+			 char **VarNames,
+			 char **VarValues,
+			 int var_count);
+
+//arguments of a scheduled genaFlushEvents
+typedef struct MODERATION_FLUSH_STRUCT {
+  UpnpDevice_Handle device_handle;
+  char * UDN;
+  char * servId;
+} moderation_flush_struct;
+
+//********************************************************
+//* Name: appendVar
+//* Description:  appends copies of a variable name and value to a pair
+//*               of growable arrays
+//* In:           char ***names, char ***values, int *count, int *size
+//*               const char *name, const char *value
+//* Out:          the arrays, count and size are updated
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//********************************************************
+
+static int appendVar(char *** names, char *** values, int * count,
+		     int * size, const char * name, const char * value)
+{
+  char ** temp=NULL;
+  char * name_copy=NULL;
+  char * value_copy=NULL;
+  int new_size;
+
+  if ((*count)==(*size))
+    {
+      new_size=(*size) ? (*size)*2 : 8;
+      if ( (temp=(char **) realloc(*names,new_size*sizeof(char *)))==NULL)
+	return UPNP_E_OUTOF_MEMORY;
+      (*names)=temp;
+      if ( (temp=(char **) realloc(*values,new_size*sizeof(char *)))==NULL)
+	return UPNP_E_OUTOF_MEMORY;
+      (*values)=temp;
+      (*size)=new_size;
+    }
+
+  name_copy=(char *) malloc(strlen(name)+1);
+  value_copy=(char *) malloc(strlen(value)+1);
+  if ( (name_copy==NULL) || (value_copy==NULL) )
+    {
+      free(name_copy);
+      free(value_copy);
+      return UPNP_E_OUTOF_MEMORY;
+    }
+  strcpy(name_copy,name);
+  strcpy(value_copy,value);
+
+  (*names)[*count]=name_copy;
+  (*values)[*count]=value_copy;
+  (*count)++;
+  return GENA_SUCCESS;
+}
+
+//********************************************************
+//* Name: mergePendingVars
+//* Description:  merges changed variables into the pending changes of a
+//*               moderated service; a variable already pending takes
+//*               the new value.  Must be called with the handle lock held.
+//* In:           service_info *service, char **VarNames,
+//*               char **VarValues, int var_count
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//********************************************************
+
+static int mergePendingVars(service_info * service, char ** VarNames,
+			    char ** VarValues, int var_count)
+{
+  char * value_copy=NULL;
+  int return_code;
+  int i;
+  int j;
+
+  for (i=0;i<var_count;i++)
+    {
+      for (j=0;j<service->pendingCount;j++)
+	if (!strcmp(service->pendingNames[j],VarNames[i]))
+	  break;
+
+      if (j<service->pendingCount)
+	{
+	  if ( (value_copy=(char *) malloc(strlen(VarValues[i])+1))==NULL)
+	    return UPNP_E_OUTOF_MEMORY;
+	  strcpy(value_copy,VarValues[i]);
+	  free(service->pendingValues[j]);
+	  service->pendingValues[j]=value_copy;
+	}
+      else
+	if ( (return_code=appendVar(&service->pendingNames,
+				    &service->pendingValues,
+				    &service->pendingCount,
+				    &service->pendingSize,
+				    VarNames[i],VarValues[i]))!=GENA_SUCCESS)
+	  return return_code;
+    }
+  return GENA_SUCCESS;
+}
+
+//********************************************************
+//* Name: genaFlushEvents
+//* Description:  timer callback that sends the changes a moderated
+//*               service collected since its last event, as one
+//*               property set to every subscriber
+//* In:           void * input (moderation_flush_struct *)
+//* Out:          None
+//* Return Codes: None
+//* Error Codes:  None
+//********************************************************
+
+static void genaFlushEvents(void * input)
+{
+  moderation_flush_struct * flush=(moderation_flush_struct *) input;
+  struct Handle_Info * handle_info;
+  service_info * service=NULL;
+  char ** names=NULL;
+  char ** values=NULL;
+  int count=0;
+
+  HandleLock();
+
+  if ( (GetHandleInfo(flush->device_handle,&handle_info)==HND_DEVICE)
+       && ( (service=FindServiceId(&handle_info->ServiceTable,
+				   flush->servId,flush->UDN))!=NULL)
+       && (service->eventPending) )
+    {
+      names=service->pendingNames;
+      values=service->pendingValues;
+      count=service->pendingCount;
+      service->pendingNames=NULL;
+      service->pendingValues=NULL;
+      service->pendingCount=0;
+      service->pendingSize=0;
+      service->eventPending=0;
+      service->lastEventMs=getMonotonicMs();
+    }
+
+  HandleUnlock();
+
+  if (count>0)
+    sendNotifyAll(flush->device_handle,flush->UDN,flush->servId,
+		  names,values,count);
+
+  freeVarList(names,values,count);
+  free(flush->UDN);
+  free(flush->servId);
+  free(flush);
+}
+
+//********************************************************
+//* Name: isModerated
+//* Description:  tells whether the events of a service are moderated
+//* In:           UpnpDevice_Handle device_handle, char *UDN, char *servId
+//* Out:          None
+//* Return Codes: 1 if moderated, 0 otherwise (including unknown services)
+//* Error Codes:  None
+//********************************************************
+
+static int isModerated(UpnpDevice_Handle device_handle, char * UDN,
+		       char * servId)
+{
+  struct Handle_Info * handle_info;
+  service_info * service=NULL;
+  int moderated=0;
+
+  HandleReadLock();
+  if ( (GetHandleInfo(device_handle,&handle_info)==HND_DEVICE)
+       && ( (service=FindServiceId(&handle_info->ServiceTable,
+				   servId,UDN))!=NULL) )
+    moderated=(service->eventInterval>0);
+  HandleUnlock();
+
+  return moderated;
+}
+
+//********************************************************
+//* Name: moderateEvent
+//* Description:  records changed variables of a moderated service and
+//*               makes sure a flush is scheduled for when the service's
+//*               minimum interval since its last event has passed
+//* In:           UpnpDevice_Handle device_handle, char *UDN, char *servId
+//*               char **VarNames, char **VarValues, int var_count
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  GENA_E_BAD_HANDLE
+//*               GENA_E_BAD_SERVICE
+//*               UPNP_E_OUTOF_MEMORY
+//********************************************************
+
+static int moderateEvent(UpnpDevice_Handle device_handle, char * UDN,
+			 char * servId, char ** VarNames, char ** VarValues,
+			 int var_count)
+{
+  struct Handle_Info * handle_info;
+  service_info * service=NULL;
+  moderation_flush_struct * flush=NULL;
+  unsigned long long now;
+  int delay=0;
+  int eventId;
+  int return_code;
+
   HandleLock();
 
   if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
     {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
       return GENA_E_BAD_HANDLE;
     }
 
   if ( (service = FindServiceId( &handle_info->ServiceTable, 
-			     servId, UDN)) ==NULL)
-    { 
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
-      HandleUnlock();
-      return GENA_E_BAD_SERVICE;
-    }
-  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SERVICE IN INIT NOTFY EXT: UDN %s, ServID: %d\n",UDN,servId));
-  
-  
-  if ( ( (sub=GetSubscriptionSID( sid,service))==NULL) ||
-       (sub->active))
+				 servId, UDN)) ==NULL)
     {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
       HandleUnlock();
-      return GENA_E_BAD_SID;
+      return GENA_E_BAD_SERVICE;
     }
-  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"FOUND SUBSCRIPTION IN INIT NOTIFY EXT: SID %s",sid));
-
-
-  sub->active=1;
-  
-
-  TempPropSet = UpnpNewPrintDocument(PropSet);
-  if(TempPropSet == NULL)
-  {
-      free(UDN_copy);
-      free(reference_count);
-      free(servId_copy);
-      HandleUnlock();
-      return UPNP_E_INVALID_PARAM;
-  }
-  else
-  {
-      propertySet=strstr(TempPropSet,"<e:propertyset");
-      if(propertySet == NULL)
-      {
-         free(UDN_copy);
-         free(reference_count);
-         free(servId_copy);
-         HandleUnlock();
-         Upnpfree(TempPropSet);
-         return UPNP_E_INVALID_PARAM;
-      }
-  }
-
-  DBGONLY(UpnpPrintf(UPNP_INFO,GENA,__FILE__,__LINE__,"GENERATED PROPERY SET IN INIT EXT NOTIFY: %s",propertySet));
-
-
-  headers_size=strlen("CONTENT-TYPE text/xml\r\n") +
-    strlen("CONTENT-LENGTH: \r\n")+MAX_CONTENT_LENGTH +
-    strlen("NT: upnp:event\r\n") +
-    strlen("NTS: upnp:propchange\r\n")+1;
 
-    
-  headers=(char *) malloc(headers_size);
-  
-  if (headers==NULL)
+  if ( (return_code=mergePendingVars(service,VarNames,VarValues,
+				     var_count))!=GENA_SUCCESS)
     {
-      free(propertySet);
-      free(UDN_copy);
-      free(servId_copy);
-      free(reference_count);
       HandleUnlock();
-      return UPNP_E_OUTOF_MEMORY;
+      return return_code;
     }
-  
-  sprintf(headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",
-	  strlen(propertySet)+1);
-  
- 
 
-  //schedule thread for initial notification
-
-  thread_struct=(notify_thread_struct *) malloc(sizeof(notify_thread_struct));
-  if (thread_struct==NULL)
-      return_code= UPNP_E_OUTOF_MEMORY;
-  else
+  if (!service->eventPending)
     {
-      (*reference_count)=1;
-      thread_struct->servId=servId_copy;
-      thread_struct->UDN=UDN_copy;
-      thread_struct->headers=headers;
-      thread_struct->propertySet=propertySet;
-      strcpy(thread_struct->sid,sid);
-      thread_struct->eventKey=sub->eventKey++;
-      thread_struct->reference_count=reference_count;
-      thread_struct->device_handle=device_handle;
-      if ( (return_code=tpool_Schedule( genaNotifyThread, thread_struct ))!=0)
+      now=getMonotonicMs();
+      if (now<service->lastEventMs+service->eventInterval)
+	delay=(int) (service->lastEventMs+service->eventInterval-now);
+
+      flush=(moderation_flush_struct *) malloc(sizeof(moderation_flush_struct));
+      if (flush==NULL)
 	{
-	  if (return_code==-1)
-	    return_code= UPNP_E_OUTOF_MEMORY;
+	  HandleUnlock();
+	  return UPNP_E_OUTOF_MEMORY;
 	}
-      else
-	return_code=GENA_SUCCESS;
-      
-    }
-  
-  if (return_code!=GENA_SUCCESS)
-    {
-     
-      free(reference_count);
-      free(UDN_copy);
-      free(servId_copy);
-      free(thread_struct);
-      free(propertySet);
-      free(headers);
+      flush->device_handle=device_handle;
+      flush->UDN=(char *) malloc(strlen(UDN)+1);
+      flush->servId=(char *) malloc(strlen(servId)+1);
+      if ( (flush->UDN!=NULL) && (flush->servId!=NULL) )
+	{
+	  strcpy(flush->UDN,UDN);
+	  strcpy(flush->servId,servId);
+	}
+      if ( (flush->UDN==NULL) || (flush->servId==NULL)
+	   || (ScheduleTimerEventMs(delay,genaFlushEvents,flush,
+				    &GLOBAL_TIMER_THREAD,&eventId)
+	       !=UPNP_E_SUCCESS) )
+	{
+	  //the changes stay pending for the next call
+	  free(flush->UDN);
+	  free(flush->servId);
+	  free(flush);
+	  HandleUnlock();
+	  return UPNP_E_OUTOF_MEMORY;
+	}
+      service->eventPending=1;
     }
 
   HandleUnlock();
-
-  return return_code;
-  
-  
+  return GENA_SUCCESS;
 }
-int genaNotifyAllExt(UpnpDevice_Handle device_handle, char *UDN, char *servId,IN Upnp_Document PropSet)
-{
-  char * headers=NULL;
-  int headers_size;
-  int return_code=GENA_SUCCESS; 
-  char * UDN_copy=NULL;
-  char * servId_copy=NULL;
-  int *reference_count =NULL;
-  struct Handle_Info *handle_info;
-  Upnp_DOMString propertySet=NULL;
-  Upnp_DOMString TempPropSet=NULL;
 
+//collects the variables of a property set for getPropertySetVars
+typedef struct VAR_LIST {
+  char ** names;
+  char ** values;
+  int count;
+  int size;
+} var_list;
 
-  subscription * finger=NULL;
+static int appendVarToList(void * cookie, const char * name,
+			   const char * value)
+{
+  var_list * list=(var_list *) cookie;
 
-  notify_thread_struct * thread_struct=NULL;
+  return appendVar(&list->names,&list->values,&list->count,&list->size,
+		   name,value);
+}
 
-  service_info *service=NULL;
+//********************************************************
+//* Name: getPropertySetVars
+//* Description:  reads the variable names and values out of a
+//*               property set document
+//* In:           Upnp_Document PropSet
+//* Out:          char ***VarNames, char ***VarValues, int *var_count
+//*               (free with freeVarList)
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  UPNP_E_INVALID_PARAM
+//*               UPNP_E_OUTOF_MEMORY
+//********************************************************
 
-  reference_count= (int *) malloc(sizeof(int));
+static int getPropertySetVars(Upnp_Document PropSet, char *** VarNames,
+			      char *** VarValues, int * var_count)
+{
+  var_list list;
+  int return_code;
 
-  if (reference_count==NULL)
-    return UPNP_E_OUTOF_MEMORY;
+  list.names=NULL;
+  list.values=NULL;
+  list.count=0;
+  list.size=0;
 
-  (*reference_count=0);
+  if ( (return_code=walkPropertySet(PropSet,appendVarToList,&list))
+       !=GENA_SUCCESS)
+    {
+      freeVarList(list.names,list.values,list.count);
+      return return_code;
+    }
 
-  UDN_copy=(char *) malloc(strlen(UDN)+1);
-  
+  (*VarNames)=list.names;
+  (*VarValues)=list.values;
+  (*var_count)=list.count;
+  return GENA_SUCCESS;
+}
 
-  if (UDN_copy==NULL)
-  {
-    free(reference_count);
-    return UPNP_E_OUTOF_MEMORY;
-  }
+//********************************************************
+//* Name: genaSetEventModeration
+//* Description:  sets the minimum time between two events of a service.
+//*               Changes made in between are merged, the latest value
+//*               of each variable winning, and sent as one property set.
+//* In:           UpnpDevice_Handle device_handle, char *UDN, char *servId
+//*               int interval (milliseconds, 0 turns moderation off)
+//* Out:          None
+//* Return Codes: GENA_SUCCESS
+//* Error Codes:  GENA_E_BAD_HANDLE
+//*               GENA_E_BAD_SERVICE
+//********************************************************
 
-  servId_copy=(char *) malloc(strlen(servId)+1);
-  
-  if (servId_copy==NULL)
-    {
-      free(UDN_copy);
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-    
-  strcpy(UDN_copy,UDN);
-  strcpy(servId_copy,servId);
-  
-  TempPropSet = UpnpNewPrintDocument(PropSet);
-  if(TempPropSet == NULL)
-  {
-     free(UDN_copy);
-     free(servId_copy);
-     free(reference_count);
-     return UPNP_E_INVALID_PARAM;
-  }
-  else
-  {
-      propertySet=strstr(TempPropSet,"<e:propertyset");
-      if(propertySet == NULL)
-      {
-         free(UDN_copy);
-         free(servId_copy);
-         free(reference_count);
-         Upnpfree(TempPropSet);
-         return UPNP_E_INVALID_PARAM;
-      }
-  }
-    
+int genaSetEventModeration(UpnpDevice_Handle device_handle, char * UDN,
+			   char * servId, int interval)
+{
+  struct Handle_Info * handle_info;
+  service_info * service=NULL;
 
-  headers_size=strlen("CONTENT-TYPE text/xml\r\n") +
-    strlen("CONTENT-LENGTH: \r\n")+MAX_CONTENT_LENGTH +
-    strlen("NT: upnp:event\r\n") +
-    strlen("NTS: upnp:propchange\r\n")+1;
-  
-  headers=(char *) malloc(headers_size);
-  if (headers==NULL)
-    {
-      free(UDN_copy);
-      free(servId_copy);
-      free(TempPropSet);
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-  //changed to add null terminator at end of content
-  //content length = (length in bytes of property set) + null char
-  sprintf(headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",strlen(propertySet)+1);
-  
   HandleLock();
 
   if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
-    return_code=GENA_E_BAD_HANDLE;
-  else
     {
-      if ( (service = FindServiceId( &handle_info->ServiceTable, 
-				     servId, UDN)) !=NULL)
-	{ 
-	  finger=GetFirstSubscription(service);
-	  
-	  while (finger)
-	    {
-	      thread_struct=(notify_thread_struct *) malloc(sizeof(notify_thread_struct));
-	      if (thread_struct==NULL)
-		{
-		  break;
-		  return_code= UPNP_E_OUTOF_MEMORY;
-		}
-	      (*reference_count)++;
-	      thread_struct->reference_count=reference_count;
-	      thread_struct->UDN=UDN_copy;
-	      thread_struct->servId=servId_copy;
-	      thread_struct->headers=headers;
-	      thread_struct->propertySet=propertySet;
-	      strcpy(thread_struct->sid,finger->sid);
-	      thread_struct->eventKey=finger->eventKey++;
-	      thread_struct->device_handle=device_handle;
-	      //if overflow, wrap to 1
-	      if (finger->eventKey<0)
-		finger->eventKey=1;
-	      
-	      if ( (return_code=tpool_Schedule( genaNotifyThread, thread_struct ))!=0)
-		{
-		  if (return_code==-1)
-		    return_code= UPNP_E_OUTOF_MEMORY;
-		  break;
-		}
-	      
-	      finger=GetNextSubscription(service,finger);
-	      
-	    }
-	}
-      else
-	return_code=GENA_E_BAD_SERVICE;  
+      HandleUnlock();
+      return GENA_E_BAD_HANDLE;
     }
-  
-  if ((*reference_count)==0)
+
+  if ( (service = FindServiceId( &handle_info->ServiceTable, 
+				 servId, UDN)) ==NULL)
     {
-      free(reference_count);
-      free(headers);
-      free(TempPropSet);
-      free(UDN_copy);
-      free(servId_copy);
+      HandleUnlock();
+      return GENA_E_BAD_SERVICE;
     }
-  HandleUnlock();
-  
-  return return_code;
-}
 
+  service->eventInterval=interval;
 
+  HandleUnlock();
+  return GENA_SUCCESS;
+}
 
-int genaNotifyAll(UpnpDevice_Handle device_handle,
-	       char *UDN,
-	       char *servId,
-	       char **VarNames,
-	       char **VarValues,
-		  int var_count
-	       )
+int genaNotifyAllExt(UpnpDevice_Handle device_handle, char *UDN, char *servId,IN Upnp_Document PropSet)
 {
-  char * headers=NULL;
   char * propertySet=NULL;
-  int headers_size;
-  int return_code=GENA_SUCCESS;
-  char * UDN_copy=NULL;
-  char * servId_copy=NULL;
-  int *reference_count =NULL;
-  struct Handle_Info *handle_info;
-
-  subscription * finger=NULL;
-
-  notify_thread_struct * thread_struct=NULL;
-
-  service_info *service=NULL;
+  char ** VarNames=NULL;
+  char ** VarValues=NULL;
+  int var_count=0;
+  int return_code=GENA_SUCCESS; 
 
-  reference_count= (int *) malloc(sizeof(int));
+  if (isModerated(device_handle,UDN,servId))
+    {
+      if ( (return_code=getPropertySetVars(PropSet,&VarNames,&VarValues,
+					   &var_count))!=GENA_SUCCESS)
+	return return_code;
+      return_code=moderateEvent(device_handle,UDN,servId,
+				VarNames,VarValues,var_count);
+      freeVarList(VarNames,VarValues,var_count);
+      return return_code;
+    }
 
-  if (reference_count==NULL)
-    return UPNP_E_OUTOF_MEMORY;
+  if ( (return_code=GeneratePropertySetDoc(PropSet,&propertySet))!=XML_SUCCESS)
+    return return_code;
 
-  (*reference_count=0);
+  return notifyAllPayload(device_handle,UDN,servId,propertySet);
+}
 
-  UDN_copy=(char *) malloc(strlen(UDN)+1);
-  
 
-  if (UDN_copy==NULL)
-  {
-    free(reference_count);
-    return UPNP_E_OUTOF_MEMORY;
-  }
 
-  servId_copy=(char *) malloc(strlen(servId)+1);
-  
-  if (servId_copy==NULL)
-    {
-      free(UDN_copy);
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-    
-  strcpy(UDN_copy,UDN);
-  strcpy(servId_copy,servId);
-  
+//sends one property set with the variables to every subscriber of
+//the service right away
+static int sendNotifyAll(UpnpDevice_Handle device_handle,
+			 char *UDN,
+			 char *servId,
+			 char **VarNames,
+			 char **VarValues,
+			 int var_count
+			 )
+{
+  char * propertySet=NULL;
+  int return_code=GENA_SUCCESS;
   
   if ( (return_code=GeneratePropertySet(VarNames,VarValues,
 					var_count,&propertySet))!=XML_SUCCESS)
-  {
-    free(UDN_copy);
-    free(servId_copy);
-    free(reference_count);
     return return_code;
-  }
-  
-  headers_size=strlen("CONTENT-TYPE text/xml\r\n") +
-    strlen("CONTENT-LENGTH: \r\n")+MAX_CONTENT_LENGTH +
-    strlen("NT: upnp:event\r\n") +
-    strlen("NTS: upnp:propchange\r\n")+1;
-  
-  headers=(char *) malloc(headers_size);
-  if (headers==NULL)
-    {
-      free(UDN_copy);
-      free(servId_copy);
-      free(propertySet);
-      free(reference_count);
-      return UPNP_E_OUTOF_MEMORY;
-    }
-  //changed to add null terminator at end of content
-  //content length = (length in bytes of property set) + null char
-  sprintf(headers,"CONTENT-TYPE: text/xml\r\nCONTENT-LENGTH: %d\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\n",strlen(propertySet)+1);
-  
-  HandleLock();
 
-  if ( GetHandleInfo(device_handle,&handle_info)!=HND_DEVICE)
-    return_code=GENA_E_BAD_HANDLE;
-  else
-    {
-      if ( (service = FindServiceId( &handle_info->ServiceTable, 
-				     servId, UDN)) !=NULL)
-	{ 
-	  finger=GetFirstSubscription(service);
-	  
-	  while (finger)
-	    {
-	      thread_struct=(notify_thread_struct *) malloc(sizeof(notify_thread_struct));
-	      if (thread_struct==NULL)
-		{
-		  break;
-		  return_code= UPNP_E_OUTOF_MEMORY;
-		}
-	      (*reference_count)++;
-	      thread_struct->reference_count=reference_count;
-	      thread_struct->UDN=UDN_copy;
-	      thread_struct->servId=servId_copy;
-	      thread_struct->headers=headers;
-	      thread_struct->propertySet=propertySet;
-	      strcpy(thread_struct->sid,finger->sid);
-	      thread_struct->eventKey=finger->eventKey++;
-	      thread_struct->device_handle=device_handle;
-	      //if overflow, wrap to 1
-	      if (finger->eventKey<0)
-		finger->eventKey=1;
-	      
-	      if ( (return_code=tpool_Schedule( genaNotifyThread, thread_struct ))!=0)
-		{
-		  if (return_code==-1)
-		    return_code= UPNP_E_OUTOF_MEMORY;
-		  break;
-		}
-	      
-	      finger=GetNextSubscription(service,finger);
-	      
-	    }
-	}
-      else
-	return_code=GENA_E_BAD_SERVICE;  
-    }
-  
-  if ((*reference_count)==0)
-    {
-      free(reference_count);
-      free(headers);
-      free(propertySet);
-      free(UDN_copy);
-      free(servId_copy);
-    }
-  HandleUnlock();
-  
-  return return_code;
+  return notifyAllPayload(device_handle,UDN,servId,propertySet);
+}
+
+
+
+int genaNotifyAll(UpnpDevice_Handle device_handle,
+	       char *UDN,
+	       char *servId,
+	       char **VarNames,
+	       char **VarValues,
+		  int var_count
+	       )
+{
+  if (isModerated(device_handle,UDN,servId))
+    return moderateEvent(device_handle,UDN,servId,VarNames,VarValues,var_count);
+
+  return sendNotifyAll(device_handle,UDN,servId,VarNames,VarValues,var_count);
 }
 
 void genaUnsubscribeRequest(http_message request, int sockfd)
@@ -1372,6 +1720,9 @@ void genaSubscriptionRequest(http_message request, int sockfd)
   sub->ToSendEventKey=0;
   sub->active=0;
   sub->next=NULL;
+  sub->outgoing=NULL;
+  sub->outgoingTail=NULL;
+  sub->sending=0;
   
   //check for valid callbacks
   if ( (!search_for_header(&request,"CALLBACK",&callback))
@@ -1415,18 +1766,22 @@ void genaSubscriptionRequest(http_message request, int sockfd)
   uuid_unparse(uuid,temp_sid);
   sprintf(sub->sid,"uuid:%s",temp_sid);
   
-  //respond
-  if (respondOK(sockfd,time_out,sub)!=UPNP_E_SUCCESS)
+  //add to subscription list
+  if (AddSubscription(service,sub)!=HTTP_SUCCESS)
     {
+      respond(sockfd,UNABLE_MEMORY);
       freeSubscriptionList(sub);
       HandleUnlock();
       return;
     }
 
-  //add to subscription list
-  sub->next=service->subscriptionList;
-  service->subscriptionList=sub;
-  service->TotalSubscriptions++;
+  //respond
+  if (respondOK(sockfd,time_out,sub)!=UPNP_E_SUCCESS)
+    {
+      RemoveSubscriptionSID(sub->sid,service);
+      HandleUnlock();
+      return;
+    }
   
   //finally generate callback for init table dump
   request_struct.ServiceId=service->serviceId;
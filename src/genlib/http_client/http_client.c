@@ -37,6 +37,8 @@
 //and connecting to an http server as a client
 
 #include "./genlib/http_client/http_client.h"
+#include <pthread.h>
+#include <sys/poll.h>
 
 
 //*************************************************************************
@@ -471,60 +473,6 @@ void currentTmToHttpDate(char *out)
   
 }
 
-//*************************************************************************
-//* Name: parse_header_value
-//*
-//* Description:  Parses the input for a header value.
-//*               the header value is equal to all characters up to /r/n 
-//*               (end of line)
-//*               with beginning and trailing whitespace, removed  
-//*               (TAB and ' ')
-//*               The memory is NOT copied.  The returned token simply 
-//*               points into the original char array. 
-//*               Assumes that the whitespace has been stripped from
-//*               the beginning of value
-//* In:            char *in , int max_size (max_size to be considered 
-//*               to avoid 
-//*               running into bad memory)
-//*
-//* Out:          the size of the header value that was parsed, out.buff 
-//*               points into the original string. There is NO new memory 
-//*               created.
-//*
-//* Return Codes: None
-//* Error Codes:  None       
-//*************************************************************************
-int parse_header_value(  char *in, token *out, int max_size)
-{
-  int counter =0;
-   char * finger=in;
-  counter = parse_http_line(in,max_size);
-  if (!counter)
-    { 
-      out->size=0;
-      out->buff=NULL;
-      return 0;
-    }
-
-  counter-=2;
-
-  finger+=(counter);
-
-  //strip whitespace from end 
-  while ( (counter>=0)
-	  && ( (*finger==' ')
-	       || (*finger==TAB)))
-   {
-     counter--;
-     finger--;
-   }
-
-  out->buff=in;
-  out->size=counter;
-  return counter;
-
-}
-
 //*************************************************************************
 //* Name: parse_http_line
 //*
@@ -628,154 +576,6 @@ DBGONLY(void print_request_line(http_request *in,Dbg_Level level,
 
 })
 
-//*************************************************************************
-//* Name: parse_status_line
-//*
-//* Description:  parses the status line of an http response
-//* In:            char *in , http_status *out, int max_size 
-//*              ( to avoid running into bad memory)
-//*
-//* Out:          returns size of line (including /r/n)
-//* Return Codes: None
-//* Error Codes:  0 if any piece is missing (NOTE: NO LWS is expected at 
-//*                                          beginning of in) 
-//*                                         values are not to be trusted
-//*                                         if return code is zero      
-//*************************************************************************
-int parse_status_line( char * in, http_status * out, int max_size)
-{
-  int temp=0;
-  int max_len=max_size;
-   char * finger=in;
-  int size=0;
-
-  out->http_version.buff=NULL;
-  out->http_version.size=0;
-  out->status_code.buff=NULL;
-  out->status_code.size=0;
-  out->reason_phrase.buff=NULL;
-  out->reason_phrase.size=0;
-
-  if (! (temp=parse_not_LWS(in,&out->http_version,max_size)))
-      {
-	DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,
-	  "PARSING STATUS LINE \n COULDN'T GET HTTP VERSION"));
-	return 0;
-      }
-  finger+=temp;
-  max_len-=temp;
-  size+=temp;
-
-  temp=parse_LWS(finger,max_len);
-
-  max_len-=temp;
-  finger+=temp;
-  size+=temp;
-
-  if (! (temp=parse_not_LWS(finger,&out->status_code,max_len)))
-    { DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"PARSING STATUS LINE \n COULDN't GET STATUS CODE"));
-      return 0;
-    }
-  finger+=temp;
-  max_len-=temp;
-  size+=temp;
-
-  temp=parse_LWS(finger,max_len);
-
-  max_len-=temp;
-  finger+=temp;
-  size+=temp;
-
-  if (! (temp=parse_http_line(finger,max_len)))
-    { DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"PARSING STATUS LINE \n COULDN'T GET REASON PHRASE"));
-      return 0;
-    }
-  out->reason_phrase.buff=finger;
-
-  //remove /r/n
-  out->reason_phrase.size=temp-2;
-
-  size+=temp;
-  return size;
-      
-}
-
-//*************************************************************************
-//* Name: parse_request_line
-//*
-//* Description:  parses the request line of an http response
-//* In:            char *in , http_status *out, int max_size 
-//*              ( to avoid running into bad memory)
-//*
-//* Out:          returns size of line (including /r/n)
-//* Return Codes: None
-//* Error Codes:  0 if any piece is missing or bad (NOTE: 
-//*                 NO LWS is expected at 
-//*                                          beginning of in) 
-//*                                          values are not to be trusted
-//*                                          if return code is zero      
-//*************************************************************************
-int parse_request_line( char * in, http_request * out, int max_size)
-{
-  int temp=0;
-  int max_len=max_size;
-  char * finger=in;
-  int size=0;
-  token tempToken;
-
-  out->http_version.buff=NULL;
-  out->http_version.size=0;
-  out->method.buff=NULL;
-  out->method.size=0;
- 
-
-  if (! (temp=parse_token(in,&out->method,max_size)))
-    {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"PARSING REQUEST LINE \n COULDN'T GET METHOD"));
-      return 0;
-    }
-  finger+=temp;
-  max_len-=temp;
-  size+=temp;
-
-  temp=parse_LWS(finger,max_len);
-
-  max_len-=temp;
-  finger+=temp;
-  size+=temp;
-
-    //parse request URI (path)
-  if (!(temp=parse_uri(finger,max_len,&out->request_uri)))
-    {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"PARSING REQUEST LINE \n COULDN't GET REQUEST URI"));
-      return 0;
-    }
-  temp=parse_not_LWS(finger,&tempToken,max_len);
-
-  max_len-=temp;
-  finger+=temp;
-  size+=temp;
-
-  temp=parse_LWS(finger,max_len);
-
-  max_len-=temp;
-  finger+=temp;
-  size+=temp;
-
-  if (! (temp=parse_http_line(finger,max_len)))
-    {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"PARSING REQUEST LINE \n COULDN'T GET HTTP VERSION"));
-      return 0;
-    }
-  //remove /r/n
-  out->http_version.size=temp-2;
-  out->http_version.buff=finger;
-  size+=temp;
-  
-  return size;
-      
-}
-
 //*************************************************************************
 //* Name: parse_not_LWS
 //*
@@ -1764,6 +1564,80 @@ ssize_t readLine(int fd, char *out, int max, int *timeout)
 
 
 
+//*************************************************************************
+//* Name: isPersistentResponse
+//*
+//* Description:  checks whether the connection a response arrived on
+//*               can carry another request: the response must be
+//*               HTTP/1.1, delimited by a "CONTENT-LENGTH:" header and
+//*               must not carry "CONNECTION: close"
+//*              
+//* In:           char *in (response, headers first)
+//*               int size (number of bytes in the response)
+//*
+//* Out:          None
+//*           
+//* Return Codes: 1 if the connection can be reused, 0 otherwise
+//* Error Codes:  None
+//*************************************************************************
+static int isPersistentResponse(char *in, int size)
+{
+  char *line=in;
+  char *end=in+size;
+  char *eol=NULL;
+  char *finger=NULL;
+  int hasLength=0;
+
+  if ( (size<8) || (strncasecmp(in,"HTTP/1.1",8)) )
+    return 0;
+
+  while ( (line<end)
+	  && ( (eol=(char *) memchr(line,'\n',end-line))!=NULL) )
+    {
+      line=eol+1;
+      //blank line ends the headers
+      if ( (line>=end) || (line[0]=='\r') || (line[0]=='\n') )
+	break;
+      if ( (end-line>15) && (!strncasecmp(line,"CONTENT-LENGTH:",15)) )
+	hasLength=1;
+      else
+	if ( (end-line>11) && (!strncasecmp(line,"CONNECTION:",11)) )
+	  {
+	    for (finger=line+11;
+		 (finger+5<=end) && (*finger!='\n'); finger++)
+	      if (!strncasecmp(finger,"close",5))
+		return 0;
+	  }
+    }
+
+  return hasLength;
+}
+
+
+//*************************************************************************
+//* Name: isPersistentRequest
+//*
+//* Description:  checks whether a request asks for a persistent
+//*               connection, i.e. its request line ends in HTTP/1.1
+//*              
+//* In:           char *in (request)
+//*               int size (number of bytes in the request)
+//*
+//* Out:          None
+//*           
+//* Return Codes: 1 if the request is HTTP/1.1, 0 otherwise
+//* Error Codes:  None
+//*************************************************************************
+static int isPersistentRequest(char *in, int size)
+{
+  char *eol=(char *) memchr(in,'\n',size);
+
+  if ( (eol==NULL) || (eol-in<10) )
+    return 0;
+  return (!strncasecmp(eol-9,"HTTP/1.1\r",9));
+}
+
+
 //*************************************************************************
 //* Name: read_http_response
 //*
@@ -1776,17 +1650,22 @@ ssize_t readLine(int fd, char *out, int max, int *timeout)
 //*                           stored here)
 //*               int timeout (timeout for operation)
 //*
+//*               int *persistent (space to place persistence flag, may
+//*                                be NULL)
+//*
 //* Out:          http response is read and returned in null terminated 
 //*               string, (*out). http headers and content are read
 //*               ONLY WORKS if "CONTENT LENGTH:" header is present.
 //*               otherwise content is NOT returned.
+//*               (*persistent) is set to 1 if the whole response was
+//*               read and the connection may carry another request.
 //*           
 //* Return Codes: HTTP_SUCCESS on success
 //* Error Codes:  UPNP_E_OUTOF_MEMORY, memory error
 //*               UPNP_E_SOCKET_READ, socket read error, including
 //*               timeout
 //*************************************************************************
-int read_http_response(int fd, char **out, int timeout)
+int read_http_response(int fd, char **out, int timeout, int *persistent)
 {
   socket_buffer head;
   socket_buffer *current=&head;
@@ -1799,7 +1678,11 @@ int read_http_response(int fd, char **out, int timeout)
   socket_buffer chunkSizebuff;
   char *invalidchar;
   int nextToRead=0;
+  int complete=0;
   head.next=NULL;
+
+  if (persistent)
+    (*persistent)=0;
  
 
  
@@ -1812,6 +1695,7 @@ int read_http_response(int fd, char **out, int timeout)
 	{
 	  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"NO CONTENT EXPECTED"));
 	  done=1;
+	  complete=1;
 	}
       while (!done)
 	{
@@ -1882,6 +1766,7 @@ int read_http_response(int fd, char **out, int timeout)
 		if (contentLength==0)
 		  {
 		    done=1;
+		    complete=1;
 		  }
 	      }
 	    if (contentLength==-1)
@@ -1917,6 +1802,9 @@ int read_http_response(int fd, char **out, int timeout)
   (*out)[total_size]=0;
  
   free_socket_buffers(&head);
+
+  if ( (persistent) && (complete) )
+    (*persistent)=isPersistentResponse((*out),total_size);
   
   return HTTP_SUCCESS;
 }
@@ -1956,6 +1844,404 @@ size_t write_bytes(int fd,   char * bytes, size_t n, int timeout)
   return bytes_written;
 }
 
+//*************************************************************************
+//* Name: write_vector
+//*
+//* Description:  writes a list of buffers to a socket with a timeout,
+//*               gathering them into as few send calls as possible.
+//*               writes until all bytes are written
+//*              
+//* In:           int fd (socket)
+//*               struct iovec *parts (buffers to be sent, in order)
+//*               int count (number of buffers, at most HTTP_MAX_PARTS)
+//*               int timeout (timeout for operation)
+//*
+//* Out:          # of bytes sent. 
+//*           
+//* Return Codes: >=0 success
+//* Error Codes:  -1 (error writing socket, including
+//*                                    timeout)
+//*************************************************************************
+size_t write_vector(int fd, struct iovec *parts, int count, int timeout)
+{
+  struct iovec left[HTTP_MAX_PARTS];
+  struct msghdr msg;
+  struct pollfd pfd;
+  int rc;
+  time_t current_time;
+  time_t new_time;
+  int Timeout=timeout;
+  ssize_t bytes_written=0;
+  size_t total=0;
+  int first=0;
+
+  if ( (count<0) || (count>HTTP_MAX_PARTS) )
+    return -1;
+  memcpy(left,parts,count*sizeof(struct iovec));
+
+  while (first<count)
+    {
+      if (left[first].iov_len==0)
+	{
+	  first++;
+	  continue;
+	}
+      if (Timeout<=0)
+	return -1; //TIMEOUT
+
+      pfd.fd=fd;
+      pfd.events=POLLOUT;
+      pfd.revents=0;
+      time(&current_time);
+      do
+	rc=poll(&pfd,1,Timeout*1000);
+      while ( (rc==-1) && (errno==EINTR) );
+      if (rc<=0)
+	return -1; //TIMEOUT
+      time(&new_time);
+      Timeout-=(new_time-current_time);
+
+      memset(&msg,0,sizeof(msg));
+      msg.msg_iov=&left[first];
+      msg.msg_iovlen=count-first;
+      if ( (bytes_written=sendmsg(fd,&msg,MSG_NOSIGNAL))<=0)
+	return -1;//error
+      total+=bytes_written;
+
+      //skip what was sent
+      while ( (first<count) && (bytes_written>=(ssize_t)left[first].iov_len) )
+	bytes_written-=left[first++].iov_len;
+      if (first<count)
+	{
+	  left[first].iov_base=(char *) left[first].iov_base+bytes_written;
+	  left[first].iov_len-=bytes_written;
+	}
+    }
+
+  return total;
+}
+
+
+//Idle persistent client connection, kept in
+//IdleConnections until it is reused or expires
+typedef struct HTTP_CONNECTION {
+  int fd;
+  struct sockaddr_in addr;
+  time_t expires;
+  struct HTTP_CONNECTION *next;
+} http_connection;
+
+static http_connection * IdleConnections=NULL;
+static pthread_mutex_t IdleConnectionsMutex=PTHREAD_MUTEX_INITIALIZER;
+
+
+//*************************************************************************
+//* Name: getConnection
+//*
+//* Description:  returns a connected socket to the given address. An
+//*               idle connection to the same host and port is reused
+//*               when one is available and still open, otherwise a
+//*               new connection is made. Expired idle connections are
+//*               closed along the way.
+//*              
+//* In:           struct sockaddr_in *addr (server address)
+//*               int allowIdle (0 forces a new connection)
+//*               int *fd (space to place the socket)
+//*               int *reused (space to place 1 if the socket was idle)
+//*
+//* Out:          (*fd) connected socket, must be passed to
+//*               releaseConnection
+//*           
+//* Return Codes: HTTP_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_SOCKET
+//*               UPNP_E_SOCKET_CONNECT
+//*************************************************************************
+static int getConnection(struct sockaddr_in *addr, int allowIdle,
+			 int *fd, int *reused)
+{
+  http_connection **link=&IdleConnections;
+  http_connection *conn=NULL;
+  time_t now=time(NULL);
+  char peek;
+
+  (*fd)=-1;
+  (*reused)=0;
+
+  pthread_mutex_lock(&IdleConnectionsMutex);
+  while ( (conn=(*link))!=NULL)
+    {
+      if ( (conn->expires>now)
+	   && ( (!allowIdle) || ((*fd)!=-1)
+		|| (conn->addr.sin_addr.s_addr!=addr->sin_addr.s_addr)
+		|| (conn->addr.sin_port!=addr->sin_port)))
+	{
+	  link=&conn->next;
+	  continue;
+	}
+      (*link)=conn->next;
+      //an open idle connection has nothing to read, anything else
+      //means the server closed it or sent something unexpected
+      if ( (conn->expires>now)
+	   && (recv(conn->fd,&peek,1,MSG_PEEK|MSG_DONTWAIT)==-1)
+	   && ( (errno==EAGAIN) || (errno==EWOULDBLOCK)))
+	(*fd)=conn->fd;
+      else
+	close(conn->fd);
+      free(conn);
+    }
+  pthread_mutex_unlock(&IdleConnectionsMutex);
+
+  if ((*fd)!=-1)
+    {
+      (*reused)=1;
+      return HTTP_SUCCESS;
+    }
+
+  if ( ((*fd)=socket(AF_INET,SOCK_STREAM,0))==-1)
+    {
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"OUT OF SOCKET"));
+      return UPNP_E_OUTOF_SOCKET;
+    }
+  
+  if (connect((*fd),(struct sockaddr*) addr,sizeof(struct sockaddr))==-1)
+    {
+      close((*fd));
+      (*fd)=-1;
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"CONNECT ERROR"));
+      return UPNP_E_SOCKET_CONNECT;
+    }
+
+  return HTTP_SUCCESS;
+}
+
+
+//*************************************************************************
+//* Name: releaseConnection
+//*
+//* Description:  returns a socket obtained from getConnection. If the
+//*               connection can be reused and the host has fewer than
+//*               HTTP_CLIENT_MAX_IDLE_PER_HOST idle connections it is
+//*               kept for HTTP_CLIENT_IDLE_TIMEOUT seconds, otherwise
+//*               it is closed.
+//*              
+//* In:           int fd (socket)
+//*               struct sockaddr_in *addr (server address)
+//*               int keep (1 if the connection can be reused)
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+static void releaseConnection(int fd, struct sockaddr_in *addr, int keep)
+{
+  http_connection *conn=NULL;
+  int count=0;
+
+  if ( (keep) && (HTTP_CLIENT_MAX_IDLE_PER_HOST>0))
+    {
+      pthread_mutex_lock(&IdleConnectionsMutex);
+      for (conn=IdleConnections; conn!=NULL; conn=conn->next)
+	if ( (conn->addr.sin_addr.s_addr==addr->sin_addr.s_addr)
+	     && (conn->addr.sin_port==addr->sin_port))
+	  count++;
+      if ( (count<HTTP_CLIENT_MAX_IDLE_PER_HOST)
+	   && ( (conn=(http_connection *)
+		 malloc(sizeof(http_connection)))!=NULL))
+	{
+	  conn->fd=fd;
+	  copy_sockaddr_in(addr,&conn->addr);
+	  conn->expires=time(NULL)+HTTP_CLIENT_IDLE_TIMEOUT;
+	  conn->next=IdleConnections;
+	  IdleConnections=conn;
+	  fd=-1;
+	}
+      pthread_mutex_unlock(&IdleConnectionsMutex);
+    }
+
+  if (fd!=-1)
+    close(fd);
+}
+
+
+//*************************************************************************
+//* Name: closeIdleConnections
+//*
+//* Description:  closes every idle client connection (used by
+//*               UpnpFinish)
+//*              
+//* In:           None
+//*
+//* Out:          None
+//*           
+//* Return Codes: None
+//* Error Codes:  None
+//*************************************************************************
+void closeIdleConnections(void)
+{
+  http_connection *conn=NULL;
+
+  pthread_mutex_lock(&IdleConnectionsMutex);
+  while ( (conn=IdleConnections)!=NULL)
+    {
+      IdleConnections=conn->next;
+      close(conn->fd);
+      free(conn);
+    }
+  pthread_mutex_unlock(&IdleConnectionsMutex);
+}
+
+
+//*************************************************************************
+//* Name: waitForResponse
+//*
+//* Description:  waits for the first byte of a response on a reused
+//*               connection without consuming it, to tell a connection
+//*               the server closed while it was idle from a server that
+//*               is slow to answer
+//*              
+//* In:           int fd (socket)
+//*               int *timeout (timeout for operation)
+//*
+//* Out:          timeout is updated, time of operation is subtracted
+//*               from it.
+//*           
+//* Return Codes: 1 response data is available
+//*               0 the server closed or reset the connection before
+//*                 sending anything; the request was not served
+//* Error Codes:  -1 timeout or other error; the request may have been
+//*                  served
+//*************************************************************************
+static int waitForResponse(int fd, int *timeout)
+{
+  struct pollfd pfd;
+  time_t start;
+  time_t now;
+  char c;
+  int rc;
+
+  pfd.fd=fd;
+  pfd.events=POLLIN;
+  pfd.revents=0;
+
+  time(&start);
+  do
+    rc=poll(&pfd,1,(*timeout)*1000);
+  while ( (rc==-1) && (errno==EINTR) );
+  time(&now);
+  (*timeout)-=(now-start);
+  
+  if (rc<=0)
+    {
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"TIMEOUT ON READ"));
+      return -1;
+    }
+
+  rc=recv(fd,&c,1,MSG_PEEK);
+  if (rc>0)
+    return 1;
+  if ( (rc==0) || (errno==ECONNRESET) )
+    return 0;
+  return -1;
+}
+
+
+//*************************************************************************
+//* Name: sendHttpRequestv
+//*
+//* Description:  sends a complete http request to a server and reads
+//*               the response, reusing an idle connection when the
+//*               request is HTTP/1.1. If a reused connection turns out
+//*               to have been closed by the server before it answered,
+//*               the request is sent once more on a new connection.
+//*              
+//* In:           struct sockaddr_in *addr (server address)
+//*               struct iovec *toSend (parts of the request, in order;
+//*                                     the first holds the request line)
+//*               int count (number of parts, at most HTTP_MAX_PARTS)
+//*               char ** out (output)
+//*
+//* Out:          HTTP_SUCCESS (on success) , (*out) null terminated string
+//*           
+//* Return Codes: HTTP_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//*               UPNP_E_READ_SOCKET
+//*               UPNP_E_WRITE_SOCKET
+//*               UPNP_E_OUTOF_SOCKET
+//*               UPNP_E_SOCKET_CONNECT
+//*************************************************************************
+static int sendHttpRequestv(struct sockaddr_in *addr, struct iovec *toSend,
+			    int count, char **out)
+{
+  int persistent=isPersistentRequest((char *) toSend[0].iov_base,
+				     toSend[0].iov_len);
+  int allowIdle=persistent;
+  int client_socket=-1;
+  int reused=0;
+  int keep=0;
+  int return_code=HTTP_SUCCESS;
+  int timeout;
+
+  while (1)
+    {
+      if ( (return_code=getConnection(addr,allowIdle,&client_socket,&reused))
+	   !=HTTP_SUCCESS)
+	return return_code;
+      
+      allowIdle=0;
+
+      if ( write_vector(client_socket,toSend,
+			count,RESPONSE_TIMEOUT)==-1) 
+	{
+	  close(client_socket);
+	  if (reused)
+	    continue;
+	  DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"WRITE ERROR"));
+	  return UPNP_E_SOCKET_WRITE;
+	}
+  
+      timeout=RESPONSE_TIMEOUT;
+
+      //a request is only sent again if the server closed the idle
+      //connection before answering anything; once it may have been
+      //served (e.g. the read timed out) it is not repeated
+      if (reused)
+	{
+	  return_code=waitForResponse(client_socket,&timeout);
+	  if (return_code==0)
+	    {
+	      DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"IDLE CONNECTION CLOSED BY SERVER, RETRYING"));
+	      close(client_socket);
+	      continue;
+	    }
+	  if (return_code<0)
+	    {
+	      (*out)=NULL;
+	      close(client_socket);
+	      return UPNP_E_SOCKET_READ;
+	    }
+	}
+  
+      return_code=read_http_response(client_socket,out,timeout,&keep);
+      
+      releaseConnection(client_socket,addr,
+			(persistent) && (return_code==HTTP_SUCCESS) && (keep));
+
+      return return_code;
+    }
+}
+
+//same as sendHttpRequestv, with the request in one buffer
+static int sendHttpRequest(struct sockaddr_in *addr, char *toSend,
+			   int toSendSize, char **out)
+{
+  struct iovec part;
+
+  part.iov_base=toSend;
+  part.iov_len=toSendSize;
+  return sendHttpRequestv(addr,&part,1,out);
+}
+
 
 //*************************************************************************
 //* Name: transferHTTP
@@ -2043,7 +2329,6 @@ int transferHTTPRaw( char * toSend, int toSendSize, char **out,  char
   uri_type parsed_url;
   
   int return_code=HTTP_SUCCESS;
-  int client_socket=0;
   
   
   if ( (return_code=parse_uri(Url,strlen(Url),&parsed_url))==HTTP_SUCCESS )
@@ -2059,38 +2344,9 @@ int transferHTTPRaw( char * toSend, int toSendSize, char **out,  char
 	  return UPNP_E_INVALID_URL;
 	}
       
-      if ( (client_socket=socket(AF_INET,SOCK_STREAM,0))==-1)
-	{
-	  
-	  DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"OUT OF SOCKET"));
-	  return UPNP_E_OUTOF_SOCKET;
-	}
-      
-      if (connect(client_socket,(struct sockaddr*) & 
-		  parsed_url.hostport.IPv4address,sizeof(struct sockaddr))==-1)
-	{
-	  
-	  close(client_socket);
-	  DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"CONNECT ERROR"));
-	  return UPNP_E_SOCKET_CONNECT;
-	}
-      
       //changed to transmit null character
-      if ( write_bytes(client_socket,toSend,
-		       toSendSize,RESPONSE_TIMEOUT)==-1) 
-	{
-	  
-	  close(client_socket);
-	  DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"WRITE ERROR"));
-	  return UPNP_E_SOCKET_WRITE;
-	}
-  
-      return_code=read_http_response(client_socket,out,RESPONSE_TIMEOUT);
-      
-      close(client_socket);    
-      
-      return return_code;
-      
+      return sendHttpRequest(&parsed_url.hostport.IPv4address,
+			     toSend,toSendSize,out);
     }
   else return return_code; 
 }
@@ -2131,19 +2387,56 @@ int transferHTTPRaw( char * toSend, int toSendSize, char **out,  char
 //*************************************************************************
 int transferHTTPparsedURL(  char * request,   char * toSend, 
 			   int toSendSize, char **out, uri_type *URL)
+{
+  struct iovec part;
+
+  part.iov_base=toSend;
+  part.iov_len=toSendSize;
+  return transferHTTPparsedURLv(request,&part,1,out,URL);
+}
+
+//*************************************************************************
+//* Name: transferHTTPparsedURLv
+//*
+//* Description:  same as transferHTTPparsedURL, with the bytes to be
+//*               sent after the HOST header given as a list of buffers.
+//*               The buffers are written to the socket as they are,
+//*               without being copied into one message.
+//*              
+//* In:           char * request (NULL terminated string, e.g. "GET")
+//*               struct iovec * toSend (buffers to be sent, in order)
+//*               int count (number of buffers, less than HTTP_MAX_PARTS)
+//*               char ** out (output)
+//*               uri_type *URL(parsed url)
+//*
+//* Out:          HTTP_SUCCESS (on success) , (*out) null terminated string
+//*           
+//* Return Codes: HTTP_SUCCESS
+//* Error Codes:  UPNP_E_INVALID_PARAM (too many buffers)
+//*               UPNP_E_OUTOF_MEMORY
+//*               UPNP_E_READ_SOCKET
+//*               UPNP_E_WRITE_SOCKET
+//*               UPNP_E_OUTOF_SOCKET
+//*               UPNP_E_SOCKET_CONNECT
+//*************************************************************************
+int transferHTTPparsedURLv(  char * request, struct iovec * toSend, 
+			    int count, char **out, uri_type *URL)
 {
   uri_type parsed_url=(*URL);
+  struct iovec parts[HTTP_MAX_PARTS];
   int request_length=0;
   int host_length=0;
   char * message=NULL;
   char *  message_finger=NULL;
-  int client_socket=0;
   
   char temp_path='/';
  
   int return_code=HTTP_SUCCESS;
   int message_size=0;
 
+  if ( (count<0) || (count>=HTTP_MAX_PARTS) )
+    return UPNP_E_INVALID_PARAM;
+
   if (token_string_casecmp(&parsed_url.scheme,"http"))
     {
       return UPNP_E_INVALID_URL;
@@ -2162,8 +2455,8 @@ int transferHTTPparsedURL(  char * request,   char * toSend,
   request_length=strlen(request) + 1 + parsed_url.pathquery.size + 8 +1 + 2;
   //host_length = "HOST:<sp>(host:port)\r\n"
   host_length = 6 + parsed_url.hostport.text.size +2;
-  message_size=request_length+host_length+toSendSize;
-  message = (char * ) malloc(message_size);
+  message_size=request_length+host_length;
+  message = (char * ) malloc(message_size+1);
   
   if (message==NULL)
 	return UPNP_E_OUTOF_MEMORY;
@@ -2189,57 +2482,26 @@ int transferHTTPparsedURL(  char * request,   char * toSend,
 	 parsed_url.hostport.text.size);
   message_finger+=parsed_url.hostport.text.size;
   memcpy(message_finger,"\r\n",2);
-  message_finger+=2;
-  memcpy(message_finger,toSend,toSendSize);
-  
 
-  //set up tcp connection
-  
-  if ( (client_socket=socket(AF_INET,SOCK_STREAM,0))==-1)
-    {
-      free(message);
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"OUT OF SOCKET"));
-      return UPNP_E_OUTOF_SOCKET;
-    }
-  
-  if (connect(client_socket,(struct sockaddr*) & 
-	      parsed_url.hostport.IPv4address,sizeof(struct sockaddr))==-1)
-    {
-      free(message);
-      close(client_socket);
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"CONNECT ERROR"));
-      return UPNP_E_SOCKET_CONNECT;
-    }
-  
-  
-  if ( write_bytes(client_socket,message,message_size,RESPONSE_TIMEOUT)==-1) 
-    {
-      free(message);
-      close(client_socket);
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"WRITE ERROR"));
-      return UPNP_E_SOCKET_WRITE;
-    }
+  //the request line and host go first, the caller's buffers follow
+  parts[0].iov_base=message;
+  parts[0].iov_len=message_size;
+  memcpy(&parts[1],toSend,count*sizeof(struct iovec));
+
+  return_code=sendHttpRequestv(&parsed_url.hostport.IPv4address,
+			       parts,count+1,out);
   
   free(message);
-  
-  return_code=read_http_response(client_socket,out,RESPONSE_TIMEOUT);
-  
-  close(client_socket);    
 
   return return_code;
 }
 
 
 
+//headers of a message are allocated in one block by load_http_message
 void free_http_headers(http_header * list)
 {
-  http_header * next;
-  while (list)
-    {
-      next=list->next;
-      free(list);
-      list=next;
-    }
+  free(list);
 }
 
 void free_http_message(http_message * message)
@@ -2328,14 +2590,19 @@ DBGONLY(void print_http_request( http_message * message,Dbg_Level
 
 
 
+//known headers are compared by id, others by name
 int search_for_header(http_message * in, char * header, token *out)
 {
   http_header *temp=in->header_list;
+  int size=strlen(header);
+  int id=http_HeaderNameToID(header,size);
 
   while (temp)
     { 
-      if (temp->header.size== (int)strlen(header))
-      if ( !(strncasecmp(header,temp->header.buff,temp->header.size)))
+      if ( (temp->id==id)
+	   && ( (id!=HDR_UNKNOWN)
+		|| ( (temp->header.size==size)
+		     && !(strncasecmp(header,temp->header.buff,size)) ) ) )
 	{
 	  out->size=temp->value.size;
 	  out->buff=temp->value.buff;
@@ -2347,131 +2614,115 @@ int search_for_header(http_message * in, char * header, token *out)
 
 }
 
-int parse_headers(char *in, http_message *out, int max_len)
+//*************************************************************************
+//* Name: load_http_message
+//*
+//* Description:  fills in an http_message from a message the incremental
+//*               parser (httpparser.h) has already parsed, so that the
+//*               message is not parsed a second time.
+//*               The tokens point into in; NO memory is copied.
+//* In:           char *in (the parsed message), int max_len (its size),
+//*               const HttpParser *parser (in state HTTP_PARSER_DONE)
+//*
+//* Out:          http_message *out, free with free_http_message
+//* Return Codes: HTTP_SUCCESS
+//* Error Codes:  UPNP_E_OUTOF_MEMORY
+//*               UPNP_E_BAD_REQUEST (bad request URI)
+//*************************************************************************
+int load_http_message(char * in, int max_len, const HttpParser *parser,
+		      http_message *out)
 {
-  int counter;
-  char * finger=in;
-  char * max_finger=in+max_len;
-  http_header *current=NULL;
-  http_header *head =NULL;
+  http_header *headers=NULL;
+  const HttpHeaderRef *ref;
+  token version;
+  int i;
 
-  //parse headers
+  memset(out,0,sizeof(http_message));
 
-  while ( (finger<max_finger-1) &&
-	  ( ( (*finger)!=CR) || ((*(finger+1))!=LF)))
+  version.buff=in+parser->versionStart;
+  version.size=parser->versionLen;
+  
+  if (parser->isRequest)
     {
-      
-      if (current)
-	{
-	  current->next=(http_header *) malloc(sizeof(http_header));
-	  current=current->next;
-	}
-      else
-	{
-	  head=(http_header *) malloc(sizeof(http_header));
-	  current=head;
-	}
-      if (!current)
-	{
-	  free_http_headers(head);
-	  return UPNP_E_OUTOF_MEMORY;
-	}
-      current->next=NULL;
-      
-      //parse header
-      if (!(counter=parse_token(finger, &current->header,max_len)))
-	{ free_http_headers(head);
-	  return UPNP_E_BAD_REQUEST;
-	
-	}
-      
-      finger+=counter;
-      if ( (*finger!=':'))
+      out->request.method.buff=in+parser->methodStart;
+      out->request.method.size=parser->methodLen;
+      out->request.http_version=version;
+      if (parse_uri(in+parser->uriStart,parser->uriLen,
+		    &out->request.request_uri)!=HTTP_SUCCESS)
 	{
-	  free_http_headers(head);
+	  DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD REQUEST URI"));
 	  return UPNP_E_BAD_REQUEST;
 	}
-      counter++;
-      finger++;
-      max_len-=counter;
+    }
+  else
+    {
+      out->status.http_version=version;
+      out->status.status_code.buff=in+parser->statusStart;
+      out->status.status_code.size=parser->statusLen;
+      out->status.reason_phrase.buff=in+parser->reasonStart;
+      out->status.reason_phrase.size=parser->reasonLen;
+    }
 
-      //get rid of whitespace
-      counter=parse_LWS(finger,max_len);
-      finger+=counter;
-      max_len-=counter;
+  //all headers in one block
+  if (parser->numHeaders>0)
+    {
+      headers=(http_header *) malloc(parser->numHeaders*sizeof(http_header));
+      if (!headers)
+	return UPNP_E_OUTOF_MEMORY;
       
-      //parse value, allows empty values
-      if (!(counter=parse_header_value(finger,&current->value,max_len)))
+      for (i=0;i<parser->numHeaders;i++)
 	{
-	  current->value.size=0;
-	  current->value.buff=NULL;
+	  ref=&parser->headers[i];
+	  headers[i].header.buff=in+ref->nameStart;
+	  headers[i].header.size=ref->nameLen;
+	  headers[i].value.buff=in+ref->valueStart;
+	  headers[i].value.size=ref->valueLen;
+	  headers[i].id=ref->id;
+	  headers[i].next= (i+1<parser->numHeaders) ? &headers[i+1] : NULL;
 	}
-      
-      finger+=counter;
-      max_len-=counter;
-      
-      counter=parse_http_line(finger,max_len);
-      finger+=counter;
-      max_len-=counter;
     }
-  
-  out->header_list=head;
-
-  if (finger<max_finger-1)
-    finger+=2;
-    
-  out->content.buff=finger;
-  if (max_len>0)
-    out->content.size=max_len-2;
-  else
-    out->content.size=0;
+  out->header_list=headers;
+
+  out->content.buff=in+parser->headerLen;
+  out->content.size=max_len-parser->headerLen;
 
   return HTTP_SUCCESS;
 }
 
-
 int parse_http_response( char * in, http_message *out, int max_len)
 {
-  int temp;
-  int max=max_len;
-  char *finger=in;
-  
-  if ( !(temp=parse_status_line(in,&out->status,max_len)))
+  HttpParser parser;
+  int ret;
+
+  http_ParserInit(&parser);
+  if ( (http_ParseMessageEnd(&parser,in,max_len)!=HTTP_PARSE_DONE)
+       || (parser.isRequest))
     {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD_STATUS LINE"));
+      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD RESPONSE"));
+      http_ParserFree(&parser);
       return UPNP_E_BAD_RESPONSE;
     }
-  max-=temp;
-  finger+=temp;
   
-  if ( parse_headers(finger,out,max)!=HTTP_SUCCESS)
-    {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD HEADERS"));
-      return UPNP_E_BAD_REQUEST;
-    }
-  return HTTP_SUCCESS;
-
+  ret=load_http_message(in,max_len,&parser,out);
+  http_ParserFree(&parser);
+  return ret;
 }
 
 int parse_http_request(  char * in, http_message * out, int max_len)
 {
-  int temp;
-  int max=max_len;
-  char *finger=in;
-  
-  if ( !(temp=parse_request_line(in,&out->request,max_len)))
+  HttpParser parser;
+  int ret;
+
+  http_ParserInit(&parser);
+  if ( (http_ParseMessageEnd(&parser,in,max_len)!=HTTP_PARSE_DONE)
+       || (!parser.isRequest))
     {
       DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD REQUEST"));
+      http_ParserFree(&parser);
       return UPNP_E_BAD_REQUEST;
     }
-  max-=temp;
-  finger+=temp;
-  
-  if ( parse_headers(finger,out,max)!=HTTP_SUCCESS)
-    {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,API,__FILE__,__LINE__,"BAD HEADERS"));
-      return UPNP_E_BAD_REQUEST;
-    }
-  return HTTP_SUCCESS;
   
+  ret=load_http_message(in,max_len,&parser,out);
+  http_ParserFree(&parser);
+  return ret;
 }
@@ -46,10 +46,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#if MINISERVER_REACTOR
+#include <fcntl.h>
+#include <sys/epoll.h>
+#endif
 
 #include <genlib/util/utilall.h>
 #include <genlib/util/util.h>
 #include <genlib/miniserver/miniserver.h>
+#include <genlib/net/http/parseutil.h>
+#include <genlib/net/http/httpparser.h>
 #include <genlib/tpool/scheduler.h>
 #include <genlib/tpool/interrupts.h>
 #include "upnp.h"
@@ -71,6 +77,7 @@ enum READ_EXCEPTION_CODE {
         RCODE_INTERNAL_SERVER_ERROR = -5,
         RCODE_METHOD_NOT_IMPLEMENTED = -6,
         RCODE_TIMEDOUT              = -7,
+        RCODE_REQUEST_TOO_LARGE     = -8,
         };
         
 enum HTTP_COMMAND_TYPE { CMD_HTTP_GET,
@@ -81,215 +88,46 @@ enum HTTP_COMMAND_TYPE { CMD_HTTP_GET,
 
 // module vars
 
-static MiniServerCallback gGetCallback = NULL;
-static MiniServerCallback gSoapCallback = NULL;
-static MiniServerCallback gGenaCallback = NULL;
+static MiniServerRequestCallback gGetCallback = NULL;
+static MiniServerRequestCallback gSoapCallback = NULL;
+static MiniServerRequestCallback gGenaCallback = NULL;
 
 static MiniServerState gMServState = MSERV_IDLE;
 static pthread_t gMServThread = 0;
 
 //////////////
 
-void SetHTTPGetCallback( MiniServerCallback callback )
+void SetHTTPGetCallback( MiniServerRequestCallback callback )
 {
     gGetCallback = callback;
 }
 
-MiniServerCallback GetHTTPGetCallback( void )
+MiniServerRequestCallback GetHTTPGetCallback( void )
 {
     return gGetCallback;
 }
 
-void SetSoapCallback( MiniServerCallback callback )
+void SetSoapCallback( MiniServerRequestCallback callback )
 {
     gSoapCallback = callback;
 }
 
-MiniServerCallback GetSoapCallback( void )
+MiniServerRequestCallback GetSoapCallback( void )
 {
     return gSoapCallback;
 }
 
-void SetGenaCallback( MiniServerCallback callback )
+void SetGenaCallback( MiniServerRequestCallback callback )
 {
     gGenaCallback = callback;
 }
 
-MiniServerCallback GetGenaCallback( void )
+MiniServerRequestCallback GetGenaCallback( void )
 {
     return gGenaCallback;
 }
 
 
-class NetReader1
-{
-public:
-    NetReader1( int socketfd );
-    virtual ~NetReader1();
-
-	// throws MiniServerReadException.RCODE_TIMEDOUT
-    int getChar( char& c );
-
-	// throws MiniServerReadException.RCODE_TIMEDOUT
-    int getLine( xstring& s, bool& newlineNotFound );
-
-	// throws MiniServerReadException.RCODE_TIMEDOUT
-    int readData( void* buf, size_t bufferLen );
-    
-    int getMaxBufSize() const
-        { return maxbufsize; }
-    
-private:
-    bool bufferHasData() const
-    { return offset < buflen; }
- 
-	// throws MiniServerReadException.RCODE_TIMEDOUT
-    ssize_t refillBuffer();
-
-private:
-    enum { MAX_BUFFER_SIZE = 1024 * 2 };
-
-private:
-    int sockfd;
-    char data[MAX_BUFFER_SIZE + 1]; // extra byte for null terminator
-    int offset;
-    int buflen;
-    int maxbufsize;
-};
-
-NetReader1::NetReader1( int socketfd )
-{
-    sockfd = socketfd;
-    offset = 0;
-    maxbufsize = MAX_BUFFER_SIZE;
-    buflen = 0;
-    data[maxbufsize] = 0;
-}
-
-NetReader1::~NetReader1()
-{
-
-}
-
-int NetReader1::getChar( char& c )
-{
-    int status;
-    
-    if ( !bufferHasData() )
-    {
-        status = refillBuffer();
-        
-        if ( status <= 0 )
-            return status;
-            
-        if ( !bufferHasData() )
-            return 0;
-    }
-        
-    c = data[offset];
-    offset++;
-    
-    return 1;   // length of data returned
-}
-
-int NetReader1::getLine( xstring& s, bool& newlineNotFound )
-{
-    int startOffset;
-    char c;
-    int status;
-    bool crFound;
-        
-    startOffset = offset;
-    
-    s = "";
-    
-    newlineNotFound = false;
-    crFound = false;
-    while ( true )
-    {
-        status = getChar( c );
-        
-        if ( status == 0 )
-        {
-            // no more chars in stream
-            newlineNotFound = true;
-            return s.length();
-        }
-        
-        if ( status < 0 )
-        {
-            // some kind of error
-            return status;
-        }
-        
-        s += c;
-        
-        if ( c == 0xA )
-        {
-            return s.length();
-        }
-        else if ( c == 0xD )            // CR
-        {
-            crFound = true;
-        }
-        else
-        {
-            // wanted to see LF after CR; error
-            if ( crFound )
-            {
-                newlineNotFound = true;
-                return s.length();
-            }
-        }
-    }
-    
-    return 0;
-}
-
-// read data
-int NetReader1::readData( void* buf, size_t bufferLen )
-{
-    int status;
-    int copyLen;
-    size_t dataLeft;    // size of data left in buffer
-    
-    if ( bufferLen <= 0 )
-        return 0;
-    
-    // refill empty buffer  
-    if ( !bufferHasData() )
-    {
-        status = refillBuffer();
-        
-        if ( status <= 0 )
-            return status;
-            
-        if ( !bufferHasData() )
-            return 0;
-            
-        dataLeft = buflen;
-    }
-    else
-    {
-        dataLeft = buflen - offset;
-    }
-    
-    if ( bufferLen < dataLeft )
-    {
-        copyLen = bufferLen;
-    }
-    else
-    {
-        copyLen = dataLeft;
-    }
-    
-    memcpy( buf, &data[offset], copyLen );
-    
-    offset += copyLen;
-    
-    return copyLen;
-}
-
 // throws MiniServerReadException.RCODE_TIMEDOUT
 static int SocketRead( int sockfd, char* buffer, size_t bufsize,
     int timeoutSecs )
@@ -341,199 +179,84 @@ static int SocketRead( int sockfd, char* buffer, size_t bufsize,
 
 }
 
-ssize_t NetReader1::refillBuffer()
-{
-    ssize_t numRead;
-
-    // old code
-    // numRead = read( sockfd, data, maxbufsize );
-    ///////
-
-    numRead = SocketRead( sockfd, data, maxbufsize, TIMEOUT_SECS );
-
-    if ( numRead >= 0 )
-    {
-        buflen = numRead;
-    }
-    else
-    {
-        buflen = 0;
-    }
-    
-    offset = 0;
-        
-    return numRead;
-}
-
-
 static void WriteNetData( const char* s, int sockfd )
 {
     write( sockfd, s, strlen(s) );
 }
     
-// determines type of UPNP command from request line, ln
-static HTTP_COMMAND_TYPE GetCommandType( const xstring& ln )
+// determines type of UPNP command from the request method
+static HTTP_COMMAND_TYPE GetCommandType( int method )
 {
     // commands GET, POST, M-POST, SUBSCRIBE, UNSUBSCRIBE, NOTIFY
-    
-    xstring line = ln;
-    int i;
-    char c;
-    
-    char * getStr = "GET";
-    char * postStr = "POST";
-    char * mpostStr = "M-POST";
-    char * subscribeStr = "SUBSCRIBE";
-    char * unsubscribeStr = "UNSUBSCRIBE";
-    char * notifyStr = "NOTIFY";
-    char * pattern;
-    HTTP_COMMAND_TYPE retCode=CMD_HTTP_UNKNOWN;
-    
-    try
+    switch ( method )
     {
-        line.toUppercase();
-    
-        c = line[0];
-        
-        switch (c)
-        {
-            case 'G':
-                pattern = getStr;
-                retCode = CMD_HTTP_GET;
-                break;
-                
-            case 'P':
-                pattern = postStr;
-                retCode = CMD_SOAP_POST;
-                break;
-                
-            case 'M':
-                pattern = mpostStr;
-                retCode = CMD_SOAP_MPOST;
-                break;
-                
-            case 'S':
-                pattern = subscribeStr;
-                retCode = CMD_GENA_SUBSCRIBE;
-                break;
-                
-            case 'U':
-                pattern = unsubscribeStr;
-                retCode = CMD_GENA_UNSUBSCRIBE;
-                break;
-                
-            case 'N':
-                pattern = notifyStr;
-                retCode = CMD_GENA_NOTIFY;
-                break;
+        case HTTP_GET:
+            return CMD_HTTP_GET;
             
-            default:
-                // unknown method
-                throw -1;
-                
-        }
-        
-        int patLength = strlen( pattern );
-        
-        for ( i = 1; i < patLength; i++ )
-        {
-            if ( line[i] != pattern[i] )
-                throw -1;
-        }
-    }
-    catch ( OutOfBoundsException& e )
-    {
-        return CMD_HTTP_UNKNOWN;
-    }
-    catch ( int parseCode )
-    {
-        if ( parseCode == -1 )
-        {
+        case UPNP_POST:
+            return CMD_SOAP_POST;
+            
+        case UPNP_MPOST:
+            return CMD_SOAP_MPOST;
+            
+        case UPNP_SUBSCRIBE:
+            return CMD_GENA_SUBSCRIBE;
+            
+        case UPNP_UNSUBSCRIBE:
+            return CMD_GENA_UNSUBSCRIBE;
+            
+        case UPNP_NOTIFY:
+            return CMD_GENA_NOTIFY;
+            
+        default:
             return CMD_HTTP_UNKNOWN;
-        }
     }
-    
-    return retCode;
 }
 
-static int ParseContentLength( const xstring& textLine, bool& malformed )
+// finds the SOAPACTION header of a parsed request in buf; it may be
+//  NN-SOAPACTION in an M-POST
+// returns NULL if there is none
+static const HttpHeaderRef* FindSoapAction( const char* buf,
+    const HttpParser& parser )
 {
-    xstring line;
-    xstring asciiNum;
-    char *pattern = "CONTENT-LENGTH";
-    int patlen = strlen( pattern );
+    const char* name = "SOAPACTION";
+    int namelen = strlen( name );
+    const HttpHeaderRef* action;
     int i;
-    int contentLength;
-    
-    malformed = false;
-    
-    contentLength = -1;
-    line = textLine;
-    line.toUppercase();
     
-    if ( strncmp(line.c_str(), pattern, patlen) != 0 )
+    action = http_FindHeader( &parser, HDR_UPNP_SOAPACTION );
+    for ( i = 0; action == NULL && i < parser.numHeaders; i++ )
     {
-        // unknown header
-        return -1;
-    }
-    
-    i = patlen;
-    
-    try
-    {
-        // skip whitespace
-        while ( line[i] == ' ' || line [i] == '\t' )
-        {
-            i++;
-        }
+        const HttpHeaderRef* header = &parser.headers[i];
+        const char* hname = &buf[header->nameStart];
         
-        // ":"
-        if ( line[i] != ':' )
+        if ( header->id == HDR_UNKNOWN &&
+             header->nameLen == namelen + 3 && hname[2] == '-' &&
+             strncasecmp(&hname[3], name, namelen) == 0 )
         {
-            throw -1;
-        }
-        i++;
-        
-        char* invalidChar = NULL;
-        
-        contentLength = strtol( &line[i], &invalidChar, 10 );
-        // anything other than crlf or whitespace after number is invalid
-        if ( *invalidChar != '\0' )
-        {
-            // see if there is an invalid number
-            while ( *invalidChar )
-            {
-                char c;
-                
-                c = *invalidChar;
-                
-                if ( !(c == ' ' || c == '\t' || c == '\r' || c == '\n') )
-                {
-                    // invalid char in number
-                    throw -1;
-                }
-                
-                invalidChar++;
-            }
+            action = header;
         }
     }
-    catch ( OutOfBoundsException& e )
+    
+    return action;
+}
+
+// length of the parsed request, headers and body
+// returns -1 if it is over MINISERVER_MAX_REQUEST_BYTES; the length
+//  is checked before it is summed, so a huge CONTENT-LENGTH can not
+//  overflow it
+static int RequestLength( const HttpParser& parser )
+{
+    if ( parser.contentLength > MINISERVER_MAX_REQUEST_BYTES -
+         parser.headerLen )
     {
-        malformed = true;
         return -1;
     }
-    catch ( int errCode )
-    {
-        if ( errCode == -1 )
-        {
-            malformed = true;
-            return -1;
-        }
-    }
-    
-    return contentLength;   
+    return parser.headerLen +
+        (parser.contentLength > 0 ? parser.contentLength : 0);
 }
 
+// parser is initialized by the caller, who frees it
 // throws 
 //	OutOfMemoryException
 //	MiniServerReadException
@@ -541,96 +264,68 @@ static int ParseContentLength( const xstring& textLine, bool& malformed )
 //		RCODE_MALFORMED_LINE
 //		RCODE_METHOD_NOT_IMPLEMENTED 
 //		RCODE_LENGTH_NOT_SPECIFIED
+//		RCODE_REQUEST_TOO_LARGE
 static void ReadRequest( int sockfd, xstring& document,
-    HTTP_COMMAND_TYPE& command )
+    HTTP_COMMAND_TYPE& command, HttpParser& parser )
 {
-    NetReader1 reader( sockfd );
-    xstring reqLine;
-    xstring line;
-    bool newlineNotFound;
+    const int BUFSIZE = 2 * 1024;
+    char buf[ BUFSIZE + 1 ];
     int status;
+    int numRead;
+    int reqLen;
     HTTP_COMMAND_TYPE cmd;
-    int contentLength;
-    const int BUFSIZE = 3;
-    char buf[ BUFSIZE + 1 ];
     MiniServerReadException excep;
     
     document = "";
     
-    // read request-line
-    status = reader.getLine( reqLine, newlineNotFound );
-    
-    if ( status < 0 )
-    {
-        // read error
-        excep.setErrorCode( RCODE_NETWORK_READ_ERROR );
-        throw excep;
-    }
-    
-    if ( newlineNotFound )
-    {
-        // format error
-        excep.setErrorCode( RCODE_MALFORMED_LINE );
-        throw excep;
-    }
-        
-    cmd = GetCommandType( reqLine );
-    
-    if ( cmd == CMD_HTTP_UNKNOWN )
-    {
-        // unknown or unsupported cmd
-        excep.setErrorCode( RCODE_METHOD_NOT_IMPLEMENTED );
-        throw excep;
-    }
-    
-    document += reqLine;
-    
-    contentLength = -1;     // init
-    
-    // read headers
+    // read request-line and headers
     while ( true )
     {
-        status = reader.getLine( line, newlineNotFound );
-        
-        if ( status < 0 )
+        status = http_ParseMessage( &parser, document.c_str(),
+            document.length() );
+        if ( status == HTTP_PARSE_DONE )
         {
-            // network error
-            excep.setErrorCode( RCODE_NETWORK_READ_ERROR );
-            throw excep;
-        }   
-        
-        if ( newlineNotFound )
+            break;
+        }
+        if ( status == HTTP_PARSE_ERROR )
         {
-            // bad format
             excep.setErrorCode( RCODE_MALFORMED_LINE );
             throw excep;
         }
-        
-        // get content-length if not obtained already
-        if ( contentLength < 0 )
+        if ( (int)document.length() >= MINISERVER_MAX_REQUEST_BYTES )
         {
-            bool malformed;
-            
-            contentLength = ParseContentLength( line, malformed );
-            
-            if ( malformed )
-            {
-                excep.setErrorCode( RCODE_MALFORMED_LINE );
-                throw excep;
-            }
+            excep.setErrorCode( RCODE_REQUEST_TOO_LARGE );
+            throw excep;
         }
         
-        document += line;
-        
-        // done ?
-        if ( line == "\n" || line == "\r\n" )
+        numRead = SocketRead( sockfd, buf, BUFSIZE, TIMEOUT_SECS );
+        if ( numRead < 0 )
         {
-            break;
+            // network error
+            excep.setErrorCode( RCODE_NETWORK_READ_ERROR );
+            throw excep;
         }
+        if ( numRead == 0 )
+        {
+            // stream ended in the headers
+            excep.setErrorCode( RCODE_MALFORMED_LINE );
+            throw excep;
+        }
+        buf[ numRead ] = 0;
+        document.appendLimited( buf, numRead );
+    }
+        
+    cmd = parser.isRequest ? GetCommandType( parser.method ) :
+        CMD_HTTP_UNKNOWN;
+    if ( cmd == CMD_HTTP_UNKNOWN )
+    {
+        // unknown or unsupported cmd
+        excep.setErrorCode( RCODE_METHOD_NOT_IMPLEMENTED );
+        throw excep;
     }
     
     // must have body for POST and M-POST msgs
-    if ( contentLength < 0 &&
+    if ( parser.contentLength < 0 &&
          (cmd == CMD_SOAP_POST || cmd == CMD_SOAP_MPOST)
        )
     {
@@ -639,41 +334,35 @@ static void ReadRequest( int sockfd, xstring& document,
         throw excep;
     }
     
-    if ( contentLength > 0 )
+    // read rest of body
+    reqLen = RequestLength( parser );
+    if ( reqLen < 0 )
     {
-        int totalBytesRead = 0;
-        
-        // read body
-        while ( true )
+        excep.setErrorCode( RCODE_REQUEST_TOO_LARGE );
+        throw excep;
+    }
+    while ( document.length() < reqLen )
+    {
+        numRead = SocketRead( sockfd, buf, BUFSIZE, TIMEOUT_SECS );
+        if ( numRead == 0 )
         {
-            int bytesRead;
-            
-            bytesRead = reader.readData( buf, BUFSIZE );
- 
-            if ( bytesRead > 0 )
-            {
-                buf[ bytesRead ] = 0;   // null terminate string
-                document.appendLimited( buf, bytesRead );
-                totalBytesRead += bytesRead;
-                
-                if ( totalBytesRead >= contentLength )
-                {
-                    // done reading data
-                    break;
-                }
-            }
-            else if ( bytesRead == 0 )
-            {
-                // done
-                break;
-            }
-            else
-            {
-                // error reading
-                excep.setErrorCode( RCODE_NETWORK_READ_ERROR );
-                throw excep;
-            }
+            // done
+            break;
         }
+        if ( numRead < 0 )
+        {
+            // error reading
+            excep.setErrorCode( RCODE_NETWORK_READ_ERROR );
+            throw excep;
+        }
+        buf[ numRead ] = 0;   // null terminate string
+        document.appendLimited( buf, numRead );
+    }
+    
+    // nothing after the request is answered on this connection
+    if ( document.length() > reqLen )
+    {
+        document.deleteSubstring( reqLen, document.length() - reqLen );
     }
     
     command = cmd;
@@ -705,6 +394,10 @@ static void HandleError( int errCode, int sockfd )
         errMsg = "405 Method Not Allowed";
         break;
 
+    case RCODE_REQUEST_TOO_LARGE:
+        errMsg = "413 Request Entity Too Large";
+        break;
+
     case RCODE_INTERNAL_SERVER_ERROR:
         errMsg = "500 Internal Server Error";
         break;
@@ -726,9 +419,10 @@ static void HandleError( int errCode, int sockfd )
         
     xstring msg;
     
+    // a length ends the response on a connection that is kept
     msg = "HTTP/1.1 ";
     msg += errMsg;
-    msg += "\r\n\r\n";
+    msg += "\r\nCONTENT-LENGTH: 0\r\n\r\n";
     
     // send msg
     WriteNetData( msg.c_str(), sockfd );
@@ -747,15 +441,19 @@ static void HandleError( int errCode, int sockfd )
 
 // throws MiniServerReadException.RCODE_METHOD_NOT_IMPLEMENTED
 static void MultiplexCommand( HTTP_COMMAND_TYPE cmd, const xstring& document,
-        int sockfd )
+        const HttpParser& parser, int sockfd )
 {
-    MiniServerCallback callback;
+    MiniServerRequestCallback callback;
+    MiniServerRequest request;
+    const HttpHeaderRef* action = NULL;
+    const char* doc = document.c_str();
     
     switch ( cmd )
     {
     case CMD_SOAP_POST:
     case CMD_SOAP_MPOST:
         callback = gSoapCallback;
+        action = FindSoapAction( doc, parser );
         break;
             
     case CMD_GENA_NOTIFY:
@@ -781,7 +479,19 @@ static void MultiplexCommand( HTTP_COMMAND_TYPE cmd, const xstring& document,
         throw e;
     }
     
-    callback( document.c_str(), sockfd );
+    // hand over the parse done while reading; handlers do not parse
+    //  the request again
+    request.document = doc;
+    request.documentLen = document.length();
+    request.parser = &parser;
+    request.uri = &doc[parser.uriStart];
+    request.uriLen = parser.uriLen;
+    request.soapAction = action == NULL ? NULL : &doc[action->valueStart];
+    request.soapActionLen = action == NULL ? 0 : action->valueLen;
+    request.body = &doc[parser.headerLen];
+    request.bodyLen = request.documentLen - parser.headerLen;
+    
+    callback( &request, sockfd );
 }
 
 static void HandleRequest( void *args )
@@ -789,15 +499,17 @@ static void HandleRequest( void *args )
     int sockfd;
     xstring document;
     HTTP_COMMAND_TYPE cmd;
+    HttpParser parser;
     
     sockfd = (long) args;
+    http_ParserInit( &parser );
     
     try
     {
-        ReadRequest( sockfd, document, cmd );
+        ReadRequest( sockfd, document, cmd, parser );
         
         // pass data to callback
-        MultiplexCommand( cmd, document, sockfd );
+        MultiplexCommand( cmd, document, parser, sockfd );
         
         //printf( "input document:\n%s\n", document.c_str() );
     }
@@ -820,8 +532,541 @@ static void HandleRequest( void *args )
 		        "HandleRequest(): unknown error\n"); )
 		close( sockfd );
 	}
+    
+    http_ParserFree( &parser );
+}
+
+
+#if MINISERVER_REACTOR
+
+// initial size of a connection's read buffer
+#define CONN_BUFFER_SIZE 2048
+
+// max events returned by one epoll_wait()
+#define MAX_EPOLL_EVENTS 64
+
+// a client connection watched by the reactor; owned by the reactor
+// thread while armed in epoll, and by a pool thread while busy
+struct MiniServerConn
+{
+    int sockfd;
+    int epollfd;            // reactor the connection belongs to
+    char* buf;              // bytes read and not yet handed out
+    int buflen;
+    int bufsize;
+    HttpParser parser;      // request at the head of buf
+    HTTP_COMMAND_TYPE cmd;
+    bool keepAlive;
+    bool busy;
+    time_t lastActive;
+    MiniServerConn* prev;
+    MiniServerConn* next;
+};
+
+static int gEpollFd = -1;
+static MiniServerConn* gConnList = NULL;
+// protects gEpollFd, gConnList and the busy flag of the connections
+static pthread_mutex_t gConnMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void ResetConnRequest( MiniServerConn* conn )
+{
+    http_ParserInit( &conn->parser );
+    conn->cmd = CMD_HTTP_UNKNOWN;
+    conn->keepAlive = false;
+}
+
+// parses the request buffered so far; picks up where the last call
+//  stopped, so every byte is looked at once
+// returns:
+//   1: a complete request is buffered
+//   0: more data needed
+//   RCODE_XXX on error
+static int ParseConnRequest( MiniServerConn* conn )
+{
+    HttpParser* parser = &conn->parser;
+    int status;
+    int reqLen;
+    
+    if ( parser->state != HTTP_PARSER_DONE )
+    {
+        status = http_ParseMessage( parser, conn->buf, conn->buflen );
+        if ( status == HTTP_PARSE_INCOMPLETE )
+        {
+            if ( conn->buflen >= MINISERVER_MAX_REQUEST_BYTES )
+            {
+                return RCODE_REQUEST_TOO_LARGE;
+            }
+            return 0;   // headers not complete
+        }
+        if ( status == HTTP_PARSE_ERROR || !parser->isRequest )
+        {
+            return RCODE_MALFORMED_LINE;
+        }
+        
+        conn->cmd = GetCommandType( parser->method );
+        if ( conn->cmd == CMD_HTTP_UNKNOWN )
+        {
+            return RCODE_METHOD_NOT_IMPLEMENTED;
+        }
+        
+        // every handler answers with a length, so any HTTP/1.1
+        //  request can share the connection
+        conn->keepAlive = parser->majorVersion == 1 &&
+            parser->minorVersion >= 1 && !parser->connectionClose;
+    }
+    
+    // must have body for POST and M-POST msgs
+    if ( parser->contentLength < 0 &&
+         (conn->cmd == CMD_SOAP_POST || conn->cmd == CMD_SOAP_MPOST)
+       )
+    {
+        return RCODE_LENGTH_NOT_SPECIFIED;
+    }
+
+    reqLen = RequestLength( *parser );
+    if ( reqLen < 0 )
+    {
+        return RCODE_REQUEST_TOO_LARGE;
+    }
+    if ( conn->buflen < reqLen )
+    {
+        return 0;   // body not complete
+    }
+    
+    return 1;
+}
+
+// moves the complete request at the head of the buffer into document;
+//  ParseConnRequest() has checked its length
+static void TakeConnRequest( MiniServerConn* conn, xstring& document,
+    HttpParser& parser, HTTP_COMMAND_TYPE& cmd, bool& keepAlive )
+{
+    int reqLen;
+
+    reqLen = RequestLength( conn->parser );
+    
+    document = "";
+    document.appendLimited( conn->buf, reqLen );
+    http_ParserMove( &parser, &conn->parser );
+    cmd = conn->cmd;
+    keepAlive = conn->keepAlive;
+    
+    // keep pipelined data
+    conn->buflen -= reqLen;
+    memmove( conn->buf, &conn->buf[reqLen], conn->buflen );
+    conn->buf[conn->buflen] = 0;
+    ResetConnRequest( conn );
+}
+
+// unlinks conn from the connection list; gConnMutex must be held
+static void UnlinkConn( MiniServerConn* conn )
+{
+    if ( conn->prev != NULL )
+        conn->prev->next = conn->next;
+    else
+        gConnList = conn->next;
+    if ( conn->next != NULL )
+        conn->next->prev = conn->prev;
+    conn->prev = conn->next = NULL;
+}
+
+static void FreeConn( MiniServerConn* conn )
+{
+    http_ParserFree( &conn->parser );
+    free( conn->buf );
+    free( conn );
+}
+
+static void CloseConn( MiniServerConn* conn )
+{
+    pthread_mutex_lock( &gConnMutex );
+    UnlinkConn( conn );
+    pthread_mutex_unlock( &gConnMutex );
+    
+    close( conn->sockfd );
+    FreeConn( conn );
+}
+
+// arms conn for its next read event
+// returns false if the reactor is gone; conn is closed in that case
+static bool ArmConn( MiniServerConn* conn )
+{
+    epoll_event ev;
+    int code = -1;
+    
+    pthread_mutex_lock( &gConnMutex );
+    conn->busy = false;
+    time( &conn->lastActive );
+    if ( gMServState == MSERV_RUNNING && conn->epollfd == gEpollFd )
+    {
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        code = epoll_ctl( gEpollFd, EPOLL_CTL_MOD, conn->sockfd, &ev );
+    }
+    pthread_mutex_unlock( &gConnMutex );
+    
+    if ( code == -1 )
+    {
+        CloseConn( conn );
+        return false;
+    }
+    return true;
+}
+
+// pool thread: serves the buffered request(s) of a busy connection
+static void HandleConnRequest( void *args )
+{
+    MiniServerConn* conn = (MiniServerConn*) args;
+    xstring document;
+    HttpParser parser;
+    HTTP_COMMAND_TYPE cmd;
+    bool keepAlive;
+    int sockfd;
+    int status;
+    
+    while ( true )
+    {
+        TakeConnRequest( conn, document, parser, cmd, keepAlive );
+        
+        // handlers close the socket they are given when they are
+        //  done, so a persistent connection gives them a duplicate
+        sockfd = -1;
+        if ( keepAlive )
+        {
+            sockfd = dup( conn->sockfd );
+        }
+        if ( sockfd == -1 )
+        {
+            keepAlive = false;
+            sockfd = conn->sockfd;
+            
+            pthread_mutex_lock( &gConnMutex );
+            UnlinkConn( conn );
+            pthread_mutex_unlock( &gConnMutex );
+            FreeConn( conn );
+            conn = NULL;
+        }
+        
+        try
+        {
+            MultiplexCommand( cmd, document, parser, sockfd );
+        }
+        catch ( MiniServerReadException& e )
+        {
+            DBG(
+                UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
+                    "error code = %d\n", e.getErrorCode()); )
+
+            HandleError( e.getErrorCode(), sockfd );
+            close( sockfd );
+        }
+        catch ( ... )
+        {
+            DBG(
+                UpnpPrintf( UPNP_CRITICAL, MSERV, __FILE__, __LINE__,
+                    "HandleConnRequest(): unknown error\n"); )
+            close( sockfd );
+        }
+        http_ParserFree( &parser );
+        
+        if ( !keepAlive )
+        {
+            return;
+        }
+        
+        // a pipelined request may already be buffered
+        status = ParseConnRequest( conn );
+        if ( status == 0 )
+        {
+            ArmConn( conn );
+            return;
+        }
+        if ( status < 0 )
+        {
+            HandleError( status, conn->sockfd );
+            CloseConn( conn );
+            return;
+        }
+    }
+}
+
+// accepts all pending connections on listenfd
+static void AcceptConns( int listenfd )
+{
+    while ( true )
+    {
+        sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof( clientAddr );
+        MiniServerConn* conn;
+        epoll_event ev;
+        int connectfd;
+        
+        connectfd = accept( listenfd, (sockaddr*) &clientAddr, &clientLen );
+        if ( connectfd == -1 )
+        {
+            if ( errno == EINTR )
+                continue;
+            // EAGAIN: none left; anything else is retried on the
+            //  next wakeup
+            return;
+        }
+        
+        conn = (MiniServerConn*) malloc( sizeof(MiniServerConn) );
+        if ( conn != NULL )
+        {
+            conn->buf = (char *) malloc( CONN_BUFFER_SIZE );
+        }
+        if ( conn == NULL || conn->buf == NULL )
+        {
+            free( conn );
+            HandleError( RCODE_INTERNAL_SERVER_ERROR, connectfd );
+            close( connectfd );
+            continue;
+        }
+        
+        conn->sockfd = connectfd;
+        conn->epollfd = gEpollFd;
+        conn->buflen = 0;
+        conn->bufsize = CONN_BUFFER_SIZE;
+        conn->busy = false;
+        time( &conn->lastActive );
+        ResetConnRequest( conn );
+        
+        pthread_mutex_lock( &gConnMutex );
+        conn->prev = NULL;
+        conn->next = gConnList;
+        if ( gConnList != NULL )
+            gConnList->prev = conn;
+        gConnList = conn;
+        pthread_mutex_unlock( &gConnMutex );
+        
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if ( epoll_ctl( gEpollFd, EPOLL_CTL_ADD, connectfd, &ev ) == -1 )
+        {
+            CloseConn( conn );
+        }
+    }
 }
 
+// scheduling class for a parsed request: SOAP control first, then
+//  GENA; description and other GETs come with discovery
+static TPoolPriority ConnPriority( MiniServerConn* conn )
+{
+    switch ( conn->cmd )
+    {
+        case CMD_SOAP_POST:
+        case CMD_SOAP_MPOST:
+            return TPOOL_CONTROL;
+        
+        case CMD_GENA_SUBSCRIBE:
+        case CMD_GENA_UNSUBSCRIBE:
+        case CMD_GENA_NOTIFY:
+            return TPOOL_EVENTING;
+        
+        default:
+            return TPOOL_DISCOVERY;
+    }
+}
+
+// reactor thread: reads what arrived on conn and hands a complete
+//  request to the thread pool
+static void ReadConn( MiniServerConn* conn )
+{
+    int numRead;
+    int status;
+    
+    // keep a byte for the null terminator; a request is never longer
+    //  than MINISERVER_MAX_REQUEST_BYTES, so neither is the buffer
+    if ( conn->buflen + 1 >= conn->bufsize )
+    {
+        int newsize = conn->bufsize * 2;
+        char* newbuf;
+
+        if ( newsize > MINISERVER_MAX_REQUEST_BYTES + 1 )
+        {
+            newsize = MINISERVER_MAX_REQUEST_BYTES + 1;
+        }
+        if ( newsize <= conn->bufsize )
+        {
+            HandleError( RCODE_REQUEST_TOO_LARGE, conn->sockfd );
+            CloseConn( conn );
+            return;
+        }
+        newbuf = (char *) realloc( conn->buf, newsize );
+        if ( newbuf == NULL )
+        {
+            HandleError( RCODE_INTERNAL_SERVER_ERROR, conn->sockfd );
+            CloseConn( conn );
+            return;
+        }
+        conn->buf = newbuf;
+        conn->bufsize = newsize;
+    }
+    
+    numRead = read( conn->sockfd, &conn->buf[conn->buflen],
+        conn->bufsize - conn->buflen - 1 );
+    if ( numRead <= 0 )
+    {
+        if ( numRead == -1 && errno == EINTR )
+        {
+            ArmConn( conn );
+        }
+        else
+        {
+            // closed by client or network error
+            CloseConn( conn );
+        }
+        return;
+    }
+    conn->buflen += numRead;
+    conn->buf[conn->buflen] = 0;    // xstring appends use strlen()
+    
+    status = ParseConnRequest( conn );
+    if ( status == 0 )
+    {
+        ArmConn( conn );
+        return;
+    }
+    if ( status < 0 )
+    {
+        HandleError( status, conn->sockfd );
+        CloseConn( conn );
+        return;
+    }
+    
+    pthread_mutex_lock( &gConnMutex );
+    conn->busy = true;
+    pthread_mutex_unlock( &gConnMutex );
+    
+    if ( tpool_ScheduleWithPriority( ConnPriority( conn ),
+            HandleConnRequest, conn ) < 0 )
+    {
+        HandleError( RCODE_INTERNAL_SERVER_ERROR, conn->sockfd );
+        CloseConn( conn );
+    }
+}
+
+// closes connections that have been idle too long; a partly read
+//  request gets the same timeout as a blocking read
+static void SweepConns()
+{
+    MiniServerConn* conn;
+    MiniServerConn* next;
+    time_t now;
+    
+    time( &now );
+    
+    pthread_mutex_lock( &gConnMutex );
+    for ( conn = gConnList; conn != NULL; conn = next )
+    {
+        next = conn->next;
+        
+        if ( conn->busy )
+            continue;
+        if ( now - conn->lastActive <
+             (conn->buflen > 0 ? TIMEOUT_SECS : MINISERVER_KEEPALIVE_TIMEOUT) )
+            continue;
+        
+        UnlinkConn( conn );
+        close( conn->sockfd );
+        FreeConn( conn );
+    }
+    pthread_mutex_unlock( &gConnMutex );
+}
+
+// runs the epoll reactor on listenfd until the server is stopped
+// returns -1 if epoll could not be set up (nothing is changed then)
+static int RunMiniServerReactor( int listenfd )
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    epoll_event ev;
+    MiniServerConn* conn;
+    MiniServerConn* next;
+    time_t lastSweep;
+    int epollfd;
+    int numEvents;
+    int i;
+    
+    epollfd = epoll_create( MAX_EPOLL_EVENTS );
+    if ( epollfd == -1 )
+    {
+        return -1;
+    }
+    
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;     // NULL marks the listening socket
+    if ( epoll_ctl( epollfd, EPOLL_CTL_ADD, listenfd, &ev ) == -1 )
+    {
+        close( epollfd );
+        return -1;
+    }
+    fcntl( listenfd, F_SETFL, fcntl( listenfd, F_GETFL, 0 ) | O_NONBLOCK );
+    
+    pthread_mutex_lock( &gConnMutex );
+    gEpollFd = epollfd;
+    pthread_mutex_unlock( &gConnMutex );
+    
+    gMServThread = pthread_self();
+    gMServState = MSERV_RUNNING;
+    
+    time( &lastSweep );
+    while ( gMServState != MSERV_STOPPING )
+    {
+        DBG(
+            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
+                "Waiting...\n" ); )
+        
+        numEvents = epoll_wait( epollfd, events, MAX_EPOLL_EVENTS, 1000 );
+        
+        for ( i = 0; i < numEvents; i++ )
+        {
+            if ( events[i].data.ptr == NULL )
+            {
+                AcceptConns( listenfd );
+            }
+            else
+            {
+                ReadConn( (MiniServerConn*) events[i].data.ptr );
+            }
+        }
+        
+        if ( time(NULL) != lastSweep )
+        {
+            SweepConns();
+            time( &lastSweep );
+        }
+    }
+    
+    DBG(
+        UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
+            "Miniserver: recvd STOP signal\n"); )
+    
+    // busy connections are closed by their pool threads
+    pthread_mutex_lock( &gConnMutex );
+    for ( conn = gConnList; conn != NULL; conn = next )
+    {
+        next = conn->next;
+        if ( !conn->busy )
+        {
+            UnlinkConn( conn );
+            close( conn->sockfd );
+            FreeConn( conn );
+        }
+    }
+    gEpollFd = -1;
+    pthread_mutex_unlock( &gConnMutex );
+    
+    close( epollfd );
+    close( listenfd );
+    
+    gMServState = MSERV_IDLE;
+    gMServThread = 0;
+    
+    return 0;
+}
+
+#endif /* MINISERVER_REACTOR */
 
 static void RunMiniServer( void* args )
 {
@@ -830,6 +1075,14 @@ static void RunMiniServer( void* args )
 
     listenfd = (long)args;   
 
+#if MINISERVER_REACTOR
+    if ( RunMiniServerReactor( listenfd ) == 0 )
+    {
+        return;
+    }
+    // no epoll; fall back to one pool thread per connection
+#endif
+
     gMServThread = pthread_self();
     gMServState = MSERV_RUNNING;
 
@@ -883,7 +1136,10 @@ static void RunMiniServer( void* args )
             
             int sched_stat;
 
-            sched_stat = tpool_Schedule( HandleRequest, (void*)connectfd );
+            // request type is not known until it is read; serve it
+            //  with the priority of control requests
+            sched_stat = tpool_ScheduleWithPriority( TPOOL_CONTROL,
+                HandleRequest, (void*)connectfd );
             if ( sched_stat < 0 )
             {
                 HandleError( RCODE_INTERNAL_SERVER_ERROR, connectfd );              
@@ -0,0 +1,829 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+// httpparser.cpp
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <genlib/net/http/parseutil.h>
+#include <genlib/net/http/httpparser.h>
+
+struct NameTableEntry
+{
+    const char* name;
+    int   id;
+};
+
+#define NUM_HEADERS 53
+
+static NameTableEntry HeaderNameTable[NUM_HEADERS] =
+{
+    { "ACCEPT",             HDR_ACCEPT },
+    { "ACCEPT-CHARSET",     HDR_ACCEPT_CHARSET },
+    { "ACCEPT-ENCODING",    HDR_ACCEPT_ENCODING },
+    { "ACCEPT-LANGUAGE",    HDR_ACCEPT_LANGUAGE },
+    { "ACCEPT-RANGES",      HDR_ACCEPT_RANGES },
+    { "AGE",                HDR_AGE },
+    { "ALLOW",              HDR_ALLOW },
+    { "AUTHORIZATION",      HDR_AUTHORIZATION },
+    
+    { "CACHE-CONTROL",      HDR_CACHE_CONTROL },
+    { "CALLBACK",           HDR_UPNP_CALLBACK },
+    { "CONNECTION",         HDR_CONNECTION },
+    { "CONTENT-ENCODING",   HDR_CONTENT_ENCODING },
+    { "CONTENT-LANGUAGE",   HDR_CONTENT_LANGUAGE },
+    { "CONTENT-LENGTH",     HDR_CONTENT_LENGTH },
+    { "CONTENT-LOCATION",   HDR_CONTENT_LOCATION },
+    { "CONTENT-MD5",        HDR_CONTENT_MD5 },
+    { "CONTENT-RANGE",      HDR_CONTENT_RANGE },
+    { "CONTENT-TYPE",       HDR_CONTENT_TYPE },
+    
+    { "DATE",               HDR_DATE },
+    
+    { "ETAG",               HDR_ETAG },
+    { "EXPECT",             HDR_EXPECT },
+    { "EXPIRES",            HDR_EXPIRES },
+    
+    { "FROM",               HDR_FROM },
+    
+    { "HOST",               HDR_HOST },
+    
+    { "IF-MATCH",           HDR_IF_MATCH },
+    { "IF-MODIFIED-SINCE",  HDR_IF_MODIFIED_SINCE },
+    { "IF-NONE-MATCH",      HDR_IF_NONE_MATCH },
+    { "IF-RANGE",           HDR_IF_RANGE },
+    { "IF-UNMODIFIED-SINCE",HDR_IF_UNMODIFIED_SINCE },
+    
+    { "LAST-MODIFIED",      HDR_LAST_MODIFIED },
+    { "LOCATION",           HDR_LOCATION },
+    
+    { "MAN",                HDR_UPNP_MAN },
+    { "MAX-FORWARDS",       HDR_MAX_FORWARDS },
+    
+    { "NT",                 HDR_UPNP_NT },
+    { "NTS",                HDR_UPNP_NTS },
+    
+    { "PRAGMA",             HDR_PRAGMA },
+    { "PROXY-AUTHENTICATE", HDR_PROXY_AUTHENTICATE },
+    { "PROXY-AUTHORIZATION",HDR_PROXY_AUTHORIZATION },
+    
+    { "RANGE",              HDR_RANGE },
+    { "REFERER",            HDR_REFERER },
+    
+    { "SERVER",             HDR_SERVER },
+    { "SID",                HDR_UPNP_SID },
+    { "SOAPACTION",         HDR_UPNP_SOAPACTION },
+    { "ST",                 HDR_UPNP_ST },
+    
+    { "TE",                 HDR_TE },
+    { "TRAILER",            HDR_TRAILER },
+    { "TRANSFER-ENCODING",  HDR_TRANSFER_ENCODING },
+    
+    { "USER-AGENT",         HDR_USER_AGENT },
+    { "USN",                HDR_UPNP_USN },
+    
+    { "VARY",               HDR_VARY },
+    { "VIA",                HDR_VIA },
+    
+    { "WARNING",            HDR_WARNING },
+    { "WWW-AUTHENTICATE",   HDR_WWW_AUTHENTICATE },
+};
+
+#define NUM_METHODS 8
+
+static NameTableEntry HttpMethodTable[NUM_METHODS] =
+{
+    { "GET",        HTTP_GET },
+    { "HEAD",       HTTP_HEAD },
+    { "M-POST",     UPNP_MPOST },
+    { "M-SEARCH",   UPNP_MSEARCH },
+    { "NOTIFY",     UPNP_NOTIFY },
+    { "POST",       UPNP_POST },
+    { "SUBSCRIBE",  UPNP_SUBSCRIBE },
+    { "UNSUBSCRIBE",UPNP_UNSUBSCRIBE },
+};
+
+////////////////////////////////////
+// header name lookup
+//
+// a perfect hash: the seed is picked when the library is loaded so
+//  that every name in HeaderNameTable has a slot of its own; a lookup
+//  is one hash and one compare
+
+#define HEADER_HASH_SIZE 256
+
+static signed char gHeaderSlots[HEADER_HASH_SIZE];     // -1 if empty
+static unsigned gHeaderHashSeed;
+
+// case-insensitive: 0x20 folds upper case letters and leaves '-' and
+//  digits alone
+static unsigned HeaderHash( const char* name, int len, unsigned seed )
+{
+    unsigned h = seed ^ (unsigned)len;
+    int i;
+    
+    for ( i = 0; i < len; i++ )
+    {
+        h = h * 31 + (unsigned char)(name[i] | 0x20);
+    }
+    h ^= h >> 11;
+    
+    return h % HEADER_HASH_SIZE;
+}
+
+static bool TryHeaderHashSeed( unsigned seed )
+{
+    int i;
+    unsigned slot;
+    
+    memset( gHeaderSlots, -1, sizeof(gHeaderSlots) );
+    for ( i = 0; i < NUM_HEADERS; i++ )
+    {
+        const char* name = HeaderNameTable[i].name;
+        
+        slot = HeaderHash( name, strlen(name), seed );
+        if ( gHeaderSlots[slot] != -1 )
+        {
+            return false;
+        }
+        gHeaderSlots[slot] = i;
+    }
+    gHeaderHashSeed = seed;
+    
+    return true;
+}
+
+class HeaderHashBuilder
+{
+public:
+    HeaderHashBuilder()
+    {
+        unsigned seed = 0;
+        
+        while ( !TryHeaderHashSeed(seed) )
+        {
+            seed++;
+            assert( seed != 0 );
+        }
+    }
+};
+
+static HeaderHashBuilder gHeaderHashBuilder;
+
+int http_HeaderNameToID( const char* name, int len )
+{
+    int index;
+    const char* entry;
+    
+    index = gHeaderSlots[ HeaderHash(name, len, gHeaderHashSeed) ];
+    if ( index < 0 )
+    {
+        return HDR_UNKNOWN;
+    }
+    
+    entry = HeaderNameTable[index].name;
+    if ( strncasecmp(name, entry, len) != 0 || entry[len] != '\0' )
+    {
+        return HDR_UNKNOWN;
+    }
+    
+    return HeaderNameTable[index].id;
+}
+
+static const char* IDToName( int id, NameTableEntry* table, int size )
+{
+    int i;
+    
+    for ( i = 0; i < size; i++ )
+    {
+        if ( table[i].id == id )
+        {
+            return table[i].name;
+        }
+    }
+    
+    return NULL;
+}
+
+const char* http_HeaderIDToName( int id )
+{
+    return IDToName( id, HeaderNameTable, NUM_HEADERS );
+}
+
+int http_MethodNameToID( const char* name, int len )
+{
+    int i;
+    const char* entry;
+    
+    for ( i = 0; i < NUM_METHODS; i++ )
+    {
+        entry = HttpMethodTable[i].name;
+        if ( strncmp(name, entry, len) == 0 && entry[len] == '\0' )
+        {
+            return HttpMethodTable[i].id;
+        }
+    }
+    
+    return HTTP_UNKNOWN_METHOD;
+}
+
+const char* http_MethodIDToName( int id )
+{
+    return IDToName( id, HttpMethodTable, NUM_METHODS );
+}
+
+////////////////////////////////////
+// parser
+
+static inline bool IsSpace( char c )
+{
+    return c == ' ' || c == '\t';
+}
+
+// a token char as in RFC 2616, section 2.2
+static inline bool IsTokenChar( char c )
+{
+    return c > ' ' && c < 127 && strchr( "()<>@,;:\\\"/[]?={}", c ) == NULL;
+}
+
+// reads a decimal number at s[*i]; moves *i past it
+// returns -1 if there is no number or it does not fit in an int
+static int ParseNumber( const char* s, int len, int* i )
+{
+    int num = 0;
+    int start = *i;
+    
+    while ( *i < len && s[*i] >= '0' && s[*i] <= '9' )
+    {
+        if ( num > (INT_MAX - 9) / 10 )
+        {
+            return -1;
+        }
+        num = num * 10 + (s[*i] - '0');
+        (*i)++;
+    }
+    
+    return *i == start ? -1 : num;
+}
+
+// HTTP/x.y at s[*i] of the line at buf[start]; moves *i past it
+static bool ParseVersion( HttpParser* parser, const char* buf, int start,
+    int len, int* i )
+{
+    const char* s = &buf[start];
+    int first = *i;
+    
+    if ( len - *i < 5 || strncasecmp(&s[*i], "HTTP/", 5) != 0 )
+    {
+        return false;
+    }
+    *i += 5;
+    
+    parser->majorVersion = ParseNumber( s, len, i );
+    if ( parser->majorVersion < 0 || *i >= len || s[*i] != '.' )
+    {
+        return false;
+    }
+    (*i)++;
+    
+    parser->minorVersion = ParseNumber( s, len, i );
+    parser->versionStart = start + first;
+    parser->versionLen = *i - first;
+    return parser->minorVersion >= 0;
+}
+
+// request-line or status-line in buf[start], len chars without CRLF
+static bool ParseStartLine( HttpParser* parser, const char* buf,
+    int start, int len )
+{
+    const char* s = &buf[start];
+    int i = 0;
+    
+    if ( len >= 5 && strncasecmp(s, "HTTP/", 5) == 0 )
+    {
+        // status-line
+        parser->isRequest = false;
+        if ( !ParseVersion(parser, buf, start, len, &i) || i >= len ||
+             !IsSpace(s[i]) )
+        {
+            return false;
+        }
+        while ( i < len && IsSpace(s[i]) )
+            i++;
+        
+        parser->statusStart = start + i;
+        parser->statusCode = ParseNumber( s, len, &i );
+        parser->statusLen = start + i - parser->statusStart;
+        if ( parser->statusCode < 0 || (i < len && !IsSpace(s[i])) )
+        {
+            return false;
+        }
+        while ( i < len && IsSpace(s[i]) )
+            i++;
+        
+        parser->reasonStart = start + i;
+        parser->reasonLen = len - i;
+        return true;
+    }
+    
+    // request-line: method
+    parser->isRequest = true;
+    while ( i < len && IsTokenChar(s[i]) )
+        i++;
+    if ( i == 0 || i >= len || !IsSpace(s[i]) )
+    {
+        return false;
+    }
+    parser->methodStart = start;
+    parser->methodLen = i;
+    parser->method = http_MethodNameToID( s, i );
+    
+    // request-URI
+    while ( i < len && IsSpace(s[i]) )
+        i++;
+    parser->uriStart = start + i;
+    while ( i < len && !IsSpace(s[i]) )
+        i++;
+    parser->uriLen = start + i - parser->uriStart;
+    if ( parser->uriLen == 0 || i >= len )
+    {
+        return false;
+    }
+    
+    // version
+    while ( i < len && IsSpace(s[i]) )
+        i++;
+    if ( !ParseVersion(parser, buf, start, len, &i) )
+    {
+        return false;
+    }
+    while ( i < len && IsSpace(s[i]) )
+        i++;
+    
+    return i == len;
+}
+
+// true if the comma separated list in s has the token, tok
+static bool ListHasToken( const char* s, int len, const char* tok )
+{
+    int toklen = strlen( tok );
+    int i = 0;
+    int start;
+    int end;
+    
+    while ( i < len )
+    {
+        while ( i < len && (IsSpace(s[i]) || s[i] == ',') )
+            i++;
+        start = i;
+        while ( i < len && s[i] != ',' && s[i] != ';' )
+            i++;
+        end = i;
+        while ( end > start && IsSpace(s[end-1]) )
+            end--;
+        if ( end - start == toklen &&
+             strncasecmp(&s[start], tok, toklen) == 0 )
+        {
+            return true;
+        }
+        while ( i < len && s[i] != ',' )
+            i++;
+    }
+    
+    return false;
+}
+
+// picks up the headers that frame the message
+static bool NoteHeader( HttpParser* parser, const char* buf,
+    const HttpHeaderRef* header )
+{
+    const char* value = &buf[header->valueStart];
+    int len = header->valueLen;
+    int i = 0;
+    int num;
+    
+    switch ( header->id )
+    {
+    case HDR_CONTENT_LENGTH:
+        num = ParseNumber( value, len, &i );
+        if ( num < 0 || i != len ||
+             (parser->contentLength >= 0 && parser->contentLength != num) )
+        {
+            return false;   // bad or conflicting length
+        }
+        parser->contentLength = num;
+        break;
+        
+    case HDR_TRANSFER_ENCODING:
+        if ( ListHasToken(value, len, "chunked") )
+        {
+            parser->chunked = true;
+        }
+        break;
+        
+    case HDR_CONNECTION:
+        if ( ListHasToken(value, len, "close") )
+        {
+            parser->connectionClose = true;
+        }
+        break;
+    }
+    
+    return true;
+}
+
+// doubles the room for headers; the first time, the inline headers
+//  are moved to the heap
+static bool GrowHeaders( HttpParser* parser )
+{
+    HttpHeaderRef* headers;
+    int maxHeaders = parser->maxHeaders * 2;
+    
+    if ( parser->headers == parser->inlineHeaders )
+    {
+        headers = (HttpHeaderRef *)malloc(
+            maxHeaders * sizeof(HttpHeaderRef) );
+        if ( headers != NULL )
+        {
+            memcpy( headers, parser->inlineHeaders,
+                sizeof(parser->inlineHeaders) );
+        }
+    }
+    else
+    {
+        headers = (HttpHeaderRef *)realloc( parser->headers,
+            maxHeaders * sizeof(HttpHeaderRef) );
+    }
+    if ( headers == NULL )
+    {
+        return false;
+    }
+    
+    parser->headers = headers;
+    parser->maxHeaders = maxHeaders;
+    return true;
+}
+
+// header line in buf[start], len chars without CRLF
+static bool ParseHeaderLine( HttpParser* parser, const char* buf,
+    int start, int len )
+{
+    const char* s = &buf[start];
+    HttpHeaderRef* header;
+    int i = 0;
+    int end;
+    
+    if ( IsSpace(s[0]) )
+    {
+        // continuation of the previous value
+        if ( parser->numHeaders == 0 )
+        {
+            return false;
+        }
+        header = &parser->headers[parser->numHeaders - 1];
+        
+        end = len;
+        while ( end > 0 && IsSpace(s[end-1]) )
+            end--;
+        if ( end > 0 )
+        {
+            if ( header->valueLen == 0 )
+            {
+                while ( IsSpace(s[i]) )
+                    i++;
+                header->valueStart = start + i;
+            }
+            header->valueLen = start + end - header->valueStart;
+        }
+        return true;
+    }
+    
+    if ( parser->numHeaders == parser->maxHeaders &&
+         !GrowHeaders(parser) )
+    {
+        return false;
+    }
+    header = &parser->headers[parser->numHeaders];
+    
+    // name
+    while ( i < len && IsTokenChar(s[i]) )
+        i++;
+    header->nameStart = start;
+    header->nameLen = i;
+    while ( i < len && IsSpace(s[i]) )
+        i++;
+    if ( header->nameLen == 0 || i >= len || s[i] != ':' )
+    {
+        return false;
+    }
+    i++;
+    
+    // value
+    while ( i < len && IsSpace(s[i]) )
+        i++;
+    end = len;
+    while ( end > i && IsSpace(s[end-1]) )
+        end--;
+    header->valueStart = start + i;
+    header->valueLen = end - i;
+    
+    header->id = http_HeaderNameToID( s, header->nameLen );
+    parser->numHeaders++;
+    
+    return true;
+}
+
+void http_ParserInit( HttpParser* parser )
+{
+    parser->state = HTTP_PARSER_START_LINE;
+    parser->lineStart = 0;
+    parser->scanned = 0;
+    parser->isRequest = false;
+    parser->method = HTTP_UNKNOWN_METHOD;
+    parser->methodStart = 0;
+    parser->methodLen = 0;
+    parser->uriStart = 0;
+    parser->uriLen = 0;
+    parser->statusCode = -1;
+    parser->statusStart = 0;
+    parser->statusLen = 0;
+    parser->reasonStart = 0;
+    parser->reasonLen = 0;
+    parser->majorVersion = 0;
+    parser->minorVersion = 0;
+    parser->versionStart = 0;
+    parser->versionLen = 0;
+    parser->headers = parser->inlineHeaders;
+    parser->maxHeaders = HTTP_PARSER_INLINE_HEADERS;
+    parser->numHeaders = 0;
+    parser->headerLen = 0;
+    parser->contentLength = -1;
+    parser->chunked = false;
+    parser->connectionClose = false;
+}
+
+void http_ParserFree( HttpParser* parser )
+{
+    if ( parser->headers != parser->inlineHeaders )
+    {
+        free( parser->headers );
+        parser->headers = parser->inlineHeaders;
+    }
+}
+
+void http_ParserMove( HttpParser* dst, HttpParser* src )
+{
+    *dst = *src;
+    if ( src->headers == src->inlineHeaders )
+    {
+        dst->headers = dst->inlineHeaders;
+    }
+    http_ParserInit( src );
+}
+
+// the headers end at buf[headerLen]; looks at the complete values
+static void EndHeaders( HttpParser* parser, const char* buf, int headerLen )
+{
+    int i;
+    
+    parser->state = HTTP_PARSER_DONE;
+    parser->headerLen = headerLen;
+    for ( i = 0; i < parser->numHeaders; i++ )
+    {
+        if ( !NoteHeader(parser, buf, &parser->headers[i]) )
+        {
+            parser->state = HTTP_PARSER_ERROR;
+            break;
+        }
+    }
+}
+
+int http_ParseMessage( HttpParser* parser, const char* buf, int len )
+{
+    const char* lf;
+    int start;
+    int lineLen;
+    
+    while ( parser->state == HTTP_PARSER_START_LINE ||
+            parser->state == HTTP_PARSER_HEADERS )
+    {
+        start = parser->lineStart;
+        lf = (const char *)memchr( &buf[start + parser->scanned], '\n',
+            len - start - parser->scanned );
+        if ( lf == NULL )
+        {
+            parser->scanned = len - start;
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        
+        // line without CRLF; a CR is only allowed right before the LF
+        lineLen = lf - &buf[start];
+        if ( lineLen > 0 && buf[start + lineLen - 1] == '\r' )
+        {
+            lineLen--;
+        }
+        if ( memchr(&buf[start], '\r', lineLen) != NULL )
+        {
+            parser->state = HTTP_PARSER_ERROR;
+            break;
+        }
+        
+        parser->lineStart = lf - buf + 1;
+        parser->scanned = 0;
+        
+        if ( parser->state == HTTP_PARSER_START_LINE )
+        {
+            // blank lines before the start line are ignored
+            if ( lineLen > 0 )
+            {
+                parser->state = ParseStartLine( parser, buf, start,
+                    lineLen ) ? HTTP_PARSER_HEADERS : HTTP_PARSER_ERROR;
+            }
+        }
+        else if ( lineLen == 0 )
+        {
+            EndHeaders( parser, buf, parser->lineStart );
+        }
+        else if ( !ParseHeaderLine(parser, buf, start, lineLen) )
+        {
+            parser->state = HTTP_PARSER_ERROR;
+        }
+    }
+    
+    return parser->state == HTTP_PARSER_DONE ?
+        HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+}
+
+int http_ParseMessageEnd( HttpParser* parser, const char* buf, int len )
+{
+    int start;
+    int lineLen;
+    
+    if ( http_ParseMessage(parser, buf, len) != HTTP_PARSE_INCOMPLETE )
+    {
+        return parser->state == HTTP_PARSER_DONE ?
+            HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+    }
+    if ( parser->state != HTTP_PARSER_HEADERS )
+    {
+        return HTTP_PARSE_ERROR;    // no start line
+    }
+    
+    // a last line without LF is a header line
+    start = parser->lineStart;
+    lineLen = len - start;
+    if ( lineLen > 0 &&
+         (memchr(&buf[start], '\r', lineLen) != NULL ||
+          !ParseHeaderLine(parser, buf, start, lineLen)) )
+    {
+        parser->state = HTTP_PARSER_ERROR;
+        return HTTP_PARSE_ERROR;
+    }
+    
+    EndHeaders( parser, buf, len );
+    return parser->state == HTTP_PARSER_DONE ?
+        HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+}
+
+const HttpHeaderRef* http_FindHeader( const HttpParser* parser,
+    int headerID )
+{
+    int i;
+    
+    for ( i = 0; i < parser->numHeaders; i++ )
+    {
+        if ( parser->headers[i].id == headerID )
+        {
+            return &parser->headers[i];
+        }
+    }
+    
+    return NULL;
+}
+
+// finds the end of the line starting at buf[start]
+// returns offset just past LF; -1 if the line is not complete
+static int NextLine( const char* buf, int len, int start )
+{
+    const char* lf;
+    
+    lf = (const char *)memchr( &buf[start], '\n', len - start );
+    return lf == NULL ? -1 : lf - buf + 1;
+}
+
+int http_NextChunk( const char* buf, int len, int* pos,
+    int* dataStart, int* dataLen )
+{
+    int i = *pos;
+    int next;
+    int size = 0;
+    int digit;
+    char c;
+    
+    next = NextLine( buf, len, i );
+    if ( next < 0 )
+    {
+        return HTTP_PARSE_INCOMPLETE;
+    }
+    
+    // chunk-size [ chunk-extension ] CRLF
+    while ( i < next )
+    {
+        c = buf[i];
+        if ( c >= '0' && c <= '9' )
+            digit = c - '0';
+        else if ( c >= 'a' && c <= 'f' )
+            digit = c - 'a' + 10;
+        else if ( c >= 'A' && c <= 'F' )
+            digit = c - 'A' + 10;
+        else
+            break;
+        if ( size > (INT_MAX - 15) / 16 )
+        {
+            return HTTP_PARSE_ERROR;
+        }
+        size = size * 16 + digit;
+        i++;
+    }
+    if ( i == *pos || !(IsSpace(c) || c == ';' || c == '\r' || c == '\n') )
+    {
+        return HTTP_PARSE_ERROR;
+    }
+    
+    if ( size == 0 )
+    {
+        // last-chunk; skip trailers up to the blank line
+        i = next;
+        while ( true )
+        {
+            next = NextLine( buf, len, i );
+            if ( next < 0 )
+            {
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            if ( next - i == 1 || (next - i == 2 && buf[i] == '\r') )
+            {
+                break;
+            }
+            i = next;
+        }
+        *dataStart = next;
+        *dataLen = 0;
+        *pos = next;
+        return HTTP_PARSE_DONE;
+    }
+    
+    // chunk-data CRLF
+    i = next;
+    if ( size > len - i )
+    {
+        return HTTP_PARSE_INCOMPLETE;
+    }
+    next = NextLine( buf, len, i + size );
+    if ( next < 0 )
+    {
+        return len - (i + size) < 2 ? HTTP_PARSE_INCOMPLETE :
+            HTTP_PARSE_ERROR;
+    }
+    if ( !(next - (i + size) == 1 ||
+           (next - (i + size) == 2 && buf[i + size] == '\r')) )
+    {
+        return HTTP_PARSE_ERROR;
+    }
+    
+    *dataStart = i;
+    *dataLen = size;
+    *pos = next;
+    return HTTP_PARSE_DONE;
+}
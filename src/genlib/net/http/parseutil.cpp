@@ -42,6 +42,7 @@
 #include <genlib/net/netexception.h>
 #include <genlib/net/http/tokenizer.h>
 #include <genlib/net/http/parseutil.h>
+#include <genlib/net/http/httpparser.h>
 #include <genlib/net/http/statuscodes.h>
 #include <genlib/util/utilall.h>
 #include <genlib/util/util.h>
@@ -109,146 +110,6 @@ static HttpHeaderValue* CreateCacheDirective()
 }
 // *********** end
 
-struct SortedTableEntry
-{
-    char* name;
-    int   id;
-};
-
-#define NUM_HEADERS 52
-
-// table _must_ be sorted by header name
-static SortedTableEntry HeaderNameTable[NUM_HEADERS] =
-{
-    { "ACCEPT",             HDR_ACCEPT },
-    { "ACCEPT-CHARSET",     HDR_ACCEPT_CHARSET },
-    { "ACCEPT-ENCODING",    HDR_ACCEPT_ENCODING },
-    { "ACCEPT-LANGUAGE",    HDR_ACCEPT_LANGUAGE },
-    { "ACCEPT-RANGES",      HDR_ACCEPT_RANGES },
-    { "AGE",                HDR_AGE },
-    { "ALLOW",              HDR_ALLOW },
-    { "AUTHORIZATION",      HDR_AUTHORIZATION },
-    
-    { "CACHE-CONTROL",      HDR_CACHE_CONTROL },
-    { "CALLBACK",           HDR_UPNP_CALLBACK },
-    { "CONNECTION",         HDR_CONNECTION },
-    { "CONTENT-ENCODING",   HDR_CONTENT_ENCODING },
-    { "CONTENT-LANGUAGE",   HDR_CONTENT_LANGUAGE },
-    { "CONTENT-LENGTH",     HDR_CONTENT_LENGTH },
-    { "CONTENT-LOCATION",   HDR_CONTENT_LOCATION },
-    { "CONTENT-MD5",        HDR_CONTENT_MD5 },
-    { "CONTENT-TYPE",       HDR_CONTENT_TYPE },
-    
-    { "DATE",               HDR_DATE },
-    
-    { "ETAG",               HDR_ETAG },
-    { "EXPECT",             HDR_EXPECT },
-    { "EXPIRES",            HDR_EXPIRES },
-    
-    { "FROM",               HDR_FROM },
-    
-    { "HOST",               HDR_HOST },
-    
-    { "IF-MATCH",           HDR_IF_MATCH },
-    { "IF-MODIFIED-SINCE",  HDR_IF_MODIFIED_SINCE },
-    { "IF-NONE-MATCH",      HDR_IF_NONE_MATCH },
-    { "IF-RANGE",           HDR_IF_RANGE },
-    { "IF-UNMODIFIED-SINCE",HDR_IF_UNMODIFIED_SINCE },
-    
-    { "LAST-MODIFIED",      HDR_LAST_MODIFIED },
-    { "LOCATION",           HDR_LOCATION },
-    
-    { "MAN",                HDR_UPNP_MAN },
-    { "MAX-FORWARDS",       HDR_MAX_FORWARDS },
-    
-    { "NT",                 HDR_UPNP_NT },
-    { "NTS",                HDR_UPNP_NTS },
-    
-    { "PRAGMA",             HDR_PRAGMA },
-    { "PROXY-AUTHENTICATE", HDR_PROXY_AUTHENTICATE },
-    { "PROXY-AUTHORIZATION",HDR_PROXY_AUTHORIZATION },
-    
-    { "RANGE",              HDR_RANGE },
-    { "REFERER",            HDR_REFERER },
-    
-    { "SERVER",             HDR_SERVER },
-    { "SID",                HDR_UPNP_SID },
-    { "SOAPACTION",         HDR_UPNP_SOAPACTION },
-    { "ST",                 HDR_UPNP_ST },
-    
-    { "TE",                 HDR_TE },
-    { "TRAILER",            HDR_TRAILER },
-    { "TRANSFER-ENCODING",  HDR_TRANSFER_ENCODING },
-    
-    { "USER-AGENT",         HDR_USER_AGENT },
-    { "USN",                HDR_UPNP_USN },
-    
-    { "VARY",               HDR_VARY },
-    { "VIA",                HDR_VIA },
-    
-    { "WARNING",            HDR_WARNING },
-    { "WWW-AUTHENTICATE",   HDR_WWW_AUTHENTICATE },
-};
-
-// returns header ID; or -1 on error
-int NameToID( const char* name,
-    SortedTableEntry* table, int size, bool caseSensitive = true )
-{
-    int top, mid, bot;
-    int cmp;
-    
-    top = 0;
-    bot = size - 1;
-    
-    while ( top <= bot )
-    {
-        mid = (top + bot) / 2;
-        if ( caseSensitive )
-        {
-            cmp = strcmp( name, table[mid].name );
-        }
-        else
-        {
-            cmp = strcasecmp( name, table[mid].name );
-        }
-        
-        if ( cmp > 0 )
-        {
-            top = mid + 1;      // look below mid
-        }
-        else if ( cmp < 0 )
-        {
-            bot = mid - 1;      // look above mid
-        }
-        else    // cmp == 0
-        {
-            return table[mid].id;   // match
-        }
-    }
-        
-    return -1;  // header name not found
-}
-
-// returns textual representation of id in table;
-//   NULL if id is invalid or missing from table
-const char* IDToName( int id,
-    SortedTableEntry* table, int size )
-{
-    if ( id < 0 )
-        return NULL;
-    
-    for ( int i = 0; i < size; i++ )
-    {
-        if ( id == table[i].id )
-        {
-            return table[i].name;
-        }
-    }
-
-    return NULL;
-}
-
-
 // skips all blank lines (lines with crlf + optional whitespace);
 // removes leading whitespace from first non-blank line
 static void SkipBlankLines( IN Tokenizer& scanner )
@@ -1225,7 +1086,7 @@ static HttpHeaderValue* ParseHeader( IN Tokenizer& scanner,
     ParseHeaderName( scanner, name );
 
     // map name to id
-    id = NameToID( name.c_str(), HeaderNameTable, NUM_HEADERS, false );
+    id = http_HeaderNameToID( name.c_str(), name.length() );
     if ( id < 0 )
     {
         // header type currently not known; process raw
@@ -2302,6 +2163,26 @@ void HostPortValue::toString( xstring& s )
     s += tempBuf;
 }
 
+bool HostPortValue::setValue( const char* value, int len )
+{
+    xstring hport;
+    hostport_type temp;
+    
+    hport.appendLimited( value, len );
+    if ( parse_hostport((char *)(hport.c_str()), hport.length(),
+            &temp) < 0 )
+    {
+        return false;
+    }
+    
+    // hostport points into the string it was parsed from
+    tempBuf = hport;
+    parse_hostport( (char *)(tempBuf.c_str()), tempBuf.length(),
+        &hostport );
+    
+    return true;
+}
+
 bool HostPortValue::setHostPort( const char* hostName, unsigned short port )
 {
     xstring s;
@@ -2364,9 +2245,9 @@ bool UriType::setUri( const char* newUriValue )
         return false;
     }
     
-    uri = temp;
-
+    // uri points into the string it was parsed from
     tempBuf = uriStr;
+    parse_uri( (char*)(tempBuf.c_str()), tempBuf.length(), &uri );
 
     return true;
 }
@@ -2469,7 +2350,7 @@ void HttpHeader::toString( xstring& s )
 {
     if ( type != HDR_UNKNOWN )
     {
-        const char *name = IDToName( type, HeaderNameTable, NUM_HEADERS );
+        const char *name = http_HeaderIDToName( type );
         s += name;
         s += ": ";
     }
@@ -2481,20 +2362,6 @@ void HttpHeader::toString( xstring& s )
 ////////////////////////////
 // HttpRequestLine
 
-#define NUM_METHODS 8
-
-static SortedTableEntry HttpMethodTable[NUM_METHODS] =
-{
-    { "GET",        HTTP_GET },
-    { "HEAD",       HTTP_HEAD },
-    { "M-POST",     UPNP_MPOST },
-    { "M-SEARCH",   UPNP_MSEARCH },
-    { "NOTIFY",     UPNP_NOTIFY },
-    { "POST",       UPNP_POST },
-    { "SUBSCRIBE",  UPNP_SUBSCRIBE },
-    { "UNSUBSCRIBE",UPNP_UNSUBSCRIBE },
-};
-
 void HttpRequestLine::load( Tokenizer& scanner )
 {
     Token* token;
@@ -2510,8 +2377,8 @@ void HttpRequestLine::load( Tokenizer& scanner )
             scanner.getLineNum() );
     }
 
-    method = (UpnpMethodType) NameToID( token->s.c_str(), HttpMethodTable,
-        NUM_METHODS );
+    method = (UpnpMethodType) http_MethodNameToID( token->s.c_str(),
+        token->s.length() );
     if ( method == -1 )
     {
         HttpParseException e( "HttpRequestLine::load() unknown method",
@@ -2568,8 +2435,7 @@ void HttpRequestLine::load( Tokenizer& scanner )
 
 void HttpRequestLine::toString( xstring& s )
 {
-    const char* methodStr = IDToName( method, HttpMethodTable,
-        NUM_METHODS );
+    const char* methodStr = http_MethodIDToName( method );
         
     assert( methodStr != NULL );
     
@@ -2694,6 +2560,8 @@ HttpEntity::HttpEntity()
 {
     init();
     type = TEXT;
+    ranges = NULL;
+    numRanges = 0;
 }
 
 HttpEntity::HttpEntity( const char* file_name )
@@ -2701,6 +2569,8 @@ HttpEntity::HttpEntity( const char* file_name )
     init();
     type = FILENAME;
     filename = file_name;
+    ranges = NULL;
+    numRanges = 0;
 }
 
 void HttpEntity::init()
@@ -2720,6 +2590,8 @@ HttpEntity::~HttpEntity()
         
     if ( type == TEXT && entity != NULL )
         free( entity );
+
+    delete [] ranges;
 }
 
 // throws OutOfMemoryException
@@ -3017,66 +2889,304 @@ void HttpMessage::loadResponse( Tokenizer& scanner, CharReader* reader,
     loadRestOfMessage( scanner, reader, requestMethod );    
 }
 
-int HttpMessage::loadRequest( const char* request )
+// value of a header found by HttpParser; NULL if it is malformed
+// the common value types are built straight from the buffer; the
+//  structured ones go through ParseHeader()
+static HttpHeaderValue* LoadParsedHeader( const char* buf,
+    const HttpHeaderRef& ref )
 {
-    int code = -1;
+    const char* value = &buf[ref.valueStart];
+    int len = ref.valueLen;
+    HttpHeaderValue* header = NULL;
     
-    try
+    switch ( ref.id )
     {
-        MemReader reader( request );
-        Tokenizer scanner( reader );
-        loadRequest( scanner, &reader );
-        code = 0;
+        case HDR_ACCEPT:
+        case HDR_ACCEPT_CHARSET:
+        case HDR_ACCEPT_ENCODING:
+        case HDR_ACCEPT_LANGUAGE:
+        case HDR_ALLOW:
+        case HDR_CACHE_CONTROL:
+        case HDR_CONNECTION:
+        case HDR_CONTENT_ENCODING:
+        case HDR_CONTENT_LANGUAGE:
+        case HDR_CONTENT_LOCATION:
+        case HDR_CONTENT_TYPE:
+        case HDR_LOCATION:
+        case HDR_RETRY_AFTER:
+        case HDR_TRANSFER_ENCODING:
+        {
+            xstring line;
+            int id;
+            
+            line.appendLimited( &buf[ref.nameStart],
+                ref.valueStart + len - ref.nameStart );
+            line += "\r\n";
+            
+            MemReader reader( line.c_str() );
+            Tokenizer scanner( reader );
+            header = ParseHeader( scanner, id );
+            break;
+        }
+        
+        case HDR_AGE:
+        case HDR_CONTENT_LENGTH:
+        case HDR_MAX_FORWARDS:
+        {
+            char* end;
+            long num;
+            
+            // the value is followed by CRLF, so strtol() stops there
+            num = strtol( value, &end, 10 );
+            if ( len == 0 || end != value + len || num < 0 || num > INT_MAX )
+            {
+                break;
+            }
+            
+            HttpNumber* number = new HttpNumber;
+            number->num = num;
+            header = number;
+            break;
+        }
+        
+        case HDR_DATE:
+        case HDR_EXPIRES:
+        case HDR_IF_MODIFIED_SINCE:
+        case HDR_IF_UNMODIFIED_SINCE:
+        case HDR_LAST_MODIFIED:
+        {
+            HttpDateValue* date = new HttpDateValue;
+            int numCharsParsed;
+            
+            if ( ParseDateTime(value, &date->gmtDateTime,
+                    &numCharsParsed) == -1 || numCharsParsed > len )
+            {
+                delete date;
+                break;
+            }
+            while ( numCharsParsed < len &&
+                    (value[numCharsParsed] == ' ' ||
+                     value[numCharsParsed] == '\t') )
+            {
+                numCharsParsed++;
+            }
+            if ( numCharsParsed != len )
+            {
+                delete date;
+                break;
+            }
+            header = date;
+            break;
+        }
+        
+        case HDR_HOST:
+        {
+            HostPortValue* host = new HostPortValue;
+            
+            if ( !host->setValue(value, len) )
+            {
+                delete host;
+                break;
+            }
+            header = host;
+            break;
+        }
+        
+        case HDR_UNKNOWN:
+        {
+            UnknownHeader* unknown = new UnknownHeader;
+            
+            unknown->name.appendLimited( &buf[ref.nameStart], ref.nameLen );
+            unknown->value.appendLimited( value, len );
+            header = unknown;
+            break;
+        }
+        
+        default:
+        {
+            RawHeaderValue* raw = new RawHeaderValue;
+            
+            raw->value.appendLimited( value, len );
+            header = raw;
+            break;
+        }
     }
-    catch ( HttpParseException& /* e */ )
+    
+    return header;
+}
+
+int HttpMessage::loadStartLineAndHeaders( const char* buf,
+    const HttpParser& parser )
+{
+    HttpHeaderValue* value;
+    int i;
+    
+    try
     {
-        code = HTTP_E_BAD_MSG_FORMAT;
+        isRequest = parser.isRequest;
+        if ( isRequest )
+        {
+            requestLine.method = (UpnpMethodType) parser.method;
+            requestLine.majorVersion = parser.majorVersion;
+            requestLine.minorVersion = parser.minorVersion;
+            
+            requestLine.pathIsStar = parser.uriLen == 1 &&
+                buf[parser.uriStart] == '*';
+            if ( !requestLine.pathIsStar )
+            {
+                xstring uri;
+                
+                uri.appendLimited( &buf[parser.uriStart], parser.uriLen );
+                if ( !requestLine.uri.setUri(uri.c_str()) )
+                {
+                    return HTTP_E_BAD_MSG_FORMAT;
+                }
+            }
+        }
+        else
+        {
+            responseLine.statusCode = parser.statusCode;
+            responseLine.majorVersion = parser.majorVersion;
+            responseLine.minorVersion = parser.minorVersion;
+            responseLine.reason = "";
+            responseLine.reason.appendLimited( &buf[parser.reasonStart],
+                parser.reasonLen );
+        }
+        
+        for ( i = 0; i < parser.numHeaders; i++ )
+        {
+            // bad headers are ignored
+            value = LoadParsedHeader( buf, parser.headers[i] );
+            if ( value != NULL )
+            {
+                addHeader( parser.headers[i].id, value );
+            }
+        }
     }
     catch ( OutOfMemoryException& /* e */ )
     {
-        code = HTTP_E_OUT_OF_MEMORY;
+        return HTTP_E_OUT_OF_MEMORY;
     }
-    catch ( TimeoutException& /* e */ )
+    
+    return 0;
+}
+
+int HttpMessage::loadEntity( const char* body, int len,
+    UpnpMethodType requestMethod )
+{
+    int length;
+    int pos;
+    int start;
+    int code = 0;
+    
+    switch ( messageBodyLen(requestMethod, length) )
     {
-        code = HTTP_E_TIMEDOUT;
+        case -1:
+            entity.type = HttpEntity::EMPTY;
+            break;
+            
+        case 1:
+            pos = 0;
+            do
+            {
+                if ( http_NextChunk(body, len, &pos, &start, &length) !=
+                     HTTP_PARSE_DONE )
+                {
+                    return HTTP_E_BAD_MSG_FORMAT;
+                }
+                if ( length > 0 )
+                {
+                    code = entity.append( &body[start], length );
+                }
+            } while ( length > 0 && code == 0 );
+            break;
+            
+        case 2:
+            if ( len < length )
+            {
+                return HTTP_E_BAD_MSG_FORMAT;
+            }
+            if ( length > 0 )
+            {
+                code = entity.append( body, length );
+            }
+            break;
+            
+        case 3:
+            if ( len > 0 )
+            {
+                code = entity.append( body, len );
+            }
+            break;
     }
-    catch ( NetException& /* e */ )
+    
+    if ( code != 0 )
     {
-        code = -1;
+        return code == -2 ? HTTP_E_OUT_OF_MEMORY : -1;
     }
     
-    return code;
+    return 0;
 }
 
-int HttpMessage::loadResponse( const char* response,
-        UpnpMethodType requestMethod )
+int HttpMessage::loadRequest( const char* request )
 {
-    int code = -1;
+    HttpParser parser;
+    int len = strlen( request );
+    int code;
     
-    try
+    http_ParserInit( &parser );
+    if ( http_ParseMessage(&parser, request, len) != HTTP_PARSE_DONE ||
+         !parser.isRequest )
     {
-        MemReader reader( response );
-        Tokenizer scanner( reader );
-        loadResponse( scanner, &reader, requestMethod );
-        code = 0;
+        code = HTTP_E_BAD_MSG_FORMAT;
     }
-    catch ( HttpParseException& /* e */ )
+    else
     {
-        code = HTTP_E_BAD_MSG_FORMAT;
+        code = loadRequest( request, len, parser );
     }
-    catch ( OutOfMemoryException& /* e */ )
+    
+    http_ParserFree( &parser );
+    return code;
+}
+
+int HttpMessage::loadRequest( const char* buf, int len,
+    const HttpParser& parser )
+{
+    int code;
+    
+    code = loadStartLineAndHeaders( buf, parser );
+    if ( code == 0 )
     {
-        code = HTTP_E_OUT_OF_MEMORY;
+        code = loadEntity( &buf[parser.headerLen],
+            len - parser.headerLen, HTTP_UNKNOWN_METHOD );
     }
-    catch ( TimeoutException& /* e */ )
+    
+    return code;
+}
+
+int HttpMessage::loadResponse( const char* response,
+        UpnpMethodType requestMethod )
+{
+    HttpParser parser;
+    int len = strlen( response );
+    int code;
+    
+    http_ParserInit( &parser );
+    if ( http_ParseMessage(&parser, response, len) != HTTP_PARSE_DONE ||
+         parser.isRequest )
     {
-        code = HTTP_E_TIMEDOUT;
+        http_ParserFree( &parser );
+        return HTTP_E_BAD_MSG_FORMAT;
     }
-    catch ( NetException& /* e */ )
+    
+    code = loadStartLineAndHeaders( response, parser );
+    if ( code == 0 )
     {
-        code = -1;
+        code = loadEntity( &response[parser.headerLen],
+            len - parser.headerLen, requestMethod );
     }
     
+    http_ParserFree( &parser );
     return code;
 }
 
@@ -3417,90 +3527,67 @@ void HttpMessage::loadRestOfMessage( Tokenizer& scanner,
     }
 }
 
-// if message is response, requestMethod is method used for request
-//   else ignored
-// return value:
-//              = -1, no body or ignore body
-//              =  1, transfer encoding
-//              =  2, content-length (length=content length)
-//              =  3, connection close
 int HttpMessage::messageBodyLen( IN UpnpMethodType requestMethod,
     OUT int& length )
 {
-    int responseCode = -1;
-    int readMethod = -1;
-    
     length = -1;
     
-    try
-    {
-        if ( !isRequest )
-            responseCode = responseLine.statusCode;
+    // std http rules for determining content length
 
-        // std http rules for determining content length
-    
-        // * no body for 1xx, 204, 304 and head
-        //    get, subscribe, unsubscribe
-        if ( isRequest )
+    // * no body for 1xx, 204, 304 and head
+    //    get, subscribe, unsubscribe
+    if ( isRequest )
+    {
+        if ( requestLine.method == HTTP_HEAD ||
+             requestLine.method == HTTP_GET ||
+             requestLine.method == UPNP_SUBSCRIBE ||
+             requestLine.method == UPNP_UNSUBSCRIBE ||
+             requestLine.method == UPNP_MSEARCH
+            )
         {
-            if ( requestLine.method == HTTP_HEAD ||
-                 requestLine.method == HTTP_GET ||
-                 requestLine.method == UPNP_SUBSCRIBE ||
-                 requestLine.method == UPNP_UNSUBSCRIBE ||
-                 requestLine.method == UPNP_MSEARCH
-                )
-            {
-                throw -1;
-            }
+            return -1;
         }
-        else    // response
-        {
-            if ( responseCode == 204 ||
-                 responseCode == 304 ||
-                (responseCode >= 100 && responseCode <= 199)
-                )
-            {
-                throw -1;
-            }
+    }
+    else    // response
+    {
+        int responseCode = responseLine.statusCode;
         
-            // request was HEAD
-            if ( requestMethod == HTTP_HEAD )
-                throw -1;
-        }
-    
-        // * transfer-encoding -- used to indicate chunked data
-        HttpHeaderNode* node;
-        node = findHeader( HDR_TRANSFER_ENCODING );
-        if ( node != NULL )
-        {
-            // read method to use transfer encoding
-            throw 1;
-        }
-
-        // * content length present?
-        length = getContentLength();
-        if ( length >= 0 )
-        {
-            throw 2;    // content-length
-        }
-    
-        // * multi-part/byteranges not supported (yet)
-    
-        // * length determined by connection closing
-        if ( isRequest )
+        if ( responseCode == 204 ||
+             responseCode == 304 ||
+            (responseCode >= 100 && responseCode <= 199)
+            )
         {
-            throw -1;   // invalid for requests
+            return -1;
         }
     
-        // read method = connection closing
-        throw 3;
+        // request was HEAD
+        if ( requestMethod == HTTP_HEAD )
+            return -1;
     }
-    catch ( int code )
+
+    // * transfer-encoding -- used to indicate chunked data
+    if ( findHeader(HDR_TRANSFER_ENCODING) != NULL )
     {
-        readMethod = code;
+        return 1;
     }
-    
-    return readMethod;
+
+    // * content length present?
+    length = getContentLength();
+    if ( length >= 0 )
+    {
+        return 2;   // content-length
+    }
+
+    // * multi-part/byteranges not supported (yet)
+
+    // * length determined by connection closing
+    if ( isRequest )
+    {
+        return -1;  // invalid for requests
+    }
+
+    // read method = connection closing
+    return 3;
 }
 
 // returns -1 if length not found
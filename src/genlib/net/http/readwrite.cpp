@@ -38,14 +38,200 @@
 #if EXCLUDE_WEB_SERVER == 0
 
 #include <stdio.h>
-#include <genlib/net/netreader.h>
+#include <stdlib.h>
+#include <string.h>
 #include <genlib/net/netexception.h>
 #include <genlib/net/http/parseutil.h>
 #include <genlib/net/http/readwrite.h>
 #include <genlib/net/http/statuscodes.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/poll.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// size of each read while receiving a message
+#define RECV_CHUNK_SIZE 4096
+
+// waits until the socket has data to read, or can take more data if
+//   forWrite is true; timeoutSecs bounds each wait, so a slow but
+//   live peer is not cut off; timeoutSecs < 0 waits forever
+// poll() is used as the reactor can hold sockets above FD_SETSIZE
+// returns 0 when ready, -1 on system error, HTTP_E_TIMEDOUT
+static int WaitSocket( IN int tcpsockfd, IN bool forWrite,
+    IN int timeoutSecs )
+{
+    struct pollfd pfd;
+    int status;
+
+    while ( true )
+    {
+        pfd.fd = tcpsockfd;
+        pfd.events = forWrite ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+
+        status = poll( &pfd, 1,
+            timeoutSecs < 0 ? -1 : timeoutSecs * 1000 );
+        if ( status > 0 )
+        {
+            return 0;
+        }
+        if ( status == 0 )
+        {
+            return HTTP_E_TIMEDOUT;
+        }
+        if ( errno != EINTR )
+        {
+            return -1;
+        }
+    }
+}
+
+// bytes of a message received so far; null terminated
+struct RecvBuffer
+{
+    char* buf;
+    int len;
+    int size;
+};
+
+// appends what the socket has to rb, growing it as needed
+// returns number of bytes read, 0 at end of stream, -1 on system
+//   error, HTTP_E_TIMEDOUT or HTTP_E_OUT_OF_MEMORY
+static int RecvMore( IN int tcpsockfd, INOUT RecvBuffer& rb,
+    IN int timeoutSecs )
+{
+    int numRead;
+    int code;
+
+    if ( rb.size - rb.len < RECV_CHUNK_SIZE + 1 )
+    {
+        int newSize = MaxVal( 2 * rb.size, rb.len + RECV_CHUNK_SIZE + 1 );
+        char* newBuf = (char *)realloc( rb.buf, newSize );
+
+        if ( newBuf == NULL )
+        {
+            return HTTP_E_OUT_OF_MEMORY;
+        }
+        rb.buf = newBuf;
+        rb.size = newSize;
+    }
+
+    code = WaitSocket( tcpsockfd, false, timeoutSecs );
+    if ( code != 0 )
+    {
+        return code;
+    }
+
+    do
+    {
+        numRead = read( tcpsockfd, &rb.buf[rb.len], rb.size - rb.len - 1 );
+    } while ( numRead == -1 && errno == EINTR );
+
+    if ( numRead > 0 )
+    {
+        rb.len += numRead;
+        rb.buf[rb.len] = 0;
+    }
+
+    return numRead;
+}
+
+// reads until parser has the start line and all headers
+static int RecvStartLineAndHeaders( IN int tcpsockfd,
+    INOUT HttpParser& parser, INOUT RecvBuffer& rb, IN int timeoutSecs )
+{
+    int code;
+
+    while ( true )
+    {
+        code = http_ParseMessage( &parser, rb.buf, rb.len );
+        if ( code == HTTP_PARSE_DONE )
+        {
+            return 0;
+        }
+        if ( code == HTTP_PARSE_ERROR )
+        {
+            return HTTP_E_BAD_MSG_FORMAT;
+        }
+
+        code = RecvMore( tcpsockfd, rb, timeoutSecs );
+        if ( code == 0 )
+        {
+            return HTTP_E_BAD_MSG_FORMAT;   // stream ended in the headers
+        }
+        if ( code < 0 )
+        {
+            return code;
+        }
+    }
+}
+
+// reads until the entity that follows the headers is complete
+static int RecvEntity( IN int tcpsockfd, IN HttpMessage& message,
+    IN const HttpParser& parser, INOUT RecvBuffer& rb,
+    IN UpnpMethodType requestMethod, IN int timeoutSecs )
+{
+    int bodyType;
+    int length;
+    int pos = parser.headerLen;
+    int start;
+    int chunkLen = -1;
+    int code;
+
+    bodyType = message.messageBodyLen( requestMethod, length );
+    while ( true )
+    {
+        if ( bodyType == -1 )
+        {
+            return 0;
+        }
+        else if ( bodyType == 1 )
+        {
+            // skip over the complete chunks
+            while ( chunkLen != 0 )
+            {
+                code = http_NextChunk( rb.buf, rb.len, &pos, &start,
+                    &chunkLen );
+                if ( code == HTTP_PARSE_ERROR )
+                {
+                    return HTTP_E_BAD_MSG_FORMAT;
+                }
+                if ( code == HTTP_PARSE_INCOMPLETE )
+                {
+                    break;
+                }
+            }
+            if ( chunkLen == 0 )
+            {
+                return 0;
+            }
+        }
+        else if ( bodyType == 2 )
+        {
+            if ( rb.len - parser.headerLen >= length )
+            {
+                return 0;
+            }
+        }
+
+        code = RecvMore( tcpsockfd, rb, timeoutSecs );
+        if ( code == 0 )
+        {
+            // end of stream; only the connection close entity ends here
+            return bodyType == 3 ? 0 : HTTP_E_BAD_MSG_FORMAT;
+        }
+        if ( code < 0 )
+        {
+            return code;
+        }
+    }
+}
 
 // return codes:
 //   0: success
@@ -56,123 +242,225 @@
 int http_RecvMessage( IN int tcpsockfd, OUT HttpMessage& message,
     UpnpMethodType requestMethod, int timeoutSecs )
 {
-    int retCode = 0;
-    
-    try
+    HttpParser parser;
+    RecvBuffer rb;
+    int code;
+
+    rb.size = RECV_CHUNK_SIZE + 1;
+    rb.len = 0;
+    rb.buf = (char *)malloc( rb.size );
+    if ( rb.buf == NULL )
     {
-        NetReader reader( tcpsockfd );
-        Tokenizer scanner( reader );
-            
-        if ( requestMethod == HTTP_UNKNOWN_METHOD )
-        {
-            // reading a request
-            message.loadRequest( scanner, &reader );
-        }
-        else
-        {
-            // read response
-            message.loadResponse( scanner, &reader, requestMethod );
-        }
-                
-        retCode = 0;
+        return HTTP_E_OUT_OF_MEMORY;
     }
-    catch ( HttpParseException& e )
-    {
-        DBG(
-            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
-                "http_RecvMessage():ERROR %s\n", e.getMessage()); )
+    rb.buf[0] = 0;
 
-        retCode = HTTP_E_BAD_MSG_FORMAT;
-    }
-    catch ( OutOfMemoryException& e )
+    http_ParserInit( &parser );
+    code = RecvStartLineAndHeaders( tcpsockfd, parser, rb, timeoutSecs );
+    if ( code == 0 &&
+         parser.isRequest != (requestMethod == HTTP_UNKNOWN_METHOD) )
     {
-        DBG(
-            UpnpPrintf(UPNP_CRITICAL, MSERV, __FILE__, __LINE__,
-                "http_RecvMessage():mem exception\n"); )
-        //DBG( e.print(); )
-        retCode = HTTP_E_OUT_OF_MEMORY;
+        code = HTTP_E_BAD_MSG_FORMAT;   // wanted a request or a response
     }
-    catch ( NetException& e )
+    if ( code == 0 )
     {
-        DBG(
-            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
-                "http_RecvMessage():...net excep\n"); )
-        //DBG( e.print(); )
-        retCode = -1;
+        code = message.loadStartLineAndHeaders( rb.buf, parser );
     }
-    catch ( TimeoutException& e )
+    if ( code == 0 )
     {
-        DBG(
-            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
-                "http_RecvMessage():...timeout excep\n"); )
-        DBG( e.print(); )
-        retCode = HTTP_E_TIMEDOUT;
+        code = RecvEntity( tcpsockfd, message, parser, rb, requestMethod,
+            timeoutSecs );
     }
-    catch ( ... )
+    if ( code == 0 )
     {
-        DBG(
-            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
-                "uncaught exception in http_RecvMessage()"); )
+        code = message.loadEntity( &rb.buf[parser.headerLen],
+            rb.len - parser.headerLen, requestMethod );
     }
 
-    return retCode;
+    DBG(
+        if ( code != 0 )
+        {
+            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
+                "http_RecvMessage(): error %d\n", code );
+        } )
+
+    http_ParserFree( &parser );
+    free( rb.buf );
+    return code;
 }
 
+// sends all 'len' bytes, looping over short writes; the socket
+//   is non-blocking while a message is being sent
+// returns 0 on success, -1 on system error, HTTP_E_TIMEDOUT
+static int SendAll( IN int tcpsockfd, IN const char* buf, IN size_t len,
+    IN int flags, IN int timeoutSecs )
+{
+    ssize_t numWritten;
+    int status;
+
+    while ( len > 0 )
+    {
+        numWritten = send( tcpsockfd, buf, len, flags | MSG_NOSIGNAL );
+        if ( numWritten == -1 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                return -1;
+            }
+            status = WaitSocket( tcpsockfd, true, timeoutSecs );
+            if ( status != 0 )
+            {
+                return status;
+            }
+            continue;
+        }
+
+        buf += numWritten;
+        len -= numWritten;
+    }
+
+    return 0;
+}
 
+// sends 'length' bytes of the open file starting at 'first' with
+//   sendfile(); if the kernel cannot sendfile() from this file,
+//   maps the bytes and sends the mapping instead
 // returns -1 on system error
 //  HTTP_E_FILE_READ
-static int SendFile( IN int tcpsockfd, IN const char* filename,
-    int timeoutSecs )
+//  HTTP_E_TIMEDOUT
+static int SendFileRange( IN int tcpsockfd, IN int fd, IN off_t first,
+    IN off_t length, IN int timeoutSecs )
 {
-    FILE *fp = NULL;
-    const int BUFSIZE = 2 * 1024;
-    char buf[BUFSIZE];
-    int numRead;
-    int numWritten;
+    off_t offset = first;
+    off_t end = first + length;
+    ssize_t numWritten;
+    void* map;
+    off_t mapStart;
     int code = 0;
 
-    try
+    while ( offset < end )
     {
-        fp = fopen( filename, "rb" );
-        if ( fp == NULL )
+        numWritten = sendfile( tcpsockfd, fd, &offset, end - offset );
+        if ( numWritten > 0 )
         {
-            throw -1;
+            continue;
         }
-
-        while ( true )
+        if ( numWritten == 0 )
+        {
+            // file shrank under us; the peer was promised more bytes
+            code = HTTP_E_FILE_READ;
+            break;
+        }
+        if ( errno == EINTR )
+        {
+            continue;
+        }
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
         {
-            // read data
-            numRead = fread( buf, sizeof(char), BUFSIZE, fp );
-            if ( numRead == 0 )
+            code = WaitSocket( tcpsockfd, true, timeoutSecs );
+            if ( code != 0 )
             {
-                if ( ferror(fp) )
-                {
-                    throw HTTP_E_FILE_READ;
-                }
                 break;
             }
-        
-            // write data
-            numWritten = send( tcpsockfd, buf, numRead, MSG_NOSIGNAL );
-            if ( numWritten == -1 )
+            continue;
+        }
+        if ( (errno == EINVAL || errno == ENOSYS) && offset == first )
+        {
+            // no sendfile() for this file or socket; mmap offsets
+            //   must be page aligned
+            mapStart = first - first % sysconf( _SC_PAGESIZE );
+            map = mmap( NULL, end - mapStart, PROT_READ, MAP_SHARED, fd,
+                mapStart );
+            if ( map == MAP_FAILED )
             {
-                throw -1;
+                code = HTTP_E_FILE_READ;
+                break;
             }
+            code = SendAll( tcpsockfd, (const char *)map + (first - mapStart),
+                length, 0, timeoutSecs );
+            munmap( map, end - mapStart );
+            break;
         }
+        code = -1;
+        break;
+    }
+
+    return code;
+}
+
+// sends the file entity: the whole file, or the entity's ranges
+//   with their multipart headers
+// returns -1 on system error
+//  HTTP_E_FILE_READ
+//  HTTP_E_TIMEDOUT
+static int SendFile( IN int tcpsockfd, IN HttpEntity& entity,
+    IN int timeoutSecs )
+{
+    int fd;
+    struct stat info;
+    int i;
+    int code = 0;
+
+    fd = open( entity.getFileName(), O_RDONLY );
+    if ( fd == -1 )
+    {
+        return -1;
     }
-    catch ( int catchCode )
+
+    if ( fstat( fd, &info ) == -1 )
     {
-        code = catchCode;
+        close( fd );
+        return HTTP_E_FILE_READ;
+    }
+
+    if ( entity.numRanges == 0 )
+    {
+        code = SendFileRange( tcpsockfd, fd, 0, info.st_size, timeoutSecs );
+    }
+
+    for ( i = 0; i < entity.numRanges && code == 0; i++ )
+    {
+        HttpFileRange& range = entity.ranges[i];
+
+        if ( (off_t)range.first + range.length > info.st_size )
+        {
+            code = HTTP_E_FILE_READ;
+            break;
+        }
+
+        code = SendAll( tcpsockfd, range.partHeader.c_str(),
+            range.partHeader.length(), 0, timeoutSecs );
+        if ( code == 0 )
+        {
+            code = SendFileRange( tcpsockfd, fd, range.first, range.length,
+                timeoutSecs );
+        }
     }
 
-    if ( fp != NULL )
+    if ( code == 0 && entity.numRanges > 0 )
     {
-        fclose( fp );
+        code = SendAll( tcpsockfd, entity.rangeTrailer.c_str(),
+            entity.rangeTrailer.length(), 0, timeoutSecs );
     }
 
+    close( fd );
+
     return code;
 }
 
+// turns TCP_CORK on or off so that the headers and a file body
+//   leave in full-sized segments
+static void SetCork( IN int tcpsockfd, IN int on )
+{
+#ifdef TCP_CORK
+    setsockopt( tcpsockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on) );
+#endif
+}
+
 
 // return codes:
 //   0: success
@@ -183,27 +471,51 @@ int http_SendMessage( IN int tcpsockfd, IN HttpMessage& message,
     int timeoutSecs )
 {
     int retCode = 0;
+    int sockFlags;
+    bool corked = false;
 
     assert( tcpsockfd > 0 );
 
+    // send non-blocking so that every wait goes through WaitSocket()
+    sockFlags = fcntl( tcpsockfd, F_GETFL, 0 );
+    if ( sockFlags == -1 )
+    {
+        return -1;
+    }
+    fcntl( tcpsockfd, F_SETFL, sockFlags | O_NONBLOCK );
+
     try
     {
         xstring s;
-        ssize_t numWritten;
         int status;
+        int moreFlag = 0;
         
-        // send headers
-        message.startLineAndHeadersToString( s );
-        
-        numWritten = send( tcpsockfd, s.c_str(), s.length(), MSG_NOSIGNAL );
-        if ( numWritten == -1 )
-            throw -1;
-            
-        // send optional body
         HttpEntity &entity = message.entity;
         HttpEntity::EntityType etype;
         
         etype = entity.getType();
+
+        // send headers; hold them back until the body follows
+        message.startLineAndHeadersToString( s );
+
+        if ( etype == HttpEntity::FILENAME )
+        {
+            SetCork( tcpsockfd, 1 );
+            corked = true;
+        }
+#ifdef MSG_MORE
+        else if ( etype != HttpEntity::EMPTY && entity.getEntity() != NULL )
+        {
+            moreFlag = MSG_MORE;
+        }
+#endif
+
+        status = SendAll( tcpsockfd, s.c_str(), s.length(), moreFlag,
+            timeoutSecs );
+        if ( status != 0 )
+            throw status;
+            
+        // send optional body
         switch ( etype )
         {
             case HttpEntity::EMPTY:
@@ -220,20 +532,19 @@ int http_SendMessage( IN int tcpsockfd, IN HttpMessage& message,
                 entityData = entity.getEntity();
                 if ( entityData != NULL )
                 {
-                    numWritten = send( tcpsockfd, (const char *)entity.getEntity(),
-                        entity.getEntityLen(), MSG_NOSIGNAL );
-                    if ( numWritten == -1 )
+                    status = SendAll( tcpsockfd, (const char *)entityData,
+                        entity.getEntityLen(), 0, timeoutSecs );
+                    if ( status != 0 )
                     {
-                        throw -1;
+                        throw status;
                     }
                 }
                 break;
             }
                 
             case HttpEntity::FILENAME:
-                status = SendFile( tcpsockfd, entity.getFileName(),
-                    timeoutSecs );
-                if ( status == -1 )
+                status = SendFile( tcpsockfd, entity, timeoutSecs );
+                if ( status != 0 )
                 {
                     throw status;
                 }
@@ -255,12 +566,98 @@ int http_SendMessage( IN int tcpsockfd, IN HttpMessage& message,
         DBG(
             UpnpPrintf(UPNP_CRITICAL, MSERV, __FILE__, __LINE__,
                 "uncaught exception in http_SendMessage" ); )
+        if ( corked )
+        {
+            SetCork( tcpsockfd, 0 );
+        }
+        fcntl( tcpsockfd, F_SETFL, sockFlags );
         throw;
     }
+
+    if ( corked )
+    {
+        SetCork( tcpsockfd, 0 );
+    }
+    fcntl( tcpsockfd, F_SETFL, sockFlags );
     
     return retCode;
 }
 
+// return codes:
+//   0: success
+//  -1: std error; check errno
+//  HTTP_E_TIMEDOUT
+int http_SendBuffers( IN int tcpsockfd, INOUT struct iovec* iov,
+    IN int iovcnt, int timeoutSecs )
+{
+    struct msghdr msg;
+    ssize_t numWritten;
+    int sockFlags;
+    int code = 0;
+
+    assert( tcpsockfd > 0 );
+
+    sockFlags = fcntl( tcpsockfd, F_GETFL, 0 );
+    if ( sockFlags == -1 )
+    {
+        return -1;
+    }
+    fcntl( tcpsockfd, F_SETFL, sockFlags | O_NONBLOCK );
+
+    memset( &msg, 0, sizeof(msg) );
+
+    while ( iovcnt > 0 )
+    {
+        // skip emptied buffers
+        if ( iov->iov_len == 0 )
+        {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        // sendmsg() rather than writev() for MSG_NOSIGNAL
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        numWritten = sendmsg( tcpsockfd, &msg, MSG_NOSIGNAL );
+        if ( numWritten == -1 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                code = -1;
+                break;
+            }
+            code = WaitSocket( tcpsockfd, true, timeoutSecs );
+            if ( code != 0 )
+            {
+                break;
+            }
+            continue;
+        }
+
+        // advance past what was written
+        while ( numWritten > 0 && numWritten >= (ssize_t)iov->iov_len )
+        {
+            numWritten -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( numWritten > 0 )
+        {
+            iov->iov_base = (char *)iov->iov_base + numWritten;
+            iov->iov_len -= numWritten;
+        }
+    }
+
+    fcntl( tcpsockfd, F_SETFL, sockFlags );
+
+    return code;
+}
+
 // on success, returns socket connect to server
 // on failure, returns -1, check errno
 int http_Connect( const char* resourceURL )
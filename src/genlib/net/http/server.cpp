@@ -39,8 +39,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <cstring>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <genlib/util/util.h>
+#include <genlib/util/gmtdate.h>
 #include <genlib/util/xstring.h>
 #include <genlib/util/dbllist.h>
 #include <genlib/net/http/statuscodes.h>
@@ -55,6 +59,13 @@
 #define SVRERR_FILE_NOT_FOUND -2
 #define SVRERR_BAD_FORMAT     -3
 
+// more byte ranges than this in one request are ignored
+#define MAX_BYTE_RANGES       16
+
+// largest file offset
+#define MAX_FILE_OFFSET \
+    ((off_t)(((unsigned long long)1 << (sizeof(off_t) * 8 - 1)) - 1))
+
 CREATE_NEW_EXCEPTION_TYPE( HttpServerException, BasicException, "HttpServerException" )
 
 //////////////////////////////////////////
@@ -121,12 +132,81 @@ private:
     pthread_mutex_t mutex;
 };
 
+//////////////////////////////////////////
+// ready-to-send 200 response for an alias or a small file
+struct CachedResponse
+{
+    xstring key;            // resource name, as looked up
+    xstring filename;       // empty for aliases
+    char* headers;          // header lines, except date; malloc'd
+    int headersLen;
+    char* body;             // malloc'd
+    int bodyLen;
+    xstring etag;
+    time_t lastModified;
+    time_t checkedTime;     // when the file was last stat()ed
+    unsigned hash;
+    int count;              // senders using it, +1 while cached
+    CachedResponse* hashNext;
+    CachedResponse* prev;   // lru list; head is most recently used
+    CachedResponse* next;
+};
+
+#define RESPONSE_CACHE_BUCKETS 64
+
+//////////////////////////////////////////////
+// responses keyed by resource name, bounded by WEB_SERVER_CACHE_BYTES
+class ResponseCache
+{
+public:
+    // throws OutOfMemoryException
+    ResponseCache();
+
+    virtual ~ResponseCache();
+
+    // returns the response cached for 'key' and holds it until
+    //   release(); returns NULL if there is none, or if the file
+    //   it was read from changed
+    CachedResponse* grab( IN const char* key );
+
+    void release( IN CachedResponse* entry );
+
+    // caches a response unless something was removed since
+    //   'generation' was read; takes ownership of 'headers' and
+    //   'body' only when it returns true
+    bool add( IN const char* key, IN const char* filename,
+        IN char* headers, IN int headersLen, IN char* body,
+        IN int bodyLen, IN const char* etag, IN time_t lastModified,
+        IN unsigned generation );
+
+    // drops the response for 'key', or every response
+    void remove( IN const char* key );
+    void removeAll();
+
+    // changes whenever a response is removed
+    unsigned getGeneration();
+
+private:
+    CachedResponse* find( IN const char* key, IN unsigned hash );
+    void unlink( IN CachedResponse* entry );
+    void drop( IN CachedResponse* entry );
+
+private:
+    CachedResponse* buckets[RESPONSE_CACHE_BUCKETS];
+    CachedResponse* head;
+    CachedResponse* tail;
+    int totalBytes;
+    unsigned generation;
+    pthread_mutex_t mutex;
+};
+
 // *******************************************************
 // module vars //////////////
 // root directory of http server; must not have '/' at the end
 static xstring gRootDocumentDir;
 static bool    gServerActive = false;       // serve requests only when active
 static AliasedEntityList gAliasList;
+static ResponseCache gResponseCache;
 /////////////////////////////
 
 
@@ -567,9 +647,313 @@ dblListNode* AliasedEntityList::find( IN const char* alias )
 
     return result;
 }
+////////////////////////////////////////
+// ResponseCache
+////////////////////////////////////////
+static unsigned HashResourceName( IN const char* s )
+{
+    unsigned h = 5381;
+
+    while ( *s != '\0' )
+    {
+        h = h * 33 + (unsigned char)*s++;
+    }
+    return h;
+}
+
+////////////////////////////////////////
+static void Free_CachedResponse( CachedResponse* entry )
+{
+    free( entry->headers );
+    free( entry->body );
+    delete entry;
+}
+
+////////////////////////////////////////
+ResponseCache::ResponseCache()
+{
+    memset( buckets, 0, sizeof(buckets) );
+    head = NULL;
+    tail = NULL;
+    totalBytes = 0;
+    generation = 0;
+
+    if ( pthread_mutex_init(&mutex, NULL) != 0 )
+    {
+        throw OutOfMemoryException( "ResponseCache::ResponseCache()" );
+    }
+}
+
+////////////////////////////////////////
+ResponseCache::~ResponseCache()
+{
+    removeAll();
+
+    while ( pthread_mutex_destroy(&mutex) == EBUSY )
+    {
+        // highly unlikely -- but still possible to return EBUSY
+        sleep( 1 );
+    }
+}
+
+////////////////////////////////////////
+CachedResponse* ResponseCache::grab( IN const char* key )
+{
+    CachedResponse* entry;
+    struct stat info;
+    time_t now;
+
+    pthread_mutex_lock( &mutex );
+
+    entry = find( key, HashResourceName(key) );
+    if ( entry != NULL && entry->filename.length() > 0 )
+    {
+        // files may change under us; look at most once a second
+        now = time( NULL );
+        if ( entry->checkedTime != now )
+        {
+            if ( stat(entry->filename.c_str(), &info) == -1 ||
+                 info.st_mtime != entry->lastModified ||
+                 info.st_size != entry->bodyLen )
+            {
+                drop( entry );
+                entry = NULL;
+            }
+            else
+            {
+                entry->checkedTime = now;
+            }
+        }
+    }
+
+    if ( entry != NULL )
+    {
+        // move to front of lru list
+        if ( entry != head )
+        {
+            unlink( entry );
+            entry->prev = NULL;
+            entry->next = head;
+            head->prev = entry;
+            head = entry;
+        }
+        entry->count++;
+    }
+
+    pthread_mutex_unlock( &mutex );
+
+    return entry;
+}
+
+////////////////////////////////////////
+void ResponseCache::release( IN CachedResponse* entry )
+{
+    bool unused;
+
+    pthread_mutex_lock( &mutex );
+    unused = --entry->count == 0;
+    pthread_mutex_unlock( &mutex );
+
+    if ( unused )
+    {
+        Free_CachedResponse( entry );
+    }
+}
+
+////////////////////////////////////////
+bool ResponseCache::add( IN const char* key, IN const char* filename,
+    IN char* headers, IN int headersLen, IN char* body,
+    IN int bodyLen, IN const char* etag, IN time_t lastModified,
+    IN unsigned generationRead )
+{
+    CachedResponse* entry;
+    CachedResponse* old;
+    int size = headersLen + bodyLen;
+
+    if ( size > WEB_SERVER_CACHE_BYTES / 4 )
+    {
+        return false;
+    }
+
+    entry = new CachedResponse;
+    if ( entry == NULL )
+    {
+        return false;
+    }
+
+    entry->key = key;
+    entry->filename = filename;
+    entry->headers = headers;
+    entry->headersLen = headersLen;
+    entry->body = body;
+    entry->bodyLen = bodyLen;
+    entry->etag = etag;
+    entry->lastModified = lastModified;
+    entry->checkedTime = time( NULL );
+    entry->hash = HashResourceName( key );
+    entry->count = 1;
+
+    pthread_mutex_lock( &mutex );
+
+    if ( generationRead != generation )
+    {
+        // an alias or the root dir changed while the response was
+        //   being made; it may be stale
+        pthread_mutex_unlock( &mutex );
+        entry->headers = NULL;
+        entry->body = NULL;
+        Free_CachedResponse( entry );
+        return false;
+    }
+
+    old = find( key, entry->hash );
+    if ( old != NULL )
+    {
+        drop( old );
+    }
+
+    // evict least recently used
+    while ( tail != NULL && totalBytes + size > WEB_SERVER_CACHE_BYTES )
+    {
+        drop( tail );
+    }
+
+    entry->hashNext = buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+    buckets[entry->hash % RESPONSE_CACHE_BUCKETS] = entry;
+
+    entry->prev = NULL;
+    entry->next = head;
+    if ( head != NULL )
+    {
+        head->prev = entry;
+    }
+    head = entry;
+    if ( tail == NULL )
+    {
+        tail = entry;
+    }
+    totalBytes += size;
+
+    pthread_mutex_unlock( &mutex );
+
+    return true;
+}
+
+////////////////////////////////////////
+void ResponseCache::remove( IN const char* key )
+{
+    CachedResponse* entry;
+
+    pthread_mutex_lock( &mutex );
+
+    generation++;
+    entry = find( key, HashResourceName(key) );
+    if ( entry != NULL )
+    {
+        drop( entry );
+    }
+
+    pthread_mutex_unlock( &mutex );
+}
+
+////////////////////////////////////////
+void ResponseCache::removeAll()
+{
+    pthread_mutex_lock( &mutex );
+
+    generation++;
+    while ( head != NULL )
+    {
+        drop( head );
+    }
+
+    pthread_mutex_unlock( &mutex );
+}
+
+////////////////////////////////////////
+unsigned ResponseCache::getGeneration()
+{
+    unsigned gen;
+
+    pthread_mutex_lock( &mutex );
+    gen = generation;
+    pthread_mutex_unlock( &mutex );
+
+    return gen;
+}
+
+////////////////////////////////////////
+// mutex must be held
+CachedResponse* ResponseCache::find( IN const char* key,
+    IN unsigned hash )
+{
+    CachedResponse* entry;
+
+    entry = buckets[hash % RESPONSE_CACHE_BUCKETS];
+    while ( entry != NULL )
+    {
+        if ( entry->hash == hash && entry->key == key )
+        {
+            return entry;
+        }
+        entry = entry->hashNext;
+    }
+
+    return NULL;
+}
+
+////////////////////////////////////////
+// removes entry from the lru list; mutex must be held
+void ResponseCache::unlink( IN CachedResponse* entry )
+{
+    if ( entry->prev != NULL )
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        head = entry->next;
+    }
+
+    if ( entry->next != NULL )
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        tail = entry->prev;
+    }
+}
+
+////////////////////////////////////////
+// takes entry out of the cache; it is freed once the last sender
+//   releases it; mutex must be held
+void ResponseCache::drop( IN CachedResponse* entry )
+{
+    CachedResponse** link;
+
+    link = &buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+    while ( *link != entry )
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+
+    unlink( entry );
+    totalBytes -= entry->headersLen + entry->bodyLen;
+
+    if ( --entry->count == 0 )
+    {
+        Free_CachedResponse( entry );
+    }
+}
+
 ///////////////////////////////////////
 void http_SetRootDir( const char* httpRootDir )
 {
+    // cached files may be under the old root
+    gResponseCache.removeAll();
+
     if ( httpRootDir == NULL )
     {
         // deactivate server
@@ -606,7 +990,7 @@ void http_SetRootDir( const char* httpRootDir )
 // -1: filename in neither a file nor a directory
 //
 static int GetFileInfo( IN const char* filename,
-    OUT int& fileLength, OUT time_t& last_modified )
+    OUT off_t& fileLength, OUT time_t& last_modified )
 {
     int code;
     struct stat s;
@@ -660,7 +1044,7 @@ static int GetFileInfo( IN const char* filename,
 //    HTTP_INTERNAL_SERVER_ERROR
 //    HTTP_FORBIDDEN
 static void GetFilename( IN HttpMessage& request,
-    OUT xstring& filename, OUT int& fileLength,
+    OUT xstring& filename, OUT off_t& fileLength,
     OUT time_t& last_modified )
 {
     xstring resourceName;
@@ -782,29 +1166,46 @@ static void GetFilename( IN HttpMessage& request,
 }
 
 ////////////////////////////////////////////
-// Sees if request doc is an alias. If it is, the entity is
-//  loaded into the response.
+// request path with "." and ".." segments resolved; this names
+//  aliases and cached responses
 //
 // returns:
-//   0: success; loaded alias in request
-//  -1: did not find alias
-static int TryToGetAlias( IN HttpMessage& request,
-    OUT HttpMessage& response, OUT xstring& aliasOut )
+//   0: success
+//  -1: path climbs above the root
+static int GetResourceName( IN HttpMessage& request,
+    OUT xstring& resourceName )
 {
-    xstring resourceName;
     uri_type* uri;
-    int retCode = 0;
     char *tempBuf;
+    int code;
 
     uri = &request.requestLine.uri.uri;
 
     resourceName.copyLimited( uri->pathquery.buff, uri->pathquery.size );
 
     tempBuf = resourceName.detach();
-    retCode = remove_dots( tempBuf, strlen(tempBuf) );
+    code = remove_dots( tempBuf, strlen(tempBuf) );
     resourceName = tempBuf;
     free( tempBuf );
-    if ( retCode != 0 )
+
+    return code == 0 ? 0 : -1;
+}
+
+////////////////////////////////////////////
+// Sees if request doc is an alias. If it is, the aliased entity
+//  is grabbed; release it with free_alias() when done.
+//
+// returns:
+//   0: success; entity and its attributes returned
+//  -1: did not find alias
+static int TryToGetAlias( IN HttpMessage& request, OUT xstring& aliasOut,
+    OUT HttpEntity** entity, OUT xstring& contentType,
+    OUT xstring& contentSubtype, OUT time_t& lastModified )
+{
+    xstring resourceName;
+    int retCode = 0;
+
+    if ( GetResourceName(request, resourceName) != 0 )
     {
         return -1;
     }
@@ -812,38 +1213,11 @@ static int TryToGetAlias( IN HttpMessage& request,
 
     try
     {
-        HttpEntity* entity;
-        xstring contentType;
-        xstring contentSubtype;
-        time_t lastModified;
-
-        gAliasList.grabEntity( resourceName.c_str(), &entity,
+        gAliasList.grabEntity( resourceName.c_str(), entity,
             contentType, contentSubtype, lastModified );
 
-        assert( entity != NULL );
-        assert( entity->type == HttpEntity::TEXT );
-
-        response.isRequest = false;
-
-        //response.addContentLengthHeader( entity->getEntityLen() );
-        response.addNumTypeHeader( HDR_CONTENT_LENGTH,
-            entity->getEntityLen() );
-
-        response.addContentTypeHeader( contentType.c_str(),
-            contentSubtype.c_str() );
-
-        //response.addLastModifiedHeader( lastModified );
-        response.addDateTypeHeader( HDR_LAST_MODIFIED, lastModified );
-
-        if ( request.requestLine.method == HTTP_GET )
-        {
-            response.entity.setTextPtrEntity( entity->getEntity(),
-                entity->getEntityLen() );
-        }
-        else
-        {
-            response.entity.type = HttpEntity::EMPTY;
-        }
+        assert( *entity != NULL );
+        assert( (*entity)->type == HttpEntity::TEXT );
     }
     catch ( AliasedListException& /* e */ )
     {
@@ -854,13 +1228,11 @@ static int TryToGetAlias( IN HttpMessage& request,
 }
 
 ////////////////////////////////////////////
-// throws OutOfMemoryException
-static void AddContentType( IN const char* fileName,
-    OUT HttpMessage& response )
+// media type of a file, from its extension
+static void GetContentType( IN const char* fileName,
+    OUT xstring& type, OUT xstring& subtype )
 {
     const char *extPtr;
-    char *type = NULL;
-    const char *subtype = NULL;
     int index;
 
     // find last dot
@@ -885,8 +1257,389 @@ static void AddContentType( IN const char* fileName,
         type = ApplicationStr;
         subtype = "octet-stream";
     }
-        
-    response.addContentTypeHeader( type, subtype );
+}
+
+////////////////////////////////////////////
+// entity tag of a file or alias; changes whenever its length or
+//  modification time does
+static void MakeETag( IN off_t length, IN time_t lastModified,
+    OUT xstring& etag )
+{
+    char buf[64];
+
+    sprintf( buf, "\"%lx-%llx\"", (unsigned long)lastModified,
+        (unsigned long long)length );
+    etag = buf;
+}
+
+////////////////////////////////////////////
+// returns true if 'tagList', a comma separated list of entity tags,
+//  is "*" or contains 'etag'; weak tags (W/"...") only match if
+//  'weak' is true
+static bool ETagListMatches( IN const char* tagList, IN const char* etag,
+    IN bool weak )
+{
+    const char* s = tagList;
+    const char* tag;
+    const char* endQuote;
+    bool isWeak;
+    int etagLen = strlen( etag );
+
+    while ( true )
+    {
+        while ( *s == ' ' || *s == '\t' || *s == ',' )
+        {
+            s++;
+        }
+        if ( *s == '\0' )
+        {
+            return false;
+        }
+
+        if ( *s == '*' )
+        {
+            return true;
+        }
+
+        isWeak = (s[0] == 'W' && s[1] == '/');
+        tag = isWeak ? s + 2 : s;
+        if ( *tag != '"' )
+        {
+            return false;       // malformed
+        }
+
+        endQuote = strchr( tag + 1, '"' );
+        if ( endQuote == NULL )
+        {
+            return false;
+        }
+
+        if ( (weak || !isWeak) && endQuote - tag + 1 == etagLen &&
+             strncmp(tag, etag, etagLen) == 0 )
+        {
+            return true;
+        }
+
+        s = endQuote + 1;
+    }
+}
+
+////////////////////////////////////////////
+// returns true if the request's If-None-Match or If-Modified-Since
+//  header says the client's copy is current
+static bool IsNotModified( IN HttpMessage& request, IN const char* etag,
+    IN time_t lastModified )
+{
+    RawHeaderValue* noneMatch;
+    HttpDateValue* modifiedSince;
+    time_t since;
+
+    // if-none-match overrides if-modified-since
+    noneMatch = (RawHeaderValue *)request.getHeaderValue(
+        HDR_IF_NONE_MATCH );
+    if ( noneMatch != NULL )
+    {
+        return ETagListMatches( noneMatch->value.c_str(), etag, true );
+    }
+
+    modifiedSince = (HttpDateValue *)request.getHeaderValue(
+        HDR_IF_MODIFIED_SINCE );
+    if ( modifiedSince != NULL )
+    {
+        since = timegm( &modifiedSince->gmtDateTime );
+
+        // ignore dates in the future
+        return since != (time_t)-1 && since <= time(NULL) &&
+            lastModified <= since;
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////
+// returns true unless the request has an If-Range header naming
+//  a different version of the resource
+static bool IfRangeMatches( IN HttpMessage& request, IN const char* etag,
+    IN time_t lastModified )
+{
+    RawHeaderValue* ifRange;
+    const char* value;
+    struct tm date;
+    int numCharsParsed;
+
+    ifRange = (RawHeaderValue *)request.getHeaderValue( HDR_IF_RANGE );
+    if ( ifRange == NULL )
+    {
+        return true;
+    }
+
+    value = ifRange->value.c_str();
+    if ( value[0] == '"' || (value[0] == 'W' && value[1] == '/') )
+    {
+        // needs a strong match
+        return ETagListMatches( value, etag, false );
+    }
+
+    if ( ParseDateTime(value, &date, &numCharsParsed) == -1 )
+    {
+        return false;
+    }
+
+    return timegm( &date ) == lastModified;
+}
+
+////////////////////////////////////////////
+// reads a decimal number; values too large for an off_t are clamped
+// returns false if 's' does not point to a digit
+static bool ParseRangeNum( INOUT const char*& s, OUT off_t& num )
+{
+    if ( *s < '0' || *s > '9' )
+    {
+        return false;
+    }
+
+    num = 0;
+    while ( *s >= '0' && *s <= '9' )
+    {
+        if ( num <= (MAX_FILE_OFFSET - 9) / 10 )
+        {
+            num = num * 10 + (*s - '0');
+        }
+        else
+        {
+            num = MAX_FILE_OFFSET;
+        }
+        s++;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////
+// parses the value of a Range header for a resource of 'length'
+//  bytes
+//
+// returns:
+//  >0: number of satisfiable ranges stored in 'ranges'
+//   0: no range can be satisfied
+//  -1: not a valid byte range set, or more than 'maxRanges'
+//      ranges; the header should be ignored
+static int ParseByteRanges( IN const char* spec, IN off_t length,
+    OUT HttpFileRange* ranges, IN int maxRanges )
+{
+    const char* s = spec;
+    int numSpecs = 0;
+    int numRanges = 0;
+    off_t first;
+    off_t last;
+
+    if ( strncasecmp(s, "bytes", 5) != 0 )
+    {
+        return -1;
+    }
+    s += 5;
+    while ( *s == ' ' || *s == '\t' )
+    {
+        s++;
+    }
+    if ( *s++ != '=' )
+    {
+        return -1;
+    }
+
+    while ( true )
+    {
+        while ( *s == ' ' || *s == '\t' || *s == ',' )
+        {
+            s++;
+        }
+        if ( *s == '\0' )
+        {
+            break;
+        }
+
+        if ( *s == '-' )
+        {
+            // suffix range: last N bytes
+            s++;
+            if ( !ParseRangeNum(s, last) )
+            {
+                return -1;
+            }
+            first = length - (last < length ? last : length);
+            if ( last == 0 || length == 0 )
+            {
+                first = length;     // unsatisfiable
+            }
+            last = length - 1;
+        }
+        else
+        {
+            if ( !ParseRangeNum(s, first) || *s++ != '-' )
+            {
+                return -1;
+            }
+            if ( !ParseRangeNum(s, last) )
+            {
+                last = length - 1;  // open ended
+            }
+            else if ( last < first )
+            {
+                return -1;
+            }
+            if ( last >= length )
+            {
+                last = length - 1;
+            }
+        }
+
+        while ( *s == ' ' || *s == '\t' )
+        {
+            s++;
+        }
+        if ( *s != ',' && *s != '\0' )
+        {
+            return -1;
+        }
+
+        numSpecs++;
+        if ( first >= length )
+        {
+            continue;       // unsatisfiable; skip
+        }
+
+        if ( numRanges == maxRanges )
+        {
+            return -1;
+        }
+        ranges[numRanges].first = first;
+        ranges[numRanges].length = last - first + 1;
+        numRanges++;
+    }
+
+    return numSpecs == 0 ? -1 : numRanges;
+}
+
+////////////////////////////////////////////
+// formats "bytes first-last/length" for a Content-Range header
+static void ContentRangeToString( IN const HttpFileRange& range,
+    IN off_t length, OUT xstring& s )
+{
+    char buf[100];
+
+    sprintf( buf, "bytes %lld-%lld/%lld", (long long)range.first,
+        (long long)(range.first + range.length - 1), (long long)length );
+    s = buf;
+}
+
+////////////////////////////////////////////
+// adds a Content-Length header; HttpNumber only holds an int, and
+//  files can be larger
+static void AddContentLength( INOUT HttpMessage& response,
+    IN off_t length )
+{
+    char buf[32];
+
+    sprintf( buf, "%lld", (long long)length );
+    response.addRawHeader( HDR_CONTENT_LENGTH, buf );
+}
+
+////////////////////////////////////////////
+// sets a 206 body for the ranges of a file ('data' == NULL) or of
+//  an alias; more than one range makes a multipart/byteranges body
+//
+// throws OutOfMemoryException
+static void SetRangeEntity( INOUT HttpMessage& response,
+    IN HttpFileRange* ranges, IN int numRanges, IN off_t length,
+    IN const char* type, IN const char* subtype,
+    IN const char* filename, IN const char* data )
+{
+    HttpEntity& entity = response.entity;
+    xstring contentRange;
+    off_t bodyLength = 0;
+    int i;
+
+    if ( numRanges == 1 )
+    {
+        ContentRangeToString( ranges[0], length, contentRange );
+        response.addRawHeader( HDR_CONTENT_RANGE, contentRange.c_str() );
+        response.addContentTypeHeader( type, subtype );
+        bodyLength = ranges[0].length;
+    }
+    else
+    {
+        char boundary[64];
+        RawHeaderValue* multipartType;
+
+        sprintf( boundary, "%08lx%08lx", (unsigned long)time(NULL),
+            (unsigned long)rand() );
+
+        for ( i = 0; i < numRanges; i++ )
+        {
+            xstring& partHeader = ranges[i].partHeader;
+
+            ContentRangeToString( ranges[i], length, contentRange );
+
+            partHeader = "\r\n--";
+            partHeader += boundary;
+            partHeader += "\r\nContent-Type: ";
+            partHeader += type;
+            partHeader += '/';
+            partHeader += subtype;
+            partHeader += "\r\nContent-Range: ";
+            partHeader += contentRange;
+            partHeader += "\r\n\r\n";
+
+            bodyLength += partHeader.length() + ranges[i].length;
+        }
+
+        entity.rangeTrailer = "\r\n--";
+        entity.rangeTrailer += boundary;
+        entity.rangeTrailer += "--\r\n";
+        bodyLength += entity.rangeTrailer.length();
+
+        // header is only ever written out, so a raw value will do
+        multipartType = new RawHeaderValue;
+        if ( multipartType == NULL )
+        {
+            throw OutOfMemoryException( "SetRangeEntity()" );
+        }
+        multipartType->value = "multipart/byteranges; boundary=";
+        multipartType->value += boundary;
+        response.addHeader( HDR_CONTENT_TYPE, multipartType );
+    }
+
+    AddContentLength( response, bodyLength );
+
+    if ( data == NULL )
+    {
+        entity.type = HttpEntity::FILENAME;
+        entity.filename = filename;
+        entity.numRanges = numRanges;
+    }
+    else if ( numRanges == 1 )
+    {
+        entity.setTextPtrEntity( data + ranges[0].first, ranges[0].length );
+    }
+    else
+    {
+        entity.type = HttpEntity::TEXT;
+        for ( i = 0; i < numRanges; i++ )
+        {
+            if ( entity.append(ranges[i].partHeader.c_str(),
+                    ranges[i].partHeader.length()) != 0 ||
+                 entity.append(data + ranges[i].first,
+                    ranges[i].length) != 0 )
+            {
+                throw OutOfMemoryException( "SetRangeEntity()" );
+            }
+        }
+        if ( entity.append(entity.rangeTrailer.c_str(),
+                entity.rangeTrailer.length()) != 0 )
+        {
+            throw OutOfMemoryException( "SetRangeEntity()" );
+        }
+    }
 }
 
 ////////////////////////////////////////////
@@ -934,6 +1687,40 @@ static void GetReplyVersion( IN HttpRequestLine& reqLine,
     minorVersion = respMinor;
 }
 
+////////////////////////////////////////////
+// true if the miniserver keeps the connection after answering: an
+//  HTTP/1.1 request without "Connection: close"
+static bool KeepsConnection( IN HttpMessage& request )
+{
+    HttpRequestLine& reqLine = request.requestLine;
+    CommaSeparatedList* connection;
+    HttpHeaderValueNode* node;
+
+    if ( reqLine.majorVersion != 1 || reqLine.minorVersion < 1 )
+    {
+        return false;
+    }
+
+    connection = (CommaSeparatedList *)request.getHeaderValue(
+        HDR_CONNECTION );
+    if ( connection == NULL )
+    {
+        return true;
+    }
+    node = connection->valueList.getFirstItem();
+    while ( node != NULL )
+    {
+        if ( strcasecmp(((IdentifierValue *)node->data)->value.c_str(),
+                "close") == 0 )
+        {
+            return false;
+        }
+        node = connection->valueList.next( node );
+    }
+
+    return true;
+}
+
 ////////////////////////////////////////////
 void free_alias( IN bool usingAlias, IN const char* alias )
 {
@@ -954,7 +1741,9 @@ void free_alias( IN bool usingAlias, IN const char* alias )
 
 
 ////////////////////////////////////////////
-// processes GET and HEAD methods
+// processes GET and HEAD methods; answers If-None-Match and
+//  If-Modified-Since with 304 and byte Range requests with 206
+//  (or 416 if no range can be satisfied)
 // throws HttpServerException
 //    HTTP_BAD_REQUEST
 //    HTTP_NOT_FOUND
@@ -967,6 +1756,7 @@ static void ProcessRequest( IN HttpMessage& request,
 {
     int method;
     int respMajor, respMinor;
+    int statusCode = HTTP_OK;
 
     usingAlias = false;
     
@@ -982,38 +1772,109 @@ static void ProcessRequest( IN HttpMessage& request,
         GetReplyVersion( request.requestLine, respMajor, respMinor );
 
         xstring filename;
-        int fileLength;
+        off_t fileLength;
         time_t lastModified;
+        xstring contentType;
+        xstring contentSubtype;
+        HttpEntity* aliasEntity = NULL;
+        const char* aliasData = NULL;
+        xstring etag;
+        RawHeaderValue* range;
+        HttpFileRange* ranges;
+        int numRanges = -1;
 
         usingAlias = true;
-        if ( TryToGetAlias(request, response, aliasOut) != 0 )
+        if ( TryToGetAlias(request, aliasOut, &aliasEntity, contentType,
+                contentSubtype, lastModified) != 0 )
         {
             // alias not found -- try files
             usingAlias = false;
 
             GetFilename( request, filename, fileLength, lastModified );
 
-            AddContentType( filename.c_str(), response );
-            
-            // add std response headers
-        
-            // content-length
-            //response.addContentLengthHeader( fileLength );
-            response.addNumTypeHeader( HDR_CONTENT_LENGTH, fileLength );
+            GetContentType( filename.c_str(), contentType, contentSubtype );
+        }
+        else
+        {
+            fileLength = aliasEntity->getEntityLen();
+            aliasData = (const char *)aliasEntity->getEntity();
+        }
+
+        // add std response headers
+
+        // validators
+        MakeETag( fileLength, lastModified, etag );
+        response.addRawHeader( HDR_ETAG, etag.c_str() );
+
+        //response.addLastModifiedHeader( lastModified );
+        response.addDateTypeHeader( HDR_LAST_MODIFIED, lastModified );
 
-            // last modified
-            //response.addLastModifiedHeader( lastModified );
-            response.addDateTypeHeader( HDR_LAST_MODIFIED, lastModified );
+        response.entity.type = HttpEntity::EMPTY;
 
-            if ( method == HTTP_GET )
+        if ( IsNotModified(request, etag.c_str(), lastModified) )
+        {
+            // client's copy is current; no body
+            statusCode = HTTP_NOT_MODIFIED;
+        }
+        else
+        {
+            response.addRawHeader( HDR_ACCEPT_RANGES, "bytes" );
+
+            range = (RawHeaderValue *)request.getHeaderValue( HDR_RANGE );
+            if ( method == HTTP_GET && range != NULL &&
+                 IfRangeMatches(request, etag.c_str(), lastModified) )
             {
-                // set http body to be sent
-                response.entity.type = HttpEntity::FILENAME;
-                response.entity.filename = filename;
+                ranges = new HttpFileRange[MAX_BYTE_RANGES];
+                if ( ranges == NULL )
+                {
+                    throw OutOfMemoryException( "ProcessRequest()" );
+                }
+                response.entity.ranges = ranges;   // entity frees it
+
+                numRanges = ParseByteRanges( range->value.c_str(),
+                    fileLength, ranges, MAX_BYTE_RANGES );
+            }
+
+            if ( numRanges == 0 )
+            {
+                xstring contentRange;
+                char buf[64];
+
+                sprintf( buf, "bytes */%lld", (long long)fileLength );
+                contentRange = buf;
+
+                statusCode = HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+                response.addRawHeader( HDR_CONTENT_RANGE,
+                    contentRange.c_str() );
+                response.addNumTypeHeader( HDR_CONTENT_LENGTH, 0 );
+            }
+            else if ( numRanges > 0 )
+            {
+                statusCode = HTTP_PARTIAL_CONTENT;
+                SetRangeEntity( response, ranges, numRanges, fileLength,
+                    contentType.c_str(), contentSubtype.c_str(),
+                    filename.c_str(), aliasData );
             }
             else
             {
-                response.entity.type = HttpEntity::EMPTY;
+                // whole resource
+                response.addContentTypeHeader( contentType.c_str(),
+                    contentSubtype.c_str() );
+
+                //response.addContentLengthHeader( fileLength );
+                AddContentLength( response, fileLength );
+
+                if ( method == HTTP_GET && usingAlias )
+                {
+                    response.entity.setTextPtrEntity( aliasData,
+                        fileLength );
+                }
+                else if ( method == HTTP_GET )
+                {
+                    // set http body to be sent
+                    response.entity.type = HttpEntity::FILENAME;
+                    response.entity.filename = filename;
+                }
             }
         }
 
@@ -1024,11 +1885,14 @@ static void ProcessRequest( IN HttpMessage& request,
         // server
         response.addServerHeader();
 
-        // connection close
-        const char *idents[] = {"close"};
-        response.addIdentListHeader( HDR_CONNECTION, idents, 1 );
+        // connection close, unless the connection is kept
+        if ( !KeepsConnection(request) )
+        {
+            const char *idents[] = {"close"};
+            response.addIdentListHeader( HDR_CONNECTION, idents, 1 );
+        }
 
-        response.responseLine.setValue( HTTP_OK, respMajor, respMinor );
+        response.responseLine.setValue( statusCode, respMajor, respMinor );
         response.isRequest = false;
     }
     catch ( int errCode )
@@ -1043,6 +1907,195 @@ static void ProcessRequest( IN HttpMessage& request,
             "ProcessRequest(): done\n"); )
 }
 
+////////////////////////////////////////////
+// sends the cached response for a GET or HEAD request, if there is
+//  one; requests for ranges or for a 304 are left to ProcessRequest
+//
+// returns true if the response was sent, or the sending failed
+static bool SendCachedResponse( IN HttpMessage& request, IN int sockfd )
+{
+    HttpRequestLine& reqLine = request.requestLine;
+    CachedResponse* entry;
+    xstring resourceName;
+    char statusLine[64];
+    char dateLine[96];
+    char* date;
+    struct tm gmt;
+    time_t now;
+    struct iovec iov[4];
+    int code;
+
+    if ( WEB_SERVER_CACHE_BYTES <= 0 ||
+         (reqLine.method != HTTP_GET && reqLine.method != HTTP_HEAD) ||
+         reqLine.pathIsStar || reqLine.majorVersion < 1 ||
+         request.getHeaderValue(HDR_RANGE) != NULL ||
+         GetResourceName(request, resourceName) != 0 )
+    {
+        return false;
+    }
+
+    entry = gResponseCache.grab( resourceName.c_str() );
+    if ( entry == NULL )
+    {
+        return false;
+    }
+
+    if ( IsNotModified(request, entry->etag.c_str(), entry->lastModified) )
+    {
+        gResponseCache.release( entry );
+        return false;
+    }
+
+    // same version GetReplyVersion() picks
+    sprintf( statusLine, "HTTP/1.%d 200 %s\r\n",
+        (reqLine.majorVersion == 1 && reqLine.minorVersion == 0) ? 0 : 1,
+        http_GetCodeText(HTTP_OK) );
+
+    now = time( NULL );
+    date = DateToString( gmtime_r(&now, &gmt) );
+    sprintf( dateLine, "%sDATE: %s\r\n\r\n",
+        KeepsConnection(request) ? "" : "CONNECTION: close\r\n", date );
+    free( date );
+
+    iov[0].iov_base = statusLine;
+    iov[0].iov_len = strlen( statusLine );
+    iov[1].iov_base = entry->headers;
+    iov[1].iov_len = entry->headersLen;
+    iov[2].iov_base = dateLine;
+    iov[2].iov_len = strlen( dateLine );
+    iov[3].iov_base = entry->body;
+    iov[3].iov_len = reqLine.method == HTTP_GET ? entry->bodyLen : 0;
+
+    code = http_SendBuffers( sockfd, iov, 4 );
+    if ( code != 0 )
+    {
+        // part of the response may be out; the connection is dropped
+        //  rather than answered again
+        DBG(
+            UpnpPrintf( UPNP_INFO, MSERV, __FILE__, __LINE__,
+                "SendCachedResponse(): send failed: %d\n", code); )
+    }
+
+    gResponseCache.release( entry );
+
+    return true;
+}
+
+////////////////////////////////////////////
+// keeps a 200 response to a GET for later requests: the body of an
+//  alias, or the contents of a file if small enough
+static void CacheResponse( IN HttpMessage& request,
+    IN HttpMessage& response, IN unsigned generation )
+{
+    HttpEntity& entity = response.entity;
+    xstring resourceName;
+    xstring headerStr;
+    xstring etag;
+    RawHeaderValue* etagValue;
+    HttpHeaderNode* node;
+    HttpHeader* header;
+    char* headers;
+    int headersLen;
+    char* body = NULL;
+    int bodyLen;
+    struct stat info;
+    time_t lastModified;
+    const char* filename = "";
+
+    if ( WEB_SERVER_CACHE_BYTES <= 0 ||
+         request.requestLine.method != HTTP_GET ||
+         response.responseLine.statusCode != HTTP_OK ||
+         GetResourceName(request, resourceName) != 0 )
+    {
+        return;
+    }
+
+    etagValue = (RawHeaderValue *)response.getHeaderValue( HDR_ETAG );
+    if ( etagValue == NULL )
+    {
+        return;
+    }
+
+    if ( entity.type == HttpEntity::TEXT_PTR )
+    {
+        // alias
+        HttpDateValue* modified;
+
+        bodyLen = entity.getEntityLen();
+        if ( bodyLen > WEB_SERVER_CACHE_BYTES / 4 )
+        {
+            return;
+        }
+        body = (char *)malloc( bodyLen + 1 );
+        if ( body == NULL )
+        {
+            return;
+        }
+        memcpy( body, entity.getEntity(), bodyLen );
+
+        modified = (HttpDateValue *)response.getHeaderValue(
+            HDR_LAST_MODIFIED );
+        lastModified = timegm( &modified->gmtDateTime );
+    }
+    else if ( entity.type == HttpEntity::FILENAME )
+    {
+        int fd;
+
+        filename = entity.getFileName();
+        fd = open( filename, O_RDONLY );
+        if ( fd == -1 )
+        {
+            return;
+        }
+        if ( fstat(fd, &info) == -1 ||
+             info.st_size > WEB_SERVER_CACHE_BYTES / 4 ||
+             (body = (char *)malloc(info.st_size + 1)) == NULL ||
+             read(fd, body, info.st_size) != info.st_size )
+        {
+            free( body );
+            close( fd );
+            return;
+        }
+        close( fd );
+
+        // file must still be the one the headers describe
+        bodyLen = info.st_size;
+        lastModified = info.st_mtime;
+        MakeETag( bodyLen, lastModified, etag );
+        if ( etag != etagValue->value )
+        {
+            free( body );
+            return;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    // render the headers once; date and connection are added when sent
+    node = response.getFirstHeader();
+    while ( node != NULL )
+    {
+        header = (HttpHeader *)node->data;
+        if ( header->type != HDR_DATE && header->type != HDR_CONNECTION )
+        {
+            header->toString( headerStr );
+        }
+        node = response.getNextHeader( node );
+    }
+    headersLen = headerStr.length();
+    headers = headerStr.detach();
+
+    if ( !gResponseCache.add(resourceName.c_str(), filename, headers,
+            headersLen, body, bodyLen, etagValue->value.c_str(),
+            lastModified, generation) )
+    {
+        free( headers );
+        free( body );
+    }
+}
+
 ////////////////////////////////////////////
 static void HandleError( IN HttpMessage& request, IN int errCode,
     IN int sockfd )
@@ -1106,6 +2159,7 @@ int http_ServerCallback( IN HttpMessage& request, int sockfd )
     HttpMessage response;
     bool usingAlias = false;
     xstring alias;
+    unsigned generation;
     
     try
     {
@@ -1116,9 +2170,20 @@ int http_ServerCallback( IN HttpMessage& request, int sockfd )
             throw e;
         }
 
+        if ( SendCachedResponse(request, sockfd) )
+        {
+            close( sockfd );
+            return 0;
+        }
+
+        generation = gResponseCache.getGeneration();
+
         ProcessRequest( request, response, usingAlias, alias );
         
-        http_SendMessage( sockfd, response );
+        if ( http_SendMessage(sockfd, response) == 0 )
+        {
+            CacheResponse( request, response, generation );
+        }
     }
     catch ( HttpServerException& e )
     {
@@ -1140,12 +2205,14 @@ int http_ServerCallback( IN HttpMessage& request, int sockfd )
 }
 
 ////////////////////////////////////////////
-void http_OldServerCallback( IN const char* msg, int sockfd )
+void http_OldServerCallback( IN const MiniServerRequest* msg, int sockfd )
 {
     HttpMessage request;
     int code;
 
-    code = request.loadRequest( msg );
+    // the miniserver has parsed the request already
+    code = request.loadRequest( msg->document, msg->documentLen,
+        *msg->parser );
     if ( code < 0 )
     {
         if ( code == HTTP_E_BAD_MSG_FORMAT )
@@ -1179,6 +2246,7 @@ int http_AddAlias( IN const char* aliasRelURL, IN HttpEntity* entity,
     try
     {
         gAliasList.addEntity( aliasRelURL, entity, actualAlias );
+        gResponseCache.remove( actualAlias.c_str() );
         retCode = 0;
     }
     catch ( OutOfMemoryException& /* e */ )
@@ -1196,6 +2264,7 @@ int http_RemoveAlias( IN const char* alias )
 
     try
     {
+        gResponseCache.remove( alias );
         gAliasList.releaseEntity( alias, true );
         retCode = 0;        // removed
     }
@@ -38,6 +38,25 @@
 
 
 DEVICEONLY(
+
+//hashes len bytes of s into h (h is the running hash value)
+static unsigned int hashBytes(unsigned int h, const char * s, int len)
+{
+  while (len-->0)
+    h=(h*33)^(unsigned char) (*s++);
+  return h;
+}
+
+static unsigned int hashString(unsigned int h, const char * s)
+{
+  return hashBytes(h,s,strlen(s));
+}
+
+static unsigned int hashServiceId(const char * serviceId, const char * UDN)
+{
+  return hashString(hashString(5381,UDN),serviceId)%SERVICE_HASH_SIZE;
+}
+
 int copy_subscription(subscription *in, subscription *out)
 {
   int return_code=HTTP_SUCCESS;
@@ -51,122 +70,178 @@ int copy_subscription(subscription *in, subscription *out)
   if ( (return_code=copy_URL_list(&in->DeliveryURLs,&out->DeliveryURLs))!=HTTP_SUCCESS)
     return return_code;
   out->next=NULL; 
+  out->prev=NULL;
+  out->hashNext=NULL;
+  out->outgoing=NULL;
+  out->outgoingTail=NULL;
+  out->sending=0;
   return HTTP_SUCCESS; 
 }
 
-void RemoveSubscriptionSID(Upnp_SID sid, service_info * service)
+//rebuilds the SID index of the service with size buckets
+static int ResizeSIDIndex(service_info * service, int size)
 {
-  subscription * finger=service->subscriptionList;
-  subscription * previous=NULL;
-  
-  while (finger)
+  subscription ** index=NULL;
+  subscription * finger=NULL;
+  unsigned int bucket=0;
+
+  index=(subscription **) malloc(sizeof(subscription *)*size);
+  if (index==NULL)
+    return UPNP_E_OUTOF_MEMORY;
+  memset(index,0,sizeof(subscription *)*size);
+
+  for (finger=service->subscriptionList;finger;finger=finger->next)
     {
-      if ( !(strcmp(sid,finger->sid)))
-	{
-	  if (previous)
-	    previous->next=finger->next;
-	  else
-	    service->subscriptionList=finger->next;
-	  finger->next=NULL;
-	  freeSubscriptionList(finger);
-	  finger=NULL;
-	  service->TotalSubscriptions--;
-	}
-      else
-	{ previous=finger;
-	  finger=finger->next;
-	}
+      bucket=hashString(5381,finger->sid)%size;
+      finger->hashNext=index[bucket];
+      index[bucket]=finger;
     }
-  
+  if (service->SIDIndex)
+    free(service->SIDIndex);
+  service->SIDIndex=index;
+  service->SIDIndexSize=size;
+  return HTTP_SUCCESS;
 }
 
+int AddSubscription(service_info * service, subscription * sub)
+{
+  unsigned int bucket=0;
 
-subscription * GetSubscriptionSID(Upnp_SID sid,service_info * service)
+  if (service->SIDIndex==NULL)
+    {
+      if (ResizeSIDIndex(service,SID_HASH_INITIAL_SIZE)!=HTTP_SUCCESS)
+	return UPNP_E_OUTOF_MEMORY;
+    }
+  else
+    if (service->TotalSubscriptions>=service->SIDIndexSize)
+      //a failed resize leaves the old (longer chained) index in place
+      ResizeSIDIndex(service,service->SIDIndexSize*2);
+
+  sub->prev=NULL;
+  sub->next=service->subscriptionList;
+  if (sub->next)
+    sub->next->prev=sub;
+  service->subscriptionList=sub;
+
+  bucket=hashString(5381,sub->sid)%service->SIDIndexSize;
+  sub->hashNext=service->SIDIndex[bucket];
+  service->SIDIndex[bucket]=sub;
+
+  service->TotalSubscriptions++;
+  return HTTP_SUCCESS;
+}
+
+//finds the subscription with the SID in the service's SID index
+static subscription * LookupSubscriptionSID(Upnp_SID sid, service_info * service)
 {
-  subscription * next =service->subscriptionList;
-  subscription * previous =NULL;
-  subscription * found=NULL;
+  subscription * finger=NULL;
 
+  if (service->SIDIndex==NULL)
+    return NULL;
+  finger=service->SIDIndex[hashString(5381,sid)%service->SIDIndexSize];
+  while ( (finger) && (strcmp(finger->sid,sid)) )
+    finger=finger->hashNext;
+  return finger;
+}
+
+//unlinks the subscription from the subscription list and the SID index
+//of the service and frees it
+static void DeleteSubscription(service_info * service, subscription * sub)
+{
+  subscription ** link=NULL;
+
+  link=&service->SIDIndex[hashString(5381,sub->sid)%service->SIDIndexSize];
+  while ( (*link) && ((*link)!=sub) )
+    link=&(*link)->hashNext;
+  if (*link)
+    (*link)=sub->hashNext;
+
+  if (sub->prev)
+    sub->prev->next=sub->next;
+  else
+    service->subscriptionList=sub->next;
+  if (sub->next)
+    sub->next->prev=sub->prev;
+
+  sub->next=NULL;
+  freeSubscriptionList(sub);
+  service->TotalSubscriptions--;
+}
+
+void RemoveSubscriptionSID(Upnp_SID sid, service_info * service)
+{
+  subscription * found=LookupSubscriptionSID(sid,service);
+
+  if (found)
+    DeleteSubscription(service,found);
+}
+
+
+subscription * GetSubscriptionSID(Upnp_SID sid,service_info * service)
+{
+  subscription * found=LookupSubscriptionSID(sid,service);
   time_t current_time;
 
-  while ( (next) && (found==NULL))
-    {
-      if ( ! strcmp(next->sid,sid))
-	    found=next;
-      else 
-	{
-	  previous=next;
-	  next=next->next;
-	}
-    } 
   if (found)
     {
        //get the current_time
       time(&current_time);
       if ( (found->expireTime!=0) && (found->expireTime<current_time) )
 	{
-	  if (previous)
-	    previous->next=found->next;
-	  else 
-	    service->subscriptionList=found->next;
-	  found->next=NULL;
-	  freeSubscriptionList(found);
+	  DeleteSubscription(service,found);
 	  found=NULL;
-	  service->TotalSubscriptions--;
 	}
     }
   return found;
 
 }
 
+subscription * FindSubscriptionSID(Upnp_SID sid,service_info * service)
+{
+  subscription * found=LookupSubscriptionSID(sid,service);
+  time_t current_time;
 
-subscription * GetNextSubscription(service_info * service, subscription *current)
+  if (found)
+    {
+      time(&current_time);
+      if ( (found->expireTime!=0) && (found->expireTime<current_time) )
+	found=NULL;
+    }
+  return found;
+}
+
+//returns the first ACTIVE subscription that has not expired, starting
+//at (and including) current.  Expired subscriptions are removed
+static subscription * GetLiveSubscription(service_info * service, subscription *current)
 {
   time_t current_time;
   subscription * next=NULL;
-  subscription * previous=NULL;
-  int notDone =1;
 
   //get the current_time
   time(&current_time);
-  while ( (notDone) && (current))
+  while (current)
     {
-      previous=current;
-      current=current->next;
-
-      if (current==NULL)
-	{
-	  notDone=0;
-	  next=current;
-	}
+      next=current->next;
+      if ( (current->expireTime!=0) && (current->expireTime<current_time) )
+	DeleteSubscription(service,current);
       else
-	if ( (current->expireTime!=0) && (current->expireTime<current_time) )
-	  {
-	    previous->next=current->next;
-	    current->next=NULL;
-	    freeSubscriptionList(current);
-	    current=previous;
-	    service->TotalSubscriptions--;
-	  }
-	    else
-	  if (current->active)
-	    {
-	      notDone=0;
-	      next=current;
-	    }
+	if (current->active)
+	  return current;
+      current=next;
     }
-  return next;
+  return NULL;
+}
+
+subscription * GetNextSubscription(service_info * service, subscription *current)
+{
+  if (current==NULL)
+    return NULL;
+  return GetLiveSubscription(service,current->next);
 }
 
 subscription * GetFirstSubscription(service_info *service)
 {
-  subscription temp; 
-  subscription * next=NULL;
-  temp.next=service->subscriptionList;
-  next=GetNextSubscription(service, &temp);
-  service->subscriptionList=temp.next;
-  //  service->subscriptionList=next;
-  return next;
+  return GetLiveSubscription(service,service->subscriptionList);
 }
 
 
@@ -179,7 +254,7 @@ service_info * FindServiceId(service_table *table, const char * serviceId, const
 
   if (table)
     {
-      finger=table->serviceList;
+      finger=table->idIndex[hashServiceId(serviceId,UDN)];
       while(finger)
 	{
 	  if (  ( !strcmp(serviceId,finger->serviceId)) && 
@@ -187,36 +262,50 @@ service_info * FindServiceId(service_table *table, const char * serviceId, const
 	    {
 	      return finger;
 	    }
-	  finger=finger->next;
+	  finger=finger->idNext;
 	}
     }
 
   return NULL;
 }
 
+//returns the path and query of url as a newly allocated string,
+//NULL if url is NULL or can not be parsed
+static char * getURLPath(char * url)
+{
+  uri_type parsed_url;
+  char * path=NULL;
+
+  if ( (url) && (parse_uri(url,strlen(url),&parsed_url)) )
+    {
+      path=(char *) malloc(parsed_url.pathquery.size+1);
+      if (path)
+	{
+	  memcpy(path,parsed_url.pathquery.buff,parsed_url.pathquery.size);
+	  path[parsed_url.pathquery.size]=0;
+	}
+    }
+  return path;
+}
+
 service_info * FindServiceEventURLPath(service_table *table, 
 				       char * eventURLPath)
 {
   service_info * finger=NULL;
-  uri_type parsed_url;
   uri_type parsed_url_in;
 
   if ( (table) && (parse_uri(eventURLPath,strlen(eventURLPath),&parsed_url_in)))
     {
-     
-      finger=table->serviceList;
+      finger=table->eventIndex[hashBytes(5381,parsed_url_in.pathquery.buff,
+					 parsed_url_in.pathquery.size)
+			      %SERVICE_HASH_SIZE];
       while (finger)
 	{  
-	  if (finger->eventURL)
-	  if ( (parse_uri(finger->eventURL,strlen(finger->eventURL),
-			  &parsed_url)))
-	    {
-	     
-	      if (!token_cmp(&parsed_url.pathquery,&parsed_url_in.pathquery))
-		return finger;
-	      
-	    }
-	  finger=finger->next;
+	  if ( (strlen(finger->eventURLPath)==parsed_url_in.pathquery.size) &&
+	       (!strncmp(finger->eventURLPath,parsed_url_in.pathquery.buff,
+			 parsed_url_in.pathquery.size)) )
+	    return finger;
+	  finger=finger->eventNext;
 	}
     }
   
@@ -226,22 +315,20 @@ service_info * FindServiceEventURLPath(service_table *table,
 service_info * FindServiceControlURLPath(service_table * table, char * controlURLPath)
 {
   service_info * finger=NULL;
-  uri_type parsed_url;
   uri_type parsed_url_in;
 
   if ( (table) && (parse_uri(controlURLPath,strlen(controlURLPath),&parsed_url_in)))
     {
-      finger=table->serviceList;
+      finger=table->controlIndex[hashBytes(5381,parsed_url_in.pathquery.buff,
+					   parsed_url_in.pathquery.size)
+				%SERVICE_HASH_SIZE];
       while (finger)
 	{
-	  if (finger->controlURL)
-	  if ( (parse_uri(finger->controlURL,strlen(finger->controlURL),
-			  &parsed_url)))
-	    {
-	      if (!token_cmp(&parsed_url.pathquery,&parsed_url_in.pathquery))
-		return finger;
-	    }
-	  finger=finger->next;
+	  if ( (strlen(finger->controlURLPath)==parsed_url_in.pathquery.size) &&
+	       (!strncmp(finger->controlURLPath,parsed_url_in.pathquery.buff,
+			 parsed_url_in.pathquery.size)) )
+	    return finger;
+	  finger=finger->controlNext;
 	}
     }
 
@@ -249,6 +336,35 @@ service_info * FindServiceControlURLPath(service_table * table, char * controlUR
   
 }
 
+//fills the idIndex, controlIndex and eventIndex of the table
+//from its serviceList
+static void buildServiceIndexes(service_table * table)
+{
+  service_info * finger=NULL;
+  unsigned int bucket=0;
+
+  for (finger=table->serviceList;finger;finger=finger->next)
+    {
+      bucket=hashServiceId(finger->serviceId,finger->UDN);
+      finger->idNext=table->idIndex[bucket];
+      table->idIndex[bucket]=finger;
+
+      if ( (finger->controlURLPath=getURLPath(finger->controlURL)) )
+	{
+	  bucket=hashString(5381,finger->controlURLPath)%SERVICE_HASH_SIZE;
+	  finger->controlNext=table->controlIndex[bucket];
+	  table->controlIndex[bucket]=finger;
+	}
+
+      if ( (finger->eventURLPath=getURLPath(finger->eventURL)) )
+	{
+	  bucket=hashString(5381,finger->eventURLPath)%SERVICE_HASH_SIZE;
+	  finger->eventNext=table->eventIndex[bucket];
+	  table->eventIndex[bucket]=finger;
+	}
+    }
+}
+
 DBGONLY(
 void printService(service_info *service, Dbg_Level level,
 		  Dbg_Module module)
@@ -320,9 +436,29 @@ void freeSubscription(subscription * sub)
   if (sub)
     {
       free_URL_list(&sub->DeliveryURLs);
+#if EXCLUDE_GENA == 0
+      freeNotifyQueue(sub->outgoing);
+#endif
+      sub->outgoing=NULL;
+      sub->outgoingTail=NULL;
     }
 }
 
+void freeVarList(char ** names, char ** values, int count)
+{
+  int i;
+
+  for (i=0;i<count;i++)
+    {
+      free(names[i]);
+      free(values[i]);
+    }
+  if (names)
+    free(names);
+  if (values)
+    free(values);
+}
+
 void freeSubscriptionList(subscription * head)
 {
   subscription * next=NULL;
@@ -352,8 +488,15 @@ void freeServiceList(service_info * head)
 	free(head->eventURL);
       if (head->UDN)
 	UpnpDOMString_free(head->UDN);
+      if (head->controlURLPath)
+	free(head->controlURLPath);
+      if (head->eventURLPath)
+	free(head->eventURLPath);
       if (head->subscriptionList)
 	freeSubscriptionList(head->subscriptionList);
+      if (head->SIDIndex)
+	free(head->SIDIndex);
+      freeVarList(head->pendingNames,head->pendingValues,head->pendingCount);
       head->TotalSubscriptions=0;
       next=head->next;
       free(head);
@@ -368,6 +511,9 @@ void freeServiceTable(service_table * table)
   UpnpDOMString_free(table->URLBase);
   freeServiceList(table->serviceList);
   table->serviceList=NULL;
+  memset(table->idIndex,0,sizeof(table->idIndex));
+  memset(table->controlIndex,0,sizeof(table->controlIndex));
+  memset(table->eventIndex,0,sizeof(table->eventIndex));
 }
 
 
@@ -496,6 +642,20 @@ service_info * getServiceList(Upnp_Node node,service_info **end, char * URLBase)
 	      current->active=1;
 	      current->subscriptionList=NULL;
 	      current->TotalSubscriptions=0;
+	      current->SIDIndex=NULL;
+	      current->SIDIndexSize=0;
+	      current->controlURLPath=NULL;
+	      current->eventURLPath=NULL;
+	      current->idNext=NULL;
+	      current->controlNext=NULL;
+	      current->eventNext=NULL;
+	      current->eventInterval=0;
+	      current->lastEventMs=0;
+	      current->eventPending=0;
+	      current->pendingNames=NULL;
+	      current->pendingValues=NULL;
+	      current->pendingCount=0;
+	      current->pendingSize=0;
 
 	      if (!(current->UDN=getElementValue(UDN)))
 		fail=1;
@@ -620,7 +780,10 @@ int getServiceTable(Upnp_Node node,
   Upnp_Node URLBase=NULL;
   //  Upnp_Node device;
   
-  
+  out->serviceList=NULL;
+  memset(out->idIndex,0,sizeof(out->idIndex));
+  memset(out->controlIndex,0,sizeof(out->controlIndex));
+  memset(out->eventIndex,0,sizeof(out->eventIndex));
 
   if (getSubElement("root",node,&root))
     { 
@@ -645,6 +808,7 @@ int getServiceTable(Upnp_Node node,
      
       if ((out->serviceList=getAllServiceList(root,out->URLBase)))
 	{
+	  buildServiceIndexes(out);
 	  UpnpNode_free(root);
 	  return 1;
 	}
@@ -1,4 +1,5 @@
 #include "genlib/timer_thread/timer_thread.h"
+#include <string.h>
 
 timer_thread_struct GLOBAL_TIMER_THREAD;
 
@@ -13,108 +14,316 @@ void free_upnp_timeout(upnp_timeout *event)
 }
 
 
+//Returns the current CLOCK_MONOTONIC time in milliseconds. Unlike
+//time() it does not jump when the wall clock is set.
+unsigned long long getMonotonicMs(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return ((unsigned long long) now.tv_sec)*1000+now.tv_nsec/1000000;
+}
+
+//Returns the wheel slot for an event expiring at expires, relative to
+//the next tick to be processed. Events already due go in the current
+//slot; events beyond the top level are parked in its farthest slot
+//and filed again when that slot is cascaded.
+static timer_event ** findSlot(timer_thread_struct * timer,
+			       unsigned long long expires)
+{
+  unsigned long long tick=timer->currentTick;
+  unsigned long long delta;
+  int level;
+  int shift=TIMER_WHEEL_BITS0;
+
+  if (expires<tick)
+    return &timer->wheel0[tick&(TIMER_WHEEL_SLOTS0-1)];
+
+  delta=expires-tick;
+  if (delta<TIMER_WHEEL_SLOTS0)
+    return &timer->wheel0[expires&(TIMER_WHEEL_SLOTS0-1)];
+
+  for (level=0;level<TIMER_WHEEL_LEVELS-1;level++)
+    {
+      if (delta< (1ULL<<(shift+TIMER_WHEEL_BITS)))
+	return &timer->wheel[level][(expires>>shift)&(TIMER_WHEEL_SLOTS-1)];
+      shift+=TIMER_WHEEL_BITS;
+    }
+
+  if (delta>= (1ULL<<(shift+TIMER_WHEEL_BITS)))
+    expires=tick+(1ULL<<(shift+TIMER_WHEEL_BITS))-1;
+  return &timer->wheel[level][(expires>>shift)&(TIMER_WHEEL_SLOTS-1)];
+}
+
+static void addToWheel(timer_thread_struct * timer, timer_event * event)
+{
+  timer_event ** slot=findSlot(timer,event->expires);
+
+  event->next=(*slot);
+  if (event->next)
+    event->next->pprev=&event->next;
+  event->pprev=slot;
+  (*slot)=event;
+}
+
+static void removeFromWheel(timer_event * event)
+{
+  (*event->pprev)=event->next;
+  if (event->next)
+    event->next->pprev=event->pprev;
+  event->next=NULL;
+  event->pprev=NULL;
+}
+
+//Grows the event id index to newSize buckets (power of 2). On memory
+//failure the old index is kept, it just gets longer chains.
+static void resizeIdIndex(timer_thread_struct * timer, int newSize)
+{
+  timer_event ** newIndex;
+  timer_event * event;
+  timer_event * next;
+  int i;
+
+  newIndex=(timer_event **) calloc(newSize,sizeof(timer_event *));
+  if (newIndex==NULL)
+    return;
+
+  for (i=0;i<timer->idIndexSize;i++)
+    for (event=timer->idIndex[i];event;event=next)
+      {
+	next=event->hashNext;
+	event->hashNext=newIndex[event->eventId&(newSize-1)];
+	newIndex[event->eventId&(newSize-1)]=event;
+      }
+
+  free(timer->idIndex);
+  timer->idIndex=newIndex;
+  timer->idIndexSize=newSize;
+}
+
+static void addToIdIndex(timer_thread_struct * timer, timer_event * event)
+{
+  timer_event ** bucket;
+
+  if (timer->numEvents>2*timer->idIndexSize)
+    resizeIdIndex(timer,timer->idIndexSize*2);
+
+  bucket=&timer->idIndex[event->eventId&(timer->idIndexSize-1)];
+  event->hashNext=(*bucket);
+  (*bucket)=event;
+}
+
+//Removes and returns the event with the given id from the id index,
+//or NULL if there is none. The index is gone after StopTimerThread.
+static timer_event * removeFromIdIndex(timer_thread_struct * timer,
+				       int eventId)
+{
+  timer_event ** link;
+  timer_event * event;
+
+  if (timer->idIndexSize==0)
+    return NULL;
+
+  link=&timer->idIndex[eventId&(timer->idIndexSize-1)];
+  while ( (event=(*link))!=NULL)
+    {
+      if (event->eventId==eventId)
+	{
+	  (*link)=event->hashNext;
+	  event->hashNext=NULL;
+	  return event;
+	}
+      link=&event->hashNext;
+    }
+  return NULL;
+}
+
+//Files the events of one slot of an upper level again, which moves
+//them to lower levels as their time approaches.
+static int cascade(timer_thread_struct * timer, int level, int index)
+{
+  timer_event * event=timer->wheel[level][index];
+  timer_event * next;
+
+  timer->wheel[level][index]=NULL;
+  for (;event;event=next)
+    {
+      next=event->next;
+      addToWheel(timer,event);
+    }
+  return index;
+}
+
+//Processes every tick up to and including now. Returns the expired
+//events as a list linked through next; they are no longer in the
+//wheel or the id index. Timer mutex must be held.
+static timer_event * advanceWheel(timer_thread_struct * timer,
+				  unsigned long long now)
+{
+  timer_event * expired=NULL;
+  timer_event ** expiredTail=&expired;
+  timer_event * event;
+  unsigned long long tick;
+  int index;
+  int level;
+  int shift;
+
+  while ( (timer->numEvents>0) && (timer->currentTick<=now))
+    {
+      tick=timer->currentTick;
+      index=tick&(TIMER_WHEEL_SLOTS0-1);
+
+      //level 0 wrapped: bring down the next slot of each upper level
+      //that wrapped too
+      if (index==0)
+	for (level=0,shift=TIMER_WHEEL_BITS0;level<TIMER_WHEEL_LEVELS;
+	     level++,shift+=TIMER_WHEEL_BITS)
+	  if (cascade(timer,level,(tick>>shift)&(TIMER_WHEEL_SLOTS-1))!=0)
+	    break;
+
+      while ( (event=timer->wheel0[index])!=NULL)
+	{
+	  removeFromWheel(event);
+	  removeFromIdIndex(timer,event->eventId);
+	  timer->numEvents--;
+	  (*expiredTail)=event;
+	  expiredTail=&event->next;
+	}
+
+      timer->currentTick++;
+    }
+
+  //nothing left to process, so the wheel can skip ahead to now
+  if ( (timer->numEvents==0) && (timer->currentTick<=now))
+    timer->currentTick=now+1;
+
+  return expired;
+}
+
+//Computes the next tick at which the wheel has work: the first
+//non-empty level 0 slot, or the first cascade of a non-empty upper
+//slot, whichever comes first. Returns 0 if there are no events.
+static int nextWakeup(timer_thread_struct * timer, unsigned long long *when)
+{
+  unsigned long long tick=timer->currentTick;
+  unsigned long long candidate;
+  int found=0;
+  int level;
+  int shift;
+  int i;
+
+  if (timer->numEvents==0)
+    return 0;
+
+  for (i=0;i<TIMER_WHEEL_SLOTS0;i++)
+    if (timer->wheel0[(tick+i)&(TIMER_WHEEL_SLOTS0-1)])
+      {
+	(*when)=tick+i;
+	found=1;
+	break;
+      }
+
+  for (level=0,shift=TIMER_WHEEL_BITS0;level<TIMER_WHEEL_LEVELS;
+       level++,shift+=TIMER_WHEEL_BITS)
+    for (i=0;i<=TIMER_WHEEL_SLOTS;i++)
+      {
+	candidate=((tick>>shift)+i)<<shift;
+	if (candidate<tick)
+	  continue;
+	if ( (found) && (candidate>=(*when)))
+	  break;
+	if (timer->wheel[level][((tick>>shift)+i)&(TIMER_WHEEL_SLOTS-1)])
+	  {
+	    (*when)=candidate;
+	    found=1;
+	    break;
+	  }
+      }
+
+  return found;
+}
+
 void TimerThread(void * input)
 { 
-  time_t next_event_time;
-  time_t current_time;
-  timer_event * current_event;
+  timer_event * expired;
+  timer_event * next;
+  unsigned long long wakeup=0;
   struct timespec timeout;
-  int retcode;
 
   timer_thread_struct * timer=(timer_thread_struct *) input;
   
-  while (1)
+  pthread_mutex_lock(&timer->mutex);
+
+  while (!timer->shutdown)
     { 
-      
-      if ( (pthread_mutex_lock(&timer->mutex)!=0)
-	   || (timer->shutdown))
-	{ 
-	  pthread_mutex_unlock(&timer->mutex);
-	  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TIMER THREAD SHUT DOWN"));
-	  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"timer thread shutdown self : %ld\n",pthread_self()));
-	  return;
-	}
-      
-      time(&current_time);
-      if ((current_event=timer->eventQ)!=NULL)
+      expired=advanceWheel(timer,getMonotonicMs());
+
+      if (expired)
 	{
-	  next_event_time=current_event->time;
-	}
-      else next_event_time=-1;
-      //make callback if time has expired
-      
-      if ( (next_event_time!=-1) && (current_time>=next_event_time))
-	{ //remove from the Q
-	  timer->eventQ=timer->eventQ->next;
+	  //dispatch the whole batch with one trip through the mutex
 	  pthread_mutex_unlock(&timer->mutex);
-	  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"SCHEDULING TIMER EVENT INTO THREAD POOL"));
-	  tpool_Schedule( current_event->callback, current_event->argument); 
-	  free(current_event);
-	  continue;
-	}
-      
-      if (next_event_time!=-1)
-	{
-	  timeout.tv_sec=next_event_time;
-	  timeout.tv_nsec=0;
-	  retcode=0;
-	  
-	  while ( (timer->newEvent==0) && (retcode!=ETIMEDOUT))
-	    { 
-	      retcode=pthread_cond_timedwait(&timer->newEventCond,
-					     &timer->mutex,&timeout);
-	    }
-	  if (timer->shutdown)
+	  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"SCHEDULING TIMER EVENTS INTO THREAD POOL"));
+	  for (;expired;expired=next)
 	    {
-	      pthread_mutex_unlock(&timer->mutex);
-	      DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TIMER THREAD SHUT DOWN"));
-	      DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"timer thread shutdown self : %ld\n",pthread_self()));
-	      return;
+	      next=expired->next;
+	      tpool_Schedule( expired->callback, expired->argument); 
+	      free(expired);
 	    }
-	  if (timer->newEvent==1)
-	    timer->newEvent=0;
-	  pthread_mutex_unlock(&timer->mutex);
+	  pthread_mutex_lock(&timer->mutex);
 	  continue;
-	  
 	}
-      else
+
+      if (timer->newEvent==0)
 	{
-	  while ((timer->newEvent==0))
+	  if (nextWakeup(timer,&wakeup))
 	    {
-	      retcode=pthread_cond_wait(&timer->newEventCond,
-					     &timer->mutex);
+	      timeout.tv_sec=wakeup/1000;
+	      timeout.tv_nsec=(wakeup%1000)*1000000;
+	      pthread_cond_timedwait(&timer->newEventCond,
+				     &timer->mutex,&timeout);
 	    }
-	 
-	  if (timer->shutdown)
-	    {
-	      //shutdown     
-	      pthread_mutex_unlock(&timer->mutex);
-	      DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TIMER_THREAD SHUTDOWN"));
-	      DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"timer thread shutdown self : %ld\n",pthread_self()));
-	      return;
-	    }
-	  timer->newEvent=0;
-	  pthread_mutex_unlock(&timer->mutex);
-	  continue;
+	  else
+	    pthread_cond_wait(&timer->newEventCond,&timer->mutex);
 	}
+      timer->newEvent=0;
     }
-  
+
+  pthread_mutex_unlock(&timer->mutex);
+  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TIMER THREAD SHUT DOWN"));
+  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"timer thread shutdown self : %ld\n",pthread_self()));
 }
 
 int InitTimerThread(timer_thread_struct * timer)
 {
+  pthread_condattr_t attr;
+
   pthread_mutex_init(&timer->mutex, NULL);
 
   pthread_mutex_lock(&timer->mutex);
 
-  pthread_cond_init(&timer->newEventCond,NULL);
+  //wait on the monotonic clock so setting the wall clock does not
+  //fire or delay timers
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+  pthread_cond_init(&timer->newEventCond,&attr);
+  pthread_condattr_destroy(&attr);
   
-  timer->eventQ=NULL;
+  memset(timer->wheel0,0,sizeof(timer->wheel0));
+  memset(timer->wheel,0,sizeof(timer->wheel));
+  timer->idIndexSize=TIMER_ID_HASH_SIZE;
+  timer->idIndex=(timer_event **) calloc(TIMER_ID_HASH_SIZE,
+					 sizeof(timer_event *));
+  timer->numEvents=0;
+  timer->currentTick=getMonotonicMs();
   timer->newEvent=0;
   timer->currentEventId=0;
   timer->shutdown=0;
   
   pthread_mutex_unlock(&timer->mutex);
+
+  if (timer->idIndex==NULL)
+    return UPNP_E_OUTOF_MEMORY;
+
   //schedule timer_thread
   if (tpool_Schedule( TimerThread, timer)!=0)
     return UPNP_E_INIT_FAILED;
@@ -126,7 +335,6 @@ int InitTimerThread(timer_thread_struct * timer)
 int RemoveTimerEvent(int eventId, void **argument, timer_thread_struct *timer)
 {
   timer_event * current_event=NULL;
-  timer_event * previous=NULL;
   int found=0;
   
   DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,
@@ -134,31 +342,13 @@ int RemoveTimerEvent(int eventId, void **argument, timer_thread_struct *timer)
   if (eventId!=-1)
   {
     pthread_mutex_lock(&timer->mutex);
-    current_event=timer->eventQ;
-    while (current_event)
-      {
-	DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TRYING TO REMOVE EVENT : %d\n",eventId));
-	if (current_event->eventId==eventId)
-	  {
-	    found=1;
-	    break;
-	  }
-	previous=current_event;
-	current_event=current_event->next;
-      }
-    if (found)
+    if ( (current_event=removeFromIdIndex(timer,eventId))!=NULL)
       {
+	found=1;
 	(*argument)=current_event->argument;
-	if (previous)
-	  {
-	    previous->next=current_event->next;
-	  }
-	else
-	  {
-	    timer->eventQ=current_event->next;
-	  }
+	removeFromWheel(current_event);
+	timer->numEvents--;
 	free(current_event);
-	pthread_cond_signal(&timer->newEventCond);
 	DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"REMOVING TIMER EVENT"));
       }
     else
@@ -173,24 +363,46 @@ int RemoveTimerEvent(int eventId, void **argument, timer_thread_struct *timer)
 int StopTimerThread(timer_thread_struct * timer)
 {
   timer_event * current_event;
+  timer_event * pending=NULL;
+  int level;
+  int i;
 
   pthread_mutex_lock(&timer->mutex);
   
   timer->shutdown=1;
-  
-  while (timer->eventQ)
+
+  //take every remaining event out of the wheel
+  for (i=0;i<TIMER_WHEEL_SLOTS0;i++)
+    while ( (current_event=timer->wheel0[i])!=NULL)
+      {
+	removeFromWheel(current_event);
+	current_event->next=pending;
+	pending=current_event;
+      }
+  for (level=0;level<TIMER_WHEEL_LEVELS;level++)
+    for (i=0;i<TIMER_WHEEL_SLOTS;i++)
+      while ( (current_event=timer->wheel[level][i])!=NULL)
+	{
+	  removeFromWheel(current_event);
+	  current_event->next=pending;
+	  pending=current_event;
+	}
+  timer->numEvents=0;
+  free(timer->idIndex);
+  timer->idIndex=NULL;
+  timer->idIndexSize=0;
+  pthread_mutex_unlock(&timer->mutex);
+
+  while (pending)
     {
-      current_event=timer->eventQ;
-      timer->eventQ=timer->eventQ->next;
-      pthread_mutex_unlock(&timer->mutex);
-      
+      current_event=pending;
+      pending=pending->next;
       current_event->callback(current_event->argument);
       free(current_event);
-
-      pthread_mutex_lock(&timer->mutex);
     }
  
   //signal timer thread to stop
+  pthread_mutex_lock(&timer->mutex);
   timer->newEvent=1;
   pthread_cond_signal(&timer->newEventCond);
   pthread_mutex_unlock(&timer->mutex);
@@ -200,26 +412,25 @@ int StopTimerThread(timer_thread_struct * timer)
   return UPNP_E_SUCCESS;
 }
 
-int ScheduleTimerEvent(int TimeOut, ScheduleFunc callback, void * argument,
-		       timer_thread_struct *timer, int * eventId)
+static int scheduleEvent(long long TimeOutMs, ScheduleFunc callback,
+			 void * argument, timer_thread_struct *timer,
+			 int * eventId)
 {
   timer_event *new_event;
-  timer_event *prev=NULL;
-  timer_event *finger=NULL;
-  time_t current_time;
-  time_t expireTime;
-  //get time
-  time(&current_time);
-  expireTime=current_time+TimeOut;
+
+  if (TimeOutMs<0)
+    TimeOutMs=0;
 
   new_event=(timer_event*) malloc(sizeof(timer_event));
   if (new_event==NULL)
     return UPNP_E_OUTOF_MEMORY;
 
-  new_event->time=expireTime;
+  new_event->expires=getMonotonicMs()+TimeOutMs;
   new_event->callback=callback;
   new_event->argument=argument;
   new_event->next=NULL;
+  new_event->pprev=NULL;
+  new_event->hashNext=NULL;
   DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"TRYING TO GET TIMER MUTEX"));
   pthread_mutex_lock(&timer->mutex);
   DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"GOT TIMER MUTEX"));
@@ -235,24 +446,9 @@ int ScheduleTimerEvent(int TimeOut, ScheduleFunc callback, void * argument,
   if (timer->currentEventId<0)
     timer->currentEventId=0;
 
-  finger=timer->eventQ;
-  
-  while ( (finger) && (finger->time<new_event->time) )
-    {
-      prev=finger;
-      finger=finger->next;
-    }
-
-  new_event->next=finger;
-
-  if (prev)
-    {
-      prev->next=new_event;
-    }
-  else
-    { 
-      timer->eventQ=new_event;
-    }
+  addToWheel(timer,new_event);
+  addToIdIndex(timer,new_event);
+  timer->numEvents++;
    
   timer->newEvent=1;
   (*eventId)=new_event->eventId;
@@ -262,3 +458,17 @@ int ScheduleTimerEvent(int TimeOut, ScheduleFunc callback, void * argument,
   pthread_mutex_unlock(&timer->mutex);		 
   return UPNP_E_SUCCESS;
 }
+
+int ScheduleTimerEvent(int TimeOut, ScheduleFunc callback, void * argument,
+		       timer_thread_struct *timer, int * eventId)
+{
+  return scheduleEvent(((long long) TimeOut)*1000,callback,argument,
+		       timer,eventId);
+}
+
+int ScheduleTimerEventMs(int TimeOutMs, ScheduleFunc callback,
+			 void * argument, timer_thread_struct *timer,
+			 int * eventId)
+{
+  return scheduleEvent(TimeOutMs,callback,argument,timer,eventId);
+}
@@ -42,6 +42,22 @@ int tpool_Schedule( ScheduleFunc func, void* arg )
     return Pool.schedule( func, arg );
 }
 
+int tpool_ScheduleWithPriority( TPoolPriority priority,
+    ScheduleFunc func, void* arg )
+{
+    return Pool.schedule( priority, func, arg );
+}
+
+void tpool_SetPriorityQuota( TPoolPriority priority, unsigned maxThreads )
+{
+    Pool.setQuota( priority, maxThreads );
+}
+
+unsigned tpool_GetPriorityQuota( TPoolPriority priority )
+{
+    return Pool.getQuota( priority );
+}
+
 unsigned tpool_GetMaxThreads( void )
 {
     return Pool.getMaxThreads();
@@ -48,157 +48,21 @@
 #include <sys/time.h>
 #include <unistd.h>
 
-#define EVENT_TIMEDOUT 		-2
-#define EVENT_TERMINATE		-3
-
-
-//typedef xdlistNode<PoolQueueItem> ThreadPoolNode;
 typedef dblListNode ThreadPoolNode;
 
-struct ThreadArg
-{
-    unsigned *timeoutSecs;
-    ThreadPoolQueue* q;
-    
-    // pool data
-    pthread_mutex_t* poolMutex;
-    pthread_cond_t* condVariable;
-    pthread_cond_t* zeroCountCondVariable;
-    unsigned* numThreads;
-    bool* die;
-};
-
-// returns
-//	 0: success
-//	 EVENT_TIMEDOUT
-//	 EVENT_TERMINATE
-int GetNextItemInQueue( ThreadArg* arg,
-    OUT PoolQueueItem& callback )
-{
-    unsigned timeoutSecs = *arg->timeoutSecs;
-    int code = 0;
-    int retCode;
-    ThreadPoolQueue* q;
-    
-    q = arg->q;
-    
-    pthread_mutex_lock( arg->poolMutex );
-    
-    // wait until item becomes available
-    if ( timeoutSecs < 0 )
-    {
-        while ( q->length() == 0 && *arg->die == false )
-        {
-            pthread_cond_wait( arg->condVariable,
-                arg->poolMutex );
-        }
-    }
-    else
-    {
-        timeval now;
-        timespec timeout;
-        
-        gettimeofday( &now, NULL );
-        timeout.tv_sec = now.tv_sec + timeoutSecs;
-        timeout.tv_nsec = now.tv_usec * 1000;
-        
-        while ( q->length() == 0 &&
-                *arg->die == false &&
-                code != ETIMEDOUT )
-        {
-            code = pthread_cond_timedwait( arg->condVariable,
-                arg->poolMutex, &timeout );
-        }
-    }
-    
-    DBG( pthread_t tempThread = pthread_self(); )
-    
-    if ( *arg->die == true )
-    {
-        retCode = EVENT_TERMINATE;
-        
-        DBG(
-            UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
-                "thread %ld: got terminate msg\n", tempThread); )
-    }
-    else if ( code == ETIMEDOUT )
-    {
-        retCode = EVENT_TIMEDOUT;
-        DBG(
-            UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
-                "thread %ld: got timeout msg\n", tempThread); )
-    }
-    else
-    {
-        ThreadPoolNode* node;
-        PoolQueueItem* callbackptr;
-        
-        assert( q->length() > 0 );
-        
-        node = q->getFirstItem();
-        callbackptr = (PoolQueueItem*) node->data;
-        callback = *callbackptr;
-        q->remove( node );
-
-        // broadcast zero count condition of queue
-        if ( arg->q->length() == 0 )
-        {
-            //DBG( printf("thread pool q len = 0 broadcast\n"); )
-            pthread_cond_broadcast( arg->zeroCountCondVariable );
-        }
-        
-        retCode = 0;
-    }
-    
-    pthread_mutex_unlock( arg->poolMutex );	
-    
-    return retCode;
-}
-
 static void* ThreadCallback( void* the_arg )
 {
-    ThreadArg* arg = (ThreadArg *)the_arg;
-    int retCode;
-    PoolQueueItem callback;
-    
-    // DBG
-    //unsigned threadNum;
-    
-    //{
-    //}
-    ///////////////
-    
+    PoolWorker* self = (PoolWorker *)the_arg;
+
     DBG(
         UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
             "thread %ld: started...\n", pthread_self()); )
-    //DBG( int countxxx = 0; )
-    
-    while ( true )
-    {
-        // pull out next callback from queue
-        DBG(
-            UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
-                "thread %ld: waiting for item\n", pthread_self()); )
-        retCode = GetNextItemInQueue( arg, callback );
-        
-        if ( retCode == EVENT_TIMEDOUT || retCode == EVENT_TERMINATE )
-        {
-            //DBG( printf("thread got signal %d\n", retCode); )
-            break;		// done with thread
-        }
-        
-        // invoke callback
-        callback.func( callback.arg );
-    }
-    
-    // decrement active thread count
-    pthread_mutex_lock( arg->poolMutex );
-    
-    *arg->numThreads = *arg->numThreads - 1;
-    
-    pthread_mutex_unlock( arg->poolMutex );
 
-    delete arg;
+    self->pool->runWorker( self );
+
+    DBG(
+        UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
+            "thread %ld: done\n", pthread_self()); )
 
     pthread_exit( NULL );
     return NULL;
@@ -210,10 +74,32 @@ static void* ThreadCallback( void* the_arg )
 
 ThreadPool::ThreadPool()
 {
+    unsigned i;
+    int c;
+    
     numThreads = 0;
     maxThreads = DEF_MAX_THREADS;
     lingerTime = DEF_LINGER_TIME;
     allDie = false;
+    numIdle = 0;
+    numWorkers = 0;
+    
+    for ( c = 0; c < TPOOL_NUM_CLASSES; c++ )
+    {
+        ringHead[c] = 0;
+        ringTail[c] = 0;
+        numOverflow[c] = 0;
+        running[c] = 0;
+        quota[c] = 0;
+        for ( i = 0; i < RING_SIZE; i++ )
+        {
+            ring[c][i].seq = i;
+        }
+    }
+    for ( i = 0; i < MAX_WORKERS; i++ )
+    {
+        workers[i] = NULL;
+    }
     
     int success;
     
@@ -229,14 +115,14 @@ ThreadPool::ThreadPool()
         throw OutOfMemoryException( "Mutex creation error in thread pool" );
     }
     
-    success = pthread_cond_init( &condVariable, NULL );
+    success = sem_init( &wakeup, 0, 0 );
     if ( success == -1 )
     {
         DBG(
             UpnpPrintf(
                 UPNP_CRITICAL, TPOOL, __FILE__, __LINE__,
-                    "thread pool: error creating cond var\n"); )
-        throw OutOfMemoryException( "Thread Pool: error creating cond variable" );
+                    "thread pool: error creating semaphore\n"); )
+        throw OutOfMemoryException( "Thread Pool: error creating semaphore" );
     }
     
     success = pthread_cond_init( &zeroCountCondVariable, NULL );
@@ -248,14 +134,25 @@ ThreadPool::ThreadPool()
                     "thread pool: error creating zero cond var\n"); )
         throw OutOfMemoryException( "Thread Pool: error creating count condition variable" );
     }
+
+    success = pthread_key_create( &workerKey, NULL );
+    if ( success != 0 )
+    {
+        DBG(
+            UpnpPrintf(
+                UPNP_CRITICAL, TPOOL, __FILE__, __LINE__,
+                    "thread pool: error creating worker key\n"); )
+        throw OutOfMemoryException( "Thread Pool: error creating worker key" );
+    }
 }
 
 ThreadPool::~ThreadPool()
 {
+    unsigned i;
+    
     // signal all threads to die
     pthread_mutex_lock( &mutex );
     allDie = true;
-    pthread_cond_broadcast( &condVariable );
     pthread_mutex_unlock( &mutex );
     
     DBG(
@@ -270,10 +167,11 @@ ThreadPool::~ThreadPool()
             break;
         }
 
-        //DBG( printf("thread destructor waiting: pending = %d, running = %d\n", getNumJobsPending(), getNumThreadsRunning()); )
-
-        // send signal again, if missed previously
-        pthread_cond_broadcast( &condVariable );
+        // wake sleeping threads, again if missed previously
+        for ( i = 0; i < numThreads; i++ )
+        {
+            sem_post( &wakeup );
+        }
         sleep( 1 );
     }
 
@@ -296,107 +194,560 @@ ThreadPool::~ThreadPool()
         sleep( 1 );
     }
     
-    code = pthread_cond_destroy( &condVariable );
+    code = sem_destroy( &wakeup );
     assert( code == 0 );
     
     code = pthread_mutex_destroy( &mutex );
     assert( code == 0 );
+
+    pthread_key_delete( workerKey );
+
+    for ( i = 0; i < numWorkers; i++ )
+    {
+        free( workers[i] );
+    }
 }
 
-/////////
-// queues function f to be executed in a worker thread
-// input:
-//   f: function to be executed
-//   arg: argument to passed to the function
-// returns:
-//   0 if success; -1 if not enuf mem; -2 if input func in NULL
-int ThreadPool::schedule( ScheduleFunc f, void* arg )
+// adds job to the shared ring of its class; returns false if full
+bool ThreadPool::ringPush( const PoolQueueItem& job )
 {
-    int retCode = 0;
+    int c = job.priority;
+    PoolJobSlot* slot;
+    unsigned long pos = ringTail[c];
+    long diff;
     
-    if ( f == NULL )
-        return -2;
+    while ( true )
+    {
+        slot = &ring[c][pos & (RING_SIZE - 1)];
+        diff = (long)slot->seq - (long)pos;
         
-    pthread_mutex_lock( &mutex );
+        if ( diff == 0 )
+        {
+            // slot is free for this position; claim it
+            if ( __sync_bool_compare_and_swap( &ringTail[c], pos, pos + 1 ) )
+            {
+                break;
+            }
+        }
+        else if ( diff < 0 )
+        {
+            return false;   // full
+        }
+        pos = ringTail[c];
+    }
+    
+    slot->job = job;
+    __sync_synchronize();
+    slot->seq = pos + 1;
+    
+    return true;
+}
+
+// takes the oldest job from the shared ring of class c; returns false
+// if empty
+bool ThreadPool::ringPop( int c, PoolQueueItem& job )
+{
+    PoolJobSlot* slot;
+    unsigned long pos = ringHead[c];
+    long diff;
+    
+    while ( true )
+    {
+        slot = &ring[c][pos & (RING_SIZE - 1)];
+        diff = (long)slot->seq - (long)(pos + 1);
+        
+        if ( diff == 0 )
+        {
+            // slot holds the job for this position; claim it
+            if ( __sync_bool_compare_and_swap( &ringHead[c], pos, pos + 1 ) )
+            {
+                break;
+            }
+        }
+        else if ( diff < 0 )
+        {
+            return false;   // empty
+        }
+        pos = ringHead[c];
+    }
+    
+    job = slot->job;
+    __sync_synchronize();
+    slot->seq = pos + RING_SIZE;
+    
+    return true;
+}
+
+// adds job to the queue of the calling worker; returns false if full
+bool ThreadPool::workerPush( PoolWorker* worker, const PoolQueueItem& job )
+{
+    int c = job.priority;
+    unsigned long tail = worker->tail[c];
+    
+    if ( tail - worker->head[c] >= PoolWorker::QUEUE_SIZE )
+    {
+        return false;
+    }
+    
+    worker->jobs[c][tail & (PoolWorker::QUEUE_SIZE - 1)] = job;
+    __sync_synchronize();
+    worker->tail[c] = tail + 1;
+    
+    return true;
+}
+
+// takes the oldest job from a worker queue, own or another's; jobs are
+// taken in order so work scheduled from one thread still starts FIFO
+bool ThreadPool::workerTake( PoolWorker* worker, int c,
+    PoolQueueItem& job )
+{
+    unsigned long head;
+    
+    while ( true )
+    {
+        head = worker->head[c];
+        __sync_synchronize();
+        if ( head >= worker->tail[c] )
+        {
+            return false;
+        }
+        
+        job = worker->jobs[c][head & (PoolWorker::QUEUE_SIZE - 1)];
+        if ( __sync_bool_compare_and_swap( &worker->head[c], head, head + 1 ) )
+        {
+            return true;
+        }
+    }
+}
+
+// queues job in the overflow list; used only while the ring is full
+bool ThreadPool::overflowPush( const PoolQueueItem& job )
+{
+    PoolQueueItem* item;
+    
+    item = (PoolQueueItem*)malloc( sizeof(PoolQueueItem) );
+    if ( item == NULL )
+    {
+        return false;
+    }
+    *item = job;
     
+    pthread_mutex_lock( &mutex );
     try
     {
-        PoolQueueItem* job;
+        q.addAfterTail( item );
+        numOverflow[job.priority]++;
+    }
+    catch ( OutOfMemoryException& e )
+    {
+        free( item );
+        item = NULL;
+    }
+    pthread_mutex_unlock( &mutex );
+    
+    return item != NULL;
+}
+
+// takes the oldest overflow job of class c
+bool ThreadPool::overflowPop( int c, PoolQueueItem& job )
+{
+    ThreadPoolNode* node;
+    PoolQueueItem* item;
+    bool found = false;
+    
+    if ( numOverflow[c] == 0 )
+    {
+        return false;
+    }
+    
+    pthread_mutex_lock( &mutex );
+    for ( node = q.getFirstItem(); node != NULL; node = q.next( node ) )
+    {
+        item = (PoolQueueItem*) node->data;
+        if ( item->priority == c )
+        {
+            job = *item;
+            q.remove( node );
+            numOverflow[c]--;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &mutex );
+    
+    return found;
+}
 
-        job = (PoolQueueItem*)malloc( sizeof(PoolQueueItem) );
-        if ( job == NULL )
+// counts a thread as running a job of class c if the class is under
+// its quota; returns false if the class is at its quota
+bool ThreadPool::reserveClass( int c )
+{
+    unsigned count;
+    
+    while ( true )
+    {
+        count = running[c];
+        if ( quota[c] != 0 && count >= quota[c] )
+        {
+            return false;
+        }
+        if ( __sync_bool_compare_and_swap( &running[c], count, count + 1 ) )
         {
-            throw OutOfMemoryException( "ThreadPool::schedule()" );
+            return true;
         }
+    }
+}
 
-        job->func = f;
-        job->arg = arg;
-        
-        q.addAfterTail( job );
-        
-        // signal a waiting thread
-        pthread_cond_signal( &condVariable );
+// undoes reserveClass(); wakes a sleeping thread if class c has jobs
+// that were held back by its quota
+void ThreadPool::releaseClass( int c )
+{
+    __sync_fetch_and_sub( &running[c], 1 );
+    
+    if ( quota[c] != 0 && getNumJobsPending( c ) > 0 && takeIdle() )
+    {
+        sem_post( &wakeup );
+    }
+}
+
+// true if the calling thread is the last one free and background
+// jobs wait with none running; it then takes a background job, so a
+// steady stream of higher class jobs can not starve the timer driven
+// ones (GENA renewals, advertisements)
+bool ThreadPool::mustRunBackground()
+{
+    unsigned busy = 0;
+    int c;
+    
+    if ( running[TPOOL_BACKGROUND] != 0 ||
+         getNumJobsPending( TPOOL_BACKGROUND ) == 0 )
+    {
+        return false;
+    }
+    
+    for ( c = 0; c < TPOOL_NUM_CLASSES; c++ )
+    {
+        busy += running[c];
+    }
+    return busy + 1 >= maxThreads;
+}
+
+// finds the next job for worker self, trying the classes in priority
+// order: its own queue first, then the shared ring and overflow list,
+// then the queues of the other workers
+bool ThreadPool::getJob( PoolWorker* self, PoolQueueItem& job )
+{
+    unsigned i;
+    unsigned count;
+    bool backgroundOnly;
+    int c;
+    
+    backgroundOnly = mustRunBackground();
+    
+    for ( c = 0; c < TPOOL_NUM_CLASSES; c++ )
+    {
+        if ( (backgroundOnly && c != TPOOL_BACKGROUND) ||
+             getNumJobsPending( c ) == 0 || !reserveClass( c ) )
+        {
+            continue;
+        }
         
-        // generate a thread if not too many threads
-        if ( numThreads < maxThreads )
+        if ( workerTake( self, c, job ) || ringPop( c, job ) ||
+             overflowPop( c, job ) )
         {
-            ThreadArg* t_arg = new ThreadArg;
-            if ( t_arg == NULL )
-            {
-                throw -2;	// optional error - out of mem
-            }	
-            
-            t_arg->timeoutSecs = &lingerTime;
-            t_arg->q = &q;
-            t_arg->poolMutex = &mutex;
-            t_arg->condVariable = &condVariable;
-            t_arg->zeroCountCondVariable = &zeroCountCondVariable;
-            t_arg->numThreads = &numThreads;
-            t_arg->die = &allDie;
+            return true;
+        }
         
-            pthread_t thread;
-            int code;
-            
-            // start a new thread
-            code = pthread_create( &thread, NULL, ThreadCallback,
-                t_arg );
-                
-            if ( code == 0 )
-            {
-                numThreads++;
-                code = pthread_detach( thread );
-                assert( code == 0 );
-            }	
-            
-            if ( numThreads == 0 )
+        count = numWorkers;
+        for ( i = 0; i < count; i++ )
+        {
+            if ( workers[i] != self && workerTake( workers[i], c, job ) )
             {
-                throw -2;
+                DBG(
+                    UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
+                        "thread %ld: stole job from worker %u\n",
+                        pthread_self(), i); )
+                return true;
             }
         }
+        
+        releaseClass( c );
     }
-    catch ( OutOfMemoryException& e )
+    
+    return false;
+}
+
+// true if some class under its quota has a job waiting
+bool ThreadPool::hasRunnableJobs()
+{
+    int c;
+    
+    for ( c = 0; c < TPOOL_NUM_CLASSES; c++ )
     {
-        retCode = -1;
+        if ( (quota[c] == 0 || running[c] < quota[c]) &&
+             getNumJobsPending( c ) > 0 )
+        {
+            return true;
+        }
     }
-    catch ( int code )
+    return false;
+}
+
+// removes one sleeping worker from numIdle; returns false if none
+bool ThreadPool::takeIdle()
+{
+    unsigned idle;
+    
+    while ( (idle = numIdle) > 0 )
     {
-        if ( code == -2 )
+        if ( __sync_bool_compare_and_swap( &numIdle, idle, idle - 1 ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// sleeps until a job may be available; returns false if the worker
+// should exit (linger time expired or pool destroyed)
+bool ThreadPool::waitForJob( PoolWorker* self )
+{
+    timeval now;
+    timespec timeout;
+    int code;
+    
+    __sync_fetch_and_add( &numIdle, 1 );
+    
+    if ( !hasRunnableJobs() )
+    {
+        if ( getNumJobsPending() == 0 )
+        {
+            pthread_cond_broadcast( &zeroCountCondVariable );
+        }
+        
+        gettimeofday( &now, NULL );
+        timeout.tv_sec = now.tv_sec + lingerTime;
+        timeout.tv_nsec = now.tv_usec * 1000;
+        
+        while ( (code = sem_timedwait( &wakeup, &timeout )) == -1 &&
+                errno == EINTR )
         {
-            // couldn't start new thread
-            if ( numThreads == 0 )
-            {
-                retCode = -1;
-            }
+        }
+        if ( code == 0 )
+        {
+            // schedule() claimed this wakeup from numIdle
+            return true;
         }
     }
     
+    if ( !takeIdle() )
+    {
+        // a schedule() call claimed us meanwhile; consume its wakeup
+        while ( sem_wait( &wakeup ) == -1 && errno == EINTR )
+        {
+        }
+        return true;
+    }
+    
+    if ( !allDie && hasRunnableJobs() )
+    {
+        return true;
+    }
+    
+    // linger time expired with nothing to do, or pool destroyed
+    pthread_mutex_lock( &mutex );
+    numThreads--;
+    self->active = false;
     pthread_mutex_unlock( &mutex );
     
+    // a job scheduled while numThreads was still counting this thread
+    // would find no one to run it; stay if the slot is still ours
+    __sync_synchronize();
+    if ( hasRunnableJobs() )
+    {
+        pthread_mutex_lock( &mutex );
+        if ( !allDie && !self->active && numThreads < maxThreads )
+        {
+            numThreads++;
+            self->active = true;
+            pthread_mutex_unlock( &mutex );
+            return true;
+        }
+        pthread_mutex_unlock( &mutex );
+    }
+    
+    DBG(
+        UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
+            "thread %ld: got timeout msg\n", pthread_self()); )
+    
+    return false;
+}
+
+void ThreadPool::runWorker( PoolWorker* self )
+{
+    PoolQueueItem job;
+    
+    pthread_setspecific( workerKey, self );
+    
+    while ( true )
+    {
+        if ( allDie )
+        {
+            DBG(
+                UpnpPrintf( UPNP_INFO, TPOOL, __FILE__, __LINE__,
+                    "thread %ld: got terminate msg\n", pthread_self()); )
+            
+            pthread_mutex_lock( &mutex );
+            numThreads--;
+            self->active = false;
+            pthread_mutex_unlock( &mutex );
+            break;
+        }
+        
+        if ( getJob( self, job ) )
+        {
+            // invoke callback
+            job.func( job.arg );
+            releaseClass( job.priority );
+        }
+        else if ( !waitForJob( self ) )
+        {
+            break;          // done with thread
+        }
+    }
+}
+
+// starts a worker thread; mutex must be held
+// returns 0 on success, -1 if no thread could be started
+int ThreadPool::startWorker()
+{
+    PoolWorker* worker = NULL;
+    pthread_t thread;
+    unsigned i;
+    int code;
+    
+    // reuse the slot of a worker that has exited
+    for ( i = 0; i < numWorkers; i++ )
+    {
+        if ( !workers[i]->active )
+        {
+            worker = workers[i];
+            break;
+        }
+    }
+    
+    if ( worker == NULL )
+    {
+        if ( numWorkers >= MAX_WORKERS )
+        {
+            return -1;
+        }
+        
+        worker = (PoolWorker*)malloc( sizeof(PoolWorker) );
+        if ( worker == NULL )
+        {
+            return -1;
+        }
+        worker->pool = this;
+        for ( i = 0; i < TPOOL_NUM_CLASSES; i++ )
+        {
+            worker->head[i] = 0;
+            worker->tail[i] = 0;
+        }
+        
+        workers[numWorkers] = worker;
+        __sync_synchronize();
+        numWorkers++;
+    }
+    
+    worker->active = true;
+    
+    // start a new thread
+    code = pthread_create( &thread, NULL, ThreadCallback, worker );
+    if ( code != 0 )
+    {
+        worker->active = false;
+        return -1;
+    }
+    
+    numThreads++;
+    code = pthread_detach( thread );
+    assert( code == 0 );
+    
+    return 0;
+}
+
+/////////
+// queues function f to be executed in a worker thread
+// input:
+//   f: function to be executed
+//   arg: argument to passed to the function
+// returns:
+//   0 if success; -1 if not enuf mem; -2 if input func in NULL
+int ThreadPool::schedule( ScheduleFunc f, void* arg )
+{
+    return schedule( TPOOL_BACKGROUND, f, arg );
+}
+
+/////////
+// queues function f to be executed in a worker thread, in scheduling
+// class priority
+// returns:
+//   0 if success; -1 if not enuf mem; -2 if input func in NULL or
+//   priority is not a valid class
+int ThreadPool::schedule( TPoolPriority priority, ScheduleFunc f, void* arg )
+{
+    PoolQueueItem job;
+    PoolWorker* self;
+    int retCode = 0;
+    
+    if ( f == NULL || priority < 0 || priority >= TPOOL_NUM_CLASSES )
+        return -2;
+    
+    job.func = f;
+    job.arg = arg;
+    job.priority = priority;
+    
+    // jobs scheduled by a worker stay on its own queue; the others go
+    // to the ring, or behind the overflow list once that is in use
+    self = (PoolWorker*)pthread_getspecific( workerKey );
+    if ( !(self != NULL && self->pool == this && workerPush( self, job )) &&
+         !(numOverflow[priority] == 0 && ringPush( job )) &&
+         !overflowPush( job ) )
+    {
+        return -1;
+    }
+    
+    // wake a sleeping thread, or generate one if not too many threads
+    __sync_synchronize();
+    if ( takeIdle() )
+    {
+        sem_post( &wakeup );
+    }
+    else if ( numThreads < maxThreads )
+    {
+        pthread_mutex_lock( &mutex );
+        if ( numThreads < maxThreads && !allDie )
+        {
+            startWorker();
+        }
+        if ( numThreads == 0 )
+        {
+            // couldn't start new thread
+            retCode = -1;
+        }
+        pthread_mutex_unlock( &mutex );
+    }
+    
     return retCode;
 }
 
 void ThreadPool::setMaxThreads( unsigned max )
 {
+    if ( max > MAX_WORKERS )
+    {
+        max = MAX_WORKERS;
+    }
     maxThreads = max;
 }
 
@@ -405,9 +756,54 @@ unsigned ThreadPool::getMaxThreads()
     return maxThreads;
 }
 
+void ThreadPool::setQuota( TPoolPriority priority, unsigned max )
+{
+    if ( priority >= 0 && priority < TPOOL_NUM_CLASSES )
+    {
+        quota[priority] = max;
+    }
+}
+
+unsigned ThreadPool::getQuota( TPoolPriority priority )
+{
+    if ( priority >= 0 && priority < TPOOL_NUM_CLASSES )
+    {
+        return quota[priority];
+    }
+    return 0;
+}
+
+unsigned ThreadPool::getNumJobsPending( int c )
+{
+    unsigned long pending;
+    unsigned long head;
+    unsigned count = numWorkers;
+    unsigned i;
+    
+    // read each head before its tail so a concurrent take cannot make
+    // the difference negative
+    head = ringHead[c];
+    pending = (ringTail[c] - head) + numOverflow[c];
+    for ( i = 0; i < count; i++ )
+    {
+        head = workers[i]->head[c];
+        pending += workers[i]->tail[c] - head;
+    }
+    
+    return (unsigned)pending;
+}
+
 unsigned ThreadPool::getNumJobsPending()
 {
-    return q.length();
+    unsigned pending = 0;
+    int c;
+    
+    for ( c = 0; c < TPOOL_NUM_CLASSES; c++ )
+    {
+        pending += getNumJobsPending( c );
+    }
+    
+    return pending;
 }
 
 unsigned ThreadPool::getNumThreadsRunning()
@@ -435,13 +831,20 @@ void ThreadPool::setLingerTime( unsigned seconds )
 // returns if num jobs in q == 0 or die signal has been given
 void ThreadPool::waitForZeroJobs()
 {
+    timeval now;
+    timespec timeout;
+    
     sleep( 1 );
     
     pthread_mutex_lock( &mutex );
-    // wait until num jobs == 0
-    if ( q.length() != 0 && allDie == false )
+    // wait until num jobs == 0; idle workers signal without the
+    // mutex, so check again every second
+    while ( getNumJobsPending() != 0 && allDie == false )
     {
-        pthread_cond_wait( &zeroCountCondVariable, &mutex );
+        gettimeofday( &now, NULL );
+        timeout.tv_sec = now.tv_sec + 1;
+        timeout.tv_nsec = now.tv_usec * 1000;
+        pthread_cond_timedwait( &zeroCountCondVariable, &mutex, &timeout );
     }
     pthread_mutex_unlock( &mutex );
     //DBG( printf("waitForZeroJobs(): done\n"); )
@@ -136,8 +136,12 @@ static int membuffer_set_size( INOUT membuffer* m,
 			return 0;	// have enough mem; done
 		}
 
+		// grow by at least the current capacity, so that a buffer
+		//   built by many small appends is copied a bounded number
+		//   of times
 		diff = new_length - m->length;
-		alloc_len = MAXVAL(m->size_inc, diff) + m->capacity;
+		alloc_len = MAXVAL( MAXVAL(m->size_inc, diff), m->capacity )
+			+ m->capacity;
 	}
 	else	// decrease length
 	{
@@ -198,6 +202,30 @@ void membuffer_destroy( INOUT membuffer* m )
 	membuffer_init( m );	
 }
 
+//////////////////////////////////////////////////
+void membuffer_reset( INOUT membuffer* m )
+{
+	assert( m != NULL );
+
+	m->length = 0;
+	if ( m->buf != NULL )
+	{
+		m->buf[0] = 0;
+	}
+}
+
+//////////////////////////////////////////////////
+int membuffer_reserve( INOUT membuffer* m, IN size_t len )
+{
+	assert( m != NULL );
+
+	if ( len <= m->capacity )
+	{
+		return 0;
+	}
+	return membuffer_set_size( m, len );
+}
+
 //////////////////////////////////////////////////
 int membuffer_assign( INOUT membuffer* m, IN const void* buf, 
 					 IN size_t buf_len )
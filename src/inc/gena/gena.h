@@ -57,16 +57,16 @@
 #define XML_VERSION "<?xml version='1.0' encoding='ISO-8859-1' ?>\n"
 #define XML_PROPERTYSET_HEADER "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\n"
 
-#define UNABLE_MEMORY "HTTP/1.1 500 Internal Server Error\r\n\r\n"
-#define UNABLE_SERVICE_UNKNOWN "HTTP/1.1 404 Not Found\r\n\r\n"
-#define UNABLE_SERVICE_NOT_ACCEPT "HTTP/1.1 503 Service Not Available\r\n\r\n"
+#define UNABLE_MEMORY "HTTP/1.1 500 Internal Server Error\r\nCONTENT-LENGTH: 0\r\n\r\n"
+#define UNABLE_SERVICE_UNKNOWN "HTTP/1.1 404 Not Found\r\nCONTENT-LENGTH: 0\r\n\r\n"
+#define UNABLE_SERVICE_NOT_ACCEPT "HTTP/1.1 503 Service Not Available\r\nCONTENT-LENGTH: 0\r\n\r\n"
 
 
-#define NOT_IMPLEMENTED "HTTP/1.1 501 Not Implemented\r\n\r\n"
-#define BAD_REQUEST "HTTP/1.1 400 Bad Request\r\n\r\n"
+#define NOT_IMPLEMENTED "HTTP/1.1 501 Not Implemented\r\nCONTENT-LENGTH: 0\r\n\r\n"
+#define BAD_REQUEST "HTTP/1.1 400 Bad Request\r\nCONTENT-LENGTH: 0\r\n\r\n"
 #define INVALID_NT BAD_CALLBACK
-#define BAD_CALLBACK "HTTP/1.1 412 Precondition Failed\r\n\r\n" 
-#define HTTP_OK_CRLF "HTTP/1.1 200 OK\r\n\r\n"
+#define BAD_CALLBACK "HTTP/1.1 412 Precondition Failed\r\nCONTENT-LENGTH: 0\r\n\r\n" 
+#define HTTP_OK_CRLF "HTTP/1.1 200 OK\r\nCONTENT-LENGTH: 0\r\n\r\n"
 #define HTTP_OK "HTTP/1.1 200 OK\r\n"
 #define INVALID_SID BAD_CALLBACK
 #define MISSING_SID BAD_CALLBACK
@@ -97,18 +97,27 @@ extern pthread_mutex_t GlobalClientSubscribeMutex;
 
 
 
-EXTERN_C void genaCallback (const char *document, int sockfd);
+EXTERN_C void genaCallback (const MiniServerRequest *msg, int sockfd);
 
 
-typedef struct NOTIFY_THREAD_STRUCT {
-  char * headers;
-  char * propertySet;
-  char * servId;
+//one event as sent to every subscriber; the notify_thread_structs of
+//the subscribers share it and only add their own SID and SEQ headers
+typedef struct NOTIFY_PAYLOAD {
+  int reference_count;  //one per notify_thread_struct, changed atomically
   char * UDN;
+  char * servId;
+  char * headers;       //all headers (including \r\n) except SID and SEQ
+  int headers_size;
+  char * propertySet;   //sent with its null terminator
+  int propertySet_size;
+} notify_payload;
+
+typedef struct NOTIFY_THREAD_STRUCT {
+  notify_payload * payload;
   Upnp_SID sid;
   int eventKey;
-  int *reference_count;
   UpnpDevice_Handle device_handle;
+  struct NOTIFY_THREAD_STRUCT *next; //next in the subscription's queue
 } notify_thread_struct;
 
 
@@ -155,6 +164,11 @@ DEVICEONLY(EXTERN_C int genaNotifyAll(UpnpDevice_Handle device_handle,
 
 DEVICEONLY(EXTERN_C int genaNotifyAllExt(UpnpDevice_Handle device_handle, char *UDN, char *servId,IN Upnp_Document PropSet);)
 
+DEVICEONLY(EXTERN_C int genaSetEventModeration(UpnpDevice_Handle device_handle,
+					       char *UDN,
+					       char *servId,
+					       int interval);)
+
 DEVICEONLY(EXTERN_C int genaInitNotify(UpnpDevice_Handle device_handle,
 			    char *UDN,
 			    char *servId,
@@ -53,17 +53,23 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/time.h>
 #include "tools/config.h"
 #include "upnp.h"
+#include "genlib/net/http/httpparser.h"
 
 
 
 #define HTTP_DATE_LENGTH 37 // length for HTTP DATE: 
                             //"DATE: Sun, 01 Jul 2000 08:15:23 GMT<cr><lf>"
+
+//most buffers a request can be gathered from by write_vector
+#define HTTP_MAX_PARTS 8
+
 #define SEPARATORS "()<>@,;:\\\"/[]?={} \t"
 #define MARK "-_.!~*'()"
 #define RESERVED ";/?:@&=+$,"
@@ -140,6 +146,7 @@ typedef struct URL_LIST {
 typedef struct HTTP_HEADER {
   token header;
   token value;
+  int id; //HDR_XXX from httpparser.h
   struct HTTP_HEADER * next;
 } http_header;
 
@@ -172,11 +179,21 @@ EXTERN_C int transferHTTP( char * request,  char * toSend,
 EXTERN_C int transferHTTPRaw( char * toSend, int toSendSize, 
 			     char **out,  char *URL);
 
+//closes the idle persistent connections kept by the
+//transferHTTP functions
+EXTERN_C void closeIdleConnections(void);
+
 //helper function
 EXTERN_C int transferHTTPparsedURL( char * request, 
 				    char * toSend, int toSendSize, 
 				   char **out, uri_type *URL);
 
+//same as transferHTTPparsedURL, with the bytes to send after the HOST
+//header gathered from count (< HTTP_MAX_PARTS) buffers without copying
+EXTERN_C int transferHTTPparsedURLv( char * request, 
+				     struct iovec * toSend, int count, 
+				     char **out, uri_type *URL);
+
 //assumes that char * out has enough space ( 38 characters)
 //outputs the current time in the following null terminated string:
 // "DATE: Sun, Jul 06 2000 08:53:01 GMT\r\n"
@@ -198,6 +215,8 @@ EXTERN_C int parse_http_response(  char * in, http_message * out,
 
 EXTERN_C int parse_http_request( char * in, http_message *out, 
 				int max_len);
+EXTERN_C int load_http_message( char * in, int max_len,
+			       const HttpParser *parser, http_message *out);
 
 EXTERN_C int search_for_header( http_message * in, 
 			        char * header, token *out_value);
@@ -208,6 +227,8 @@ EXTERN_C int parse_hostport(  char* in, int max, hostport_type *out );
 
 EXTERN_C size_t write_bytes(int fd,   char * bytes, size_t n, 
 			    int timeout);
+EXTERN_C size_t write_vector(int fd, struct iovec * parts, int count,
+			     int timeout);
 EXTERN_C void free_http_message(http_message * message);
 EXTERN_C int copy_URL_list( URL_list *in, URL_list *out);
 EXTERN_C void free_URL_list(URL_list * list);
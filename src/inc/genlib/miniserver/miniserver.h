@@ -35,7 +35,26 @@
 #ifndef MINISERVER_H
 #define MINISERVER_H
 
-typedef void (*MiniServerCallback) ( const char* document, int sockfd );
+#include <genlib/net/http/httpparser.h>
+
+// a request as parsed by the miniserver while reading it; handlers work
+//  from this parse instead of parsing document again; the pointers
+//  point into document and are valid during the callback only
+typedef struct
+{
+    const char* document;       // entire request, null terminated
+    int documentLen;
+    const HttpParser* parser;   // start line and headers of document
+    const char* uri;            // request-URI of the request-line
+    int uriLen;
+    const char* soapAction;     // value of SOAPACTION header; NULL if none
+    int soapActionLen;
+    const char* body;           // entity, null terminated
+    int bodyLen;
+} MiniServerRequest;
+
+typedef void (*MiniServerRequestCallback) ( const MiniServerRequest* request,
+    int sockfd );
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,14 +67,14 @@ int StartMiniServer( unsigned short listen_port );
 
 int StopMiniServer( void );
 
-void SetHTTPGetCallback( MiniServerCallback callback );
-MiniServerCallback GetHTTPGetCallback( void );
+void SetHTTPGetCallback( MiniServerRequestCallback callback );
+MiniServerRequestCallback GetHTTPGetCallback( void );
 
-void SetSoapCallback( MiniServerCallback callback );
-MiniServerCallback GetSoapCallback( void );
+void SetSoapCallback( MiniServerRequestCallback callback );
+MiniServerRequestCallback GetSoapCallback( void );
 
-void SetGenaCallback( MiniServerCallback callback );
-MiniServerCallback GetGenaCallback( void );
+void SetGenaCallback( MiniServerRequestCallback callback );
+MiniServerRequestCallback GetGenaCallback( void );
 
 #ifdef __cplusplus
 }   /* extern C */
@@ -0,0 +1,239 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of the Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+// httpparser.h
+// incremental HTTP message parser; works on the caller's receive
+//  buffer and records where things are instead of copying them
+
+#ifndef GENLIB_NET_HTTP_HTTPPARSER_H
+#define GENLIB_NET_HTTP_HTTPPARSER_H
+
+// IDs for HTTP headers
+#define HDR_UNKNOWN             -1  /* UnknownHeader */
+
+// Std. HTTP Headers
+#define HDR_ACCEPT              1   /* CommaSeparatedList<MediaRange> */
+#define HDR_ACCEPT_CHARSET      2   /* CommaSeparatedList<IdentifierQValue> */
+#define HDR_ACCEPT_ENCODING     3   /* CommaSeparatedList<IdentifierQValue> */
+#define HDR_ACCEPT_LANGUAGE     4   /* CommaSeparatedList<LanguageTag> */
+#define HDR_ACCEPT_RANGES       5   /* RawHeaderValue */
+#define HDR_AGE                 6   /* HttpNumber */
+#define HDR_ALLOW               7   /* CommaSeparatedList<IdentifierValue> */
+#define HDR_AUTHORIZATION       8   /* RawHeaderValue */
+
+#define HDR_CACHE_CONTROL       9   /* CommaSeparatedList<CacheDirective> */
+#define HDR_CONNECTION          10  /* CommaSeparatedList<IdentifierValue> */
+#define HDR_CONTENT_ENCODING    11  /* CommaSeparatedList<IdentifierValue> */
+#define HDR_CONTENT_LENGTH      12  /* HttpNumber */
+#define HDR_CONTENT_LANGUAGE    13  /* CommaSepartedList<LanguageTag> */
+#define HDR_CONTENT_LOCATION    14  /* UriType */
+#define HDR_CONTENT_MD5         15  /* RawHeaderValue */
+#define HDR_CONTENT_RANGE       16  /* RawHeaderValue */
+#define HDR_CONTENT_TYPE        17  /* MediaRange */
+
+#define HDR_DATE                18  /* HttpDateValue */
+
+#define HDR_ETAG                19  /* RawHeadervalue */
+#define HDR_EXPECT              20  /* RawHeaderValue */
+#define HDR_EXPIRES             21  /* HttpDateValue */
+
+#define HDR_FROM                22  /* RawHeaderValue */
+
+#define HDR_HOST                23  /* HostPortValue */
+
+#define HDR_IF_MATCH            24  /* RawHeaderValue */
+#define HDR_IF_MODIFIED_SINCE   25  /* HttpDateValue */
+#define HDR_IF_NONE_MATCH       26  /* RawHeaderValue */
+#define HDR_IF_RANGE            27  /* RawHeaderValue */
+#define HDR_IF_UNMODIFIED_SINCE 28  /* HttpDateValue */
+
+#define HDR_LAST_MODIFIED       29  /* HttpDateValue */
+#define HDR_LOCATION            30  /* UriType (absolute)*/
+
+#define HDR_MAX_FORWARDS        31  /* HttpNumber */
+
+#define HDR_PRAGMA              32  /* RawHeaderValue */
+#define HDR_PROXY_AUTHENTICATE  33  /* RawHeaderValue */
+#define HDR_PROXY_AUTHORIZATION 34  /* RawHeaderValue */
+
+#define HDR_RANGE               35  /* RawHeaderValue */
+#define HDR_REFERER             36  /* RawHeaderValue */
+#define HDR_RETRY_AFTER         37  /* HttpDateOrSeconds */
+
+#define HDR_SERVER              38  /* RawHeaderValue */
+
+#define HDR_TE                  39  /* RawHeaderValue */
+#define HDR_TRAILER             40  /* RawHeaderValue */
+#define HDR_TRANSFER_ENCODING   41  /* CommaSeparatedList<IdentifierValue> */
+
+#define HDR_USER_AGENT          42  /* RawHeaderValue */
+
+#define HDR_VARY                43  /* RawHeaderValue */
+#define HDR_VIA                 44  /* RawHeaderValue */
+
+#define HDR_WARNING             45  /* RawHeaderValue */
+#define HDR_WWW_AUTHENTICATE    46  /* RawHeaderValue */
+
+// SSDP
+#define HDR_UPNP_USN            100     /* RawHeaderValue */
+#define HDR_UPNP_ST             101     /* RawHeaderValue */
+#define HDR_UPNP_MAN            102     /* RawHeaderValue */
+
+// GENA
+#define HDR_UPNP_NT             200     /* RawHeaderValue */
+#define HDR_UPNP_NTS            201     /* NTSType */
+#define HDR_UPNP_CALLBACK       202     /* RawHeaderValue */
+#define HDR_UPNP_SID            203     /* RawHeaderValue */
+
+// SOAP
+#define HDR_UPNP_SOAPACTION     300     /* RawHeaderValue */
+
+// headers kept in the parser itself; more go to a heap array
+#define HTTP_PARSER_INLINE_HEADERS 32
+
+// parser states
+#define HTTP_PARSER_START_LINE  0
+#define HTTP_PARSER_HEADERS     1
+#define HTTP_PARSER_DONE        2
+#define HTTP_PARSER_ERROR       3
+
+// results of http_ParseMessage() and http_NextChunk()
+#define HTTP_PARSE_ERROR        -1
+#define HTTP_PARSE_INCOMPLETE   0
+#define HTTP_PARSE_DONE         1
+
+// a header line; offsets are into the buffer given to the parser
+typedef struct
+{
+    int id;             // HDR_XXX; HDR_UNKNOWN if not known
+    int nameStart;
+    int nameLen;
+    int valueStart;     // value without surrounding whitespace
+    int valueLen;       // folded lines are part of the value
+} HttpHeaderRef;
+
+typedef struct
+{
+    int state;          // HTTP_PARSER_XXX
+    int lineStart;      // offset of the line being parsed
+    int scanned;        // bytes from lineStart searched for LF already
+    
+    int isRequest;
+    
+    // request-line
+    int method;         // UpnpMethodType; HTTP_UNKNOWN_METHOD if not known
+    int methodStart;
+    int methodLen;
+    int uriStart;
+    int uriLen;
+    
+    // status-line
+    int statusCode;
+    int statusStart;
+    int statusLen;
+    int reasonStart;
+    int reasonLen;
+    
+    int majorVersion;
+    int minorVersion;
+    int versionStart;   // HTTP-Version of either line
+    int versionLen;
+    
+    HttpHeaderRef* headers;     // inlineHeaders, or a heap array once
+                                //  they are full
+    int maxHeaders;             // room in headers
+    int numHeaders;
+    HttpHeaderRef inlineHeaders[HTTP_PARSER_INLINE_HEADERS];
+    
+    // valid in state HTTP_PARSER_DONE
+    int headerLen;      // start line + headers + blank line
+    int contentLength;  // -1 if there is no Content-Length header
+    int chunked;        // Transfer-Encoding: chunked
+    int connectionClose;    // Connection: close
+} HttpParser;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void http_ParserInit( HttpParser* parser );
+
+// frees the heap array of a parser that found more headers than fit
+//  in it; the parser must be initialized again before it is reused
+void http_ParserFree( HttpParser* parser );
+
+// moves the parse in src to dst, which is not initialized; src is left
+//  initialized, so only dst has to be freed
+void http_ParserMove( HttpParser* dst, HttpParser* src );
+
+// parses the start line and headers in buf; call again with the same
+//  buffer, and more bytes appended to it, while HTTP_PARSE_INCOMPLETE
+//  is returned -- parsing resumes where the last call stopped; the
+//  buffer may move between calls but must keep its contents
+// returns
+//   HTTP_PARSE_DONE: start line and headers are complete
+//   HTTP_PARSE_INCOMPLETE: more data needed
+//   HTTP_PARSE_ERROR: malformed message
+int http_ParseMessage( HttpParser* parser, const char* buf, int len );
+
+// like http_ParseMessage() for a message known to end at buf[len]; the
+//  headers end there even if the blank line after them is missing
+int http_ParseMessageEnd( HttpParser* parser, const char* buf, int len );
+
+// returns the first header with the given HDR_XXX id; NULL if none
+const HttpHeaderRef* http_FindHeader( const HttpParser* parser,
+    int headerID );
+
+// finds the next chunk of a chunked entity starting at buf[*pos];
+//  chunk extensions and trailers are skipped
+// returns
+//   HTTP_PARSE_DONE: chunk data is at buf[*dataStart] and *dataLen
+//     bytes long and *pos is moved past the chunk; *dataLen is 0 for
+//     the last chunk
+//   HTTP_PARSE_INCOMPLETE: chunk not complete yet; *pos is unchanged
+//   HTTP_PARSE_ERROR: bad format
+int http_NextChunk( const char* buf, int len, int* pos,
+    int* dataStart, int* dataLen );
+
+// header and method names; lookups are case-insensitive for headers
+//  and case-sensitive for methods
+// return HDR_UNKNOWN / HTTP_UNKNOWN_METHOD, or NULL, if not known
+int http_HeaderNameToID( const char* name, int len );
+const char* http_HeaderIDToName( int id );
+int http_MethodNameToID( const char* name, int len );
+const char* http_MethodIDToName( int id );
+
+#ifdef __cplusplus
+}   /* extern C */
+#endif
+
+#endif /* GENLIB_NET_HTTP_HTTPPARSER_H */
@@ -38,91 +38,12 @@
 #include <genlib/util/xstring.h>
 #include <genlib/util/xdlist.h>
 #include <genlib/net/http/tokenizer.h>
+#include <genlib/net/http/httpparser.h>
 #include <genlib/http_client/http_client.h>
 #include <genlib/util/xstring.h>
 #include <genlib/util/dbllist.h>
 #include <netinet/in.h>
-
-// IDs for HTTP headers
-#define HDR_UNKNOWN             -1  /* UnknownHeader */
-
-// Std. HTTP Headers
-#define HDR_ACCEPT              1   /* CommaSeparatedList<MediaRange> */
-#define HDR_ACCEPT_CHARSET      2   /* CommaSeparatedList<IdentifierQValue> */
-#define HDR_ACCEPT_ENCODING     3   /* CommaSeparatedList<IdentifierQValue> */
-#define HDR_ACCEPT_LANGUAGE     4   /* CommaSeparatedList<LanguageTag> */
-#define HDR_ACCEPT_RANGES       5   /* RawHeaderValue */
-#define HDR_AGE                 6   /* HttpNumber */
-#define HDR_ALLOW               7   /* CommaSeparatedList<IdentifierValue> */
-#define HDR_AUTHORIZATION       8   /* RawHeaderValue */
-
-#define HDR_CACHE_CONTROL       9   /* CommaSeparatedList<CacheDirective> */
-#define HDR_CONNECTION          10  /* CommaSeparatedList<IdentifierValue> */
-#define HDR_CONTENT_ENCODING    11  /* CommaSeparatedList<IdentifierValue> */
-#define HDR_CONTENT_LENGTH      12  /* HttpNumber */
-#define HDR_CONTENT_LANGUAGE    13  /* CommaSepartedList<LanguageTag> */
-#define HDR_CONTENT_LOCATION    14  /* UriType */
-#define HDR_CONTENT_MD5         15  /* RawHeaderValue */
-#define HDR_CONTENT_RANGE       16  /* RawHeaderValue */
-#define HDR_CONTENT_TYPE        17  /* MediaRange */
-
-#define HDR_DATE                18  /* HttpDateValue */
-
-#define HDR_ETAG                19  /* RawHeadervalue */
-#define HDR_EXPECT              20  /* RawHeaderValue */
-#define HDR_EXPIRES             21  /* HttpDateValue */
-
-#define HDR_FROM                22  /* RawHeaderValue */
-
-#define HDR_HOST                23  /* HostPortValue */
-
-#define HDR_IF_MATCH            24  /* RawHeaderValue */
-#define HDR_IF_MODIFIED_SINCE   25  /* HttpDateValue */
-#define HDR_IF_NONE_MATCH       26  /* RawHeaderValue */
-#define HDR_IF_RANGE            27  /* RawHeaderValue */
-#define HDR_IF_UNMODIFIED_SINCE 28  /* HttpDateValue */
-
-#define HDR_LAST_MODIFIED       29  /* HttpDateValue */
-#define HDR_LOCATION            30  /* UriType (absolute)*/
-
-#define HDR_MAX_FORWARDS        31  /* HttpNumber */
-
-#define HDR_PRAGMA              32  /* RawHeaderValue */
-#define HDR_PROXY_AUTHENTICATE  33  /* RawHeaderValue */
-#define HDR_PROXY_AUTHORIZATION 34  /* RawHeaderValue */
-
-#define HDR_RANGE               35  /* RawHeaderValue */
-#define HDR_REFERER             36  /* RawHeaderValue */
-#define HDR_RETRY_AFTER         37  /* HttpDateOrSeconds */
-
-#define HDR_SERVER              38  /* RawHeaderValue */
-
-#define HDR_TE                  39  /* RawHeaderValue */
-#define HDR_TRAILER             40  /* RawHeaderValue */
-#define HDR_TRANSFER_ENCODING   41  /* CommaSeparatedList<IdentifierValue> */
-
-#define HDR_USER_AGENT          42  /* RawHeaderValue */
-
-#define HDR_VARY                43  /* RawHeaderValue */
-#define HDR_VIA                 44  /* RawHeaderValue */
-
-#define HDR_WARNING             45  /* RawHeaderValue */
-#define HDR_WWW_AUTHENTICATE    46  /* RawHeaderValue */
-
-// SSDP
-#define HDR_UPNP_USN            100     /* RawHeaderValue */
-#define HDR_UPNP_ST             101     /* RawHeaderValue */
-#define HDR_UPNP_MAN            102     /* RawHeaderValue */
-
-// GENA
-#define HDR_UPNP_NT             200     /* RawHeaderValue */
-#define HDR_UPNP_NTS            201     /* NTSType */
-#define HDR_UPNP_CALLBACK       202     /* RawHeaderValue */
-#define HDR_UPNP_SID            203     /* RawHeaderValue */
-
-// SOAP
-#define HDR_UPNP_SOAPACTION     300     /* RawHeaderValue */
-
+#include <sys/types.h>
 
 //////////////////////////////////////////
 
@@ -505,6 +426,9 @@ public:
     void toString( xstring& s );
     
     bool setHostPort( const char* hostName, unsigned short port );
+    
+    // value is "host[:port]"; returns false if it is malformed
+    bool setValue( const char* value, int len );
     void getHostPort( sockaddr_in* addr );
 
 private:
@@ -659,6 +583,15 @@ public:
 
 class HttpMessage;
 
+//////////
+// part of a file entity to send; see HttpEntity::ranges
+struct HttpFileRange
+{
+    off_t first;            // offset of first byte
+    off_t length;           // number of bytes
+    xstring partHeader;     // sent before the bytes; multipart only
+};
+
 //////////
 // body of http message
 // note: entity may or may not be ascii string, but always has
@@ -696,6 +629,13 @@ public:
 
     EntityType type;
     xstring filename;
+
+    // type = FILENAME: if numRanges > 0, only these parts of the
+    //   file are sent, followed by rangeTrailer; allocated with
+    //   new[] and owned by the entity
+    HttpFileRange* ranges;
+    int numRanges;
+    xstring rangeTrailer;
         
 private:
     enum AppendStateType { IDLE, APPENDING, DONE }; 
@@ -746,6 +686,33 @@ public:
     int loadResponse( const char* response, 
         UpnpMethodType requestMethod );
     
+    // loads the request of len bytes in buf that parser has parsed
+    //  already; returns as loadRequest() above
+    int loadRequest( const char* buf, int len, const HttpParser& parser );
+    
+    // loads what parser found in buf; the entity is not loaded
+    // returns 0, HTTP_E_BAD_MSG_FORMAT or HTTP_E_OUT_OF_MEMORY
+    int loadStartLineAndHeaders( const char* buf, const HttpParser& parser );
+    
+    // loads the entity from the len bytes that follow the headers
+    // returns
+    // 0: success
+    // -1: std error; check errno
+    // HTTP_E_BAD_MSG_FORMAT: entity incomplete or malformed
+    // HTTP_E_OUT_OF_MEMORY
+    int loadEntity( const char* body, int len,
+        UpnpMethodType requestMethod );
+    
+    // if message is response, requestMethod is method used for request
+    //   else ignored
+    // return value:
+    //              = -1, no body or ignore body
+    //              =  1, transfer encoding
+    //              =  2, content-length (length=content length)
+    //              =  3, connection close
+    int messageBodyLen( IN UpnpMethodType requestMethod,
+        OUT int& length );
+    
     int headerCount() const;
     
     void addHeader( int headerType, HttpHeaderValue* value );
@@ -798,8 +765,6 @@ private:
     void loadRestOfMessage( Tokenizer& scanner, CharReader* reader,
         UpnpMethodType requestMethod );
         
-    int messageBodyLen( IN UpnpMethodType requestMethod,
-        OUT int& length );
     int getContentLength();
     
     void readEntityUntilClose( Tokenizer& scanner );
@@ -35,6 +35,7 @@
 #ifndef GENLIB_NET_HTTP_READWRITE_H
 #define GENLIB_NET_HTTP_READWRITE_H
 
+#include <sys/uio.h>
 #include <genlib/net/http/parseutil.h>
 
 #define DEF_TIMEOUT     30
@@ -50,7 +51,9 @@ int http_RecvMessage( IN int tcpsockfd, OUT HttpMessage& message,
     UpnpMethodType requestMethod = HTTP_UNKNOWN_METHOD,
     int timeoutSecs = DEF_TIMEOUT );
 
-// write the http message to the TCP connection
+// write the http message to the TCP connection; file entities
+//   are sent with sendfile(); timeoutSecs bounds each wait for
+//   the peer to take more data (< 0 waits forever)
 // return codes:
 //   0: success
 //  -1: std error; check errno
@@ -59,6 +62,16 @@ int http_RecvMessage( IN int tcpsockfd, OUT HttpMessage& message,
 int http_SendMessage( IN int tcpsockfd, IN HttpMessage& message,
     int timeoutSecs = DEF_TIMEOUT );
 
+// write already formatted message buffers to the TCP connection,
+//   with as few system calls as the socket allows; 'iov' is
+//   modified; timeoutSecs works as in http_SendMessage()
+// return codes:
+//   0: success
+//  -1: std error; check errno
+//  HTTP_E_TIMEDOUT
+int http_SendBuffers( IN int tcpsockfd, INOUT struct iovec* iov,
+    IN int iovcnt, int timeoutSecs = DEF_TIMEOUT );
+
 // return codes:
 //   0: success
 //  -1: std error; check errno
@@ -35,6 +35,8 @@
 #ifndef GENLIB_NET_HTTP_SERVER_H
 #define GENLIB_NET_HTTP_SERVER_H
 
+#include <genlib/miniserver/miniserver.h>
+
 #ifdef __cplusplus
 
 #include <genlib/net/http/parseutil.h>
@@ -55,7 +57,7 @@ int http_AddAlias( IN const char* aliasRelURL, IN HttpEntity* entity,
 extern "C" {
 #endif /* __cplusplus */
 
-void http_OldServerCallback( IN const char* msg, int sockfd );
+void http_OldServerCallback( IN const MiniServerRequest* msg, int sockfd );
 
 void http_SetRootDir( const char* httpRootDir );
 
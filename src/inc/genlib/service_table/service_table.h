@@ -59,6 +59,13 @@
 #endif
 #define SID_SIZE  41
 
+//number of buckets in each of the service table indexes
+#define SERVICE_HASH_SIZE 64
+
+//initial number of buckets in a service's SID index
+//(doubled whenever the subscriptions outnumber the buckets)
+#define SID_HASH_INITIAL_SIZE 16
+
 DEVICEONLY(
 
 typedef struct SUBSCRIPTION {
@@ -69,6 +76,12 @@ typedef struct SUBSCRIPTION {
   int active;
   URL_list DeliveryURLs;
   struct SUBSCRIPTION *next;
+  struct SUBSCRIPTION *prev;     //previous in the subscriptionList
+  struct SUBSCRIPTION *hashNext; //next in the same SIDIndex bucket
+  //events waiting for the one in flight, oldest first (gena_server.c)
+  struct NOTIFY_THREAD_STRUCT *outgoing;
+  struct NOTIFY_THREAD_STRUCT *outgoingTail;
+  int sending;                   //an event is being delivered
 } subscription;
 
 
@@ -82,12 +95,32 @@ typedef struct SERVICE_INFO {
   int active;
   int TotalSubscriptions;
   subscription *subscriptionList;
+  subscription **SIDIndex;   //subscriptions hashed by SID
+  int SIDIndexSize;
+  char * controlURLPath;     //path and query of controlURL, parsed once
+  char * eventURLPath;       //path and query of eventURL, parsed once
+  struct SERVICE_INFO * idNext;      //next in the table's idIndex bucket
+  struct SERVICE_INFO * controlNext; //next in the table's controlIndex bucket
+  struct SERVICE_INFO * eventNext;   //next in the table's eventIndex bucket
+  //event moderation (gena_server.c): changes made within eventInterval
+  //ms of the last event are merged into pendingNames/pendingValues
+  int eventInterval;         //0 sends every change right away
+  unsigned long long lastEventMs;
+  int eventPending;          //a flush of the pending changes is scheduled
+  char ** pendingNames;
+  char ** pendingValues;
+  int pendingCount;
+  int pendingSize;
   struct SERVICE_INFO * next;
 } service_info;
 
 typedef struct SERVICE_TABLE {
   Upnp_DOMString URLBase;
   service_info *serviceList;
+  //indexes over serviceList, built by getServiceTable
+  service_info *idIndex[SERVICE_HASH_SIZE];      //by UDN and serviceId
+  service_info *controlIndex[SERVICE_HASH_SIZE]; //by controlURLPath
+  service_info *eventIndex[SERVICE_HASH_SIZE];   //by eventURLPath
 } service_table;
 
 
@@ -139,6 +172,11 @@ EXTERN_C int getServiceTable(Upnp_Node node,
 
 //functions for Subscriptions
 
+//adds the subscription to the front of the service's subscription list
+//and to its SID index
+//returns HTTP_SUCCESS or UPNP_E_OUTOF_MEMORY (sub is not added)
+EXTERN_C int AddSubscription(service_info * service, subscription * sub);
+
 //removes the subscription with the SID from the subscription list pointed to by head
 //returns the new list in head
 EXTERN_C void RemoveSubscriptionSID(Upnp_SID sid, service_info * service);
@@ -146,6 +184,11 @@ EXTERN_C void RemoveSubscriptionSID(Upnp_SID sid, service_info * service);
 //returns a pointer to the subscription with the SID, NULL if not found
 EXTERN_C subscription * GetSubscriptionSID(Upnp_SID sid,service_info * service);   
 
+//same as GetSubscriptionSID, but an expired subscription is only
+//reported as not found and is left in place, so the service is not
+//modified (safe under HandleReadLock)
+EXTERN_C subscription * FindSubscriptionSID(Upnp_SID sid,service_info * service);
+
 
 //returns a pointer to the first subscription
 EXTERN_C subscription * GetFirstSubscription(service_info *service);
@@ -157,6 +200,9 @@ EXTERN_C subscription * GetNextSubscription(service_info * service, subscription
 //frees subscriptionList (including head)
 EXTERN_C void freeSubscriptionList(subscription * head);
 
+//frees count variable names and values and the two arrays holding them
+EXTERN_C void freeVarList(char ** names, char ** values, int count);
+
 //Misc helper functions
 EXTERN_C int getSubElement(const char * element_name,Upnp_Node node, 
 		  Upnp_Node *out);
@@ -166,5 +212,10 @@ EXTERN_C Upnp_DOMString getElementValue(Upnp_Node node);
 EXTERN_C int copy_subscription(subscription *in, subscription *out);
 
 EXTERN_C void freeSubscription(subscription * sub);
+
+#if EXCLUDE_GENA == 0
+//frees the events still queued for a subscription (in gena_server.c)
+EXTERN_C void freeNotifyQueue(struct NOTIFY_THREAD_STRUCT * head);
+#endif
 )
 #endif
@@ -24,12 +24,27 @@ typedef struct UPNP_TIMEOUT {
 } upnp_timeout;
 
 
+//Timer events are kept in a hierarchical timing wheel: level 0 has
+//one slot per millisecond tick for the next TIMER_WHEEL_SLOTS0 ticks,
+//each further level covers TIMER_WHEEL_SLOTS times the span of the
+//level below. Events move down a level as their time comes closer.
+#define TIMER_WHEEL_BITS0 8
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS0 (1<<TIMER_WHEEL_BITS0)
+#define TIMER_WHEEL_SLOTS (1<<TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4      //levels above level 0
+
+//initial number of buckets in the event id index (power of 2)
+#define TIMER_ID_HASH_SIZE 64
+
 typedef struct TIMER_EVENT {
-  time_t time;
+  unsigned long long expires;   //CLOCK_MONOTONIC time in ms
   ScheduleFunc callback;
   void * argument;
   int eventId;
-  struct TIMER_EVENT * next;
+  struct TIMER_EVENT * next;    //wheel slot list
+  struct TIMER_EVENT ** pprev;  //link that points to this event
+  struct TIMER_EVENT * hashNext;//event id index chain
 } timer_event;
 
 typedef struct TIMER_THREAD_STRUCT {
@@ -38,7 +53,12 @@ typedef struct TIMER_THREAD_STRUCT {
   int newEvent;
   int shutdown;
   int currentEventId;
-  timer_event * eventQ;
+  unsigned long long currentTick; //next tick (ms) to be processed
+  int numEvents;
+  timer_event * wheel0[TIMER_WHEEL_SLOTS0];
+  timer_event * wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  timer_event ** idIndex;
+  int idIndexSize;
 } timer_thread_struct;
 
 
@@ -54,8 +74,18 @@ EXTERN_C int ScheduleTimerEvent(int TimeOut,
 				timer_thread_struct * timer,
 				int * eventId);
 
+//same as ScheduleTimerEvent, with the time out in milliseconds
+EXTERN_C int ScheduleTimerEventMs(int TimeOutMs, 
+				  ScheduleFunc callback,
+				  void * argument,
+				  timer_thread_struct * timer,
+				  int * eventId);
+
 EXTERN_C int RemoveTimerEvent(int eventId, void **argument, timer_thread_struct *timer);
 
 EXTERN_C void free_upnp_timeout(upnp_timeout *event);
 
+//milliseconds on the monotonic clock the timer thread runs on
+EXTERN_C unsigned long long getMonotonicMs(void);
+
 #endif
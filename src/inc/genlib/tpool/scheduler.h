@@ -41,6 +41,19 @@ extern "C" {
 
 typedef void(*ScheduleFunc)( void *arg );
 
+// scheduling classes, highest priority first; a free thread always
+// runs the highest class that has a job waiting and is under its quota,
+// except that the last free thread runs a TPOOL_BACKGROUND job when
+// some wait and none is running, so timers are never starved
+typedef enum
+{
+    TPOOL_CONTROL = 0,      // SOAP actions and state variable queries
+    TPOOL_EVENTING,         // GENA subscriptions and notifications
+    TPOOL_DISCOVERY,        // SSDP searches and advertisements
+    TPOOL_BACKGROUND,       // everything else
+    TPOOL_NUM_CLASSES
+} TPoolPriority;
+
 ///////
 // queues function func to be executed in a worker thread
 // input:
@@ -50,6 +63,22 @@ typedef void(*ScheduleFunc)( void *arg );
 //   0 if success; -1 if not enuf mem; -2 if input func in NULL
 int         tpool_Schedule( ScheduleFunc func, void* arg );
 
+///////
+// same as tpool_Schedule, but queues func in the given scheduling
+// class instead of TPOOL_BACKGROUND
+// returns:
+//   0 if success; -1 if not enuf mem; -2 if input func in NULL or
+//   priority is not a valid class
+int         tpool_ScheduleWithPriority( TPoolPriority priority,
+                ScheduleFunc func, void* arg );
+
+///////
+// limits the number of threads running jobs of a scheduling class at
+// the same time; 0 means no limit other than tpool_SetMaxThreads()
+void        tpool_SetPriorityQuota( TPoolPriority priority,
+                unsigned maxThreads );
+unsigned    tpool_GetPriorityQuota( TPoolPriority priority );
+
 unsigned    tpool_GetMaxThreads( void );
 void        tpool_SetMaxThreads( unsigned maxThreads );
 
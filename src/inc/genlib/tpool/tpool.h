@@ -47,18 +47,46 @@ struct PoolQueueItem
 {
     ScheduleFunc func;
     void *arg;
+    int priority;
 };
 
 //typedef xdlist<PoolQueueItem> ThreadPoolQueue;
 typedef dblList ThreadPoolQueue;
 
+// slot of the shared job ring; seq tells producers and consumers
+// whether the slot is free or holds a job for a given position
+struct PoolJobSlot
+{
+    volatile unsigned long seq;
+    PoolQueueItem job;
+};
+
+class ThreadPool;
+
+// per worker job queue; only the owning worker adds jobs (at tail),
+// any worker may take them (at head) so idle workers can steal
+struct PoolWorker
+{
+    enum { QUEUE_SIZE = 64 };       // power of 2
+
+    ThreadPool* pool;
+    bool active;                    // owned by a running thread
+    // one queue per scheduling class
+    volatile unsigned long head[TPOOL_NUM_CLASSES];
+    volatile unsigned long tail[TPOOL_NUM_CLASSES];
+    PoolQueueItem jobs[TPOOL_NUM_CLASSES][QUEUE_SIZE];
+};
+
 
 class ThreadPool
 {
 public:
     enum {  DEF_MAX_THREADS = 10,
         DEF_LINGER_TIME = 2 * 60,     // seconds
-        MAX_LINGER_TIME = 60 * 60 };
+        MAX_LINGER_TIME = 60 * 60,
+        MAX_WORKERS = 64,             // upper bound for setMaxThreads()
+        RING_SIZE = 256 };            // shared job slots per class;
+                                      //  power of 2
             
 public:
 	// throws OutOfMemoryException
@@ -67,6 +95,10 @@ public:
     virtual ~ThreadPool();
 
     int schedule( ScheduleFunc f, void* arg );
+    int schedule( TPoolPriority priority, ScheduleFunc f, void* arg );
+    
+    void setQuota( TPoolPriority priority, unsigned max );
+    unsigned getQuota( TPoolPriority priority );
     
     void setMaxThreads( unsigned max );
     unsigned getMaxThreads();
@@ -77,20 +109,61 @@ public:
     unsigned getLingerTime();
     
     void waitForZeroJobs();
+
+    // body of a worker thread
+    void runWorker( PoolWorker* self );
+        
+private:
+    bool ringPush( const PoolQueueItem& job );
+    bool ringPop( int priority, PoolQueueItem& job );
+    bool workerPush( PoolWorker* worker, const PoolQueueItem& job );
+    bool workerTake( PoolWorker* worker, int priority,
+        PoolQueueItem& job );
+    bool overflowPush( const PoolQueueItem& job );
+    bool overflowPop( int priority, PoolQueueItem& job );
+    bool reserveClass( int priority );
+    void releaseClass( int priority );
+    unsigned getNumJobsPending( int priority );
+    bool mustRunBackground();
+    bool hasRunnableJobs();
+    bool getJob( PoolWorker* self, PoolQueueItem& job );
+    bool takeIdle();
+    bool waitForJob( PoolWorker* self );
+    int startWorker();
         
 private:
+    // jobs scheduled from outside the pool; lock free
+    PoolJobSlot ring[TPOOL_NUM_CLASSES][RING_SIZE];
+    volatile unsigned long ringHead[TPOOL_NUM_CLASSES];
+    volatile unsigned long ringTail[TPOOL_NUM_CLASSES];
+
+    // threads running jobs of each class, and their limits
+    volatile unsigned running[TPOOL_NUM_CLASSES];
+    unsigned quota[TPOOL_NUM_CLASSES];
+
+    // jobs scheduled by worker threads
+    PoolWorker* workers[MAX_WORKERS];
+    volatile unsigned numWorkers;   // slots in use, never shrinks
+    pthread_key_t workerKey;
+
+    // jobs that did not fit in the ring; guarded by mutex
     ThreadPoolQueue q;
+    volatile unsigned numOverflow[TPOOL_NUM_CLASSES];
     
 private:
     unsigned numThreads;
     unsigned maxThreads;
     unsigned lingerTime; // time for idle thread to die (in secs)
-    bool allDie;         // to kill all threads
+    volatile bool allDie;         // to kill all threads
+
+    // idle workers sleep on wakeup; schedule() posts it once for
+    // every idle worker it claims from numIdle
+    volatile unsigned numIdle;
+    sem_t wakeup;
     
     //pthread_mutex_t mutex;
     pthread_mutex_t mutex;
-    pthread_cond_t condVariable;
-    pthread_cond_t zeroCountCondVariable; // q size == 0 || allDie
+    pthread_cond_t zeroCountCondVariable; // no jobs pending || allDie
 };
 
 #endif /* GENLIB_TPOOL_TPOOL_H */
@@ -107,6 +107,20 @@ void membuffer_init( INOUT membuffer* m );
 //   be valid
 void membuffer_destroy( INOUT membuffer* m );
 
+//////////////////////////////////////////////////
+// sets length to 0 but keeps the memory, so that
+//   the buffer can be filled again without allocating
+void membuffer_reset( INOUT membuffer* m );
+
+//////////////////////////////////////////////////
+// makes room for at least 'len' bytes in total, so that
+//   appends up to that length do not allocate
+//
+// returns:
+//	 UPNP_E_SUCCESS
+//	 UPNP_E_OUTOF_MEMORY
+int membuffer_reserve( INOUT membuffer* m, IN size_t len );
+
 //////////////////////////////////////////////////
 // sets m->buf to buf
 //
@@ -59,9 +59,47 @@ typedef enum SsdpSearchType{SSDP_SERROR=-1,SSDP_ALL,SSDP_ROOTDEVICE,
                            SSDP_DEVICE,SSDP_DEVICETYPE,SSDP_SERVICE} SType;
 
 
-extern pthread_mutex_t GlobalHndMutex; // = PTHREAD_MUTEX_INITIALIZER;
-#define HandleLock()  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Trying Lock")); pthread_mutex_lock(&GlobalHndMutex); DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"LOCK"));
-#define HandleUnlock() DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Trying Unlock")); pthread_mutex_unlock(&GlobalHndMutex); DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Unlock"));
+// Reader/writer lock over the handle table and everything hanging off a
+// Handle_Info.  HandleLock() takes it for writing and must be used by any
+// path that registers or unregisters a handle or changes handle data
+// (subscriptions, MaxAge, ...).  HandleReadLock() is for paths that only
+// look a handle up and copy data out; any number of them run at once.
+// Both are released with HandleUnlock().
+extern pthread_rwlock_t GlobalHndRWLock;
+#define HandleLock()  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Trying Lock")); pthread_rwlock_wrlock(&GlobalHndRWLock); DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"LOCK"));
+#define HandleReadLock()  DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Trying Read Lock")); pthread_rwlock_rdlock(&GlobalHndRWLock); DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"READ LOCK"));
+#define HandleUnlock() DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Trying Unlock")); pthread_rwlock_unlock(&GlobalHndRWLock); DBGONLY(UpnpPrintf(UPNP_INFO,API,__FILE__,__LINE__,"Unlock"));
+
+// Kinds of entries in a device's precomputed advertisement table
+typedef enum SsdpAdvKind{SSDP_ADV_ROOTDEVICE,SSDP_ADV_UDN,SSDP_ADV_DEVTYPE,
+                         SSDP_ADV_SERVICE} AdvKind;
+
+// One NT/ST + USN pair advertised by a device, with the fixed part of its
+// reply, alive and byebye packets already rendered.
+typedef struct SsdpAdvEntryStruct
+{
+    enum SsdpAdvKind Kind;
+    char *Udn;
+    char *Nt;           // NT for notifications, ST for replies
+    char *ReplyTail;
+    char *AliveTail;
+    char *ByeTail;
+} SsdpAdvEntry;
+
+// Immutable table of everything a root device advertises, built once when
+// the device is registered.  Senders pin it with HoldAdvTable() so the
+// handle lock is not needed while packets go out; RefCount is protected
+// by RefMutex.
+typedef struct SsdpAdvTableStruct
+{
+    pthread_mutex_t RefMutex;
+    int   RefCount;
+    int   NumEntries;
+    int   MaxEntries;
+    char  Location[LINE_SIZE];
+    char  Server[LINE_SIZE];
+    SsdpAdvEntry *Entries;
+} SsdpAdvTable;
 
 // Data to be stored in handle table for
 struct Handle_Info
@@ -84,6 +122,7 @@ struct Handle_Info
 
     char  DescAlias[LINE_SIZE]; // alias of desc doc served by web server
     int   aliasInstalled;       // 0 = not installed; otherwise installed
+    DEVICEONLY(SsdpAdvTable * AdvTable;) // precomputed SSDP advertisements
 } ;
 
 
@@ -153,6 +192,13 @@ int SendReply(struct sockaddr_in * DestAddr, char *DevType,int RootDev, char * U
 int ServiceAdvertisement( char *Udn,char *ServType,char *Server,char * Location,int  Duration);
 int ServiceReply(struct sockaddr_in *DestAddr, char *ServType,char * Usn,char *Server,char * Location,int  Duration);
 int ServiceShutdown( char *Udn,char *ServType,char *Server,char * Location,int  Duration);
+SsdpAdvTable * CreateAdvTable(char *Location);
+int AdvTableAddDevice(SsdpAdvTable *Table, char *DevType, int RootDev, char *Udn);
+int AdvTableAddService(SsdpAdvTable *Table, char *Udn, char *ServType);
+int AdvTableSend(SsdpAdvTable *Table, int AdFlag, enum SsdpSearchType SearchType, struct sockaddr_in *DestAddr, char *DeviceType, char *DeviceUDN, char *ServiceType, int Duration);
+void HoldAdvTable(SsdpAdvTable *Table);
+void ReleaseAdvTable(SsdpAdvTable *Table);
+void FreeAdvTable(SsdpAdvTable *Table);
 
 // GENA 
 char LOCAL_HOST[LINE_SIZE];
@@ -41,6 +41,7 @@
 #include "../inc/genlib/miniserver/miniserver.h"
 #include "../inc/interface.h"
 #include "../inc/genlib/http_client/http_client.h"
+#include "../inc/genlib/util/membuffer.h"
 #include "../../inc/upnp.h"
 #include <sys/utsname.h>
 
@@ -48,12 +49,10 @@
 #define MIN_LEN 25
 #define TIMEOUT 10
 #define XML_HEADER 300
+#define SOAP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\nCONTENT-LENGTH: 0\r\n\r\n"
 
 
 
-int CreateControlResponse(char * OutBuf, char * ActionNameRes);
-
-
 char* itoa( int Value, char* string, int radix )
 {
 
@@ -69,32 +68,6 @@ char* itoa( int Value, char* string, int radix )
 
 
 
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : void AddResponseHeader(char * First,char * OutBuff, char * XmlBuff)
- // Description : This function creates the complete request packet by adding the HTTP header and xml header.
- //
- // Parameters  : First : Type of response packet.
- //               OutBuff : Final response buffer.
- //               XmlBuff : XML buffer.
- // Return value: None
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-void AddResponseHeader(char * First,char * OutBuff, char * XmlBuff)
-{
-    char Date[40];
-
-    struct utsname sys_info;
-
-    memset(&sys_info,0x00,sizeof(sys_info));
-    uname(&sys_info);
-    
-    currentTmToHttpDate(Date);
-    sprintf(OutBuff,"%sCONTENT-LENGTH:%d\r\n",First,strlen(XmlBuff)+1);
-    sprintf(OutBuff+strlen(OutBuff),"CONTENT-TYPE:text/xml\r\n%sEXT:\r\nSERVER:%s/%s UPnP/1.0 Intel UPnP SDK/1.0\r\n\r\n",Date,sys_info.sysname,sys_info.release);
-    strcat(OutBuff,XmlBuff);
-}
-
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
  // Function    : int GetBufferErrorCode(char *Buffer)
  // Description : Checks the HTTP header error code.
@@ -276,95 +249,110 @@ int GetActionNode(Upnp_Document TempDoc, char *NodeName, Upnp_Document * RespNod
 
 
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int GetVarName(Upnp_Document TempDoc, char * VarName)
- // Description : This function retrieves the requested variable name.
- // Parameters  : TempDoc :  The root DOM node.
- //               VarName :  Output variable name.
- // Return value: 1 if successfull, or -1 if fails.
+ // Function    : int LocalNameIs(const char * Name, int NameLen, const char * Local)
+ // Description : Compares the part of a tag name after its namespace prefix, if any, with a name.
+ // Parameters  : Name : Tag name; not null terminated.
+ //               NameLen : Length of the tag name.
+ //               Local : Name to compare with.
+ // Return value: 1 if they are the same, 0 otherwise.
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int GetVarName(Upnp_Document TempDoc, char * VarName)
+static int LocalNameIs(const char * Name, int NameLen, const char * Local)
 {
+   const char * Colon = (const char *)memchr(Name,':',NameLen);
+   int LocalLen = strlen(Local);
 
-   Upnp_Node EnvpNode;
-   Upnp_Node BodyNode;
-   Upnp_Node StNode;
-   Upnp_Node VarNameNode;
-   Upnp_Node VarNode;
-   Upnp_DOMString StNodeName=NULL;
-   Upnp_DOMString Temp;
-   Upnp_DOMException Err;
-
-
-   // Got the Envelop node here
-   EnvpNode = UpnpDocument_getFirstChild(TempDoc);
-   if(EnvpNode == NULL) return -1;
-
-   // Got Body here
-   BodyNode = UpnpNode_getFirstChild(EnvpNode);
-   if( BodyNode == NULL)
+   if(Colon != NULL)
    {
-       UpnpNode_free(EnvpNode);
-       return -1;
+      NameLen -= Colon+1-Name;
+      Name = Colon+1;
    }
+   return NameLen == LocalLen && memcmp(Name,Local,LocalLen) == 0;
+}
 
-   // Got action node here
-   StNode = UpnpNode_getFirstChild(BodyNode);
-   if( StNode == NULL)
+ // State of GetVarName while the request body is scanned.
+struct VarNameState
+{
+   int Depth;        // Depth of the current element; the Envelope is 1.
+   int InQuery;      // Inside the QueryStateVariable element.
+   int SeenVarName;  // The first child of QueryStateVariable has started.
+   int InVarName;    // Inside that child, the varName element.
+   char * VarName;
+   int Len;
+};
+
+static int VarNameStart(void * Cookie, const char * Name, int NameLen)
+{
+   struct VarNameState * State = (struct VarNameState *)Cookie;
+
+   State->Depth++;
+   if(State->Depth == 3 && !State->InQuery)
    {
-       UpnpNode_free(EnvpNode);
-       UpnpNode_free(BodyNode);
-       return -1;
+      // The action element: Envelope, Body, then QueryStateVariable.
+      State->InQuery = LocalNameIs(Name,NameLen,"QueryStateVariable");
    }
-
-   //Test whether this is the action node
-   StNodeName = UpnpNode_getNodeName(StNode);
-   if( StNodeName == NULL)
+   else if(State->Depth == 4 && State->InQuery && !State->SeenVarName)
    {
-       UpnpNode_free(EnvpNode);
-       UpnpNode_free(BodyNode);
-       UpnpNode_free(StNode);
-       return -1;
+      State->SeenVarName = 1;
+      State->InVarName = 1;
    }
+   return 0;
+}
 
+static int VarNameText(void * Cookie, const char * Text, int TextLen)
+{
+   struct VarNameState * State = (struct VarNameState *)Cookie;
 
-   if(strstr(StNodeName, "QueryStateVariable") == NULL)
+   if(State->InVarName && State->Depth == 4)
    {
-       UpnpNode_free(EnvpNode);
-       UpnpNode_free(BodyNode);
-       UpnpNode_free(StNode);
-       Upnpfree(StNodeName);
-       return -1;
+      if(State->Len + TextLen >= LINE_SIZE) return -1;
+      memcpy(State->VarName+State->Len,Text,TextLen);
+      State->Len += TextLen;
+      State->VarName[State->Len] = '\0';
    }
-   else
-   {
-       Upnpfree(StNodeName);
-       VarNameNode = UpnpNode_getFirstChild(StNode);
-       if( VarNameNode == NULL)
-       {
-          UpnpNode_free(EnvpNode);
-          UpnpNode_free(BodyNode);
-          UpnpNode_free(StNode);
-          return -1;
-       }
+   return 0;
+}
+
+static int VarNameEnd(void * Cookie, const char * Name, int NameLen)
+{
+   struct VarNameState * State = (struct VarNameState *)Cookie;
+
+   if(State->InVarName && State->Depth == 4)
+       return 1; // the name is complete, there is no need to read further
+   if(State->Depth == 3)
+       State->InQuery = 0;
+   State->Depth--;
+   return 0;
+}
 
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int GetVarName(const char * Body, int Len, char * VarName)
+ // Description : This function retrieves the requested variable name from the body of a QueryStateVariable request.
+ //               The body is scanned with UpnpParse_SAX, so no DOM document is built for it.
+ // Parameters  : Body :  The request body; not null terminated.
+ //               Len :  Length of the body.
+ //               VarName :  Output variable name of LINE_SIZE.
+ // Return value: 1 if successfull, 0 if the body is not well formed XML, or -1 if it holds no variable name.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-       VarNode=UpnpNode_getFirstChild(VarNameNode);
-       Temp = UpnpNode_getNodeValue(VarNode,&Err);
-       strcpy( VarName,Temp);
+int GetVarName(const char * Body, int Len, char * VarName)
+{
+   Upnp_SAXHandler Handler = {VarNameStart,NULL,VarNameText,VarNameEnd};
+   struct VarNameState State;
+   int RetVal;
 
-       DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Received query for variable  name %s\n",VarName);)
+   memset(&State,0,sizeof(State));
+   State.VarName = VarName;
+   VarName[0] = '\0';
 
-       Upnpfree(Temp);
-       UpnpNode_free(VarNode);
-       UpnpNode_free(VarNameNode);
-       UpnpNode_free(StNode);
-       UpnpNode_free(EnvpNode);
-       UpnpNode_free(BodyNode);
+   RetVal = UpnpParse_SAX(Body,Len,&Handler,&State);
+   if(RetVal == 1 && State.Len > 0)
+   {
+       DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Received query for variable  name %s\n",VarName);)
        return 1;
    }
-
-
+   if(RetVal == -1 && !State.SeenVarName) return 0;
+   return -1;
 }
 
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -579,7 +567,7 @@ int SoapSendAction( char * ActionURL, char *ServiceType,  Upnp_Document  ActNode
     if(GetHostHeader(ActionURL,Host,Path) != HTTP_SUCCESS)
     return UPNP_E_INVALID_URL;
 
-    sprintf(RqstBuff,"POST %s HTTP/1.0\r\nContent-Type: text/xml\r\nSOAPACTION:\"%s#%s\"\r\nContent-Length: %d\r\nHost: %s\r\n\r\n%s",Path,ServiceType,ActName,strlen(XmlPtr)+1,Host,XmlPtr);
+    sprintf(RqstBuff,"POST %s HTTP/1.1\r\nContent-Type: text/xml\r\nSOAPACTION:\"%s#%s\"\r\nContent-Length: %d\r\nHost: %s\r\n\r\n%s",Path,ServiceType,ActName,strlen(XmlPtr)+1,Host,XmlPtr);
 
     DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"SoapSendAction sending buffer = \n%s\n",RqstBuff);)
 
@@ -648,77 +636,6 @@ int SoapSendAction( char * ActionURL, char *ServiceType,  Upnp_Document  ActNode
 }
 #endif
 
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int CreateControlResponse(char * OutBuf, char * ActBuf)
- // Description : It adds the required HTTP header and XML buffer to create the complete soap action packet.
- //
- // Parameters  : OutBuf : The complete SOAP action request packet including HTTP header and XML.
- //               ActBuf : Action buffer.
- // Return value: 1 if successfull.
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-int CreateControlResponse(char * OutBuf, char * ActBuf)
-{
-  char *XmlBuf;
-
-
-  char S[]="<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>\n";
-  char E[]="</s:Body> </s:Envelope>";
-
-  XmlBuf =(char *) malloc(HEADER_LENGTH+strlen(ActBuf));
-  if(XmlBuf == NULL)
-  {
-     DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
-     return UPNP_E_OUTOF_MEMORY;
-  }
-
-  strcpy(XmlBuf,S);
-  strcat(XmlBuf,ActBuf);
-  strcat(XmlBuf,E);
-  AddResponseHeader("HTTP/1.1 200 OK\r\n",OutBuf,XmlBuf);
-  free(XmlBuf);
-  return 1;
-
-
-}
-
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int CreateControlFailure(char *OutBuf,int ErrCode, char * ErrStr)
- // Description : This function creates a error response packet by adding the error code and error string in the input
- //               parameter.
- //
- // Parameters  : OutBuf : The complete SOAP request packet including HTTP header and XML.
- //               ErrCode :  Error code to be included in the reply message.
- //               ErrSt   :  Error string to be included in the reply message.
- // Return value: 1 if successfull.
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-int CreateControlFailure(char *OutBuf,int ErrCode, char * ErrStr)
-{
-   char *XmlBuf;
-   char S[]="<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><s:Fault><faultcode>s:Client</faultcode><faultstring>UPnPError</faultstring><detail><UPnPError xmlns=\"urn:schemas-upnp-org:control-1-0\"><errorCode>";
-   char E[]="</UPnPError></detail></s:Fault></s:Body></s:Envelope>";
-
-   char T[]="Unknown Error !!!!";
-
-   XmlBuf = (char *) malloc(HEADER_LENGTH+strlen(ErrStr));
-   if(XmlBuf == NULL)
-   {
-      DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
-      return UPNP_E_OUTOF_MEMORY;
-   }
-   if (ErrStr != NULL)
-   sprintf(XmlBuf,"%s%d</errorCode><errorDescription>%s</errorDescription>%s",S,ErrCode,ErrStr,E);
-   else sprintf(XmlBuf,"%s%d</errorCode><errorDescription>%s</errorDescription>%s",S,ErrCode,T,E);
-
-   AddResponseHeader("HTTP/1.1 500 Internal Server Error\r\n",OutBuf,XmlBuf);
-
-   DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"CreateControlFailure: Sending \n %s\n",OutBuf);)
-   return 1;
-}
-
-
-
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
  // Function    :  void  CreateControlQueryMsg(char * OutBuf,  char *VarName)
  // Description :  This function creates a status variable query message.
@@ -743,58 +660,89 @@ void  CreateControlQueryMsg(char * OutBuf,  char *VarName)
 
 
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int CreateControlQueryResponse(char * OutBuf, char *Var)
- // Description : This function creates the response or reply packet for the devices.
- //
- // Parameters  :  OutBuf  : The complete SOAP response packet including HTTP header and XML.
- //                Var     : The value of the variable.
+ // Function    : int SoapGetServiceVarStatus( char * ActionURL, char *VarName, char **VarVal)  //From SOAP module
+ // Description : This function creates a status variable query message send it to the specified URL. It also
+ //               collect the response.
  //
- // Return value: 1 if successfull.
+ // Parameters  :  ActionURL :  Address to send this variable query message.
+ //                VarName   : Name of the variable.
+ //                VarVal    : Output value.
+ // Return value: None
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef INCLUDE_CLIENT_APIS
 
-int CreateControlQueryResponse(char * OutBuf, char *Var)
+ // State of GetBufferNodeValue while the response is scanned.
+struct NodeValueState
 {
+   const char * NodeName;  // Name of the element looked for, without a prefix.
+   int Depth;              // Depth below that element once it has started, or 0.
+   membuffer Value;
+};
 
-  char *  XmlBuf;
+static int NodeValueStart(void * Cookie, const char * Name, int NameLen)
+{
+   struct NodeValueState * State = (struct NodeValueState *)Cookie;
 
-  char S[]="<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><u:QueryStateVariableResponse xmlns:u=\"urn:schemas-upnp-org:control-1-0\"><return>";
-  char E[]="</return> </u:QueryStateVariableResponse> </s:Body> </s:Envelope>";
+   if(State->Depth > 0) State->Depth++;
+   else if(LocalNameIs(Name,NameLen,State->NodeName)) State->Depth = 1;
+   return 0;
+}
 
-  XmlBuf =(char *) malloc(HEADER_LENGTH+strlen(Var));
-  if(XmlBuf == NULL)
-  {
-     DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
-     return UPNP_E_OUTOF_MEMORY;
-  }
+static int NodeValueText(void * Cookie, const char * Text, int TextLen)
+{
+   struct NodeValueState * State = (struct NodeValueState *)Cookie;
 
-  strcpy(XmlBuf,S);
-  strcat(XmlBuf,Var);
-  strcat(XmlBuf,E);
-  AddResponseHeader("HTTP/1.1 200 OK\r\n",OutBuf,XmlBuf);
-  free(XmlBuf);
-  return 1;
+   if(State->Depth == 1 && membuffer_append(&State->Value,Text,TextLen) != 0)
+       return -1;
+   return 0;
 }
 
+static int NodeValueEnd(void * Cookie, const char * Name, int NameLen)
+{
+   struct NodeValueState * State = (struct NodeValueState *)Cookie;
 
-
+   if(State->Depth > 0 && --State->Depth == 0)
+       return 1; // found it, there is no need to read further
+   return 0;
+}
 
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int SoapGetServiceVarStatus( char * ActionURL, char *VarName, char **VarVal)  //From SOAP module
- // Description : This function creates a status variable query message send it to the specified URL. It also
- //               collect the response.
- //
- // Parameters  :  ActionURL :  Address to send this variable query message.
- //                VarName   : Name of the variable.
- //                VarVal    : Output value.
- // Return value: None
+ // Function    : int GetBufferNodeValue(const char * Xml, char * NodeName, char ** VarVal)
+ // Description : Returns the text of the first element with the given tag name in an XML buffer, the same value
+ //               GetNodeValue returns for a parsed document.  The buffer is scanned with UpnpParse_SAX and only up to
+ //               the end of that element, so no DOM document is built for it.
+ // Parameters  : Xml  :  Null terminated XML buffer.
+ //               NodeName: Node name to be searched, without a namespace prefix.
+ //               VarVal : Output node value, allocated with malloc; NULL if the node or its value is missing.
+ // Return value: 1 if the node was found, 0 if it was not, or -1 if the XML is not well formed.
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef INCLUDE_CLIENT_APIS
+static int GetBufferNodeValue(const char * Xml, char * NodeName, char ** VarVal)
+{
+   Upnp_SAXHandler Handler = {NodeValueStart,NULL,NodeValueText,NodeValueEnd};
+   struct NodeValueState State;
+   int RetVal;
+
+   State.NodeName = NodeName;
+   State.Depth = 0;
+   membuffer_init(&State.Value);
+
+   RetVal = UpnpParse_SAX(Xml,-1,&Handler,&State);
+   if(RetVal != 1)
+   {
+      membuffer_destroy(&State.Value);
+      *VarVal = NULL;
+      return RetVal == 0 ? 0 : -1;
+   }
+   *VarVal = membuffer_detach(&State.Value);
+   DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Fn :GetBufferNodeValue : Return value is = %s\n", *VarVal ? *VarVal : "(null)");)
+   return 1;
+}
+
 int SoapGetServiceVarStatus( char * ActionURL, char *VarName, char **VarVal)  //From SOAP module
 {
 
     char *InBuff, LenBuf[7],*Xml,*RecvBuff,*XmlPtr,*Val;
     int RetVal,Buf_Len;
-    Upnp_Document XmlDoc;
 
     Buf_Len =  HEADER_LENGTH+strlen(VarName);
 
@@ -834,34 +782,35 @@ int SoapGetServiceVarStatus( char * ActionURL, char *VarName, char **VarVal)  //
        else Xml = Xml+4;
 
 
-       XmlDoc=UpnpParse_Buffer(Xml);
-       if(XmlDoc == NULL)
-       {
-          free(RecvBuff);
-          free(InBuff);
-          return UPNP_E_INVALID_DESC;
-       }
-
        if ((RetVal=GetBufferErrorCode(RecvBuff)) > 0)
        {
-           GetNodeValue(XmlDoc,"return",&Val);
+           if(GetBufferNodeValue(Xml,"return",&Val) < 0)
+           {
+              free(RecvBuff);
+              free(InBuff);
+              return UPNP_E_INVALID_DESC;
+           }
            *VarVal = Val;
            RetVal = UPNP_E_SUCCESS;
 
        }
        else
        {
-		   
-           GetNodeValue(XmlDoc,"errorCode",&Val);
+           if(GetBufferNodeValue(Xml,"errorCode",&Val) < 0 || Val == NULL)
+           {
+              Upnpfree(Val);
+              free(RecvBuff);
+              free(InBuff);
+              return UPNP_E_INVALID_DESC;
+           }
            RetVal = atoi(Val);
            Upnpfree(Val);
-           GetNodeValue(XmlDoc,"errorDescription",&Val);
+           GetBufferNodeValue(Xml,"errorDescription",&Val);
            *VarVal = Val;
        }
    
        free(InBuff);
        free(RecvBuff);
-       UpnpDocument_free(XmlDoc);
 
     }
     else if(RecvBuff != NULL)
@@ -884,37 +833,6 @@ int SoapGetServiceVarStatus( char * ActionURL, char *VarName, char **VarVal)  //
 }
 #endif
 
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int GetCtrlUrl(char * InBuf, char * Url)
- // Description : This function retrieves the control URL from the HTTP message.
- //
- // Parameters  :  InBuf : The complete HTTP buffer.
- //                Url : Control URL.
- //
- // Return value: None
- //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-int GetCtrlUrl(char * InBuf, char * Url)
-{
-  char * Sptr,*Eptr,i=0;
-
-  Sptr = (char*)strstrcase(InBuf,"POST");
-  if(Sptr != NULL ) Sptr = Sptr + 4;
-  else return -1;
-
-  Eptr = (char*)strstrcase(InBuf,"HTTP");
-  if(Eptr != NULL) Eptr = Eptr -1;
-  else return -1;
-  
-  while(++Sptr != Eptr)
-  *(Url+i++) = *Sptr;
-
-  *(Url+i++) = '\0';
-
-  return 1;
-}
-
-
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
  // Function    : int GetDeviceInfo(char *CtrlUrl,char *DevUDN, char *ServiceID, Upnp_FunPtr *Fun)
  // Description : This function returns all the information related with service.
@@ -938,7 +856,7 @@ int GetDeviceInfo(char *CtrlUrl,char *DevUDN, char *ServiceID, Upnp_FunPtr *Fun,
     strcpy(ServiceID, "");
     *Fun=NULL;
     
-    HandleLock();
+    HandleReadLock();
     
     // Write the code to find all the the data related with service
 
@@ -979,246 +897,366 @@ int GetDeviceInfo(char *CtrlUrl,char *DevUDN, char *ServiceID, Upnp_FunPtr *Fun,
 
 
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
- // Function    : int ProcessSoapEventPacket( char * InData, int Socket)
+ // Response buffers of the SOAP server.  A buffer is taken from the pool for each reply and given back afterwards,
+ // so a busy device does not allocate and free a reply buffer for every action.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef INCLUDE_DEVICE_APIS
+
+#define SOAP_BUFFER_POOL MAX_THREADS
+// buffers that grew beyond this are freed instead of kept
+#define SOAP_BUFFER_KEEP 65536
+
+static membuffer * SoapBufferPool[SOAP_BUFFER_POOL];
+static int SoapBufferCount = 0;
+static pthread_mutex_t SoapBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// SERVER header of every reply; set up by InitSoap
+static char SoapServerHeader[LINE_SIZE];
+
+static membuffer * GetSoapBuffer()
+{
+    membuffer *Buf = NULL;
+
+    pthread_mutex_lock(&SoapBufferMutex);
+    if(SoapBufferCount > 0) Buf = SoapBufferPool[--SoapBufferCount];
+    pthread_mutex_unlock(&SoapBufferMutex);
+
+    if(Buf == NULL)
+    {
+        Buf = (membuffer *) malloc(sizeof(membuffer));
+        if(Buf == NULL) return NULL;
+        membuffer_init(Buf);
+        Buf->size_inc = HEADER_LENGTH;
+    }
+    return Buf;
+}
+
+static void ReleaseSoapBuffer(membuffer *Buf)
+{
+    membuffer_reset(Buf);
+
+    pthread_mutex_lock(&SoapBufferMutex);
+    if(Buf->capacity <= SOAP_BUFFER_KEEP && SoapBufferCount < SOAP_BUFFER_POOL)
+    {
+        SoapBufferPool[SoapBufferCount++] = Buf;
+        Buf = NULL;
+    }
+    pthread_mutex_unlock(&SoapBufferMutex);
+
+    if(Buf != NULL)
+    {
+        membuffer_destroy(Buf);
+        free(Buf);
+    }
+}
+
+
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int SendSoapResponse(int Socket, char *First, membuffer *XmlBuf)
+ // Description : This function sends a reply: the HTTP header is built on the stack and sent together with the XML
+ //               in one write, so the XML is not copied.
+ //
+ // Parameters  : Socket : Socket to send the reply.
+ //               First : Status line of the reply.
+ //               XmlBuf : XML of the reply.
+ // Return value: 1 if successful, -1 otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int SendSoapResponse(int Socket, char *First, membuffer *XmlBuf)
+{
+    char Header[HEADER_LENGTH];
+    char Date[40];
+    struct iovec Parts[2];
+    int HeaderLen;
+
+    currentTmToHttpDate(Date);
+    HeaderLen = sprintf(Header,"%sCONTENT-LENGTH:%d\r\nCONTENT-TYPE:text/xml\r\n%sEXT:\r\n%s\r\n",
+                        First,(int)XmlBuf->length+1,Date,SoapServerHeader);
+
+    DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Sending response \n%s%s\n",Header,XmlBuf->buf);)
+
+    // the XML goes out with its null terminator, as it always has
+    Parts[0].iov_base = Header;
+    Parts[0].iov_len = HeaderLen;
+    Parts[1].iov_base = XmlBuf->buf;
+    Parts[1].iov_len = XmlBuf->length+1;
+
+    if(write_vector(Socket,Parts,2,TIMEOUT) == (size_t)-1) return -1;
+    return 1;
+}
+
+
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int SendControlReply(int Socket, char *First, char *Start, char *Value, char *End)
+ // Description : This function sends a reply whose XML is Start, Value and End.
+ //
+ // Parameters  : Socket : Socket to send the reply.
+ //               First : Status line of the reply.
+ //               Start, Value, End : Parts of the XML.
+ // Return value: 1 if successful, -1 or UPNP_E_OUTOF_MEMORY otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int SendControlReply(int Socket, char *First, char *Start, char *Value, char *End)
+{
+    membuffer *XmlBuf;
+    int RetVal = UPNP_E_OUTOF_MEMORY;
+
+    if((XmlBuf = GetSoapBuffer()) == NULL)
+    {
+        DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
+        return UPNP_E_OUTOF_MEMORY;
+    }
+
+    if(membuffer_append_str(XmlBuf,Start) == 0 &&
+       membuffer_append_str(XmlBuf,Value) == 0 &&
+       membuffer_append_str(XmlBuf,End) == 0)
+        RetVal = SendSoapResponse(Socket,First,XmlBuf);
+
+    ReleaseSoapBuffer(XmlBuf);
+    return RetVal;
+}
+
+static int SendControlResponse(int Socket, char *ActBuf)
+{
+    return SendControlReply(Socket,"HTTP/1.1 200 OK\r\n",
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>\n",
+        ActBuf,"</s:Body> </s:Envelope>");
+}
+
+static int SendControlQueryResponse(int Socket, char *Var)
+{
+    return SendControlReply(Socket,"HTTP/1.1 200 OK\r\n",
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><u:QueryStateVariableResponse xmlns:u=\"urn:schemas-upnp-org:control-1-0\"><return>",
+        Var,"</return> </u:QueryStateVariableResponse> </s:Body> </s:Envelope>");
+}
+
+static int SendControlFailure(int Socket, int ErrCode, char *ErrStr)
+{
+    char End[HEADER_LENGTH];
+
+    snprintf(End,sizeof(End),"%d</errorCode><errorDescription>%s</errorDescription></UPnPError></detail></s:Fault></s:Body></s:Envelope>",
+             ErrCode,ErrStr != NULL ? ErrStr : "Unknown Error !!!!");
+
+    return SendControlReply(Socket,"HTTP/1.1 500 Internal Server Error\r\n",
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><s:Fault><faultcode>s:Client</faultcode><faultstring>UPnPError</faultstring><detail><UPnPError xmlns=\"urn:schemas-upnp-org:control-1-0\"><errorCode>",
+        "",End);
+}
+
+
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int GetSoapActionName(const char * SoapAction, int Len, char * Name)
+ // Description : Retrieves the action name from the value of the SOAPACTION header, "serviceType#actionName".
+ //
+ // Parameters  : SoapAction : Value of the header; not null terminated.
+ //               Len : Length of the value.
+ //               Name : Output action name string of NAME_SIZE.
+ // Return value: 1 if successful, -1 otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int GetSoapActionName(const char * SoapAction, int Len, char * Name)
+{
+    const char *Ptr;
+    int Index = 0;
+
+    if(SoapAction == NULL) return -1;
+
+    Ptr = (const char *)memchr(SoapAction,'#',Len);
+    if(Ptr == NULL) return -1;
+
+    for(++Ptr; Ptr < SoapAction+Len && isalnum(*Ptr) && Index < NAME_SIZE-1; ++Ptr)
+        Name[Index++] = *Ptr;
+    Name[Index] = '\0';
+
+    return Index > 0 ? 1 : -1;
+}
+
+
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : void ProcessSoapEventPacket(const MiniServerRequest * Request, int Socket)
  // Description : This function serves all the request that come from the client, like GetVatStatus or execute action.
+ //               The control URL, the SOAPACTION header and the body were found by the miniserver while it read the
+ //               request, so the request is not scanned again here.
  //
- // Parameters  : InData : The input request packet that include HTTP header and XML.
+ // Parameters  : Request : The parsed request.
  //               Socket : Socket to send the reply.
- // Return value: 1 if successful.
+ // Return value: None
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef INCLUDE_DEVICE_APIS
+
 // All the response function will be called from here.
-int ProcessSoapEventPacket( char * InData, int Socket)
+void ProcessSoapEventPacket(const MiniServerRequest * Request, int Socket)
 {
-    char *InStr,*RespStr;
-    int BuffLen;
-    char ActName[NAME_SIZE],CtrlUrl[LINE_SIZE];
-    char None[] ="NULL",*Xml;
+    char *RespStr;
+    char ActName[NAME_SIZE],CtrlUrl[LINE_SIZE],VarName[LINE_SIZE];
+    char None[] ="NULL";
     Upnp_Document RespNode;
     Upnp_Document XmlDoc;
     struct Upnp_Action_Request *ActParam; // Event to be sent to client callback fn.
     struct Upnp_State_Var_Request *VarParam;
     void * Cookie=NULL;
     Upnp_FunPtr  SoapEventCallback;
+    int RetVal;
 
-    Xml= strstr(InData,"\r\n\r\n");
-    if(Xml == NULL)
-    {
-       UpnpCloseSocket(Socket);
-       return -1;
-    }
-    else Xml = Xml+4;
-    XmlDoc=UpnpParse_Buffer(Xml);
-    if(XmlDoc == NULL)
+    DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Soap server received packet \n %s\n",Request->document);)
+
+    if(Request->uriLen <= 0 || Request->uriLen >= LINE_SIZE)
     {
+       SendControlFailure(Socket,UPNP_E_INVALID_URL,"Invalid control URL !!!!!");
        UpnpCloseSocket(Socket);
-       return -1;
+       return;
     }
+    memcpy(CtrlUrl,Request->uri,Request->uriLen);
+    CtrlUrl[Request->uriLen] = '\0';
 
-    DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Soap server received packet \n %s\n",InData);)
-
-    BuffLen = strlen(InData)+1;
-    if(BuffLen < HEADER_LENGTH)BuffLen = HEADER_LENGTH ;
-
-    InStr  = (char*) malloc(BuffLen);
-    if(InStr == NULL)
+    if(GetSoapActionName(Request->soapAction,Request->soapActionLen,ActName) < 0)
     {
-        DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
+        DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Couldn't find action name in the header\n");)
+
+        SendControlFailure(Socket,UPNP_E_INVALID_ACTION,"Invalid action name!!!!!");
         UpnpCloseSocket(Socket);
-        UpnpDocument_free(XmlDoc);
-        return UPNP_E_OUTOF_MEMORY;
+        return;
     }
 
-
-    if(GetCtrlUrl(InData,CtrlUrl)  > 0 )
+    if(strcmp(ActName,"QueryStateVariable") != 0) //This soap action
     {
+        DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Found action name  = %s\n", ActName);)
 
-        if((char*)strstrcase(InData,"QueryStateVariable") == NULL) //This soap action
+        // The application gets the action as a DOM document, so only actions are parsed into one
+        XmlDoc=UpnpParse_BufferLen((char *)Request->body,Request->bodyLen);
+        if(XmlDoc == NULL)
         {
+           write_bytes(Socket,SOAP_BAD_REQUEST,strlen(SOAP_BAD_REQUEST),TIMEOUT);
+           UpnpCloseSocket(Socket);
+           return;
+        }
 
-             if(GetActionName(InData,ActName)< 0)
-             {
-                 DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Couldn't find action name in the header\n");)
-
-                 CreateControlFailure(InStr,UPNP_E_INVALID_ACTION,"Invalid action name!!!!!");
-                 write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                 UpnpCloseSocket(Socket);
-                 free(InStr);
-                 UpnpDocument_free(XmlDoc);
-                 return -1;
-             }
-
-             DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Found action name  = %s\n", ActName);)
-
-             if( GetActionNode(XmlDoc, ActName, &RespNode) < 0)
-             {
-
-                 DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Couldn't find action buffer returning error code\n"));
-                 CreateControlFailure(InStr,UPNP_E_INVALID_ACTION,"Invalid control URL!!!!!");
-                 write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                 UpnpCloseSocket(Socket);
-                 free(InStr);
-                 UpnpDocument_free(XmlDoc);
-                 return -1;
-             }
-
-             //UpnpPrintDocument(RespNode, InStr);
-             //printf("Action buffer =%s\n",InStr);
-             DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Calling Callback\n"));
-
-
-             ActParam = (struct Upnp_Action_Request *) malloc (sizeof(struct Upnp_Action_Request));
-             if(GetDeviceInfo(CtrlUrl,ActParam->DevUDN, ActParam->ServiceID,&SoapEventCallback,&Cookie)< 0)
-             {
-                  DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Inside Calling GetDeviceInfo\n"));
-
-                  CreateControlFailure(InStr,UPNP_E_INVALID_ACTION,"Invalid control URL!!!!!");
-                  write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                  UpnpDocument_free(XmlDoc);
-                  UpnpDocument_free(RespNode);
-                  free(InStr);
-                  free(ActParam);
-                  UpnpCloseSocket(Socket);
-                  return -1;
-             }
-
-             strcpy(ActParam->ActionName,ActName);
-             strcpy(ActParam->ErrStr,"");
-             ActParam->ActionRequest=RespNode;
-             ActParam->ActionResult=NULL;
-             ActParam->ErrCode = UPNP_E_SUCCESS;
-             SoapEventCallback(UPNP_CONTROL_ACTION_REQUEST,ActParam,Cookie);
-             if(ActParam->ErrCode == UPNP_E_SUCCESS && ActParam->ActionResult != NULL)
-             {
-                 RespStr = UpnpNewPrintDocument(ActParam->ActionResult);
-                 if(RespStr == NULL)
-                 {
-                     UpnpDocument_free(XmlDoc);
-                     UpnpDocument_free(RespNode);
-                     free(InStr);
-                     free(ActParam);
-                     UpnpCloseSocket(Socket);
-                     return -1;
-                 }
-
-                 if(RespStr != NULL && (int)strlen(RespStr) > abs(BuffLen-HEADER_LENGTH))
-                 {
-                    free(InStr);
-                    InStr  = (char*) malloc(strlen(RespStr)+HEADER_LENGTH);
-                 }
-
-                 CreateControlResponse(InStr,RespStr);
-                 DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Sending response \n%s\n",InStr);)
-
-                 write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                 UpnpDocument_free(ActParam->ActionResult);
-                 free(RespStr);
-             }
-             else if (strlen(ActParam->ErrStr) > 1)
-             {
-                  CreateControlFailure(InStr,ActParam->ErrCode,ActParam->ErrStr);
-                  write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-             }
-             else
-             {
-                  CreateControlFailure(InStr,ActParam->ErrCode,"Invalid Request!!!!!");
-                  write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-
-             }
-
-             UpnpDocument_free(XmlDoc);
-             UpnpDocument_free(RespNode);
-             free(InStr);
-             free(ActParam);
-             UpnpCloseSocket(Socket);
+        if( GetActionNode(XmlDoc, ActName, &RespNode) < 0)
+        {
+            DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Couldn't find action buffer returning error code\n"));
+            SendControlFailure(Socket,UPNP_E_INVALID_ACTION,"Invalid control URL!!!!!");
+            UpnpCloseSocket(Socket);
+            UpnpDocument_free(XmlDoc);
+            return;
         }
-        else
+
+        DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Calling Callback\n"));
+
+        ActParam = (struct Upnp_Action_Request *) malloc (sizeof(struct Upnp_Action_Request));
+        if(ActParam == NULL)
         {
+            DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
+            UpnpDocument_free(XmlDoc);
+            UpnpDocument_free(RespNode);
+            UpnpCloseSocket(Socket);
+            return;
+        }
+
+        if(GetDeviceInfo(CtrlUrl,ActParam->DevUDN, ActParam->ServiceID,&SoapEventCallback,&Cookie)< 0)
+        {
+            DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Inside Calling GetDeviceInfo\n"));
+
+            SendControlFailure(Socket,UPNP_E_INVALID_ACTION,"Invalid control URL!!!!!");
+            UpnpDocument_free(XmlDoc);
+            UpnpDocument_free(RespNode);
+            free(ActParam);
+            UpnpCloseSocket(Socket);
+            return;
+        }
 
-            if(GetVarName(XmlDoc,InStr) < 0)
+        strcpy(ActParam->ActionName,ActName);
+        strcpy(ActParam->ErrStr,"");
+        ActParam->ActionRequest=RespNode;
+        ActParam->ActionResult=NULL;
+        ActParam->ErrCode = UPNP_E_SUCCESS;
+        SoapEventCallback(UPNP_CONTROL_ACTION_REQUEST,ActParam,Cookie);
+        if(ActParam->ErrCode == UPNP_E_SUCCESS && ActParam->ActionResult != NULL)
+        {
+            RespStr = UpnpNewPrintDocument(ActParam->ActionResult);
+            if(RespStr != NULL)
             {
-               DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Received  error in query for var %s\n",InStr);)
-
-               CreateControlFailure(InStr,UPNP_E_INVALID_URL,"Invalid XML!!!!!");
-               write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-               UpnpCloseSocket(Socket);
-               free(InStr);
-               UpnpDocument_free(XmlDoc);
-               return -1;
+                SendControlResponse(Socket,RespStr);
+                free(RespStr);
             }
+            UpnpDocument_free(ActParam->ActionResult);
+        }
+        else if (strlen(ActParam->ErrStr) > 1)
+        {
+            SendControlFailure(Socket,ActParam->ErrCode,ActParam->ErrStr);
+        }
+        else
+        {
+            SendControlFailure(Socket,ActParam->ErrCode,"Invalid Request!!!!!");
+        }
 
+        UpnpDocument_free(XmlDoc);
+        UpnpDocument_free(RespNode);
+        free(ActParam);
+        UpnpCloseSocket(Socket);
+    }
+    else
+    {
+        RetVal = GetVarName(Request->body,Request->bodyLen,VarName);
+        if(RetVal == 0)
+        {
+            write_bytes(Socket,SOAP_BAD_REQUEST,strlen(SOAP_BAD_REQUEST),TIMEOUT);
+            UpnpCloseSocket(Socket);
+            return;
+        }
+        if(RetVal < 0)
+        {
+            DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Received  error in query for var\n");)
 
- 
-            DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Received query for var = %s\n", InStr);)
+            SendControlFailure(Socket,UPNP_E_INVALID_URL,"Invalid XML!!!!!");
+            UpnpCloseSocket(Socket);
+            return;
+        }
 
-            VarParam = (struct Upnp_State_Var_Request *) malloc (sizeof(struct Upnp_State_Var_Request));
-            if(GetDeviceInfo(CtrlUrl,VarParam->DevUDN, VarParam->ServiceID,&SoapEventCallback,&Cookie)< 0)
-            {
+        DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Received query for var = %s\n", VarName);)
 
-                  CreateControlFailure(InStr,UPNP_E_INVALID_URL,"Invalid control URL!!!!!");
-                  write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                  free(InStr);
-                  free(VarParam);
-                  UpnpDocument_free(XmlDoc);
-                  UpnpCloseSocket(Socket);
-                  return -1;
-            }
+        VarParam = (struct Upnp_State_Var_Request *) malloc (sizeof(struct Upnp_State_Var_Request));
+        if(VarParam == NULL)
+        {
+            DBGONLY(UpnpPrintf(UPNP_CRITICAL,SOAP,__FILE__,__LINE__,"Error in memory allocation!!!!!!!!!!!\n");)
+            UpnpCloseSocket(Socket);
+            return;
+        }
 
-            strcpy(VarParam->ErrStr,"");
-            VarParam->ErrCode = UPNP_E_SUCCESS;
-            VarParam->CurrentVal = NULL;
-            strcpy(VarParam->StateVarName, InStr);
-            SoapEventCallback(UPNP_CONTROL_GET_VAR_REQUEST,VarParam,Cookie);
+        if(GetDeviceInfo(CtrlUrl,VarParam->DevUDN, VarParam->ServiceID,&SoapEventCallback,&Cookie)< 0)
+        {
+            SendControlFailure(Socket,UPNP_E_INVALID_URL,"Invalid control URL!!!!!");
+            free(VarParam);
+            UpnpCloseSocket(Socket);
+            return;
+        }
 
-            DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Return from callback for var request\n"));
+        strcpy(VarParam->ErrStr,"");
+        VarParam->ErrCode = UPNP_E_SUCCESS;
+        VarParam->CurrentVal = NULL;
+        strcpy(VarParam->StateVarName, VarName);
+        SoapEventCallback(UPNP_CONTROL_GET_VAR_REQUEST,VarParam,Cookie);
 
-            if(VarParam->ErrCode == UPNP_E_SUCCESS)
+        DBGONLY(UpnpPrintf(UPNP_INFO,SOAP,__FILE__,__LINE__,"Return from callback for var request\n"));
+
+        if(VarParam->ErrCode == UPNP_E_SUCCESS)
+        {
+            if(VarParam->CurrentVal != NULL)
             {
-                if(VarParam->CurrentVal != NULL)
-                {
-                    if((int)strlen(VarParam->CurrentVal) > abs(BuffLen-HEADER_LENGTH))
-                    {
-                       free(InStr);
-                       InStr  = (char*) malloc(strlen(VarParam->CurrentVal)+HEADER_LENGTH);
-                    }
-
-                    CreateControlQueryResponse(InStr,VarParam->CurrentVal);
-
-                    DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Soap  server sending packet \n %s\n",InStr);)
-
-
-                    write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                    free(VarParam->CurrentVal);
-                 }
-                 else
-                 {
-                     CreateControlQueryResponse(InStr,None);
-                     DBGONLY(UpnpPrintf(UPNP_PACKET,SOAP,__FILE__,__LINE__,"Soap  server sending packet \n %s\n",InStr);)
-                     write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-                 }
-             }
-             else
-             {   if (strlen(VarParam->ErrStr) >1 ) CreateControlFailure(InStr,VarParam->ErrCode,VarParam->ErrStr);
-                 else CreateControlFailure(InStr,VarParam->ErrCode,"Unknown Error !!!!!!!!!!!");
-                 write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-             }
-             free(InStr);
-             free(VarParam);
-             UpnpDocument_free(XmlDoc);
-             UpnpCloseSocket(Socket);
-             return -1;
-          }
-    }
-    else
-    {
-           CreateControlFailure(InStr,UPNP_E_INVALID_URL,"Invalid control URL !!!!!");
-           write_bytes(Socket,InStr,strlen(InStr)+1,TIMEOUT);
-           free(InStr);
-           UpnpDocument_free(XmlDoc);
-           UpnpCloseSocket(Socket);
+                SendControlQueryResponse(Socket,VarParam->CurrentVal);
+                free(VarParam->CurrentVal);
+            }
+            else SendControlQueryResponse(Socket,None);
+        }
+        else
+        {
+            if (strlen(VarParam->ErrStr) >1 ) SendControlFailure(Socket,VarParam->ErrCode,VarParam->ErrStr);
+            else SendControlFailure(Socket,VarParam->ErrCode,"Unknown Error !!!!!!!!!!!");
+        }
+        free(VarParam);
+        UpnpCloseSocket(Socket);
     }
-
-    return 1;
 }
 #endif
  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1233,7 +1271,13 @@ int ProcessSoapEventPacket( char * InData, int Socket)
 int InitSoap()
 {
    #ifdef INCLUDE_DEVICE_APIS
-   SetSoapCallback((MiniServerCallback)ProcessSoapEventPacket);
+   struct utsname sys_info;
+
+   memset(&sys_info,0x00,sizeof(sys_info));
+   uname(&sys_info);
+   snprintf(SoapServerHeader,sizeof(SoapServerHeader),"SERVER:%s/%s UPnP/1.0 Intel UPnP SDK/1.0\r\n",sys_info.sysname,sys_info.release);
+
+   SetSoapCallback(ProcessSoapEventPacket);
    #endif
    return UPNP_E_SUCCESS;
 }
@@ -228,7 +228,7 @@ end:
      }
 
      PutThreadData(ThData,EventBuf,DestAddr,0);
-     tpool_Schedule((ScheduleFunc)TransferResEvent,ThData);
+     tpool_ScheduleWithPriority(TPOOL_DISCOVERY,(ScheduleFunc)TransferResEvent,ThData);
      return 1;
 
  }
@@ -649,7 +649,7 @@ end:
     if (ThData == NULL) return UPNP_E_OUTOF_MEMORY;
     PutThreadData(ThData,ReqBuf, NULL, Mx);
     ThData->Cookie = Cookie;
-    tpool_Schedule((ScheduleFunc)RequestHandler,ThData);
+    tpool_ScheduleWithPriority(TPOOL_DISCOVERY,(ScheduleFunc)RequestHandler,ThData);
 
     free(ReqBuf);
     return 1;
@@ -1340,5 +1340,332 @@ end:
 
 }
 
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : SsdpAdvTable * CreateAdvTable(char * Location)
+ // Description : This function creates an empty advertisement table for a root device.  The table holds every NT/ST
+ //               and USN pair the device answers for, with the constant part of each packet already rendered, so
+ //               that advertisements and search replies do not have to walk the description document.
+ // Parameters  : Location : Location of the device description document.
+ //
+ // Return value: New table with a reference count of one, NULL if out of memory.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ SsdpAdvTable * CreateAdvTable(char * Location)
+ {
+    SsdpAdvTable *Table;
+    struct utsname sys_info;
+
+    Table = (SsdpAdvTable *)malloc(sizeof(SsdpAdvTable));
+    if (Table == NULL) return NULL;
+
+    memset(&sys_info,0x00,sizeof(sys_info));
+    uname(&sys_info);
+
+    pthread_mutex_init(&Table->RefMutex,NULL);
+    Table->RefCount = 1;
+    Table->NumEntries = 0;
+    Table->MaxEntries = 0;
+    Table->Entries = NULL;
+    strncpy(Table->Location,Location,LINE_SIZE-1);
+    Table->Location[LINE_SIZE-1] = '\0';
+    snprintf(Table->Server,LINE_SIZE,"%s/%s UPnP/1.0 Intel UPnP SDK/1.0",
+             sys_info.sysname, sys_info.release);
+
+    return Table;
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int AdvTableAppend(SsdpAdvTable *Table, enum SsdpAdvKind Kind, char *Udn, char *Nt, char *Usn)
+ // Description : This function adds one NT/USN pair to the table and renders the parts of its reply, alive and
+ //               byebye packets which do not change between sends.
+ // Parameters  : Table : Advertisement table.
+ //               Kind  : What the entry advertises.
+ //               Udn   : UDN of the owning device.
+ //               Nt    : Notification (or search) target.
+ //               Usn   : Unique service name.
+ // Return value: UPNP_E_SUCCESS if successfull, UPNP_E_OUTOF_MEMORY otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ static int AdvTableAppend(SsdpAdvTable *Table, enum SsdpAdvKind Kind, char *Udn, char *Nt, char *Usn)
+ {
+    SsdpAdvEntry *Entry;
+    SsdpAdvEntry *NewEntries;
+    char *Block;
+    int UdnLen, NtLen, ReplyLen, AliveLen, ByeLen;
+
+    if (Table->NumEntries == Table->MaxEntries)
+    {
+       int NewMax = Table->MaxEntries ? 2*Table->MaxEntries : 16;
+
+       NewEntries = (SsdpAdvEntry *)realloc(Table->Entries, NewMax*sizeof(SsdpAdvEntry));
+       if (NewEntries == NULL) return UPNP_E_OUTOF_MEMORY;
+       Table->Entries = NewEntries;
+       Table->MaxEntries = NewMax;
+    }
+
+    UdnLen = strlen(Udn) + 1;
+    NtLen = strlen(Nt) + 1;
+    ReplyLen = snprintf(NULL,0,"EXT:\r\nLOCATION: %s\r\nSERVER: %s\r\nST: %s\r\nUSN: %s\r\n\r\n",
+                        Table->Location,Table->Server,Nt,Usn) + 1;
+    AliveLen = snprintf(NULL,0,"LOCATION: %s\r\nNT: %s\r\nNTS: ssdp:alive\r\nSERVER: %s\r\nUSN: %s\r\n\r\n",
+                        Table->Location,Nt,Table->Server,Usn) + 1;
+    ByeLen = snprintf(NULL,0,"LOCATION: %s\r\nNT: %s\r\nNTS: ssdp:byebye\r\nUSN: %s\r\n\r\n",
+                      Table->Location,Nt,Usn) + 1;
+
+    // all strings of an entry live in one block, freed with the Udn pointer
+    Block = (char *)malloc(UdnLen + NtLen + ReplyLen + AliveLen + ByeLen);
+    if (Block == NULL) return UPNP_E_OUTOF_MEMORY;
+
+    Entry = &Table->Entries[Table->NumEntries];
+    Entry->Kind = Kind;
+    Entry->Udn = Block;
+    Entry->Nt = Entry->Udn + UdnLen;
+    Entry->ReplyTail = Entry->Nt + NtLen;
+    Entry->AliveTail = Entry->ReplyTail + ReplyLen;
+    Entry->ByeTail = Entry->AliveTail + AliveLen;
+
+    strcpy(Entry->Udn,Udn);
+    strcpy(Entry->Nt,Nt);
+    sprintf(Entry->ReplyTail,"EXT:\r\nLOCATION: %s\r\nSERVER: %s\r\nST: %s\r\nUSN: %s\r\n\r\n",
+            Table->Location,Table->Server,Nt,Usn);
+    sprintf(Entry->AliveTail,"LOCATION: %s\r\nNT: %s\r\nNTS: ssdp:alive\r\nSERVER: %s\r\nUSN: %s\r\n\r\n",
+            Table->Location,Nt,Table->Server,Usn);
+    sprintf(Entry->ByeTail,"LOCATION: %s\r\nNT: %s\r\nNTS: ssdp:byebye\r\nUSN: %s\r\n\r\n",
+            Table->Location,Nt,Usn);
+
+    Table->NumEntries++;
+    return UPNP_E_SUCCESS;
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int AdvTableAddDevice(SsdpAdvTable *Table, char *DevType, int RootDev, char * Udn)
+ // Description : This function adds the entries advertised for a device: upnp:rootdevice (root device only), the
+ //               UDN and the device type, in the same order as DeviceAdvertisement() sends them.
+ // Parameters  : Table : Advertisement table.
+ //               DevType : Device Type.
+ //               RootDev : 1 means root device 0 means embedded device.
+ //               Udn : Device UDN
+ // Return value: UPNP_E_SUCCESS if successfull, UPNP_E_OUTOF_MEMORY otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ int AdvTableAddDevice(SsdpAdvTable *Table, char *DevType, int RootDev, char * Udn)
+ {
+    char Mil_Usn[LINE_SIZE];
+    int RetVal;
+
+    if (RootDev)
+    {
+       snprintf(Mil_Usn,LINE_SIZE,"%s::upnp:rootdevice",Udn);
+       if ((RetVal = AdvTableAppend(Table,SSDP_ADV_ROOTDEVICE,Udn,"upnp:rootdevice",Mil_Usn)) != UPNP_E_SUCCESS)
+          return RetVal;
+    }
+
+    if ((RetVal = AdvTableAppend(Table,SSDP_ADV_UDN,Udn,Udn,Udn)) != UPNP_E_SUCCESS)
+       return RetVal;
+
+    snprintf(Mil_Usn,LINE_SIZE,"%s::%s",Udn,DevType);
+    return AdvTableAppend(Table,SSDP_ADV_DEVTYPE,Udn,DevType,Mil_Usn);
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int AdvTableAddService(SsdpAdvTable *Table, char * Udn, char * ServType)
+ // Description : This function adds the entry advertised for a service of a device.
+ // Parameters  : Table : Advertisement table.
+ //               Udn : Device UDN
+ //               ServType : Service Type.
+ // Return value: UPNP_E_SUCCESS if successfull, UPNP_E_OUTOF_MEMORY otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ int AdvTableAddService(SsdpAdvTable *Table, char * Udn, char * ServType)
+ {
+    char Mil_Usn[LINE_SIZE];
+
+    snprintf(Mil_Usn,LINE_SIZE,"%s::%s",Udn,ServType);
+    return AdvTableAppend(Table,SSDP_ADV_SERVICE,Udn,ServType,Mil_Usn);
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int AdvEntryMatches(SsdpAdvEntry *Entry, enum SsdpSearchType SearchType, char *DeviceType,
+ //                                   char *DeviceUDN, char *ServiceType)
+ // Description : This function decides whether an entry answers a search request.
+ // Parameters  : Entry : Table entry.
+ //               SearchType : Type of the search request.
+ //               DeviceType, DeviceUDN, ServiceType : Search target from the request.
+ // Return value: 1 if the entry should be sent in the reply, 0 otherwise.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ static int AdvEntryMatches(SsdpAdvEntry *Entry, enum SsdpSearchType SearchType, char *DeviceType,
+                            char *DeviceUDN, char *ServiceType)
+ {
+    switch (SearchType)
+    {
+       case SSDP_ALL :
+          return 1;
+
+       case SSDP_ROOTDEVICE :
+          return Entry->Kind == SSDP_ADV_ROOTDEVICE;
+
+       case SSDP_DEVICE :
+          // a search by UDN is answered by UDN alone, otherwise by device type
+          if (DeviceUDN != NULL && strlen(DeviceUDN) != 0)
+             return Entry->Kind == SSDP_ADV_UDN && !strcasecmp(DeviceUDN, Entry->Udn);
+          return Entry->Kind == SSDP_ADV_DEVTYPE && DeviceType != NULL &&
+                 !strcasecmp(DeviceType, Entry->Nt);
+
+       case SSDP_SERVICE :
+          return Entry->Kind == SSDP_ADV_SERVICE && ServiceType != NULL &&
+                 !strcasecmp(ServiceType, Entry->Nt);
+
+       default :
+          return 0;
+    }
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : int AdvTableSend(SsdpAdvTable *Table, int AdFlag, enum SsdpSearchType SearchType,
+ //                                struct sockaddr_in *DestAddr, char *DeviceType, char *DeviceUDN,
+ //                                char *ServiceType, int Duration)
+ // Description : This function sends advertisements, shutdowns or search replies out of a precomputed table.  Only
+ //               the start line, CACHE-CONTROL and DATE headers are rendered here; the rest of every packet is copied
+ //               from the table.
+ // Parameters  : Table : Advertisement table.
+ //               AdFlag : -1 = shutdown, 0 = reply, 1 = advertisement.
+ //               SearchType : Type of the search request (reply only).
+ //               DestAddr : Address of the searching client (reply only).
+ //               DeviceType, DeviceUDN, ServiceType : Search target (reply only).
+ //               Duration : Advertisement age in sec.
+ // Return value: UPNP_E_SUCCESS if successfull.
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ int AdvTableSend(SsdpAdvTable *Table, int AdFlag, enum SsdpSearchType SearchType, struct sockaddr_in *DestAddr,
+                  char *DeviceType, char *DeviceUDN, char *ServiceType, int Duration)
+ {
+    char Head[COMMAND_LEN], Date[40];
+    char **szReq, *Buf, *Tail;
+    struct sockaddr_in McastAddr;
+    int HeadLen, TotalLen, NumPacket, Index, TailLen, RetVal;
+
+    if (AdFlag)
+    {
+       sprintf(Head,"NOTIFY * HTTP/1.1\r\nHOST: %s:%d\r\nCACHE-CONTROL: max-age=%d\r\n",
+               SSDP_IP,SSDP_PORT,Duration);
+
+       McastAddr.sin_family = AF_INET;
+       McastAddr.sin_addr.s_addr = inet_addr(SSDP_IP);
+       McastAddr.sin_port = htons(SSDP_PORT);
+       DestAddr = &McastAddr;
+    }
+    else
+    {
+       currentTmToHttpDate(Date);
+       sprintf(Head,"HTTP/1.1 200 OK\r\nCACHE-CONTROL: max-age=%d\r\n%s",Duration,Date);
+    }
+    HeadLen = strlen(Head);
+
+    // first pass sizes the packets, second pass copies them
+    NumPacket = 0;
+    TotalLen = 0;
+    for (Index = 0; Index < Table->NumEntries; Index++)
+    {
+       if (AdFlag == 0 && !AdvEntryMatches(&Table->Entries[Index],SearchType,DeviceType,DeviceUDN,ServiceType))
+          continue;
+       Tail = AdFlag == 1 ? Table->Entries[Index].AliveTail :
+              AdFlag == -1 ? Table->Entries[Index].ByeTail : Table->Entries[Index].ReplyTail;
+       TotalLen += HeadLen + strlen(Tail) + 1;
+       NumPacket++;
+    }
+
+    if (NumPacket == 0) return UPNP_E_SUCCESS;
+
+    szReq = (char **)malloc(NumPacket*sizeof(char *));
+    Buf = (char *)malloc(TotalLen);
+    if (szReq == NULL || Buf == NULL)
+    {
+       free(szReq);
+       free(Buf);
+       return UPNP_E_OUTOF_MEMORY;
+    }
+
+    NumPacket = 0;
+    for (Index = 0; Index < Table->NumEntries; Index++)
+    {
+       if (AdFlag == 0 && !AdvEntryMatches(&Table->Entries[Index],SearchType,DeviceType,DeviceUDN,ServiceType))
+          continue;
+       Tail = AdFlag == 1 ? Table->Entries[Index].AliveTail :
+              AdFlag == -1 ? Table->Entries[Index].ByeTail : Table->Entries[Index].ReplyTail;
+       TailLen = strlen(Tail);
+
+       szReq[NumPacket++] = Buf;
+       memcpy(Buf,Head,HeadLen);
+       memcpy(Buf+HeadLen,Tail,TailLen+1);
+       Buf += HeadLen + TailLen + 1;
+    }
+
+    RetVal = NewRequestHandler(DestAddr,NumPacket,szReq);
+
+    free(szReq[0]);
+    free(szReq);
+    return RetVal;
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : void HoldAdvTable(SsdpAdvTable *Table)
+ // Description : This function takes a reference on an advertisement table.  The caller must hold the handle lock
+ //               (read or write) while the table is reached through its Handle_Info.
+ // Parameters  : Table : Advertisement table.
+ //
+ // Return value: None
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ void HoldAdvTable(SsdpAdvTable *Table)
+ {
+    pthread_mutex_lock(&Table->RefMutex);
+    Table->RefCount++;
+    pthread_mutex_unlock(&Table->RefMutex);
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : void ReleaseAdvTable(SsdpAdvTable *Table)
+ // Description : This function drops a reference on an advertisement table and frees it with the last one.
+ // Parameters  : Table : Advertisement table, may be NULL.
+ //
+ // Return value: None
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ void ReleaseAdvTable(SsdpAdvTable *Table)
+ {
+    int RefCount;
+
+    if (Table == NULL) return;
+
+    pthread_mutex_lock(&Table->RefMutex);
+    RefCount = --Table->RefCount;
+    pthread_mutex_unlock(&Table->RefMutex);
+
+    if (RefCount == 0)
+       FreeAdvTable(Table);
+ }
+
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ // Function    : void FreeAdvTable(SsdpAdvTable *Table)
+ // Description : This function frees an advertisement table and all of its entries.
+ // Parameters  : Table : Advertisement table, may be NULL.
+ //
+ // Return value: None
+ //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ void FreeAdvTable(SsdpAdvTable *Table)
+ {
+    int Index;
+
+    if (Table == NULL) return;
+
+    for (Index = 0; Index < Table->NumEntries; Index++)
+       free(Table->Entries[Index].Udn);
+    free(Table->Entries);
+    pthread_mutex_destroy(&Table->RefMutex);
+    free(Table);
+ }
+
 #endif
 #endif
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+//	$Revision: 1.1.1.5 $
+//	$Date: 2001/06/15 00:22:16 $
+#include "../../inc/tools/config.h"
+#if EXCLUDE_DOM == 0
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "../../inc/upnpdom/DOMArena.h"
+
+//first block; a typical SOAP action or GENA event fits in it
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN(n) (((n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+
+DOMArena::DOMArena()
+{
+	blocks=NULL;
+	RefCount=1;
+}
+
+DOMArena::~DOMArena()
+{
+	while(blocks!=NULL)
+	{
+		Block *next=blocks->next;
+		free(blocks);
+		blocks=next;
+	}
+}
+
+void* DOMArena::alloc(size_t size)
+{
+	char *p;
+
+	size=ARENA_ALIGN(size);
+	if(blocks==NULL || blocks->size - blocks->used < size)
+	{
+		//each block is at least twice the size of the one before
+		size_t blockSize = blocks==NULL ? ARENA_BLOCK_SIZE : 2*blocks->size;
+		Block *b;
+
+		if(blockSize < size)
+			blockSize=size;
+		b=(Block *)malloc(ARENA_ALIGN(sizeof(Block)) + blockSize);
+		if(b==NULL)
+			throw std::bad_alloc();
+		b->next=blocks;
+		b->size=blockSize;
+		b->used=0;
+		blocks=b;
+	}
+	p=(char *)blocks + ARENA_ALIGN(sizeof(Block)) + blocks->used;
+	blocks->used+=size;
+	return p;
+}
+
+char* DOMArena::copyString(const char *s)
+{
+	size_t len;
+	char *p;
+
+	if(s==NULL)
+		return NULL;
+	len=strlen(s)+1;
+	p=(char *)alloc(len);
+	memcpy(p, s, len);
+	return p;
+}
+
+void DOMArena::addRef()
+{
+	__sync_add_and_fetch(&RefCount, 1);
+}
+
+//nodes moved to another document keep the arena alive, so the
+//reference count may drop to 0 on any thread
+void DOMArena::release()
+{
+	if(__sync_sub_and_fetch(&RefCount, 1)==0)
+		delete this;
+}
+#endif
@@ -0,0 +1,277 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "../../inc/tools/config.h"
+#if EXCLUDE_DOM == 0
+#include "../../inc/upnpdom/DOMCharScan.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <stdint.h>
+#include <immintrin.h>
+#endif
+
+//The vector scans load whole aligned blocks, so they may read past the
+//terminating null, but never into the next page.
+#if defined(__SANITIZE_ADDRESS__)
+#define SCAN_NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define SCAN_NO_ASAN
+#endif
+
+static inline bool is_space(unsigned char c)
+{
+	return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\f';
+}
+
+static inline bool is_plain(unsigned char c)
+{
+	return (c>=0x20 && c<0x80 && c!='&' && c!='<') || c=='\t' || c=='\n' || c=='\r';
+}
+
+static const char *scan_to_char_scalar(const char *s, char c)
+{
+	while (*s && *s!=c)
+		s++;
+	return s;
+}
+
+static const char *scan_past_space_scalar(const char *s)
+{
+	while (is_space(*s))
+		s++;
+	return s;
+}
+
+static const char *scan_plain_chars_scalar(const char *s, const char *end)
+{
+	while (s<end && is_plain(*s))
+		s++;
+	return s;
+}
+
+#ifdef SCAN_X86
+
+//Each scan computes a mask of the bytes of a block at which it stops.
+//The bits of the bytes before s in the first block are shifted out.
+
+static inline unsigned stop_char_sse2(__m128i v, __m128i c)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, c),
+		_mm_cmpeq_epi8(v, _mm_setzero_si128())));
+}
+
+static inline unsigned stop_space_sse2(__m128i v)
+{
+	__m128i sp=_mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\f'))));
+	return ~_mm_movemask_epi8(sp) & 0xFFFF;
+}
+
+static inline unsigned stop_plain_sse2(__m128i v)
+{
+	//bytes below 0x20 compared as signed also catch 0x80 and above
+	__m128i ctl=_mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+	__m128i ok=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(ok, ctl),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<')))));
+}
+
+#define SCAN_BLOCKS_SSE2(s, STOP) \
+	unsigned off=(uintptr_t)(s) & 15; \
+	const __m128i *p=(const __m128i *)((s)-off); \
+	unsigned mask=(STOP(_mm_load_si128(p)))>>off; \
+	if (mask) \
+		return (s)+__builtin_ctz(mask); \
+	for (;;) { \
+		p++; \
+		if ((mask=STOP(_mm_load_si128(p)))!=0) \
+			return (const char *)p+__builtin_ctz(mask); \
+	}
+
+//As SCAN_BLOCKS_SSE2, but gives up at end; blocks starting at or after
+//end are not loaded.
+#define SCAN_BLOCKS_TO_SSE2(s, end, STOP) \
+	unsigned off=(uintptr_t)(s) & 15; \
+	const char *b=(s)-off; \
+	const char *q=(s); \
+	unsigned mask=(STOP(_mm_load_si128((const __m128i *)b)))>>off; \
+	for (;;) { \
+		if (mask) { \
+			q+=__builtin_ctz(mask); \
+			return q<(end) ? q : (end); \
+		} \
+		b+=16; \
+		if (b>=(end)) \
+			return (end); \
+		mask=STOP(_mm_load_si128((const __m128i *)b)); \
+		q=b; \
+	}
+
+SCAN_NO_ASAN static const char *scan_to_char_sse2(const char *s, char c)
+{
+	__m128i vc=_mm_set1_epi8(c);
+#define STOP(v) stop_char_sse2(v, vc)
+	SCAN_BLOCKS_SSE2(s, STOP)
+#undef STOP
+}
+
+SCAN_NO_ASAN static const char *scan_past_space_sse2(const char *s)
+{
+	SCAN_BLOCKS_SSE2(s, stop_space_sse2)
+}
+
+SCAN_NO_ASAN static const char *scan_plain_chars_sse2(const char *s, const char *end)
+{
+	SCAN_BLOCKS_TO_SSE2(s, end, stop_plain_sse2)
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline unsigned stop_char_avx2(__m256i v, __m256i c)
+{
+	return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, c),
+		_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+}
+
+AVX2 static inline unsigned stop_space_avx2(__m256i v)
+{
+	__m256i sp=_mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+		_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f'))));
+	return ~(unsigned)_mm256_movemask_epi8(sp);
+}
+
+AVX2 static inline unsigned stop_plain_avx2(__m256i v)
+{
+	__m256i ctl=_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v);
+	__m256i ok=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+		_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_andnot_si256(ok, ctl),
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')))));
+}
+
+#define SCAN_BLOCKS_AVX2(s, STOP) \
+	unsigned off=(uintptr_t)(s) & 31; \
+	const __m256i *p=(const __m256i *)((s)-off); \
+	unsigned mask=(STOP(_mm256_load_si256(p)))>>off; \
+	if (mask) \
+		return (s)+__builtin_ctz(mask); \
+	for (;;) { \
+		p++; \
+		if ((mask=STOP(_mm256_load_si256(p)))!=0) \
+			return (const char *)p+__builtin_ctz(mask); \
+	}
+
+#define SCAN_BLOCKS_TO_AVX2(s, end, STOP) \
+	unsigned off=(uintptr_t)(s) & 31; \
+	const char *b=(s)-off; \
+	const char *q=(s); \
+	unsigned mask=(STOP(_mm256_load_si256((const __m256i *)b)))>>off; \
+	for (;;) { \
+		if (mask) { \
+			q+=__builtin_ctz(mask); \
+			return q<(end) ? q : (end); \
+		} \
+		b+=32; \
+		if (b>=(end)) \
+			return (end); \
+		mask=STOP(_mm256_load_si256((const __m256i *)b)); \
+		q=b; \
+	}
+
+AVX2 SCAN_NO_ASAN static const char *scan_to_char_avx2(const char *s, char c)
+{
+	__m256i vc=_mm256_set1_epi8(c);
+#define STOP(v) stop_char_avx2(v, vc)
+	SCAN_BLOCKS_AVX2(s, STOP)
+#undef STOP
+}
+
+AVX2 SCAN_NO_ASAN static const char *scan_past_space_avx2(const char *s)
+{
+	SCAN_BLOCKS_AVX2(s, stop_space_avx2)
+}
+
+AVX2 SCAN_NO_ASAN static const char *scan_plain_chars_avx2(const char *s, const char *end)
+{
+	SCAN_BLOCKS_TO_AVX2(s, end, stop_plain_avx2)
+}
+
+#endif
+
+struct ScanFunctions
+{
+	const char *(*toChar)(const char *s, char c);
+	const char *(*pastSpace)(const char *s);
+	const char *(*plainChars)(const char *s, const char *end);
+};
+
+static ScanFunctions select_scan()
+{
+	ScanFunctions f={scan_to_char_scalar, scan_past_space_scalar, scan_plain_chars_scalar};
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		f.toChar=scan_to_char_avx2;
+		f.pastSpace=scan_past_space_avx2;
+		f.plainChars=scan_plain_chars_avx2;
+	}
+	else {
+		f.toChar=scan_to_char_sse2;
+		f.pastSpace=scan_past_space_sse2;
+		f.plainChars=scan_plain_chars_sse2;
+	}
+#endif
+	return f;
+}
+
+static const ScanFunctions Scan=select_scan();
+
+const char *scan_to_char(const char *s, char c)
+{
+	return Scan.toChar(s, c);
+}
+
+const char *scan_past_space(const char *s)
+{
+	return Scan.pastSpace(s);
+}
+
+const char *scan_plain_chars(const char *s, const char *end)
+{
+	return Scan.plainChars(s, end);
+}
+#endif
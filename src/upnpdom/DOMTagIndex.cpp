@@ -0,0 +1,238 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2000 Intel Corporation
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+// * Neither name of Intel Corporation nor the names of its contributors
+// may be used to endorse or promote products derived from this software
+// without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "../../inc/tools/config.h"
+#if EXCLUDE_DOM == 0
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "../../inc/upnpdom/DOMTagIndex.h"
+#include "../../inc/upnpdom/NodeAct.h"
+#include "../../inc/upnpdom/NodeList.h"
+
+#define TAG_INDEX_BUCKETS 32
+
+//the part of an element name after its prefix
+static const char* localPart(const char *name)
+{
+	const char *colon=strchr(name, ':');
+
+	return colon==NULL ? name : colon+1;
+}
+
+static unsigned int hashName(const char *s)
+{
+	unsigned int h=5381;
+
+	while(*s)
+		h=(h*33)^(unsigned char)(*s++);
+	return h;
+}
+
+DOMTagIndex::DOMTagIndex()
+{
+	buckets=NULL;
+	bucketCount=0;
+	entryCount=0;
+	memset(&allElements, 0, sizeof(allElements));
+	nodeCount=0;
+}
+
+DOMTagIndex::~DOMTagIndex()
+{
+	for(unsigned int i=0; i<bucketCount; i++)
+	{
+		Entry *e=buckets[i];
+		while(e!=NULL)
+		{
+			Entry *next=e->next;
+			free(e->items);
+			free(e);
+			e=next;
+		}
+	}
+	free(buckets);
+	free(allElements.items);
+}
+
+//Walks the tree in document order, numbering every node so that find
+//can tell which elements lie below a given node.
+DOMTagIndex* DOMTagIndex::build(NodeAct *root)
+{
+	DOMTagIndex *index=new(std::nothrow) DOMTagIndex;
+	NodeAct *n;
+
+	if(index==NULL)
+		return NULL;
+	index->buckets=(Entry **)calloc(TAG_INDEX_BUCKETS, sizeof(Entry *));
+	if(index->buckets==NULL)
+	{
+		delete index;
+		return NULL;
+	}
+	index->bucketCount=TAG_INDEX_BUCKETS;
+
+	root->IndexOrder=index->nodeCount++;
+	n=root->FirstChild;
+	while(n!=NULL)
+	{
+		n->IndexOrder=index->nodeCount++;
+		if(n->NA_NodeType==ELEMENT_NODE && !index->add(n))
+		{
+			DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
+			delete index;
+			return NULL;
+		}
+		if(n->FirstChild!=NULL)
+		{
+			n=n->FirstChild;
+			continue;
+		}
+		while(n!=root && n->NextSibling==NULL)
+			n=n->ParentNode;
+		n = n==root ? NULL : n->NextSibling;
+	}
+	return index;
+}
+
+void DOMTagIndex::find(NodeAct *scope, char *tagName, NodeList *list)
+{
+	const char *local=localPart(tagName);
+	bool qualified = local!=tagName;
+	unsigned long first, last, lo, hi;
+	NodeAct *n;
+	Entry *e;
+
+	if(strcmp(tagName, "*")==0)
+		e=&allElements;
+	else
+		e=lookup(local, hashName(local));
+	if(e==NULL)
+		return;
+
+	//the nodes below scope are numbered first+1 up to, but not
+	//including, the number of the node that follows them
+	first=scope->IndexOrder;
+	for(n=scope; n->ParentNode!=NULL && n->NextSibling==NULL; n=n->ParentNode);
+	last = n->NextSibling==NULL ? nodeCount : n->NextSibling->IndexOrder;
+
+	lo=0;
+	hi=e->count;
+	while(lo<hi)
+	{
+		unsigned long mid=lo+(hi-lo)/2;
+		if(e->items[mid]->IndexOrder <= first)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	for(; lo<e->count && e->items[lo]->IndexOrder<last; lo++)
+	{
+		if(qualified && strcmp(e->items[lo]->NA_NodeName, tagName)!=0)
+			continue;
+		list->addToInternalList(e->items[lo]);
+	}
+}
+
+bool DOMTagIndex::add(NodeAct *element)
+{
+	const char *local=localPart(element->NA_NodeName);
+	unsigned int hash=hashName(local);
+	Entry *e=lookup(local, hash);
+
+	if(e==NULL)
+	{
+		if(entryCount>=bucketCount && !grow())
+			return false;
+		e=(Entry *)calloc(1, sizeof(Entry));
+		if(e==NULL)
+			return false;
+		e->localName=local;
+		e->hash=hash;
+		e->next=buckets[hash & (bucketCount-1)];
+		buckets[hash & (bucketCount-1)]=e;
+		entryCount++;
+	}
+	return addToEntry(e, element) && addToEntry(&allElements, element);
+}
+
+bool DOMTagIndex::addToEntry(Entry *e, NodeAct *element)
+{
+	if(e->count==e->capacity)
+	{
+		unsigned long newCapacity = e->capacity==0 ? 4 : 2*e->capacity;
+		NodeAct **newItems=(NodeAct **)realloc(e->items, newCapacity*sizeof(NodeAct *));
+
+		if(newItems==NULL)
+			return false;
+		e->items=newItems;
+		e->capacity=newCapacity;
+	}
+	e->items[e->count++]=element;
+	return true;
+}
+
+DOMTagIndex::Entry* DOMTagIndex::lookup(const char *localName, unsigned int hash)
+{
+	Entry *e;
+
+	for(e=buckets[hash & (bucketCount-1)]; e!=NULL; e=e->next)
+		if(e->hash==hash && strcmp(e->localName, localName)==0)
+			return e;
+	return NULL;
+}
+
+//doubles the number of buckets
+bool DOMTagIndex::grow()
+{
+	unsigned int newCount=2*bucketCount;
+	Entry **newBuckets=(Entry **)calloc(newCount, sizeof(Entry *));
+
+	if(newBuckets==NULL)
+		return false;
+	for(unsigned int i=0; i<bucketCount; i++)
+	{
+		Entry *e=buckets[i];
+		while(e!=NULL)
+		{
+			Entry *next=e->next;
+			e->next=newBuckets[e->hash & (newCount-1)];
+			newBuckets[e->hash & (newCount-1)]=e;
+			e=next;
+		}
+	}
+	free(buckets);
+	buckets=newBuckets;
+	bucketCount=newCount;
+	return true;
+}
+
+#endif
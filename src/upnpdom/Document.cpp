@@ -108,10 +108,10 @@ Node& 	Document::createTextNode(char *data)
 }
 	
 	
-Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file)
+Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file, int bufferLen)
 {
 	//to do: try handling this in a better fashin than allocating a static length..
-	char *fileBuffer;
+	char *fileBuffer=NULL;
 	FILE *XML;
 	Document *RootDoc;
 	NODE_TYPE NodeType;
@@ -119,9 +119,8 @@ Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file)
 	char *NodeValue=NULL;
 	bool IsEnd;
 	bool IgnoreWhiteSpace=true;
-	Node *a;
-	Node *b;
-	Element *back;
+	DOMArena *arena;
+	NodeAct *na;
 
 	DBGONLY(UpnpPrintf(UPNP_ALL,DOM,__FILE__,__LINE__,"Inside ReadDocumentFileOrBuffer function\n");)
 	if(file)
@@ -147,27 +146,19 @@ Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file)
         			fclose (XML);
         	}
  	}
- 	else
- 	{
- 		fileBuffer=(char *)malloc(strlen(xmlFile)+1);
-		if(fileBuffer == NULL)
-		{
-			DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
-			throw DOMException(DOMException::INSUFFICIENT_MEMORY, NULL);
-		}
-		strcpy(fileBuffer, xmlFile);
- 	}
+ 	// all nodes of the document are allocated from one arena; the
+ 	// reference held here is dropped when parsing is over
+ 	arena=new DOMArena;
+ 	// a buffer is parsed in place; the parser keeps its own copy
     try
     { 		   	
-	Parser myparser(fileBuffer);
-	free(fileBuffer);
+	Parser myparser(file ? fileBuffer : xmlFile, file ? -1 : bufferLen);
+	if(file)
+		free(fileBuffer);
    	createDocument(&RootDoc);
    	RootDoc->CurrentNodePtr=RootDoc->nact;
-   	back=NULL;
 	while(1)
 	{
-		Element ele;
-		Attr attr;
 		try
 		{
     		if(myparser.getNextNode(NodeType, &NodeName, &NodeValue, IsEnd, IgnoreWhiteSpace)==0)
@@ -178,22 +169,14 @@ Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file)
         			switch(NodeType)
         			{
         			case ELEMENT_NODE:	
-        								ele=createElement(NodeName);
-        								a=(Node*)&ele;
-        								RootDoc->CurrentNodePtr->appendChild(a->nact);
-        								RootDoc->CurrentNodePtr=RootDoc->CurrentNodePtr->LastChild;
-        								delete ele.ownerElement;
+        								na=new(arena) NodeAct(NodeType, NodeName, NULL, arena);
+        								RootDoc->CurrentNodePtr->appendChild(na);
+        								RootDoc->CurrentNodePtr=na;
         								break;
         			case TEXT_NODE:		
-        								Node::createNode(&b,NodeType,NodeName,NodeValue);
-        								RootDoc->CurrentNodePtr->appendChild(b->nact);
-        								delete b;
-        								break;
         			case ATTRIBUTE_NODE:
-        								attr=createAttribute(NodeName, NodeValue);
-        								a=(Node*)&attr;
-        								RootDoc->CurrentNodePtr->appendChild(a->nact);
-        								delete attr.ownerAttr;
+        								na=new(arena) NodeAct(NodeType, NodeName, NodeValue, arena);
+        								RootDoc->CurrentNodePtr->appendChild(na);
         								break;
         			case INVALID_NODE:
         								break;
@@ -246,8 +229,10 @@ Document& Document::ReadDocumentFileOrBuffer(char * xmlFile, bool file)
    	}catch(DOMException& toCatch)
    	{
    	    RootDoc=NULL;
+   	    arena->release();
 	    throw DOMException(toCatch.code);
 	}
+	arena->release();
 	RootDoc->ownerDocument=RootDoc;
 	DBGONLY(UpnpPrintf(UPNP_ALL,DOM,__FILE__,__LINE__,"**EndParse**\n");)
 	return *RootDoc;
@@ -286,6 +271,8 @@ NodeList& Document::getElementsByTagName( char * tagName)
 	if(!returnNodeList)
 		{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
 	returnNodeList->ownerNodeList=returnNodeList;
+	if(IndexedSearch(tagName, returnNodeList))
+		return *returnNodeList;
 	DBGONLY(UpnpPrintf(UPNP_ALL,DOM,__FILE__,__LINE__,"Calling makeNodeList\n");)
     SearchList(*this, tagName, &returnNodeList, strchr(tagName,':')==NULL);
 	return *returnNodeList;
@@ -57,9 +57,7 @@ void Element::setAttribute(char *name, char *value)
 	}
 	else
 	{
-		delete n.nact->NA_NodeValue;
-		n.nact->NA_NodeValue=new char[strlen(value)+1];
-		strcpy(n.nact->NA_NodeValue, value);
+		n.nact->replaceValue(value);
 	}
 	n.deleteNode();
 	nm.deleteNamedNodeMap();
@@ -80,6 +78,8 @@ NodeList& Element::getElementsByTagName( char * tagName)
 	if(!returnNodeList)
 	   	{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
 	returnNodeList->ownerNodeList=returnNodeList;
+	if(IndexedSearch(tagName, returnNodeList))
+		return *returnNodeList;
     nact->NA_NodeType = DOCUMENT_NODE;
    	DBGONLY(UpnpPrintf(UPNP_ALL,DOM,__FILE__,__LINE__,"Calling MakeNodeList for element whose tagname is %s\n", tagName);)
     SearchList(*this, tagName, &returnNodeList, strchr(tagName,':')==NULL);
@@ -108,16 +108,12 @@ void	Node::setNodeValue(char *newNodeValue)
 {
 	if(nact!=NULL)
 	{
-		if(this->nact->NA_NodeValue !=NULL)
-			delete this->nact->NA_NodeValue;
-		this->nact->NA_NodeValue =NULL;	
-		this->nact->NA_NodeValue=new char[strlen(newNodeValue)+1];
+		this->nact->replaceValue(newNodeValue);
 		if(!this->nact->NA_NodeValue)
 		{
 			DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
 			throw DOMException(DOMException::INSUFFICIENT_MEMORY);
 		}
-		strcpy(this->nact->NA_NodeValue, newNodeValue);
 	}
 	else
 		throw DOMException(DOMException::NO_SUCH_NODE);
@@ -406,6 +402,33 @@ void Node::SearchList(Node& n, char *tagname, NodeList **lst, bool ignorePrefix)
 		n.deleteNode();
 }
 
+//Answers getElementsByTagName from the tag index of the document this
+//node is part of, building the index on first use.  Returns false if
+//the node is not in a document or the index could not be built, in
+//which case the caller falls back to SearchList.
+bool Node::IndexedSearch(char *tagname, NodeList *lst)
+{
+#if DOM_TAG_INDEX
+	NodeAct *root;
+
+	if(nact==NULL)
+		return false;
+	for(root=nact; root->ParentNode!=NULL; root=root->ParentNode);
+	if(root->NA_NodeType!=DOCUMENT_NODE)
+		return false;
+	if(root->TagIndex==NULL)
+	{
+		root->TagIndex=DOMTagIndex::build(root);
+		if(root->TagIndex==NULL)
+			return false;
+	}
+	root->TagIndex->find(nact, tagname, lst);
+	return true;
+#else
+	return false;
+#endif
+}
+
 
 #endif
 
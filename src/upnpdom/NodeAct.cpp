@@ -34,6 +34,55 @@
 #include "../../inc/tools/config.h"
 #if EXCLUDE_DOM == 0
 #include "../../inc/upnpdom/NodeAct.h"
+#include <stdlib.h>
+#include <new>
+
+//every NodeAct is preceded by the arena it came from, or NULL if it was
+//allocated on the heap; the header keeps the node aligned
+union NodeActHeader
+{
+	DOMArena *arena;
+	double align;
+};
+
+void* NodeAct::operator new(size_t size)
+{
+	NodeActHeader *h;
+
+	h=(NodeActHeader *)malloc(sizeof(NodeActHeader) + size);
+	if(h==NULL)
+		throw std::bad_alloc();
+	h->arena=NULL;
+	return h+1;
+}
+
+void* NodeAct::operator new(size_t size, DOMArena *arena)
+{
+	NodeActHeader *h;
+
+	h=(NodeActHeader *)arena->alloc(sizeof(NodeActHeader) + size);
+	h->arena=arena;
+	arena->addRef();
+	return h+1;
+}
+
+void NodeAct::operator delete(void *p)
+{
+	NodeActHeader *h;
+
+	if(p==NULL)
+		return;
+	h=(NodeActHeader *)p - 1;
+	if(h->arena!=NULL)
+		h->arena->release();
+	else
+		free(h);
+}
+
+void NodeAct::operator delete(void *p, DOMArena * /* arena */)
+{
+	NodeAct::operator delete(p);
+}
 
 NodeAct::NodeAct(NODE_TYPE nt,char *NodeName, char *NodeValue, Node *myCreator)
 {
@@ -66,6 +115,31 @@ NodeAct::NodeAct(NODE_TYPE nt,char *NodeName, char *NodeValue, Node *myCreator)
 	LastAttr=NULL;
 	Creator=myCreator;
 	RefCount=0;
+	NameInArena=false;
+	ValueInArena=false;
+	TagIndex=NULL;
+	IndexOrder=0;
+}
+
+NodeAct::NodeAct(NODE_TYPE nt,char *NodeName, char *NodeValue, DOMArena *arena)
+{
+	NA_NodeName=arena->copyString(NodeName);
+	NA_NodeValue=arena->copyString(NodeValue);
+	NA_NodeType = nt;
+	ParentNode=NULL;
+	OwnerNode=this;
+	NextSibling=NULL;
+	PrevSibling=NULL;
+	FirstChild=NULL;
+	LastChild=NULL;
+	FirstAttr=NULL;
+	LastAttr=NULL;
+	Creator=NULL;
+	RefCount=0;
+	NameInArena=true;
+	ValueInArena=true;
+	TagIndex=NULL;
+	IndexOrder=0;
 }
 
 NodeAct::NodeAct(const NodeAct &other, bool deep)
@@ -74,6 +148,10 @@ NodeAct::NodeAct(const NodeAct &other, bool deep)
 	this->setValue(other.NA_NodeValue);
 	this->NA_NodeType=other.NA_NodeType;
     this->Creator = other.Creator;
+	this->NameInArena=false;
+	this->ValueInArena=false;
+	this->TagIndex=NULL;
+	this->IndexOrder=0;
 	this->OwnerNode=other.OwnerNode;
     this->RefCount=1;
     // Need to break the association w/ original kids
@@ -160,6 +238,19 @@ void NodeAct::changeOwnerNode(NodeAct *n, NodeAct *newOwner)
 	}
 }
 
+//Drops the tag index of the document this node belongs to.
+void NodeAct::treeChanged()
+{
+	NodeAct *root;
+
+	for(root=this; root->ParentNode!=NULL; root=root->ParentNode);
+	if(root->TagIndex!=NULL)
+	{
+		delete root->TagIndex;
+		root->TagIndex=NULL;
+	}
+}
+
 void NodeAct::insertBefore(NodeAct *newChild, NodeAct *refChild)
 {
 	if(refChild!=NULL)
@@ -178,6 +269,8 @@ void NodeAct::insertBefore(NodeAct *newChild, NodeAct *refChild)
 			newChild->PrevSibling =NULL;
 		}
 		//Todo: Raise exception for if the node is one of the ancestors, etc..
+		if(newChild->NA_NodeType != ATTRIBUTE_NODE)
+			treeChanged();
 		newChild->RefCount++;
 
 		newChild->NextSibling=refChild;
@@ -222,6 +315,8 @@ void NodeAct::removeChild(NodeAct *oldChild)
 		throw DOMException(DOMException::NOT_FOUND_ERR);
 		return;
 	}
+	if(oldChild->NA_NodeType != ATTRIBUTE_NODE)
+		treeChanged();
 	if(oldChild->PrevSibling !=NULL)
    		oldChild->PrevSibling->NextSibling=oldChild->NextSibling;
    	if(oldChild->NextSibling !=NULL)
@@ -249,7 +344,15 @@ NodeAct * NodeAct::cloneNode(bool deep)
 //If the child has children all of them will be appended
 void NodeAct::appendChild(NodeAct *newChild)
 {
-	if(findNodeFromRef(this->OwnerNode,newChild))
+	if(newChild->NA_NodeType != ATTRIBUTE_NODE)
+	{
+		treeChanged();
+		if(newChild->ParentNode!=NULL)
+			newChild->ParentNode->treeChanged();
+	}
+	//a node without a parent is in no tree, so the search is skipped;
+	//this keeps building a parsed document linear in its size
+	if(newChild->ParentNode!=NULL && findNodeFromRef(this->OwnerNode,newChild))
 	{
 		newChild->ParentNode->removeChild(newChild);
 		newChild->ParentNode=this;
@@ -325,17 +428,28 @@ void NodeAct::setValue(char *v)
 		NA_NodeValue=NULL;
 }
 
+void NodeAct::replaceValue(char *v)
+{
+	if(NA_NodeValue!=NULL && !ValueInArena)
+		delete NA_NodeValue;
+	ValueInArena=false;
+	setValue(v);
+}
+
 NodeAct::~NodeAct()
 {
-	if(NA_NodeName!=NULL)
+	//strings in an arena go with the arena
+	if(NA_NodeName!=NULL && !NameInArena)
 		delete NA_NodeName;
-	if(NA_NodeValue!=NULL)
+	if(NA_NodeValue!=NULL && !ValueInArena)
 		delete NA_NodeValue;
+	delete TagIndex;
 //	deleteNodeTree(this);
 }
 
 void NodeAct::deleteNodeAct()
 {
+	treeChanged();
 	while(this->FirstChild!=NULL)//delete all except itself
 		deleteNodeTree(this);
 }
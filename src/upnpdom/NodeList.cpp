@@ -35,28 +35,22 @@
 #if EXCLUDE_DOM == 0
 #include "../../inc/upnpdom/NodeList.h"
 
+#include <stdlib.h>
+
 Node& NodeList::item(unsigned long index)
 {
-	InternalList *n;
 	Node *ReturnNode;
-//	Node ReturnNode;
-	if(index > getLength()-1)
-	{
-		ReturnNode = new Node;
-		if(!ReturnNode)
-		   	{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
-		ReturnNode->nact=NULL;
-		ReturnNode->ownerNode=ReturnNode;
-		return *ReturnNode;
-	}
-	n=head;
-	for(unsigned int i=0; i<index && n!=NULL; ++i)
-		n = n->next;
+
 	ReturnNode = new Node;
 	if(!ReturnNode)
 	   	{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
 	ReturnNode->ownerNode=ReturnNode;
-	ReturnNode->nact = n->ofWho;
+	if(index >= length)
+	{
+		ReturnNode->nact=NULL;
+		return *ReturnNode;
+	}
+	ReturnNode->nact = items[index];
 	ReturnNode->nact->RefCount++;
     return *ReturnNode;
 }
@@ -65,57 +59,43 @@ Node& NodeList::item(unsigned long index)
 
 void NodeList::addToInternalList(NodeAct *add)
 {
-	InternalList *traverse, *p;
-	InternalList *na = new InternalList;
-	if(!na)
-	   	{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
-	
-	na->next=NULL;
-	na->ofWho=add;
-
-	if(head==NULL)
-	{
-		head=na;
-		return;
-	}
-	traverse=head;
-	p=traverse;
-	while(traverse !=NULL)
+	if(length == capacity)
 	{
-		p=traverse;
-		traverse=traverse->next;
+		//double the array, so that building a list is linear
+		unsigned long newCapacity = capacity == 0 ? 8 : 2*capacity;
+		NodeAct **newItems;
+
+		newItems = (NodeAct **)realloc(items, newCapacity*sizeof(NodeAct *));
+		if(!newItems)
+		{
+			DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
+			return;
+		}
+		items = newItems;
+		capacity = newCapacity;
 	}
-	p->next=na;
+	items[length++] = add;
 }
 
 
 unsigned long NodeList::getLength()
 {
-	InternalList *n;
-	unsigned long length=0;
-
-	n=head;
-	for(length=0; n!=NULL; ++length, n=n->next);
 	return length;
 }
 
+//the C interface copies lists member by member, so the copy shares the
+//array with ownerNodeList, which frees it
 void NodeList::deleteNodeList()
 {
 	delete this->ownerNodeList;
-	this->head=NULL;
+	this->items=NULL;
+	this->length=0;
+	this->capacity=0;
 }
 
 NodeList::~NodeList()
 {
-	InternalList *del, *prev;
-	del=head;
-	prev=del;
-	while(del!=NULL)
-	{
-		del=del->next;
-		delete prev;
-		prev=del;
-	}
+	free(items);
 }
 
 #endif
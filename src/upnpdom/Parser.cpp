@@ -37,6 +37,8 @@
 #include <string.h>
 #include "../../inc/upnpdom/DOMException.h"
 #include "../../inc/upnpdom/Parser.h"
+#include "../../inc/upnpdom/domCif.h"
+#include "../../inc/upnpdom/DOMCharScan.h"
 
 #ifdef _WIN32
 #define strncasecmp strnicmp
@@ -260,16 +262,19 @@ bool char_match (char cUnknown, const char * strMatchSet)
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
 
-Parser::Parser(char *ParseStr)
+Parser::Parser(char *ParseStr, int ParseLen)
 {
 	if(ParseStr == NULL)
 		throw DOMException(DOMException::FATAL_ERROR_DURING_PARSING);
-	if(*ParseStr == '\0')
+	if(ParseLen < 0)
+		ParseLen = strlen(ParseStr);
+	if(ParseLen == 0 || *ParseStr == '\0')
 		throw DOMException(DOMException::FATAL_ERROR_DURING_PARSING);
-	ParseBuff = new char[strlen(ParseStr)+1];
+	ParseBuff = new char[ParseLen+1];
 	if(!ParseBuff)
 	   	{DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)}
-	strcpy(ParseBuff, ParseStr);
+	memcpy(ParseBuff, ParseStr, ParseLen);
+	ParseBuff[ParseLen] = '\0';
 	CurrPtr=ParseBuff;
 	TagVal=false;
 	TagName=false;
@@ -356,6 +361,9 @@ char * Parser::findNextMatch (char *strSearch, const char *strMatch)
 	if ((strSearch == NULL) || (strMatch == NULL))
 		return NULL;
 
+	if (strMatch[0] != '\0' && strMatch[1] == '\0')
+		return (char *)scan_to_char(strSearch, strMatch[0]);
+
 	strIndex = strSearch;
 
 	while (!(char_match (*strIndex, strMatch)) && (*strIndex != '\0'))
@@ -433,6 +441,13 @@ bool Parser::copy_token(char *src, int len)
     psrc=src;
     pend=src+len;
     while (psrc<pend){
+        // copy runs of characters that need no decoding in one go
+        char *plain=(char *)scan_plain_chars(psrc, pend);
+        if (plain>psrc){
+            membuffer_append(&tokBuf, psrc, plain-psrc);
+            psrc=plain;
+            continue;
+        }
         
         if ((c=get_char(psrc, &cl))<=0) 
         { 
@@ -499,6 +514,12 @@ long Parser::skipString (char **pstrFragment, const char *strSkipChars)
 	if (!pstrFragment || !strSkipChars)
 		return -1;
 
+	if (strSkipChars == WHITESPACE)
+	{
+		*pstrFragment = (char *)scan_past_space(*pstrFragment);
+		return 0;
+	}
+
 	while ((**pstrFragment != '\0') && (char_match (**pstrFragment, strSkipChars)))
 	{
 		(*pstrFragment)++;
@@ -512,13 +533,23 @@ long Parser::skipString (char **pstrFragment, const char *strSkipChars)
 //Then it skips the skip key and returns.
 long Parser::skipUntilString (char **pstrSource, const char *strSkipKey)
 {
+	int keyLen;
+
 	if (!pstrSource || !strSkipKey)
 		return -1;
 
-	while (**pstrSource && strncmp (*pstrSource, strSkipKey, strlen(strSkipKey)))
+	keyLen = strlen(strSkipKey);
+	for (;;)
+	{
+		*pstrSource = (char *)scan_to_char(*pstrSource, *strSkipKey);
+		if (**pstrSource == '\0')
+			return 0; // not found; stop at the end rather than past it
+		if (!strncmp (*pstrSource, strSkipKey, keyLen))
+			break;
 		(*pstrSource)++;
+	}
 
-	*pstrSource = *pstrSource + strlen (strSkipKey);
+	*pstrSource = *pstrSource + keyLen;
 
 	return 0; //success
 }
@@ -637,8 +668,7 @@ int Parser::getNextToken()
 
     		while (bReadContent)
     		{
-    			while (!char_match (*pEndContent, LESSTHAN) && *pEndContent)
-    				pEndContent++;
+    			pEndContent = (char *)scan_to_char(pEndContent, '<');
 
     			if (!strncmp (pEndContent, BEGIN_COMMENT, strlen (BEGIN_COMMENT)))
     				skipUntilString (&pEndContent, END_COMMENT);
@@ -672,8 +702,7 @@ int Parser::getNextToken()
 
 		while (bReadContent)
 		{
-			while (!char_match (*pEndContent, LESSTHAN) && *pEndContent)
-				pEndContent++;
+			pEndContent = (char *)scan_to_char(pEndContent, '<');
 
 			if (!strncmp (pEndContent, BEGIN_COMMENT, strlen (BEGIN_COMMENT)))
 				skipUntilString (&pEndContent, END_COMMENT);
@@ -934,12 +963,252 @@ int Parser::getNextNode(NODE_TYPE &NodeType, char **NodeName, char **NodeValue,
 	}
 	return 0;
 }
-#endif			
-		
-		
 
+//////////////////////////////////////////////////////////////////////
+// Event parsing
+//////////////////////////////////////////////////////////////////////
+
+#define SAX_STACK_SIZE 32
+
+// An element that has been started but not yet ended.
+struct sax_name_t
+{
+    const char *name;
+    int len;
+};
 
+static inline bool sax_isspace(char c)
+{
+    return c==' '||c=='\t'||c=='\n'||c=='\r'||c=='\f';
+}
 
+static const char *sax_skipspace(const char *p, const char *end)
+{
+    while (p<end && sax_isspace(*p))
+        p++;
+    return p;
+}
 
+// Returns the end of the tag or attribute name starting at p.
+static const char *sax_scanname(const char *p, const char *end)
+{
+    while (p<end && !sax_isspace(*p) && *p!='/' && *p!='>' && *p!='=' &&
+        *p!='<' && *p!='"' && *p!='\'')
+        p++;
+    return p;
+}
 
+// Returns the position just past the next key in p..end; or NULL if there is none.
+static const char *sax_skippast(const char *p, const char *end, const char *key)
+{
+    int len=strlen(key);
+
+    while (end-p>=len) {
+        p=(const char *)memchr(p, key[0], end-p-len+1);
+        if (p==NULL)
+            return NULL;
+        if (!memcmp(p, key, len))
+            return p+len;
+        p++;
+    }
+    return NULL;
+}
 
+// Sets text/textLen to src/len, or, when src holds references like &amp;,
+// to a copy in buf with the references replaced.
+// returns 0: success; or -1 on a bad reference or if out of memory
+static int sax_decode(const char *src, int len, membuffer *buf, const char **text, int *textLen)
+{
+    const char *end=src+len;
+    const char *amp=(const char *)memchr(src, '&', len);
+    utf8char uch;
+    int c, cl, ul;
+
+    if (amp==NULL) {
+        *text=src;
+        *textLen=len;
+        return 0;
+    }
+    membuffer_reset(buf);
+    while (amp!=NULL) {
+        if (membuffer_append(buf, src, amp-src)!=0)
+            return -1;
+        // src..end is followed by '<' or a quote, which stops get_char
+        if ((c=get_char((char *)amp, &cl))<=0 || amp+cl>end)
+            return -1;
+        if ((ul=toutf8(c, uch))<0 || membuffer_append(buf, uch, ul)!=0)
+            return -1;
+        src=amp+cl;
+        amp=(const char *)memchr(src, '&', end-src);
+    }
+    if (membuffer_append(buf, src, end-src)!=0)
+        return -1;
+    *text=buf->buf;
+    *textLen=buf->length;
+    return 0;
+}
+
+int Parser::parseEvents(const char *ParseStr, int ParseLen, const Upnp_SAXHandler *Handler, void *Cookie)
+{
+    sax_name_t fixedStack[SAX_STACK_SIZE];
+    sax_name_t *stack=fixedStack, *newStack;
+    int depth=0, capacity=SAX_STACK_SIZE;
+    bool rootDone=false;
+    const char *p, *q, *end, *name, *text;
+    int nameLen, textLen;
+    char quote;
+    membuffer scratch;
+    int ret=0;
+
+    if (ParseStr==NULL || Handler==NULL)
+        return -1;
+    if (ParseLen<0)
+        ParseLen=strlen(ParseStr);
+    membuffer_init(&scratch);
+    p=ParseStr;
+    end=ParseStr+ParseLen;
+
+    while (ret==0 && p<end) {
+        if (*p!='<') {
+            q=(const char *)memchr(p, '<', end-p);
+            if (q==NULL)
+                q=end;
+            if (depth==0) {
+                // only white space may surround the root element
+                if (sax_skipspace(p, q)!=q)
+                    ret=-1;
+            }
+            else if (q==end)
+                ret=-1;
+            else if (Handler->Characters) {
+                if (sax_decode(p, q-p, &scratch, &text, &textLen)!=0)
+                    ret=-1;
+                else
+                    ret=Handler->Characters(Cookie, text, textLen);
+            }
+            p=q;
+        }
+        else if (end-p>=4 && !memcmp(p, BEGIN_COMMENT, 4)) {
+            if ((p=sax_skippast(p+4, end, END_COMMENT))==NULL)
+                ret=-1;
+        }
+        else if (end-p>=9 && !memcmp(p, "<![CDATA[", 9)) {
+            q=sax_skippast(p+9, end, "]]>");
+            if (q==NULL || depth==0)
+                ret=-1;
+            else if (Handler->Characters)
+                ret=Handler->Characters(Cookie, p+9, q-3-(p+9));
+            p=q;
+        }
+        else if (end-p>=2 && !memcmp(p, BEGIN_PROCESSING, 2)) {
+            if ((p=sax_skippast(p+2, end, END_PROCESSING))==NULL)
+                ret=-1;
+        }
+        else if (end-p>=2 && !memcmp(p, BEGIN_DOCTYPE, 2)) {
+            if ((p=sax_skippast(p+2, end, GREATERTHAN))==NULL)
+                ret=-1;
+        }
+        else if (end-p>=2 && !memcmp(p, ENDTAG, 2)) {
+            name=p+2;
+            q=sax_scanname(name, end);
+            nameLen=q-name;
+            p=sax_skipspace(q, end);
+            if (nameLen==0 || p==end || *p!='>' || depth==0 ||
+                stack[depth-1].len!=nameLen || memcmp(stack[depth-1].name, name, nameLen)) {
+                ret=-1;
+                break;
+            }
+            p++;
+            if (--depth==0)
+                rootDone=true;
+            if (Handler->EndElement)
+                ret=Handler->EndElement(Cookie, name, nameLen);
+        }
+        else {
+            name=p+1;
+            q=sax_scanname(name, end);
+            nameLen=q-name;
+            if (nameLen==0 || rootDone) {
+                ret=-1;
+                break;
+            }
+            if (Handler->StartElement && (ret=Handler->StartElement(Cookie, name, nameLen))!=0)
+                break;
+            // attributes, up to the end of the tag
+            for (;;) {
+                p=sax_skipspace(q, end);
+                if (p==end) {
+                    ret=-1;
+                    break;
+                }
+                if (*p=='/') {
+                    if (end-p<2 || p[1]!='>') {
+                        ret=-1;
+                        break;
+                    }
+                    p+=2;
+                    if (depth==0)
+                        rootDone=true;
+                    if (Handler->EndElement)
+                        ret=Handler->EndElement(Cookie, name, nameLen);
+                    break;
+                }
+                if (*p=='>') {
+                    p++;
+                    if (depth==capacity) {
+                        newStack=(sax_name_t *)malloc(2*capacity*sizeof(sax_name_t));
+                        if (newStack==NULL) {
+                            DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
+                            ret=-1;
+                            break;
+                        }
+                        memcpy(newStack, stack, depth*sizeof(sax_name_t));
+                        if (stack!=fixedStack)
+                            free(stack);
+                        stack=newStack;
+                        capacity*=2;
+                    }
+                    stack[depth].name=name;
+                    stack[depth].len=nameLen;
+                    depth++;
+                    break;
+                }
+                const char *attr=p;
+                q=sax_scanname(attr, end);
+                int attrLen=q-attr;
+                p=sax_skipspace(q, end);
+                if (attrLen==0 || p==end || *p!='=') {
+                    ret=-1;
+                    break;
+                }
+                p=sax_skipspace(p+1, end);
+                if (p==end || (*p!='"' && *p!='\'')) {
+                    ret=-1;
+                    break;
+                }
+                quote=*p++;
+                if ((q=(const char *)memchr(p, quote, end-p))==NULL) {
+                    ret=-1;
+                    break;
+                }
+                if (Handler->Attribute) {
+                    if (sax_decode(p, q-p, &scratch, &text, &textLen)!=0)
+                        ret=-1;
+                    else
+                        ret=Handler->Attribute(Cookie, attr, attrLen, text, textLen);
+                    if (ret!=0)
+                        break;
+                }
+                q++;
+            }
+        }
+    }
+    if (ret==0 && (depth!=0 || !rootDone))
+        ret=-1;
+
+    if (stack!=fixedStack)
+        free(stack);
+    membuffer_destroy(&scratch);
+    return ret;
+}
+#endif
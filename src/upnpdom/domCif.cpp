@@ -37,6 +37,7 @@
 #if EXCLUDE_DOM == 0
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <iostream>
 #include <malloc.h>
 #include "../../inc/upnpdom/domCif.h"
@@ -50,9 +51,7 @@
 // ---------------------------------------------------------------------------
 //  Forward references
 // ---------------------------------------------------------------------------
-void copyToTarget(char*& target, const char* p);
-void DumpDocument(char *&target, Node& n, int loop);
-void DumpNonEscapedDocument(char*& target, Node& n, int loop);
+static int PrintDocument(Node& n, bool escape, membuffer *buf, char *out, int outLen);
 
 // todo::
 //bool  Upnp_DOMImplementation_hasFeature( const Upnp_DOMString & feature,const Upnp_DOMString & version)
@@ -875,6 +874,13 @@ int   UpnpNodeList_getLength(Upnp_NodeList OperationNodeList)
 	return((*(NodeList *)OperationNodeList).getLength());
 }
 
+Upnp_Node   UpnpNodeList_next(Upnp_NodeList OperationNodeList, unsigned long *position)
+{
+	if(OperationNodeList == NULL || position == NULL
+	   || *position >= (*(NodeList *)OperationNodeList).getLength())
+		return NULL;
+	return(UpnpNodeList_item(OperationNodeList, (*position)++));
+}
 
 Upnp_Void	UpnpNodeList_free(Upnp_NodeList OperationNodeList)
 {
@@ -1372,36 +1378,51 @@ Upnp_Document  UpnpParseFileAndGetDocument(char* xmlFile)
 
 Upnp_DOMString  UpnpNewPrintDocument(Upnp_Node OperationNode)
 {
+	membuffer buf;
+
 	if(OperationNode == NULL)
 		return NULL;
-	Upnp_DOMString Upnp_Buff=NULL;
 	if((*(Node *)OperationNode).isNull())
 		return NULL;
-    if((*(Node *)OperationNode).isNull())
-    	return NULL;
-    DumpDocument(Upnp_Buff, *(Node *)OperationNode,0);
-  	return Upnp_Buff;
+	membuffer_init(&buf);
+	if(PrintDocument(*(Node *)OperationNode, true, &buf, NULL, 0) < 0)
+	{
+		membuffer_destroy(&buf);
+		return NULL;
+	}
+  	return membuffer_detach(&buf);
 }
 
 Upnp_DOMString  UpnpPrintDocumentDeEscaped(Upnp_Node OperationNode)
 {
+	membuffer buf;
+
 	if(OperationNode == NULL)
 		return NULL;
-	Upnp_DOMString Upnp_Buff=NULL;
 	if((*(Node *)OperationNode).isNull())
 		return NULL;
-    if((*(Node *)OperationNode).isNull())
-    	return NULL;
-    DumpNonEscapedDocument(Upnp_Buff, *(Node *)OperationNode,0);
-  	return Upnp_Buff;
+	membuffer_init(&buf);
+	if(PrintDocument(*(Node *)OperationNode, false, &buf, NULL, 0) < 0)
+	{
+		membuffer_destroy(&buf);
+		return NULL;
+	}
+  	return membuffer_detach(&buf);
+}
+
+int  UpnpPrintDocumentToBuffer(Upnp_Node OperationNode, char *Upnp_Buff, int BuffLen)
+{
+	if(OperationNode == NULL || (Upnp_Buff == NULL && BuffLen > 0) || BuffLen < 0)
+		return -1;
+	if((*(Node *)OperationNode).isNull())
+		return -1;
+	return PrintDocument(*(Node *)OperationNode, true, NULL, Upnp_Buff, BuffLen);
 }
 
 Upnp_Void  UpnpPrintDocument(Upnp_Node OperationNode, char * Upnp_Buff)
 {
-	Upnp_DOMString temp=NULL;
-    DumpDocument(temp, *(Node *)OperationNode, 0);
-  	strcpy(Upnp_Buff, temp);
-	delete temp;
+	//the caller promises that the buffer is large enough
+	UpnpPrintDocumentToBuffer(OperationNode, Upnp_Buff, INT_MAX);
 }
 
 
@@ -1434,273 +1455,216 @@ Upnp_Document  UpnpParse_Buffer(char *Buff1)
 		return((void *)ret);
 }
 
-void copyToTarget(char*& target, const char* p)
+Upnp_Document  UpnpParse_BufferLen(char *Buff1, int Len)
 {
-	if(target==NULL)
+	if(Buff1 == NULL || Len <= 0)
+		return NULL;
+	
+	Document *ret = new Document;
+	if(!ret)
+	{
+	   	DBGONLY(UpnpPrintf(UPNP_CRITICAL,DOM,__FILE__,__LINE__,"Insuffecient memory\n");)
+	   	return NULL;
+	}  		
+	try
 	{
-		target = (char *)malloc(strlen(p)+1);
-		strcpy(target, p);
+		*ret=(*ret).ReadDocumentFileOrBuffer(Buff1, false, Len);
+	}
+	catch (DOMException& /* toCatch */)
+	{
+		return NULL;
+	}
+	if(ret->isNull())
+	{
+		UpnpDocument_free(ret);
+		return NULL;
 	}
 	else
+		return((void *)ret);
+}
+
+int UpnpParse_SAX(const char *Buff, int Len, const Upnp_SAXHandler *Handler, void *Cookie)
+{
+	if(Buff == NULL || Handler == NULL || Len == 0)
+		return -1;
+	return Parser::parseEvents(Buff, Len, Handler, Cookie);
+}
+
+//Destination of PrintDocument: either a membuffer, or a caller supplied
+//buffer that takes as much as fits.  len counts every byte produced, so
+//that a caller whose buffer was too small learns the size it needs.
+struct PrintTarget
+{
+	membuffer *buf;
+	char *out;
+	size_t outLen;
+	size_t len;
+	bool failed;
+};
+
+static void PrintBytes(PrintTarget *t, const char *p, size_t n)
+{
+	if(t->buf != NULL)
 	{
-		target = (char *)realloc(target, strlen(target)+strlen(p)+1);
-		strcat(target,p);
-	}
-}
-
-void copy_with_escape( membuffer* buf, const char* p){
-    int plen = strlen(p);
-    for ( int i = 0; i < plen; i++ ) {
-        switch (p[i]) {
-        case '<': membuffer_append_str( buf, "&lt;" ); break;
-        case '>': membuffer_append_str( buf, "&gt;" ); break;
-        case '&': membuffer_append_str( buf, "&amp;" );break;
-        case '\'': membuffer_append_str( buf, "&apos;" ); break;
-        default: membuffer_append( buf, &p[i], 1 );
-        }
-    }
-}
-
-//This function takes only a document node
-//void DumpEscapedDocument(char*& target, Node& n, int loop)
-void dump_doc(membuffer *buf, Node& n, int loop)
-{
-    char*   nodeName  = n.getNodeName();
-    char*   nodeValue = n.getNodeValue();
-
-    switch (n.getNodeType())
-    {
-		case TEXT_NODE:
-        {
-            copy_with_escape( buf, nodeValue );
-            break;
-        }
-
-        case PROCESSING_INSTRUCTION_NODE :
-        {
-            membuffer_append_str( buf, "<?" );
-            membuffer_append_str( buf, nodeName );
-            membuffer_append_str( buf, " " );
-            membuffer_append_str( buf, nodeValue );
-            membuffer_append_str( buf, "?>\n" );
-            break;
-        }
-
-        case DOCUMENT_NODE :
-        {
-            Node child=n.getFirstChild();
-			Node *del;
-			del=&child;
-            Node temp;
-            while(!child.isNull())
-            {
-                temp = child.getNextSibling();
-                dump_doc(buf, child,1);
-                child=temp;
-            }
-			(*del).deleteNode();
-            break;
-        }
-
-        case ELEMENT_NODE :
-        {
-            // Output the element start tag.
-            membuffer_append_str( buf, "<" );
-            membuffer_append_str( buf, nodeName );
-            // Output any attributes on this element
-            NamedNodeMap attributes = n.getAttributes();
-            int attrCount = attributes.getLength();
-            for (int i = 0; i < attrCount; i++)
-            {
-                Node  attribute = attributes.item(i);
-				char *nn=attribute.getNodeName();
-				char *nv=attribute.getNodeValue();
-                membuffer_append_str( buf, "  " );
-                membuffer_append_str( buf, nn );
-                membuffer_append_str( buf, "=\"" );
-                copy_with_escape( buf, nv );
-                membuffer_append_str( buf, "\"" );
-				delete nn;
-				delete nv;
-				attribute.deleteNode();
-            }
-			attributes.deleteNamedNodeMap();
-			
-            //
-            //  Test for the presence of children, which includes both
-            //  text content and nested elements.
-            //
-            Node child, temp;
-			child = n.getFirstChild();
-			Node *del=&child;;
-            if (!child.isNull())
-            {
-                // There are children. Close start-tag, and output children.
-                if(child.getNodeType()!=3) {
-                    membuffer_append_str( buf, ">\n" );
-                }
-                else {
-                    membuffer_append_str( buf, ">" );
-                }
-                while( !child.isNull())
-                {
-                    temp = child.getNextSibling();
-                    dump_doc(buf, child,1);
-                    child=temp;
-                }
-				if(child.isNull())
-					child.deleteNode();
-
-                // Done with children.  Output the end tag.
-                membuffer_append_str( buf, "</" );
-                membuffer_append_str( buf, nodeName );
-                membuffer_append_str( buf, ">\n" );
-            }
-            else
-            {
-                //
-                //  There were no children.  Output the short form close of the
-                //  element start tag, making it an empty-element tag.
-                //
-				(*del).deleteNode();
-                membuffer_append_str( buf, "/>\n" );
-            }
-            break;
-        }
-        default:
-//            DBGONLY(printf("Unrecognized node type = %d\n",n.getNodeType()));
-            break;
-    }
-	//do not delete the topmost node's parent node as it is created by someone else
-	//for now dont delete the document node
-	delete nodeName;
-	delete nodeValue;
-//	if(n.getNodeType()!=DOCUMENT_NODE)
-	if(loop!=0)
-		n.deleteNode();
-}
-
-void DumpDocument(char*& target, Node& n, int loop) {
-    membuffer buf;
-    membuffer_init( &buf );
-    dump_doc( &buf, n, loop );
-    target = membuffer_detach( &buf );
-}
-
-//This function takes only a document node
-void DumpNonEscapedDocument(char*& target, Node& n, int loop)
-{
-    char*   nodeName  = n.getNodeName();
-    char*   nodeValue = n.getNodeValue();
-
-    switch (n.getNodeType())
-    {
-		case TEXT_NODE:
-        {
-            copyToTarget(target,nodeValue);
-            break;
-        }
-
-        case PROCESSING_INSTRUCTION_NODE :
-        {
-			copyToTarget(target,"<?");
-			copyToTarget(target,nodeName);
-			copyToTarget(target," ");
-			copyToTarget(target,nodeValue);
-			copyToTarget(target,"?>\n");
-            break;
-        }
-
-        case DOCUMENT_NODE :
-        {
-            Node child=n.getFirstChild();
-			Node *del;
-			del=&child;
-            Node temp;
-            while(!child.isNull())
-            {
-                temp = child.getNextSibling();
-				DumpDocument(target, child,1);
-                child=temp;
-            }
-			(*del).deleteNode();
-            break;
-        }
-
-        case ELEMENT_NODE :
-        {
-            // Output the element start tag.
-			copyToTarget(target,"<");
-			copyToTarget(target,nodeName);
-            // Output any attributes on this element
-            NamedNodeMap attributes = n.getAttributes();
-            int attrCount = attributes.getLength();
-            for (int i = 0; i < attrCount; i++)
-            {
-                Node  attribute = attributes.item(i);
-				char *nn=attribute.getNodeName();
-				char *nv=attribute.getNodeValue();
-				copyToTarget(target,"  ");
-				copyToTarget(target,nn);
-				copyToTarget(target,"=\"");
-				copyToTarget(target,nv);
-				copyToTarget(target,"\"");
-				delete nn;
-				delete nv;
-				attribute.deleteNode();
-            }
-			attributes.deleteNamedNodeMap();
-			
-            //
-            //  Test for the presence of children, which includes both
-            //  text content and nested elements.
-            //
-            Node child, temp;
-			child = n.getFirstChild();
-			Node *del=&child;;
-            if (!child.isNull())
-            {
-                // There are children. Close start-tag, and output children.
-                if(child.getNodeType()!=3)
-					copyToTarget(target,">\n");
-                else
-					copyToTarget(target,">");
-                while( !child.isNull())
-                {
-                    temp = child.getNextSibling();
-					DumpDocument(target, child,1);
-                    child=temp;
-                }
-				if(child.isNull())
-					child.deleteNode();
-
-                // Done with children.  Output the end tag.
-				copyToTarget(target,"</");
-				copyToTarget(target,nodeName);
-				copyToTarget(target,">\n");
-            }
-            else
-            {
-                //
-                //  There were no children.  Output the short form close of the
-                //  element start tag, making it an empty-element tag.
-                //
-				(*del).deleteNode();
-				copyToTarget(target,"/>\n");
-            }
-            break;
-        }
-        default:
-//            DBGONLY(printf("Unrecognized node type = %d\n",n.getNodeType()));
-            break;
-    }
-	//do not delete the topmost node's parent node as it is created by someone else
-	//for now dont delete the document node
-	delete nodeName;
-	delete nodeValue;
-//	if(n.getNodeType()!=DOCUMENT_NODE)
-	if(loop!=0)
-		n.deleteNode();
+		if(!t->failed && membuffer_append(t->buf, p, n) != 0)
+			t->failed = true;
+	}
+	else if(t->len < t->outLen)
+		memcpy(t->out + t->len, p, t->len + n <= t->outLen ? n : t->outLen - t->len);
+	t->len += n;
+}
+
+static void PrintString(PrintTarget *t, const char *p)
+{
+	if(p != NULL)
+		PrintBytes(t, p, strlen(p));
+}
+
+//Copies p, replacing the characters that cannot appear as they are in
+//XML text; '"' is only replaced inside attribute values.  Runs of plain
+//characters are copied in one piece.
+static void PrintEscaped(PrintTarget *t, const char *p, bool escape, bool attribute)
+{
+	const char *run;
+
+	if(p == NULL)
+		return;
+	if(!escape)
+	{
+		PrintString(t, p);
+		return;
+	}
+	for(run = p; *p != '\0'; p++)
+	{
+		const char *entity;
+
+		switch(*p)
+		{
+		case '<':  entity = "&lt;"; break;
+		case '>':  entity = "&gt;"; break;
+		case '&':  entity = "&amp;"; break;
+		case '\'': entity = "&apos;"; break;
+		case '"':
+			if(!attribute)
+				continue;
+			entity = "&quot;";
+			break;
+		default:
+			continue;
+		}
+		PrintBytes(t, run, p - run);
+		PrintString(t, entity);
+		run = p + 1;
+	}
+	PrintBytes(t, run, p - run);
+}
+
+//Bytes PrintNode writes for na and its subtree before any escaping; used
+//to size the output buffer up front.
+static size_t PrintSize(NodeAct *na)
+{
+	size_t size = 0;
+	size_t nameLen = na->NA_NodeName != NULL ? strlen(na->NA_NodeName) : 0;
+	size_t valueLen = na->NA_NodeValue != NULL ? strlen(na->NA_NodeValue) : 0;
+
+	switch(na->NA_NodeType)
+	{
+	case TEXT_NODE:
+		return valueLen;
+	case PROCESSING_INSTRUCTION_NODE:
+		return nameLen + valueLen + 6;
+	case ELEMENT_NODE:
+		size = 2*nameLen + 6;
+		for(NodeAct *attr = na->FirstAttr; attr != NULL; attr = attr->NextSibling)
+			size += PrintSize(attr);
+		break;
+	case ATTRIBUTE_NODE:
+		return nameLen + valueLen + 5;
+	case DOCUMENT_NODE:
+		break;
+	default:
+		return 0;
+	}
+	for(NodeAct *child = na->FirstChild; child != NULL; child = child->NextSibling)
+		size += PrintSize(child);
+	return size;
+}
+
+//Writes na and its subtree in one pass over the NodeActs.
+static void PrintNode(PrintTarget *t, NodeAct *na, bool escape)
+{
+	switch(na->NA_NodeType)
+	{
+	case TEXT_NODE:
+		PrintEscaped(t, na->NA_NodeValue, escape, false);
+		break;
+
+	case PROCESSING_INSTRUCTION_NODE:
+		PrintBytes(t, "<?", 2);
+		PrintString(t, na->NA_NodeName);
+		PrintBytes(t, " ", 1);
+		PrintString(t, na->NA_NodeValue);
+		PrintBytes(t, "?>\n", 3);
+		break;
+
+	case DOCUMENT_NODE:
+		for(NodeAct *child = na->FirstChild; child != NULL; child = child->NextSibling)
+			PrintNode(t, child, escape);
+		break;
+
+	case ELEMENT_NODE:
+		PrintBytes(t, "<", 1);
+		PrintString(t, na->NA_NodeName);
+		for(NodeAct *attr = na->FirstAttr; attr != NULL; attr = attr->NextSibling)
+		{
+			PrintBytes(t, "  ", 2);
+			PrintString(t, attr->NA_NodeName);
+			PrintBytes(t, "=\"", 2);
+			PrintEscaped(t, attr->NA_NodeValue, escape, true);
+			PrintBytes(t, "\"", 1);
+		}
+		if(na->FirstChild != NULL)
+		{
+			//text right after the start tag stays on its line
+			if(na->FirstChild->NA_NodeType != TEXT_NODE)
+				PrintBytes(t, ">\n", 2);
+			else
+				PrintBytes(t, ">", 1);
+			for(NodeAct *child = na->FirstChild; child != NULL; child = child->NextSibling)
+				PrintNode(t, child, escape);
+			PrintBytes(t, "</", 2);
+			PrintString(t, na->NA_NodeName);
+			PrintBytes(t, ">\n", 2);
+		}
+		else
+			PrintBytes(t, "/>\n", 3);
+		break;
+
+	default:
+		break;
+	}
+}
+
+//Renders n either into buf, which is sized from PrintSize first, or
+//into out, which receives at most outLen-1 bytes and a terminating null.
+//Returns the length of the whole rendering, or -1 if buf could not grow.
+static int PrintDocument(Node& n, bool escape, membuffer *buf, char *out, int outLen)
+{
+	PrintTarget t;
+
+	t.buf = buf;
+	t.out = out;
+	t.outLen = outLen > 0 ? outLen - 1 : 0;
+	t.len = 0;
+	t.failed = false;
+	if(buf != NULL && membuffer_reserve(buf, buf->length + PrintSize(n.nact)) != 0)
+		return -1;
+	PrintNode(&t, n.nact, escape);
+	if(t.failed)
+		return -1;
+	if(out != NULL && outLen > 0)
+		out[t.len < t.outLen ? t.len : t.outLen] = '\0';
+	return (int)t.len;
 }
 
 char *UpnpCloneDOMString(const char *src)